@@ -0,0 +1,174 @@
+/*
+**  I2CBackend.h
+**
+**  This header file contains the interface between our I2C routines and the operating system's I2C bus driver.
+**  The backend is picked when we are compiled - FreeBSD's iic(4) or Linux's i2c-dev - and building a message and
+**  handing a transaction to the driver are inline, so the routines cost exactly what they did when they called
+**  the FreeBSD ioctl directly.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef I2CBackend_h
+#define I2CBackend_h
+
+# include <stdbool.h>
+# include <stdint.h>
+# include <sys/ioctl.h>
+
+# if defined (RTCDATE_SIM)
+
+# include "RTCSim.h"
+
+/*
+** The simulator (see RTCSim.c) stands in for the bus and the RTC, so that everything above the backend runs
+** unchanged without the hardware. The bus descriptor is just a placeholder
+*/
+
+typedef struct sim_msg  i2c_backend_msg;
+
+# define I2C_BACKEND_NAME           "rtcsim"
+# define I2C_BACKEND_BUS_FORMAT     "rtcsim%d"
+# define I2C_BACKEND_BUS_USAGE      "rtcsimn"
+# define I2C_BACKEND_WR             SIM_MSG_WR
+# define I2C_BACKEND_RD             SIM_MSG_RD
+# define I2C_BACKEND_NOSTART        SIM_MSG_NOSTART
+
+static inline void I2CBackendMessage (i2c_backend_msg *pMsg, int busdevid, int nFlags, void *lpBuffer, int nLength)
+{
+    pMsg ->m_nAddress = busdevid;
+    pMsg ->m_nFlags = nFlags;
+    pMsg ->m_nLength = nLength;
+    pMsg ->m_puiBuffer = (uint8_t *) lpBuffer;
+}
+
+static inline int I2CBackendTransfer (int busfd, i2c_backend_msg *pMsgs, int nMsgs)
+{
+    return SimTransfer (pMsgs, nMsgs);
+}
+
+# elif defined (__FreeBSD__)
+
+# include <dev/iicbus/iic.h>
+
+/*
+** FreeBSD's iic(4) takes the address shifted left, as it goes on the wire, and a transaction is a struct
+** iic_rdwr_data handed to the I2CRDWR ioctl
+*/
+
+typedef struct iic_msg  i2c_backend_msg;
+
+# define I2C_BACKEND_NAME           "FreeBSD iic(4)"
+# define I2C_BACKEND_BUS_FORMAT     "/dev/iic%d"
+# define I2C_BACKEND_BUS_USAGE      "/dev/iicn"
+# define I2C_BACKEND_WR             IIC_M_WR
+# define I2C_BACKEND_RD             IIC_M_RD
+# define I2C_BACKEND_NOSTART        IIC_M_NOSTART
+
+static inline void I2CBackendMessage (i2c_backend_msg *pMsg, int busdevid, int nFlags, void *lpBuffer, int nLength)
+{
+    pMsg ->slave = busdevid << 1;
+    pMsg ->flags = nFlags;
+    pMsg ->len = nLength;
+    pMsg ->buf = (uint8_t *) lpBuffer;
+}
+
+static inline int I2CBackendTransfer (int busfd, i2c_backend_msg *pMsgs, int nMsgs)
+{
+    struct iic_rdwr_data iicRdWr;
+    
+    iicRdWr.msgs = pMsgs;
+    iicRdWr.nmsgs = nMsgs;
+    
+    return (ioctl (busfd, I2CRDWR, &iicRdWr) < 0 ? -1 : 0);
+}
+
+# elif defined (__linux__)
+
+# include <linux/i2c.h>
+# include <linux/i2c-dev.h>
+
+/*
+** Linux's i2c-dev takes the 7-bit address as it is, and a transaction is a struct i2c_rdwr_ioctl_data handed
+** to the I2C_RDWR ioctl. Some adapters (i2c-stub, which we test against, and a few SMBus controllers) cannot do
+** plain I2C transfers, only SMBus ones. If the bus we opened is one of those its descriptor is remembered and
+** transactions to it are sent as SMBus block transfers instead - see I2CBackendTransferSMBus()
+*/
+
+typedef struct i2c_msg  i2c_backend_msg;
+
+# define I2C_BACKEND_NAME           "Linux i2c-dev"
+# define I2C_BACKEND_BUS_FORMAT     "/dev/i2c-%d"
+# define I2C_BACKEND_BUS_USAGE      "/dev/i2c-n"
+# define I2C_BACKEND_WR             0
+# define I2C_BACKEND_RD             I2C_M_RD
+# define I2C_BACKEND_NOSTART        I2C_M_NOSTART
+
+extern _Thread_local int nI2CBackendSMBusFD;
+
+int I2CBackendTransferSMBus (int busfd, i2c_backend_msg *pMsgs, int nMsgs);
+
+static inline void I2CBackendMessage (i2c_backend_msg *pMsg, int busdevid, int nFlags, void *lpBuffer, int nLength)
+{
+    pMsg ->addr = busdevid;
+    pMsg ->flags = nFlags;
+    pMsg ->len = nLength;
+    pMsg ->buf = (uint8_t *) lpBuffer;
+}
+
+static inline int I2CBackendTransfer (int busfd, i2c_backend_msg *pMsgs, int nMsgs)
+{
+    struct i2c_rdwr_ioctl_data i2cRdWr;
+    
+    if (busfd == nI2CBackendSMBusFD)
+        return I2CBackendTransferSMBus (busfd, pMsgs, nMsgs);
+    
+    i2cRdWr.msgs = pMsgs;
+    i2cRdWr.nmsgs = nMsgs;
+    
+    return (ioctl (busfd, I2C_RDWR, &i2cRdWr) < 0 ? -1 : 0);
+}
+
+# else
+#  error "There is no I2C bus backend for this operating system"
+# endif
+
+/*
+** Set by I2CBackendAttach () if a write message can carry on from the last one without a new start (the
+** backend's NOSTART flag), so that a write's offset and its data can be sent from separate buffers. What
+** the backend learns about a bus when it attaches is kept per thread, as discovery attaches every bus at once
+*/
+
+extern _Thread_local bool bI2CBackendNoStart;
+
+int I2CBackendOpen (char *szDeviceName);
+int I2CBackendAttach (int busfd, char *szDeviceName);
+
+#endif // I2CBackend_h
@@ -0,0 +1,66 @@
+/*
+**  I2CBackendFreeBSD.c
+**
+**  This source file contains the FreeBSD iic(4) bus backend - the parts that are not inline in I2CBackend.h.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# if defined (__FreeBSD__) && ! defined (RTCDATE_SIM)
+
+# include <fcntl.h>
+# include <stdio.h>
+# include <sys/types.h>
+
+# include "I2CBackend.h"
+
+_Thread_local bool bI2CBackendNoStart = false;  // Not every controller's driver honours IIC_M_NOSTART, and we cannot ask
+
+/* int I2CBackendOpen (char *szDeviceName)
+**
+** Open the bus device
+*/
+
+int I2CBackendOpen (char *szDeviceName)
+{
+    return open (szDeviceName, O_RDWR);
+}
+
+/* int I2CBackendAttach (int busfd, char *szDeviceName)
+**
+** Called once the bus device is open. iic(4) needs nothing more
+*/
+
+int I2CBackendAttach (int busfd, char *szDeviceName)
+{
+    return 0;
+}
+
+# endif // __FreeBSD__ && ! RTCDATE_SIM
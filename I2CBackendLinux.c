@@ -0,0 +1,193 @@
+/*
+**  I2CBackendLinux.c
+**
+**  This source file contains the Linux i2c-dev bus backend - the parts that are not inline in I2CBackend.h. That
+**  includes sending transactions as SMBus block transfers, for adapters that cannot do plain I2C.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# if defined (__linux__) && ! defined (RTCDATE_SIM)
+
+# include <errno.h>
+# include <fcntl.h>
+# include <stdio.h>
+# include <string.h>
+# include <unistd.h>
+# include <sys/types.h>
+# include <linux/i2c.h>
+# include <linux/i2c-dev.h>
+
+# include "I2CBackend.h"
+
+/*
+** The descriptor of a bus that only does SMBus, and the address we last selected on it with I2C_SLAVE (SMBus
+** transfers do not carry one)
+*/
+
+_Thread_local int nI2CBackendSMBusFD = -1;
+static _Thread_local int nI2CBackendSMBusAddress = -1;
+
+_Thread_local bool bI2CBackendNoStart = false;
+
+/* int I2CBackendOpen (char *szDeviceName)
+**
+** Open the bus device
+*/
+
+int I2CBackendOpen (char *szDeviceName)
+{
+    return open (szDeviceName, O_RDWR);
+}
+
+/* int I2CBackendAttach (int busfd, char *szDeviceName)
+**
+** Called once the bus device is open. We ask the adapter what it can do - if plain I2C transfers are out but
+** SMBus block transfers are in, transactions on this bus are sent as those instead. I2CBackendTransferSMBus ()
+** carries a NOSTART write on itself, and an I2C adapter says whether it can
+*/
+
+int I2CBackendAttach (int busfd, char *szDeviceName)
+{
+    unsigned long ulFunctions;
+    char szPErrorString [256 +1];
+    
+    if (ioctl (busfd, I2C_FUNCS, &ulFunctions) < 0) {
+        (void) snprintf (szPErrorString, sizeof (szPErrorString), "ioctl I2C_FUNCS on bus %s", szDeviceName);
+        (void) perror (szPErrorString);
+        return -1;
+    }
+    
+    if ((ulFunctions & I2C_FUNC_I2C) != 0) {
+        bI2CBackendNoStart = ((ulFunctions & I2C_FUNC_NOSTART) != 0);
+        return 0;
+    }
+    
+    if ((ulFunctions & I2C_FUNC_SMBUS_I2C_BLOCK) != I2C_FUNC_SMBUS_I2C_BLOCK) {
+        (void) fprintf (stderr, "The adapter for %s can do neither I2C nor SMBus block transfers.\n", szDeviceName);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    
+    nI2CBackendSMBusFD = busfd;
+    nI2CBackendSMBusAddress = -1;
+    bI2CBackendNoStart = true;
+    return 0;
+}
+
+/* static int I2CBackendSMBus (int busfd, int nAddress, char cReadWrite, uint8_t uiCommand, int nSize, union i2c_smbus_data *pData)
+**
+** Perform one SMBus transfer, selecting the device first if it is not the one we last talked to
+*/
+
+static int I2CBackendSMBus (int busfd, int nAddress, char cReadWrite, uint8_t uiCommand, int nSize, union i2c_smbus_data *pData)
+{
+    struct i2c_smbus_ioctl_data i2cSMBus;
+    
+    if (nAddress != nI2CBackendSMBusAddress) {
+        if (ioctl (busfd, I2C_SLAVE, nAddress) < 0)
+            return -1;
+        nI2CBackendSMBusAddress = nAddress;
+    }
+    
+    i2cSMBus.read_write = cReadWrite;
+    i2cSMBus.command = uiCommand;
+    i2cSMBus.size = nSize;
+    i2cSMBus.data = pData;
+    
+    return (ioctl (busfd, I2C_SMBUS, &i2cSMBus) < 0 ? -1 : 0);
+}
+
+/* int I2CBackendTransferSMBus (int busfd, i2c_backend_msg *pMsgs, int nMsgs)
+**
+** Send a transaction as SMBus transfers. A write message starts with the register offset, a NOSTART write carries
+** on from where the last one left off, and a read reads from there - which is what the MCP7940N's register
+** pointer does. Every message becomes one or more I2C block transfers of up to 32 bytes, so unlike I2C_RDWR the
+** transaction is not atomic - which is fine for testing against i2c-stub, and the best an SMBus-only adapter can
+** do. A zero length read (our probe for the device) becomes a byte read
+*/
+
+int I2CBackendTransferSMBus (int busfd, i2c_backend_msg *pMsgs, int nMsgs)
+{
+    union i2c_smbus_data i2cData;
+    int nMsg, nDone, nChunk, nStart;
+    uint8_t uiPointer = 0;
+    
+    for (nMsg = 0; nMsg < nMsgs; nMsg ++) {
+        if ((pMsgs [nMsg].flags & I2C_M_RD) != 0) {
+            if (pMsgs [nMsg].len == 0) {
+                if (I2CBackendSMBus (busfd, pMsgs [nMsg].addr, I2C_SMBUS_READ, uiPointer, I2C_SMBUS_BYTE_DATA, &i2cData) < 0)
+                    return -1;
+                continue;
+            }
+            
+            for (nDone = 0; nDone < pMsgs [nMsg].len; nDone += nChunk) {
+                nChunk = pMsgs [nMsg].len - nDone;
+                if (nChunk > I2C_SMBUS_BLOCK_MAX)
+                    nChunk = I2C_SMBUS_BLOCK_MAX;
+                
+                i2cData.block [0] = (uint8_t) nChunk;
+                if (I2CBackendSMBus (busfd, pMsgs [nMsg].addr, I2C_SMBUS_READ, uiPointer, I2C_SMBUS_I2C_BLOCK_DATA, &i2cData) < 0)
+                    return -1;
+                memcpy (&(pMsgs [nMsg].buf [nDone]), &(i2cData.block [1]), nChunk);
+                uiPointer += nChunk;
+            }
+        }
+        else {
+            // The first byte of a write is the offset, unless this write carries on from the last one
+            
+            nStart = 0;
+            if ((pMsgs [nMsg].flags & I2C_M_NOSTART) == 0) {
+                if (pMsgs [nMsg].len == 0) {
+                    errno = EINVAL;
+                    return -1;
+                }
+                uiPointer = pMsgs [nMsg].buf [0];
+                nStart = 1;
+            }
+            
+            for (nDone = nStart; nDone < pMsgs [nMsg].len; nDone += nChunk) {
+                nChunk = pMsgs [nMsg].len - nDone;
+                if (nChunk > I2C_SMBUS_BLOCK_MAX)
+                    nChunk = I2C_SMBUS_BLOCK_MAX;
+                
+                i2cData.block [0] = (uint8_t) nChunk;
+                memcpy (&(i2cData.block [1]), &(pMsgs [nMsg].buf [nDone]), nChunk);
+                if (I2CBackendSMBus (busfd, pMsgs [nMsg].addr, I2C_SMBUS_WRITE, uiPointer, I2C_SMBUS_I2C_BLOCK_DATA, &i2cData) < 0)
+                    return -1;
+                uiPointer += nChunk;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+# endif // __linux__ && ! RTCDATE_SIM
@@ -0,0 +1,79 @@
+/*
+**  I2CBackendSim.c
+**
+**  This source file contains the simulator bus backend, which hands transactions to rtcsim (RTCSim.c) in place of a bus.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# ifdef RTCDATE_SIM
+
+# include <errno.h>
+# include <fcntl.h>
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+
+# include "I2CBackend.h"
+
+_Thread_local bool bI2CBackendNoStart = true;   // The simulator does what the MCP7940N does
+
+/* int I2CBackendOpen (char *szDeviceName)
+**
+** There is only the one simulated bus. The simulator does not need a descriptor, but the callers close the one
+** they are given, so they get one they can close
+*/
+
+int I2CBackendOpen (char *szDeviceName)
+{
+    if (strcmp (szDeviceName, SIM_BUS_NAME) != 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    
+    return open ("/dev/null", O_RDWR);
+}
+
+/* int I2CBackendAttach (int busfd, char *szDeviceName)
+**
+** Start the simulator, with the settings in the environment
+*/
+
+int I2CBackendAttach (int busfd, char *szDeviceName)
+{
+    if (SimAttach (getenv (SIM_ENVIRONMENT)) < 0) {
+        (void) perror ("rtcsim");
+        return -1;
+    }
+    
+    return 0;
+}
+
+# endif // RTCDATE_SIM
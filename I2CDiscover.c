@@ -0,0 +1,249 @@
+/*
+**  I2CDiscover.c
+**
+**  This source file contains the code that finds the RTC. Guessing the bus from the model of Raspberry Pi
+**  goes wrong on anything newer than a Pi 2, so instead every bus is probed at once, each from a thread of its
+**  own so that a hung bus cannot hold up the rest, for a device at the address that answers like an MCP7940N
+**  rather than just acknowledging. The bus it is found on is remembered in a small file, and used until it
+**  stops answering that way.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <errno.h>
+# include <pthread.h>
+# include <stdint.h>
+# include <stdio.h>
+# include <string.h>
+# include <unistd.h>
+
+# include "PiFaceRTC.h"
+# include "I2CBackend.h"
+# include "I2CRoutines.h"
+# include "I2CDiscover.h"
+# include "RTCTiming.h"
+
+# define I2C_DISCOVER_PENDING       0
+# define I2C_DISCOVER_ABSENT        1
+# define I2C_DISCOVER_FOUND         2
+
+/*
+** The result of probing each bus. A probe that is still running when we give up on it may finish later, so
+** each round of discovery has a generation, and a probe only reports back to the round that started it
+*/
+
+static int nDiscoverResult [I2C_DISCOVER_MAX_BUSES];
+static int nDiscoverGeneration = 0, nDiscoverPending = 0, nDiscoverBusDevId = 0;
+static pthread_mutex_t mutexDiscover = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condDiscover = PTHREAD_COND_INITIALIZER;
+
+static char szDiscoverCached [I2C_DISCOVER_NAME_SIZE], szDiscoverFound [I2C_DISCOVER_NAME_SIZE];
+
+/* static bool I2CDiscoverIsBCD (uint8_t uiValue, int nMaxTens)
+**
+** Is this a BCD number, with no more than nMaxTens in the tens digit
+*/
+
+static bool I2CDiscoverIsBCD (uint8_t uiValue, int nMaxTens)
+{
+    return (((uiValue & 0x0f) <= 9) && ((uiValue >> 4) <= nMaxTens));
+}
+
+/* static int I2CDiscoverSignature (int busfd, int busdevid)
+**
+** Check that the device at busdevid is an MCP7940N, in one transaction. The bits the date/time registers do
+** not implement read back as zero and what they do hold is BCD (even a blank RTC, which is all zeroes, passes),
+** and reading on from the last byte of the SRAM wraps back to the first, where most devices would carry on.
+** Returns -1, with errno ENODEV if the device answered but is not one. It goes straight to the backend rather
+** than through the trace, which is not thread safe
+*/
+
+static int I2CDiscoverSignature (int busfd, int busdevid)
+{
+    struct i2c_transaction i2cTransaction;
+    uint8_t uiDateTime [6], uiWrap [2], uiFirst [1];
+    
+    I2CTransactionBegin (&i2cTransaction, busdevid);
+    (void) I2CTransactionRead (&i2cTransaction, MCP7940N_RTCMIN_OFFSET, uiDateTime, sizeof (uiDateTime));
+    (void) I2CTransactionRead (&i2cTransaction, MCP7940N_NVRAM_OFFSET + MCP7940N_NVRAM_SIZE -1, uiWrap, sizeof (uiWrap));
+    (void) I2CTransactionRead (&i2cTransaction, MCP7940N_NVRAM_OFFSET, uiFirst, sizeof (uiFirst));
+    
+    if (I2CBackendTransfer (busfd, i2cTransaction.m_i2cMsgs, i2cTransaction.m_nMsgs) < 0)
+        return -1;
+    
+    // Minutes, hours (12 or 24 hour), weekday, date, month (LPYR aside) and year
+    
+    if ((! I2CDiscoverIsBCD (uiDateTime [0], 5)) ||
+        ((uiDateTime [1] & 0x80) != 0) || (! I2CDiscoverIsBCD ((uiDateTime [1] & ((uiDateTime [1] & 0x40) ? 0x1f : 0x3f)), 2)) ||
+        ((uiDateTime [2] & 0xc0) != 0) ||
+        (! I2CDiscoverIsBCD (uiDateTime [3], 3)) ||
+        (! I2CDiscoverIsBCD ((uiDateTime [4] & 0xdf), 1)) ||
+        (! I2CDiscoverIsBCD (uiDateTime [5], 9)) ||
+        (uiWrap [1] != uiFirst [0])) {
+        errno = ENODEV;
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* static void *I2CDiscoverProbe (void *lpArgument)
+**
+** The thread that probes one bus. The bus number and the generation of the round are packed into the argument,
+** so that a probe that starts late knows whether anyone is still waiting for it
+*/
+
+static void *I2CDiscoverProbe (void *lpArgument)
+{
+    char szBusName [I2C_DISCOVER_NAME_SIZE];
+    int nBus = (int) (((intptr_t) lpArgument) & 0xff), nGeneration = (int) (((intptr_t) lpArgument) >> 8);
+    int busfd, nBusDevId, nResult = I2C_DISCOVER_ABSENT;
+    
+    (void) pthread_mutex_lock (&mutexDiscover);
+    nBusDevId = nDiscoverBusDevId;
+    (void) pthread_mutex_unlock (&mutexDiscover);
+    
+    (void) snprintf (szBusName, sizeof (szBusName), I2C_BACKEND_BUS_FORMAT, nBus);
+    if ((busfd = I2CBackendOpen (szBusName)) >= 0) {
+        if ((I2CBackendAttach (busfd, szBusName) == 0) && (I2CDiscoverSignature (busfd, nBusDevId) == 0))
+            nResult = I2C_DISCOVER_FOUND;
+        (void) close (busfd);
+    }
+    
+    (void) pthread_mutex_lock (&mutexDiscover);
+    if (nGeneration == nDiscoverGeneration) {
+        nDiscoverResult [nBus] = nResult;
+        nDiscoverPending --;
+        (void) pthread_cond_signal (&condDiscover);
+    }
+    (void) pthread_mutex_unlock (&mutexDiscover);
+    
+    return (void *) 0;
+}
+
+/* char *I2CDiscoverCached (int busdevid)
+**
+** The bus the RTC was found on last time, if it was found at the same address, or null
+*/
+
+char *I2CDiscoverCached (int busdevid)
+{
+    FILE *fileCache;
+    int nBusDevId, nFields;
+    
+    if ((fileCache = fopen (I2C_DISCOVER_CACHE_PATH, "r")) == (FILE *) 0)
+        return (char *) 0;
+    
+    nFields = fscanf (fileCache, "%63s %i", szDiscoverCached, &nBusDevId);
+    (void) fclose (fileCache);
+    
+    return (((nFields == 2) && (nBusDevId == busdevid)) ? szDiscoverCached : (char *) 0);
+}
+
+/* char *I2CDiscoverBus (int busdevid)
+**
+** Probe every bus at once for an MCP7940N at busdevid, and remember the first bus it is on. Buses that do not
+** exist fail to open straight away, and any that are still going after I2C_DISCOVER_TIMEOUT_MSECS are left to
+** it. Returns the name of the bus, or null having said why not
+*/
+
+char *I2CDiscoverBus (int busdevid)
+{
+    struct timespec tsDeadline;
+    pthread_attr_t attrProbe;
+    pthread_t threadProbe;
+    FILE *fileCache;
+    int nBus, nFound = -1;
+    
+    if (pthread_attr_init (&attrProbe) != 0) {
+        (void) perror ("pthread_attr_init");
+        return (char *) 0;
+    }
+    (void) pthread_attr_setdetachstate (&attrProbe, PTHREAD_CREATE_DETACHED);
+    TimingToTimespec (TimingNow (CLOCK_REALTIME) + (I2C_DISCOVER_TIMEOUT_MSECS * NSEC_PER_MSEC), &tsDeadline);
+    
+    (void) pthread_mutex_lock (&mutexDiscover);
+    nDiscoverGeneration ++;
+    nDiscoverBusDevId = busdevid;
+    for (nBus = 0, nDiscoverPending = 0; nBus < I2C_DISCOVER_MAX_BUSES; nBus ++) {
+        nDiscoverResult [nBus] = I2C_DISCOVER_PENDING;
+        if (pthread_create (&threadProbe, &attrProbe, I2CDiscoverProbe, (void *) (intptr_t) ((nDiscoverGeneration << 8) | nBus)) == 0)
+            nDiscoverPending ++;
+        else
+            nDiscoverResult [nBus] = I2C_DISCOVER_ABSENT;
+    }
+    (void) pthread_attr_destroy (&attrProbe);
+    
+    // Wait for them all, or until we run out of time. The lowest numbered bus with the RTC on it wins
+    
+    while (nDiscoverPending > 0) {
+        if (pthread_cond_timedwait (&condDiscover, &mutexDiscover, &tsDeadline) == ETIMEDOUT)
+            break;
+    }
+    
+    for (nBus = 0; nBus < I2C_DISCOVER_MAX_BUSES; nBus ++) {
+        if (nDiscoverResult [nBus] == I2C_DISCOVER_FOUND) {
+            nFound = nBus;
+            break;
+        }
+    }
+    nDiscoverGeneration ++;
+    (void) pthread_mutex_unlock (&mutexDiscover);
+    
+    if (nFound < 0) {
+        (void) fprintf (stderr, "No MCP7940N answered at 0x%02x on any bus (%s), use -i to name one.\n", busdevid, I2C_BACKEND_BUS_USAGE);
+        return (char *) 0;
+    }
+    
+    // Remember it for next time, but only if root ran us - rtcdate may be setuid, and then anyone could have
+    // us write the fixed path as root. Anyone else just looks again. The simulator's path is the user's own
+    
+    (void) snprintf (szDiscoverFound, sizeof (szDiscoverFound), I2C_BACKEND_BUS_FORMAT, nFound);
+# if ! defined (RTCDATE_SIM)
+    if (getuid () != 0)
+        return szDiscoverFound;
+# endif
+    if ((fileCache = fopen (I2C_DISCOVER_CACHE_PATH, "w")) != (FILE *) 0) {
+        (void) fprintf (fileCache, "%s 0x%02x\n", szDiscoverFound, busdevid);
+        (void) fclose (fileCache);
+    }
+    
+    return szDiscoverFound;
+}
+
+/* void I2CDiscoverForget (void)
+**
+** The remembered bus did not check out, so look again next time
+*/
+
+void I2CDiscoverForget (void)
+{
+    (void) unlink (I2C_DISCOVER_CACHE_PATH);
+}
@@ -0,0 +1,55 @@
+/*
+**  I2CDiscover.h
+**
+**  This header file contains the declarations for finding the RTC - which bus it is on, found by probing
+**  every bus at once and remembered for the next run.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef I2CDiscover_h
+#define I2CDiscover_h
+
+# if defined (RTCDATE_SIM)
+# define I2C_DISCOVER_CACHE_PATH    "/tmp/rtcsim.bus"           // Not the real RTC's
+# elif defined (__linux__)
+# define I2C_DISCOVER_CACHE_PATH    "/var/lib/rtcdate.bus"      // Linux has no /var/db
+# else
+# define I2C_DISCOVER_CACHE_PATH    "/var/db/rtcdate.bus"
+# endif
+# define I2C_DISCOVER_MAX_BUSES     16          // Buses 0 to 15 are probed
+# define I2C_DISCOVER_TIMEOUT_MSECS 500         // A bus that has not answered by then is taken to be hung
+# define I2C_DISCOVER_NAME_SIZE     64
+
+char *I2CDiscoverCached (int busdevid);
+char *I2CDiscoverBus (int busdevid);
+void I2CDiscoverForget (void);
+
+#endif // I2CDiscover_h
@@ -44,119 +44,171 @@
 */
 
 # include <strings.h>
-# include <stdlib.h>
 # include <sys/types.h>
-# include <dev/iicbus/iic.h>
-# include <sys/sysctl.h>
 # include <errno.h>
 # include <stdio.h>
 # include <fcntl.h>
 # include <unistd.h>
 
+# include "I2CBackend.h"
 # include "I2CRoutines.h"
+# include "I2CDiscover.h"
+# include "I2CTrace.h"
 
-/* int OpenI2CDevice (char *szDeviceName, int nBusDevID)
+static char szI2CBusName [I2C_DISCOVER_NAME_SIZE];   // The bus the device was last opened on
+
+/* static inline int I2CTransfer (int busfd, i2c_backend_msg *pMsgs, int nMsgs, int nDirection, int nOffset,
+**                                 int nWriteLength, int nReadLength)
 **
-** Open the bus device specified as a parameter. If no device name is supplied we will simply guess based
-** on what information we can get about the system.
+** Hand a transaction to the backend, timing it if we are tracing. The direction, offset and lengths are only
+** for the trace, and the caller sees the errno from the backend, whatever the trace did after it
 */
 
-int OpenI2CDevice (char *szDeviceName, int nBusDevID)
+static inline int I2CTransfer (int busfd, i2c_backend_msg *pMsgs, int nMsgs, int nDirection, int nOffset,
+                               int nWriteLength, int nReadLength)
+{
+    int64_t nsStart;
+    int nStatus, nErrno;
+    
+    if (! bI2CTraceEnabled)
+        return I2CBackendTransfer (busfd, pMsgs, nMsgs);
+    
+    nsStart = TimingNow (CLOCK_MONOTONIC);
+    nStatus = I2CBackendTransfer (busfd, pMsgs, nMsgs);
+    nErrno = (nStatus < 0 ? errno : 0);
+    I2CTraceTransfer (nDirection, nOffset, nWriteLength, nReadLength, nErrno, nsStart);
+    
+    errno = nErrno;
+    return nStatus;
+}
+
+/* static int OpenI2CBus (char *szBusDeviceName, int nBusDevID, int nOffset, void *lpBuffer, int nReadLength,
+**                         bool bReportErrors)
+**
+** Open the bus device, and check that the device answers on it with a read - of nothing, unless the caller
+** has a use for what is read. A bus we remembered is allowed to fail quietly
+*/
+
+static int OpenI2CBus (char *szBusDeviceName, int nBusDevID, int nOffset, void *lpBuffer, int nReadLength, bool bReportErrors)
 {
     int nBusFD;
-    char *szSelectedBusDeviceName;
     char szPErrorString [256 +1];
-    int MIB [2], nNumCPUs;
-    size_t nLen;
-    uint8_t uiOffset [1] = { 0 }, lpBuffer [1];
-    struct iic_msg iicMsg[2];
-    struct iic_rdwr_data iicRdWr;
-
+    struct i2c_transaction i2cTransaction;
     
-    if (szDeviceName != (char *) 0) {
-        // Simply use the bus device specified by the user
-        
-        szSelectedBusDeviceName = szDeviceName;
-    }
-    else {
-        // We have to try and guess what device to open. The Raspberry Pi A and B use /dev/iic0, whereas the B 2
-        // uses /dev/iic1. We look to see how many CPUs are reported in the system to make a decision about whether
-        // we are running an original Pi (one CPU) versus a model 2 (four CPUs). The sysctl equivalent is hw.ncpu
-        
-        
-        MIB [0] = CTL_HW;
-        MIB [1] = HW_NCPU;
-        nLen = sizeof (nNumCPUs);
-        if (sysctl (MIB, 2, &nNumCPUs, &nLen, NULL, 0) < 0) {
-            // An error occurred and we could not determine the number of CPUs on the system
-            
-            (void) perror ("sysctl");
-            return -1;
-        }
-        
-        // Use the information we just collected to figure out what model of Raspberry Pi we are running on
-            
-        switch (nNumCPUs) {
-        case 1: szSelectedBusDeviceName = "/dev/iic0"; break;   // This is an original Raspberry Pi
-        case 4: szSelectedBusDeviceName = "/dev/iic1"; break;   // This is a model 2 Raspberry Pi
-        default:
-            // An error occurred
-                
-            (void) printf ("sysctl hw.ncpu= %d, unable to determine version of Raspberry Pi\n", nNumCPUs);
-            return -1;
-            break;
-        }
-    }
-
     // Open the device
 
-    nBusFD = open (szSelectedBusDeviceName, O_RDWR);
+    I2CTracePhase ("open");
+    nBusFD = I2CBackendOpen (szBusDeviceName);
     if (nBusFD < 0) {
         // An error occurred - display some information
         
-        (void) sprintf (szPErrorString, "open %s", szSelectedBusDeviceName);
-        (void) perror (szPErrorString);
+        if (bReportErrors) {
+            (void) sprintf (szPErrorString, "open %s", szBusDeviceName);
+            (void) perror (szPErrorString);
+        }
+        return -1;
+    }
+    
+    // Let the backend find out anything it needs to about the bus
+    
+    I2CTracePhase ("attach");
+    if (I2CBackendAttach (nBusFD, szBusDeviceName) < 0) {
+        (void) close (nBusFD);
         return -1;
     }
     
     // Check that the device is present. If it is not we the 'open' operation
     // is deemed to have failed. We check to see if the device is present by
-    // attempting a dummy read of 0 byte from the device
+    // attempting a dummy read of 0 byte from the device (or the read the caller wanted)
        
-    // Set up the offset in a message we write to the I2C bus
+    // Set up the offset in a message we write to the I2C bus, and the buffer we read the data back into
     
-    iicMsg[0].slave = nBusDevID << 1;
-    iicMsg[0].flags = IIC_M_WR;
-    iicMsg[0].len = 1;
-    iicMsg[0].buf = uiOffset;
-    
-    // Set up the buffer we read the data back into
-    
-    iicMsg[1].slave = nBusDevID << 1;
-    iicMsg[1].flags = IIC_M_RD;
-    iicMsg[1].len = 0;
-    iicMsg[1].buf = lpBuffer;
-    
-    iicRdWr.nmsgs = 2;
-    iicRdWr.msgs = iicMsg;
+    I2CTransactionBegin (&i2cTransaction, nBusDevID);
+    (void) I2CTransactionRead (&i2cTransaction, nOffset, lpBuffer, nReadLength);
     
     // Request the data from the i@c device
     
-    if (ioctl (nBusFD, I2CRDWR, &iicRdWr) < 0 ) {
+    I2CTracePhase ("probe");
+    if (I2CTransactionRun (nBusFD, &i2cTransaction) < 0) {
 		// An error occurred, just return -1 so the caller knows. They can
 		// handle the error as they see fit
 		
-        (void) sprintf (szPErrorString, "ioctl I2CRDWR failed to read from device 0x%02x on bus %s", nBusDevID, szSelectedBusDeviceName);
-        (void) perror (szPErrorString);
+        if (bReportErrors) {
+            (void) sprintf (szPErrorString, "%s failed to read from device 0x%02x on bus %s", I2C_BACKEND_NAME, nBusDevID, szBusDeviceName);
+            (void) perror (szPErrorString);
+        }
         (void) close (nBusFD);
         return -1;
     }
     
     // Simply return the nBusFD, whether or not it is an actual file descriptor
     
+    (void) snprintf (szI2CBusName, sizeof (szI2CBusName), "%s", szBusDeviceName);
     return nBusFD;
 }
 
+/* int OpenI2CDevice (char *szDeviceName, int nBusDevID)
+**
+** Open the bus device specified as a parameter, and check the device is there
+*/
+
+int OpenI2CDevice (char *szDeviceName, int nBusDevID)
+{
+    uint8_t lpBuffer [1];
+    
+    return OpenI2CDeviceAndRead (szDeviceName, nBusDevID, 0, (void *) lpBuffer, 0);
+}
+
+/* int OpenI2CDeviceAndRead (char *szDeviceName, int nBusDevID, int nOffset, void *lpBuffer, int nReadLength)
+**
+** Open the bus device specified as a parameter, using a read from the device as the check that it is there. If
+** no device name is supplied we use the bus we found the RTC on last time, or if it no longer answers there,
+** look for it on every bus (see I2CDiscover.c). Only discovery checks the RTC's signature - once found, the bus
+** is trusted for as long as the device keeps answering, so that a run costs no more on the bus than it did
+** when the user named it
+*/
+
+int OpenI2CDeviceAndRead (char *szDeviceName, int nBusDevID, int nOffset, void *lpBuffer, int nReadLength)
+{
+    int nBusFD;
+    char *szBusDeviceName;
+    
+    if (szDeviceName != (char *) 0) {
+        // Simply use the bus device specified by the user
+        
+        return OpenI2CBus (szDeviceName, nBusDevID, nOffset, lpBuffer, nReadLength, true);
+    }
+    
+    I2CTracePhase ("discover");
+    if ((szBusDeviceName = I2CDiscoverCached (nBusDevID)) != (char *) 0) {
+        if ((nBusFD = OpenI2CBus (szBusDeviceName, nBusDevID, nOffset, lpBuffer, nReadLength, false)) >= 0)
+            return nBusFD;
+        
+        // It has moved, or gone
+        
+        I2CTracePhase ("discover");
+        I2CDiscoverForget ();
+    }
+    
+    if ((szBusDeviceName = I2CDiscoverBus (nBusDevID)) == (char *) 0) {
+        // The error has already been displayed
+        
+        return -1;
+    }
+    
+    return OpenI2CBus (szBusDeviceName, nBusDevID, nOffset, lpBuffer, nReadLength, true);
+}
+
+/* char *I2CBusName (void)
+**
+** The name of the bus the device was last opened on, however it was found, or null if it has not been
+*/
+
+char *I2CBusName (void)
+{
+    return ((szI2CBusName [0] != '\0') ? szI2CBusName : (char *) 0);
+}
+
 /* int ReadI2CDeviceMemory (int busfd, int busdevid, int nOffset, void *lpBuffer, int nReadLength)
 **
 ** This function is used to read from the I2C device's memory. The device is identified by the second parameter,
@@ -166,94 +218,228 @@ int OpenI2CDevice (char *szDeviceName, int nBusDevID)
 
 int ReadI2CDeviceMemory (int busfd, int busdevid, int nOffset, void *lpBuffer, int nReadLength)
 {
-    uint8_t uiOffset [1];
-    struct iic_msg iicMsg[2];
-    struct iic_rdwr_data iicRdWr;
-        
-    // Set the offset into the buffer we write out to the I2C bus
+    struct i2c_transaction i2cTransaction;
     
-    uiOffset [0] = (uint8_t) nOffset;
-       
-    // Set up the offset in a message we write to the I2C bus
+    I2CTransactionBegin (&i2cTransaction, busdevid);
+    (void) I2CTransactionRead (&i2cTransaction, nOffset, lpBuffer, nReadLength);
     
-    iicMsg[0].slave = busdevid << 1;
-    iicMsg[0].flags = IIC_M_WR;
-    iicMsg[0].len = 1;
-    iicMsg[0].buf = uiOffset;
+    return I2CTransactionRun (busfd, &i2cTransaction);
+}
+
+/* int WriteI2CDeviceMemory (int busfd, int busdevid, int nOffset, void *lpBuffer, int nWriteLength)
+**
+** This function is used to write to the memory of a device on the I2C bus. The device is identified by the second
+** parameter to the function, the location of the memory on the device by the third, the buffer to write from the
+** fourth, and the last parameter is the number of bytes to write
+*/
+
+int WriteI2CDeviceMemory (int busfd, int busdevid, int nOffset, void *lpBuffer, int nWriteLength)
+{
+    struct i2c_transaction i2cTransaction;
     
-    // Set up the buffer we read the data back into
+    I2CTransactionBegin (&i2cTransaction, busdevid);
+    (void) I2CTransactionWrite (&i2cTransaction, nOffset, lpBuffer, nWriteLength);
     
-    iicMsg[1].slave = busdevid << 1;
-    iicMsg[1].flags = IIC_M_RD;
-    iicMsg[1].len = nReadLength;
-    iicMsg[1].buf = lpBuffer;
+    return I2CTransactionRun (busfd, &i2cTransaction);
+}
+
+/* int WriteThenReadI2CDeviceMemory (int busfd, int busdevid, int nWriteOffset, void *lpWriteBuffer, int nWriteLength,
+**                                    int nReadOffset, void *lpReadBuffer, int nReadLength)
+**
+** This function writes to the memory of a device on the I2C bus and then reads back from it (not necessarily
+** from the same place) in a single bus transaction. It is used where a write has to be followed by a check
+** of its effect as quickly as possible
+*/
+
+int WriteThenReadI2CDeviceMemory (int busfd, int busdevid, int nWriteOffset, void *lpWriteBuffer, int nWriteLength,
+                                  int nReadOffset, void *lpReadBuffer, int nReadLength)
+{
+    struct i2c_transaction i2cTransaction;
     
-    iicRdWr.nmsgs = 2;
-    iicRdWr.msgs = iicMsg;
+    I2CTransactionBegin (&i2cTransaction, busdevid);
+    (void) I2CTransactionWrite (&i2cTransaction, nWriteOffset, lpWriteBuffer, nWriteLength);
+    (void) I2CTransactionRead (&i2cTransaction, nReadOffset, lpReadBuffer, nReadLength);
     
-    // Request the data from the i@c device
+    return I2CTransactionRun (busfd, &i2cTransaction);
+}
+
+/* int WriteI2CDeviceMemoryRuns (int busfd, int busdevid, struct i2c_write_run *pWriteRuns, int nWriteRuns)
+**
+** This function is used to write several runs of bytes to the memory of a device on the I2C bus in a single
+** bus transaction. Each run has its own offset, so the runs do not have to be contiguous. It is all or
+** nothing - either the whole transaction is sent or none of it is
+*/
+
+int WriteI2CDeviceMemoryRuns (int busfd, int busdevid, struct i2c_write_run *pWriteRuns, int nWriteRuns)
+{
+    struct i2c_transaction i2cTransaction;
+    int nRun;
     
-    if (ioctl (busfd, I2CRDWR, &iicRdWr) < 0 ) {
-		// An error occurred, just return -1 so the caller knows. They can
-		// handle the error as they see fit
-		
+    if ((nWriteRuns <= 0) || (nWriteRuns > I2C_MAX_WRITE_RUNS)) {
+        errno = EINVAL;
         return -1;
     }
     
-    return 0;
+    I2CTransactionBegin (&i2cTransaction, busdevid);
+    for (nRun = 0; nRun < nWriteRuns; nRun ++)
+        (void) I2CTransactionWrite (&i2cTransaction, pWriteRuns [nRun].m_nOffset, pWriteRuns [nRun].m_lpBuffer, pWriteRuns [nRun].m_nWriteLength);
+    
+    return I2CTransactionRun (busfd, &i2cTransaction);
 }
 
-/* int WriteI2CDeviceMemory (int busfd, int busdevid, int nOffset, void *lpBuffer, int nWriteLength)
+/* int ReadI2CDeviceMemoryRuns (int busfd, int busdevid, struct i2c_read_run *pReadRuns, int nReadRuns)
 **
-** This function is used to write to the memory of a device on the I2C bus. The device is identified by the second
-** parameter to the function, the location of the memory on the device by the third, the buffer to write from the
-** fourth, and the last parameter is the number of bytes to write
+** This function is used to read several runs of bytes from the memory of a device on the I2C bus in a single
+** bus transaction. Each run is an offset message followed by a read message, so the runs do not have to be
+** contiguous
 */
 
-int WriteI2CDeviceMemory (int busfd, int busdevid, int nOffset, void *lpBuffer, int nWriteLength)
+int ReadI2CDeviceMemoryRuns (int busfd, int busdevid, struct i2c_read_run *pReadRuns, int nReadRuns)
 {
-	uint8_t *lpOffsetAndBuffer;
-    struct iic_msg iicMsg[1];
-    struct iic_rdwr_data iicRdWr;
-    int nStatus;
-	
-	// We need to allocate memory for the the buffer we write from. We cannot use the caller's buffer as we need to
-	// prepend the offset to the data
-	
-	lpOffsetAndBuffer = (uint8_t *) malloc (nWriteLength +1);
-	if (lpOffsetAndBuffer == (uint8_t *) 0) {
-		// An error occurred - simply return
-		
-		return -1;
-	}
-	
-    // Write the offset (the location of the NVRAM) to the first location in the buffer
+    struct i2c_transaction i2cTransaction;
+    int nRun;
     
-    lpOffsetAndBuffer [0] = (uint8_t) nOffset;
+    if ((nReadRuns <= 0) || (nReadRuns > I2C_MAX_READ_RUNS)) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    I2CTransactionBegin (&i2cTransaction, busdevid);
+    for (nRun = 0; nRun < nReadRuns; nRun ++)
+        (void) I2CTransactionRead (&i2cTransaction, pReadRuns [nRun].m_nOffset, pReadRuns [nRun].m_lpBuffer, pReadRuns [nRun].m_nReadLength);
+    
+    return I2CTransactionRun (busfd, &i2cTransaction);
+}
+
+/* void I2CTransactionBegin (struct i2c_transaction *pTransaction, int busdevid)
+**
+** Start building a transaction for the device busdevid. Nothing is allocated, and nothing goes to the bus
+** until I2CTransactionRun ()
+*/
+
+void I2CTransactionBegin (struct i2c_transaction *pTransaction, int busdevid)
+{
+    pTransaction ->m_nBusDevId = busdevid;
+    pTransaction ->m_nMsgs = 0;
+    pTransaction ->m_nCopied = 0;
+    pTransaction ->m_nFirstOffset = -1;
+    pTransaction ->m_nWriteLength = 0;
+    pTransaction ->m_nReadLength = 0;
+    pTransaction ->m_bOverflowed = false;
+}
+
+/* static uint8_t *I2CTransactionOffset (struct i2c_transaction *pTransaction, int nOffset, int nMsgs)
+**
+** Room for the offset of a read or write that takes nMsgs messages, or null (and the transaction will fail)
+** if it will not fit
+*/
+
+static uint8_t *I2CTransactionOffset (struct i2c_transaction *pTransaction, int nOffset, int nMsgs)
+{
+    if ((pTransaction ->m_nMsgs + nMsgs) > I2C_TRANSACTION_MAX_MSGS) {
+        pTransaction ->m_bOverflowed = true;
+        return (uint8_t *) 0;
+    }
     
-    // Now copy the contents we will write to the NVRAM to the rest of the buffer
+    if (pTransaction ->m_nFirstOffset < 0)
+        pTransaction ->m_nFirstOffset = nOffset;
     
-    bcopy (lpBuffer, (void *) &(lpOffsetAndBuffer [1]), nWriteLength);
+    pTransaction ->m_uiOffsets [pTransaction ->m_nMsgs] = (uint8_t) nOffset;
+    return &(pTransaction ->m_uiOffsets [pTransaction ->m_nMsgs]);
+}
+
+/* int I2CTransactionRead (struct i2c_transaction *pTransaction, int nOffset, void *lpBuffer, int nReadLength)
+**
+** Add a read of nReadLength bytes from nOffset into lpBuffer - the offset, then the read. Returns -1 if the
+** transaction is full, in which case running it fails too, so the callers can leave the check until then
+*/
+
+int I2CTransactionRead (struct i2c_transaction *pTransaction, int nOffset, void *lpBuffer, int nReadLength)
+{
+    uint8_t *puiOffset;
     
-    // Set up the buffer we write out to the I2C bus
+    if ((puiOffset = I2CTransactionOffset (pTransaction, nOffset, 2)) == (uint8_t *) 0)
+        return -1;
     
-    iicMsg[0].slave = busdevid << 1;
-    iicMsg[0].flags = IIC_M_WR;
-    iicMsg[0].len = nWriteLength +1;
-    iicMsg[0].buf = lpOffsetAndBuffer;
+    I2CBackendMessage (&(pTransaction ->m_i2cMsgs [pTransaction ->m_nMsgs ++]), pTransaction ->m_nBusDevId, I2C_BACKEND_WR, puiOffset, 1);
+    I2CBackendMessage (&(pTransaction ->m_i2cMsgs [pTransaction ->m_nMsgs ++]), pTransaction ->m_nBusDevId, I2C_BACKEND_RD, lpBuffer, nReadLength);
+    pTransaction ->m_nReadLength += nReadLength;
     
-    iicRdWr.nmsgs = 1;
-    iicRdWr.msgs = iicMsg;
+    return 0;
+}
 
-    // Write the data to the I2C device
+/* int I2CTransactionWrite (struct i2c_transaction *pTransaction, int nOffset, void *lpBuffer, int nWriteLength)
+**
+** Add a write of nWriteLength bytes from lpBuffer to nOffset. If the backend can carry a write on without a
+** start, the offset and the caller's buffer go as two messages; if not they have to be one, and the buffer is
+** copied into the transaction behind the offset. Returns -1 if it will not fit, as I2CTransactionRead () does
+*/
+
+int I2CTransactionWrite (struct i2c_transaction *pTransaction, int nOffset, void *lpBuffer, int nWriteLength)
+{
+    uint8_t *puiOffset;
+    
+    if (nWriteLength < 0) {
+        pTransaction ->m_bOverflowed = true;
+        return -1;
+    }
+    
+    if (bI2CBackendNoStart) {
+        if ((puiOffset = I2CTransactionOffset (pTransaction, nOffset, 2)) == (uint8_t *) 0)
+            return -1;
+        
+        I2CBackendMessage (&(pTransaction ->m_i2cMsgs [pTransaction ->m_nMsgs ++]), pTransaction ->m_nBusDevId, I2C_BACKEND_WR, puiOffset, 1);
+        if (nWriteLength > 0)
+            I2CBackendMessage (&(pTransaction ->m_i2cMsgs [pTransaction ->m_nMsgs ++]), pTransaction ->m_nBusDevId, (I2C_BACKEND_WR | I2C_BACKEND_NOSTART),
+                               lpBuffer, nWriteLength);
+    }
+    else {
+        if (((pTransaction ->m_nCopied + nWriteLength +1) > I2C_TRANSACTION_COPY_SIZE) ||
+            (I2CTransactionOffset (pTransaction, nOffset, 1) == (uint8_t *) 0)) {
+            pTransaction ->m_bOverflowed = true;
+            return -1;
+        }
+        
+        puiOffset = &(pTransaction ->m_uiCopies [pTransaction ->m_nCopied]);
+        puiOffset [0] = (uint8_t) nOffset;
+        bcopy (lpBuffer, (void *) &(puiOffset [1]), nWriteLength);
+        pTransaction ->m_nCopied += nWriteLength +1;
+        
+        I2CBackendMessage (&(pTransaction ->m_i2cMsgs [pTransaction ->m_nMsgs ++]), pTransaction ->m_nBusDevId, I2C_BACKEND_WR, puiOffset, nWriteLength +1);
+    }
+    pTransaction ->m_nWriteLength += nWriteLength;
     
-    nStatus = ioctl (busfd, I2CRDWR, &iicRdWr);
+    return 0;
+}
 
-	// Free up our buffer, as we no longer need fit
-	
-	(void) free ((void *) lpOffsetAndBuffer);
-	
-    return (nStatus < 0 ? -1 : 0);
+/* int I2CTransactionRun (int busfd, struct i2c_transaction *pTransaction)
+**
+** Send everything queued to the bus in one transaction. Returns -1 (with errno EINVAL) without sending any of
+** it if something did not fit or nothing was queued
+*/
+
+int I2CTransactionRun (int busfd, struct i2c_transaction *pTransaction)
+{
+    int nDirection;
+    
+    if ((pTransaction ->m_bOverflowed) || (pTransaction ->m_nMsgs == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    if (pTransaction ->m_nWriteLength == 0)
+        nDirection = I2C_TRACE_READ;
+    else
+        nDirection = ((pTransaction ->m_nReadLength == 0) ? I2C_TRACE_WRITE : I2C_TRACE_WRITE_READ);
+    
+    if (I2CTransfer (busfd, pTransaction ->m_i2cMsgs, pTransaction ->m_nMsgs, nDirection, pTransaction ->m_nFirstOffset,
+                     pTransaction ->m_nWriteLength, pTransaction ->m_nReadLength) < 0) {
+        // An error occurred, just return -1 so the caller knows
+        
+        return -1;
+    }
+    
+    return 0;
 }
 
 /* int CloseI2CDevice (int busfd)
@@ -46,9 +46,73 @@
 #ifndef I2CRoutines_h
 #define I2CRoutines_h
 
+# include <stdbool.h>
+# include <stdint.h>
+
+# include "I2CBackend.h"
+
+/*
+** A run of bytes to be written to device memory, used to send several writes in one I2CRDWR transaction
+*/
+
+struct i2c_write_run {
+    int     m_nOffset;
+    void    *m_lpBuffer;
+    int     m_nWriteLength;
+};
+
+# define I2C_MAX_WRITE_RUNS     8
+
+/*
+** A run of bytes to be read back, the counterpart of i2c_write_run. Each run costs two messages (the offset,
+** then the read)
+*/
+
+struct i2c_read_run {
+    int     m_nOffset;
+    void    *m_lpBuffer;
+    int     m_nReadLength;
+};
+
+# define I2C_MAX_READ_RUNS      8
+
+# define I2C_TRANSACTION_MAX_MSGS   (I2C_MAX_READ_RUNS * 2)
+# define I2C_TRANSACTION_COPY_SIZE  128     // For writes that have to be copied in behind their offset
+
+/*
+** A transaction being built up, to go to the bus as one I2CRDWR. It lives wherever the caller puts it (usually
+** on the stack), and the buffers queued in it have to last until it has been run. If the backend can carry a
+** write on without a new start, a write's offset goes in a message of its own ahead of the caller's buffer;
+** otherwise the write is copied in behind its offset, here. A read is always the offset then the read
+*/
+
+struct i2c_transaction {
+    int             m_nBusDevId;
+    int             m_nMsgs;
+    int             m_nCopied;              // Bytes of m_uiCopies in use
+    int             m_nFirstOffset;         // Where the transaction starts, for the trace
+    int             m_nWriteLength;
+    int             m_nReadLength;
+    bool            m_bOverflowed;          // Something did not fit, so the transaction is not run
+    i2c_backend_msg m_i2cMsgs [I2C_TRANSACTION_MAX_MSGS];
+    uint8_t         m_uiOffsets [I2C_TRANSACTION_MAX_MSGS];
+    uint8_t         m_uiCopies [I2C_TRANSACTION_COPY_SIZE];
+};
+
 int OpenI2CDevice (char *szDeviceName, int busdevid);
+int OpenI2CDeviceAndRead (char *szDeviceName, int busdevid, int nOffset, void *lpBuffer, int nReadLength);
+char *I2CBusName (void);
 int ReadI2CDeviceMemory (int busfd, int busdevid, int nOffset, void *lpBuffer, int nReadLength);
 int WriteI2CDeviceMemory (int busfd, int busdevid, int nOffset, void *lpBuffer, int nWriteLength);
+int WriteThenReadI2CDeviceMemory (int busfd, int busdevid, int nWriteOffset, void *lpWriteBuffer, int nWriteLength,
+                                   int nReadOffset, void *lpReadBuffer, int nReadLength);
+int WriteI2CDeviceMemoryRuns (int busfd, int busdevid, struct i2c_write_run *pWriteRuns, int nWriteRuns);
+int ReadI2CDeviceMemoryRuns (int busfd, int busdevid, struct i2c_read_run *pReadRuns, int nReadRuns);
 int CloseI2CDevice (int busfd);
 
+void I2CTransactionBegin (struct i2c_transaction *pTransaction, int busdevid);
+int I2CTransactionRead (struct i2c_transaction *pTransaction, int nOffset, void *lpBuffer, int nReadLength);
+int I2CTransactionWrite (struct i2c_transaction *pTransaction, int nOffset, void *lpBuffer, int nWriteLength);
+int I2CTransactionRun (int busfd, struct i2c_transaction *pTransaction);
+
 #endif // I2CRoutines_h
\ No newline at end of file
@@ -0,0 +1,336 @@
+/*
+**  I2CTrace.c
+**
+**  This source file contains the I2C transaction tracing. When it is turned on (--trace, --stats) every bus
+**  transaction is timed on the monotonic clock and accounted to the phase of the run it happened in - starting up,
+**  opening and probing the bus, each command - along with the sleeps in between. Each transaction can be displayed
+**  as it happens, and a summary of each phase with a latency histogram is displayed at exit, as text or JSON.
+**  When it is off the cost is a test of bI2CTraceEnabled per transaction.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <errno.h>
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+
+# include "I2CBackend.h"
+# include "I2CTrace.h"
+
+bool bI2CTraceEnabled = false;
+
+static int nTraceFormat = I2C_TRACE_FORMAT_NONE;
+static int nStatsFormat = I2C_TRACE_FORMAT_NONE;
+static int64_t nsTraceStarted;
+static int64_t nsPhaseEntered;
+static int nPhases, nCurrentPhase;
+static struct i2c_trace_phase phaseTrace [I2C_TRACE_MAX_PHASES];
+
+static const char *szTraceDirection [] = {"r", "w", "wr"};
+
+/* static int I2CTraceBucket (int64_t nsLatency)
+**
+** The histogram bucket for a latency. Bucket 0 is under a microsecond, and each after it is twice as wide as the
+** one before, with the last taking everything longer
+*/
+
+static int I2CTraceBucket (int64_t nsLatency)
+{
+    int nBucket;
+    int64_t usLatency = nsLatency / NSEC_PER_USEC;
+    
+    for (nBucket = 0; (usLatency > 0) && (nBucket < (I2C_TRACE_BUCKETS -1)); nBucket ++)
+        usLatency >>= 1;
+    
+    return nBucket;
+}
+
+/* static int64_t I2CTracePercentile (long *plHistogram, long lCount, int nPercent)
+**
+** The upper bound, in microseconds, of the bucket nPercent of the transactions fall within
+*/
+
+static int64_t I2CTracePercentile (long *plHistogram, long lCount, int nPercent)
+{
+    long lSeen = 0;
+    int nBucket;
+    
+    for (nBucket = 0; nBucket < I2C_TRACE_BUCKETS; nBucket ++) {
+        lSeen += plHistogram [nBucket];
+        if ((lSeen * 100) >= (lCount * nPercent))
+            break;
+    }
+    
+    return ((int64_t) 1 << (nBucket < I2C_TRACE_BUCKETS ? nBucket : (I2C_TRACE_BUCKETS -1)));
+}
+
+/* int I2CTraceConfigure (int nTrace, int nStats, int64_t nsStarted)
+**
+** Turn tracing on if either the trace of each transaction or the summary is wanted (I2C_TRACE_FORMAT_...).
+** nsStarted is when the program started, on the monotonic clock - everything up to now was starting up. It can
+** be called again, to start afresh
+*/
+
+int I2CTraceConfigure (int nTrace, int nStats, int64_t nsStarted)
+{
+    nTraceFormat = nTrace;
+    nStatsFormat = nStats;
+    bI2CTraceEnabled = ((nTrace != I2C_TRACE_FORMAT_NONE) || (nStats != I2C_TRACE_FORMAT_NONE));
+    if (! bI2CTraceEnabled)
+        return 0;
+    
+    nsTraceStarted = nsStarted;
+    nsPhaseEntered = nsStarted;
+    bzero ((void *) phaseTrace, sizeof (phaseTrace));
+    phaseTrace [0].m_szName = "startup";
+    nPhases = 1;
+    nCurrentPhase = 0;
+    
+    if (((nStats == I2C_TRACE_FORMAT_TEXT) || (nStats == I2C_TRACE_FORMAT_JSON)) && (atexit (I2CTraceReport) != 0)) {
+        (void) perror ("atexit");
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* void I2CTraceEnterPhase (const char *szPhase)
+**
+** The time since the last change of phase belongs to the phase we were in. If there are too many phases the
+** rest are lumped in with the last
+*/
+
+void I2CTraceEnterPhase (const char *szPhase)
+{
+    int64_t nsNow = TimingNow (CLOCK_MONOTONIC);
+    int nPhase;
+    
+    phaseTrace [nCurrentPhase].m_nsElapsed += nsNow - nsPhaseEntered;
+    nsPhaseEntered = nsNow;
+    
+    for (nPhase = 0; nPhase < nPhases; nPhase ++) {
+        if (strcmp (phaseTrace [nPhase].m_szName, szPhase) == 0)
+            break;
+    }
+    
+    if ((nPhase == nPhases) && (nPhases < I2C_TRACE_MAX_PHASES))
+        phaseTrace [nPhases ++].m_szName = szPhase;
+    
+    nCurrentPhase = (nPhase < nPhases ? nPhase : (nPhases -1));
+}
+
+/* void I2CTraceTransfer (int nDirection, int nOffset, int nWriteLength, int nReadLength, int nErrno, int64_t nsStart)
+**
+** Account for a transaction that started at nsStart and has just finished. The lengths are of the data, not
+** counting the offset bytes, and nErrno is 0 if it worked
+*/
+
+void I2CTraceTransfer (int nDirection, int nOffset, int nWriteLength, int nReadLength, int nErrno, int64_t nsStart)
+{
+    struct i2c_trace_phase *pPhase = &phaseTrace [nCurrentPhase];
+    int64_t nsEnd = TimingNow (CLOCK_MONOTONIC), nsLatency = nsEnd - nsStart;
+    
+    if ((pPhase ->m_lTransactions == 0) || (nsLatency < pPhase ->m_nsShortest))
+        pPhase ->m_nsShortest = nsLatency;
+    if (nsLatency > pPhase ->m_nsLongest)
+        pPhase ->m_nsLongest = nsLatency;
+    
+    pPhase ->m_lTransactions ++;
+    pPhase ->m_lErrors += (nErrno != 0 ? 1 : 0);
+    pPhase ->m_lBytesRead += nReadLength;
+    pPhase ->m_lBytesWritten += nWriteLength;
+    pPhase ->m_nsTransfers += nsLatency;
+    pPhase ->m_lHistogram [I2CTraceBucket (nsLatency)] ++;
+    
+    if (nTraceFormat == I2C_TRACE_FORMAT_JSON)
+        (void) fprintf (stderr, "{\"at_ns\":%lld,\"phase\":\"%s\",\"dir\":\"%s\",\"offset\":%d,\"write\":%d,\"read\":%d,\"errno\":%d,\"latency_ns\":%lld}\n",
+                        (long long) (nsStart - nsTraceStarted), pPhase ->m_szName, szTraceDirection [nDirection], nOffset,
+                        nWriteLength, nReadLength, nErrno, (long long) nsLatency);
+    else if (nTraceFormat == I2C_TRACE_FORMAT_TEXT)
+        (void) fprintf (stderr, "i2c %10.3f ms  %-12s %-2s 0x%02x  w %-3d r %-3d %9.1f us  %s\n",
+                        ((double) (nsStart - nsTraceStarted) / NSEC_PER_MSEC), pPhase ->m_szName, szTraceDirection [nDirection],
+                        nOffset, nWriteLength, nReadLength, ((double) nsLatency / NSEC_PER_USEC), (nErrno != 0 ? strerror (nErrno) : "ok"));
+}
+
+/* void I2CTraceSleep (int64_t nsStart)
+**
+** Account for a sleep that started at nsStart and has just finished
+*/
+
+void I2CTraceSleep (int64_t nsStart)
+{
+    phaseTrace [nCurrentPhase].m_lSleeps ++;
+    phaseTrace [nCurrentPhase].m_nsSleeps += TimingNow (CLOCK_MONOTONIC) - nsStart;
+}
+
+/* static void I2CTraceReportText (struct i2c_trace_phase *pTotal)
+**
+** Display the summary of each phase, and the latency histogram of all of them
+*/
+
+static void I2CTraceReportText (struct i2c_trace_phase *pTotal)
+{
+    struct i2c_trace_phase *pPhase;
+    int nPhase, nBucket, nLast;
+    long lWidest = 1;
+    
+    (void) fprintf (stderr, "\nI2C transactions (%s), %.3f ms in all\n\n", I2C_BACKEND_NAME, ((double) pTotal ->m_nsElapsed / NSEC_PER_MSEC));
+    (void) fprintf (stderr, "%-12s %10s %6s %5s %6s %6s %10s %8s %8s %8s %6s %10s\n",
+                    "phase", "ms", "xfers", "errs", "read", "wrote", "xfer ms", "min us", "p50 us", "max us", "sleeps", "sleep ms");
+    
+    for (nPhase = 0; nPhase <= nPhases; nPhase ++) {
+        pPhase = (nPhase < nPhases ? &phaseTrace [nPhase] : pTotal);
+        if (nPhase == nPhases)
+            (void) fprintf (stderr, "\n");
+        
+        (void) fprintf (stderr, "%-12s %10.3f %6ld %5ld %6ld %6ld %10.3f ", pPhase ->m_szName, ((double) pPhase ->m_nsElapsed / NSEC_PER_MSEC),
+                        pPhase ->m_lTransactions, pPhase ->m_lErrors, pPhase ->m_lBytesRead, pPhase ->m_lBytesWritten,
+                        ((double) pPhase ->m_nsTransfers / NSEC_PER_MSEC));
+        if (pPhase ->m_lTransactions > 0)
+            (void) fprintf (stderr, "%8.1f %8lld %8.1f ", ((double) pPhase ->m_nsShortest / NSEC_PER_USEC),
+                            (long long) I2CTracePercentile (pPhase ->m_lHistogram, pPhase ->m_lTransactions, 50),
+                            ((double) pPhase ->m_nsLongest / NSEC_PER_USEC));
+        else
+            (void) fprintf (stderr, "%8s %8s %8s ", "-", "-", "-");
+        (void) fprintf (stderr, "%6ld %10.3f\n", pPhase ->m_lSleeps, ((double) pPhase ->m_nsSleeps / NSEC_PER_MSEC));
+    }
+    
+    if (pTotal ->m_lTransactions == 0)
+        return;
+    
+    // The histogram, from the first bucket with anything in it to the last
+    
+    for (nBucket = 0, nLast = 0; nBucket < I2C_TRACE_BUCKETS; nBucket ++) {
+        if (pTotal ->m_lHistogram [nBucket] > lWidest)
+            lWidest = pTotal ->m_lHistogram [nBucket];
+        if (pTotal ->m_lHistogram [nBucket] != 0)
+            nLast = nBucket;
+    }
+    for (nBucket = 0; pTotal ->m_lHistogram [nBucket] == 0; nBucket ++)
+        ;
+    
+    (void) fprintf (stderr, "\nTransaction latency\n\n");
+    for (; nBucket <= nLast; nBucket ++)
+        (void) fprintf (stderr, "%s%8lld us %-50.*s %ld\n", ((nBucket < (I2C_TRACE_BUCKETS -1)) ? "< " : ">="),
+                        (long long) ((nBucket < (I2C_TRACE_BUCKETS -1)) ? ((int64_t) 1 << nBucket) : ((int64_t) 1 << (nBucket -1))),
+                        (int) ((pTotal ->m_lHistogram [nBucket] * 50 + lWidest -1) / lWidest),
+                        "##################################################", pTotal ->m_lHistogram [nBucket]);
+}
+
+/* static void I2CTraceReportPhaseJSON (struct i2c_trace_phase *pPhase)
+**
+** One phase as a JSON object
+*/
+
+static void I2CTraceReportPhaseJSON (struct i2c_trace_phase *pPhase)
+{
+    int nBucket;
+    
+    (void) fprintf (stderr, "{\"name\":\"%s\",\"elapsed_ns\":%lld,\"transactions\":%ld,\"errors\":%ld,\"bytes_read\":%ld,\"bytes_written\":%ld,"
+                    "\"transfer_ns\":%lld,\"shortest_ns\":%lld,\"longest_ns\":%lld,\"sleeps\":%ld,\"sleep_ns\":%lld,\"histogram\":[",
+                    pPhase ->m_szName, (long long) pPhase ->m_nsElapsed, pPhase ->m_lTransactions, pPhase ->m_lErrors,
+                    pPhase ->m_lBytesRead, pPhase ->m_lBytesWritten, (long long) pPhase ->m_nsTransfers,
+                    (long long) pPhase ->m_nsShortest, (long long) pPhase ->m_nsLongest, pPhase ->m_lSleeps, (long long) pPhase ->m_nsSleeps);
+    for (nBucket = 0; nBucket < I2C_TRACE_BUCKETS; nBucket ++)
+        (void) fprintf (stderr, "%s%ld", (nBucket == 0 ? "" : ","), pPhase ->m_lHistogram [nBucket]);
+    (void) fprintf (stderr, "]}");
+}
+
+/* static void I2CTraceReportJSON (struct i2c_trace_phase *pTotal)
+**
+** The summary as a single line of JSON. Histogram bucket n counts the transactions under 2^n microseconds (and
+** over the bucket before), except the last which counts everything longer
+*/
+
+static void I2CTraceReportJSON (struct i2c_trace_phase *pTotal)
+{
+    int nPhase;
+    
+    (void) fprintf (stderr, "{\"backend\":\"%s\",\"histogram_buckets\":%d,\"phases\":[", I2C_BACKEND_NAME, I2C_TRACE_BUCKETS);
+    for (nPhase = 0; nPhase < nPhases; nPhase ++) {
+        if (nPhase != 0)
+            (void) fprintf (stderr, ",");
+        I2CTraceReportPhaseJSON (&phaseTrace [nPhase]);
+    }
+    (void) fprintf (stderr, "],\"total\":");
+    I2CTraceReportPhaseJSON (pTotal);
+    (void) fprintf (stderr, "}\n");
+}
+
+/* void I2CTraceTotal (struct i2c_trace_phase *pTotal)
+**
+** Add up every phase so far
+*/
+
+void I2CTraceTotal (struct i2c_trace_phase *pTotal)
+{
+    int nPhase, nBucket;
+    
+    I2CTraceEnterPhase (phaseTrace [nCurrentPhase].m_szName);
+    
+    bzero ((void *) pTotal, sizeof (struct i2c_trace_phase));
+    pTotal ->m_szName = "total";
+    for (nPhase = 0; nPhase < nPhases; nPhase ++) {
+        if ((phaseTrace [nPhase].m_lTransactions > 0) &&
+            ((pTotal ->m_lTransactions == 0) || (phaseTrace [nPhase].m_nsShortest < pTotal ->m_nsShortest)))
+            pTotal ->m_nsShortest = phaseTrace [nPhase].m_nsShortest;
+        if (phaseTrace [nPhase].m_nsLongest > pTotal ->m_nsLongest)
+            pTotal ->m_nsLongest = phaseTrace [nPhase].m_nsLongest;
+        
+        pTotal ->m_nsElapsed += phaseTrace [nPhase].m_nsElapsed;
+        pTotal ->m_lTransactions += phaseTrace [nPhase].m_lTransactions;
+        pTotal ->m_lErrors += phaseTrace [nPhase].m_lErrors;
+        pTotal ->m_lBytesRead += phaseTrace [nPhase].m_lBytesRead;
+        pTotal ->m_lBytesWritten += phaseTrace [nPhase].m_lBytesWritten;
+        pTotal ->m_nsTransfers += phaseTrace [nPhase].m_nsTransfers;
+        pTotal ->m_lSleeps += phaseTrace [nPhase].m_lSleeps;
+        pTotal ->m_nsSleeps += phaseTrace [nPhase].m_nsSleeps;
+        for (nBucket = 0; nBucket < I2C_TRACE_BUCKETS; nBucket ++)
+            pTotal ->m_lHistogram [nBucket] += phaseTrace [nPhase].m_lHistogram [nBucket];
+    }
+}
+
+/* void I2CTraceReport (void)
+**
+** Display the summary, which is registered to happen at exit
+*/
+
+void I2CTraceReport (void)
+{
+    struct i2c_trace_phase phaseTotal;
+    
+    I2CTraceTotal (&phaseTotal);
+    
+    if (nStatsFormat == I2C_TRACE_FORMAT_JSON)
+        I2CTraceReportJSON (&phaseTotal);
+    else
+        I2CTraceReportText (&phaseTotal);
+}
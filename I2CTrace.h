@@ -0,0 +1,118 @@
+/*
+**  I2CTrace.h
+**
+**  This header file contains the definitions for tracing I2C transactions, and timing them by phase.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef I2CTrace_h
+#define I2CTrace_h
+
+# include <stdbool.h>
+# include <stdint.h>
+# include <time.h>
+
+# include "RTCTiming.h"
+
+# define I2C_TRACE_MAX_PHASES           32
+# define I2C_TRACE_BUCKETS              20      // Latency buckets, each twice the last, from 1us up
+
+# define I2C_TRACE_READ                 0       // An offset then a read
+# define I2C_TRACE_WRITE                1       // An offset and the data
+# define I2C_TRACE_WRITE_READ           2       // A write, then a read, in one transaction
+
+# define I2C_TRACE_FORMAT_NONE          0
+# define I2C_TRACE_FORMAT_TEXT          1
+# define I2C_TRACE_FORMAT_JSON          2
+# define I2C_TRACE_FORMAT_QUIET         3       // Collect the summary, but leave it to the caller
+
+/*
+** What happened in one phase of the run - opening the bus, a command, and so on. Elapsed is the wall time
+** spent in the phase, which is more than the transactions and sleeps in it by whatever we did in between
+*/
+
+struct i2c_trace_phase {
+    const char  *m_szName;
+    int64_t     m_nsElapsed;
+    long        m_lTransactions;
+    long        m_lErrors;
+    long        m_lBytesRead;
+    long        m_lBytesWritten;
+    int64_t     m_nsTransfers;          // Total, shortest and longest transaction
+    int64_t     m_nsShortest;
+    int64_t     m_nsLongest;
+    long        m_lSleeps;
+    int64_t     m_nsSleeps;
+    long        m_lHistogram [I2C_TRACE_BUCKETS];
+};
+
+extern bool bI2CTraceEnabled;
+
+int I2CTraceConfigure (int nTraceFormat, int nStatsFormat, int64_t nsStarted);
+void I2CTraceEnterPhase (const char *szPhase);
+void I2CTraceTransfer (int nDirection, int nOffset, int nWriteLength, int nReadLength, int nErrno, int64_t nsStart);
+void I2CTraceSleep (int64_t nsStart);
+void I2CTraceTotal (struct i2c_trace_phase *pTotal);
+void I2CTraceReport (void);
+
+/* static inline int64_t I2CTraceClock (void)
+**
+** The time to start timing something from, or 0 if we are not tracing
+*/
+
+static inline int64_t I2CTraceClock (void)
+{
+    return (bI2CTraceEnabled ? TimingNow (CLOCK_MONOTONIC) : 0);
+}
+
+/* static inline void I2CTracePhase (const char *szPhase)
+**
+** Start a new phase (or go back to one we have had before). The name must last as long as the program
+*/
+
+static inline void I2CTracePhase (const char *szPhase)
+{
+    if (bI2CTraceEnabled)
+        I2CTraceEnterPhase (szPhase);
+}
+
+/* static inline void I2CTraceSlept (int64_t nsStart)
+**
+** Account for a sleep that started at nsStart (from I2CTraceClock ()) and has just finished
+*/
+
+static inline void I2CTraceSlept (int64_t nsStart)
+{
+    if (bI2CTraceEnabled)
+        I2CTraceSleep (nsStart);
+}
+
+#endif // I2CTrace_h
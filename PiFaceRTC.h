@@ -219,5 +219,6 @@ struct mcp7940n_pwrtimestamps {
 # define MCP7940N_RTCPWRDN_OFFSET       0x18
 # define MCP7940N_RTCPWRUP_OFFSET       0x1c
 # define MCP7940N_NVRAM_OFFSET          0x20
+# define MCP7940N_NVRAM_SIZE            64
 
 #endif /* PiFaceRTC_h */
@@ -56,42 +56,106 @@
 # include <sys/time.h>
 # include <time.h>
 # include <ctype.h>
+# include <getopt.h>
 
 # include "PiFaceRTC.h"
+# include "PiFaceRTCFreeBSD.h"
+# include "I2CBackend.h"
 # include "I2CRoutines.h"
+# include "I2CDiscover.h"
+# include "I2CTrace.h"
+# include "RTCSnapshot.h"
+# include "RTCOptionPlan.h"
+# include "RTCDaemon.h"
+# include "RTCTiming.h"
+# include "RTCEdge.h"
+# include "RTCDrift.h"
+# include "RTCDiscipline.h"
+# include "RTCShm.h"
+# include "RTCTimePage.h"
+# include "RTCCache.h"
+# include "RTCDelta.h"
+# include "RTCKeyValue.h"
+# include "RTCCodec.h"
+# include "RTCCivil.h"
+# include "RTCCompat.h"
+
+/*
+** When setting the RTC on a second boundary we need at least this much notice to get ready, and we spin
+** rather than sleep for the last part of the wait
+*/
+
+# define PRECISE_SET_MIN_NOTICE_NSECS   (20 * NSEC_PER_MSEC)
+# define PRECISE_SET_SPIN_NSECS         (2 * NSEC_PER_MSEC)
+
+/*
+** When waiting for the OSCRUN bit to change we first sleep for about two oscillator cycles, doubling each time
+** up to a millisecond, and give up after five milliseconds in all
+*/
+
+# define OSCILLATOR_WAIT_FIRST_USECS    64
+# define OSCILLATOR_WAIT_BUDGET_USECS   5000
+
+/*
+** The options that only have a long form, numbered out of the way of the single letter ones
+*/
+
+# define OPTION_TRACE                   256
+# define OPTION_STATS                   257
+# define OPTION_SLEW                    258
+# define OPTION_LOOP                    259
+# define OPTION_TOLERANCE               260
+# define OPTION_SHM                     261
+# define OPTION_TIMEPAGE                262
+# define OPTION_CACHE_TTL               263
+
+/*
+** Against the simulator the computer clock is left alone. The simulator counts the times we would have set it
+*/
+
+# ifdef RTCDATE_SIM
+# define clock_settime(clockid, ptsTime)        SimSetComputerClock (TimingFromTimespec (ptsTime))
+# define settimeofday(ptvTime, ptzZone)         SimSetComputerClock (((int64_t) (ptvTime) ->tv_sec * NSEC_PER_SEC) + \
+                                                                     ((int64_t) (ptvTime) ->tv_usec * NSEC_PER_USEC))
+# define adjtime(ptvDelta, ptvOld)              SimSlewComputerClock (((int64_t) (ptvDelta) ->tv_sec * NSEC_PER_SEC) + \
+                                                                      ((int64_t) (ptvDelta) ->tv_usec * NSEC_PER_USEC))
+# endif
 
 /*
 ** Funtion prototypes
 */
 
 void Usage (void);
-int DisplayPowerFailTime (int busfd, int nBusDevId);
-int DisplayPowerRestoreTime (int busfd, int nBusDevId);
-int HWSetTimeOfDay (int busfd, int nBusDevId, char *szDatetime, bool bUseComputerClockToSetRTC);
-int HWGetTimeOfDay (int busfd, int nBusDevId, bool bDisplayDateTimeAsDateInput, bool bSetComputerClockFromRTC);
-int ReadNVRAM (int busfd, int nBusDevId);
-int WriteNVRAM (int busfd, int nBusDevId, char *szNVRAMContents);
-int ProcessHWClockOption (int busfd, int nBusDevId, char *szOptionsToProcess);
-
-int HWOptionInitRTC (int busfd, int nBusDevId);
-int HWOptionBatteryEnable (int busfd, int nBusDevId);
-int HWOptionBatteryDisable (int busfd, int nBusDevId);
-int HWOptionBatteryGetSetting (int busfd, int nBusDevId);
-int HWOptionControlRegistersDisplay (int busfd, int nBusDevId);
-int HWOptionCalibrateClock (int busfd, int nBusDevId);
-int HWOptionClearNVRAM (int busfd, int nBusDevId);
-int HWOptionOscillatorEnable (int busfd, int nBusDevId);
-int HWOptionOscillatorDisable (int busfd, int nBusDevId);
-int HWOptionOscillatorGetStatus (int busfd, int nBusDevId);
-int HWOptionOscillatorGetSetting (int busfd, int nBusDevId);
-int HWOptionPowerFailStatus (int busfd, int nBusDevId);
-int HWOptionPowerFailClearFlag (int busfd, int nBusDevId);
-
-int HWOptionOscillatorConfigure (int busfd, int nBusDevId, bool bEnable);
-int HWOptionBatteryConfigure (int busfd, int nBusDevId, bool bEnable);
-
-void TranslateRTCDateTimeToTm (struct mcp7940n_datetime *pdatetimeRTCClock, struct tm *ptmRTCDateTime);
-void TranslateTmToRTCDateTime (struct tm *ptmRTCDateTime, struct mcp7940n_datetime *pdatetimeRTCClock);
+
+int HWOptionInitRTC (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionInitRTCSetTime (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionBatteryEnable (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionBatteryDisable (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionBatteryGetSetting (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionControlRegistersDisplay (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionCalibrateClock (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionClearNVRAM (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionClearNVRAMWrite (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionOscillatorEnable (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionOscillatorDisable (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionOscillatorGetStatus (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionOscillatorGetSetting (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionPowerFailStatus (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionPowerFailClearFlag (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionStatus (int busfd, int nBusDevId, FILE *fpOutput);
+int HWOptionDriftReport (int busfd, int nBusDevId, FILE *fpOutput);
+
+void HWDriftRecordSet (int busfd, int nBusDevId, bool bSetFromComputerClock, int64_t nsSystemTime, int64_t nsOffset);
+
+int HWOptionOscillatorConfigure (int busfd, int nBusDevId, bool bEnable, FILE *fpOutput);
+int HWStopOscillator (int busfd, int nBusDevId, struct mcp7940n_datetime *pdatetimeRTCClock, int64_t *pnsStopped);
+int HWRestartOscillator (int busfd, int nBusDevId, struct mcp7940n_rtcsec *prtcsecStopped);
+int HWWaitForOscillator (int busfd, int nBusDevId, bool bRunning, struct mcp7940n_rtcwkday *prtcwkdayAlreadyRead);
+int HWOptionBatteryConfigure (int busfd, int nBusDevId, bool bEnable, FILE *fpOutput);
+
+void DisplayDeltaStats (char *szWhat, struct delta_stats *pStats, FILE *fpOutput);
+int ParseNVRAMRange (char *szRange, int *pnOffset, int *pnLength, bool *pbLengthGiven);
+
 
 struct rtc_option {
     char *m_szOption;
@@ -110,33 +174,66 @@ struct rtc_option {
     { "oscstat", &HWOptionOscillatorGetStatus },
     { "pwrstat", &HWOptionPowerFailStatus },
     { "clrpwr", &HWOptionPowerFailClearFlag },
+    { "status", &HWOptionStatus },
+    { "drift", &HWOptionDriftReport },
     { 0, 0 }
 };
 
+struct option RTCLongOptions [] = {
+    { "trace", optional_argument, (int *) 0, OPTION_TRACE },
+    { "stats", optional_argument, (int *) 0, OPTION_STATS },
+    { "slew", optional_argument, (int *) 0, OPTION_SLEW },
+    { "loop", required_argument, (int *) 0, OPTION_LOOP },
+    { "tolerance", required_argument, (int *) 0, OPTION_TOLERANCE },
+    { "shm", required_argument, (int *) 0, OPTION_SHM },
+    { "timepage", required_argument, (int *) 0, OPTION_TIMEPAGE },
+    { "cache-ttl", required_argument, (int *) 0, OPTION_CACHE_TTL },
+    { (char *) 0, 0, (int *) 0, 0 }
+};
+
+bool bVerbose = false;                  // Set by -v, for extra information about what we did
+
 char *szDisplayWeekday [] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
 char *szDisplayMonth [] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
  
 /* int main (int argc, char **argv)
 **
-** This is the entry point for the application
+** This is the entry point for the application. rtcbench builds everything else with RTCDATE_NO_MAIN, to time the
+** commands against the simulator
 */
 
+# ifndef RTCDATE_NO_MAIN
+
 int main (int argc, char **argv)
 {
     int ch, nBusDevId = 0x6f, busfd;     // The PiFace RTC bus device id is 0x69 in 7-bit addressing
-    char *szBusName = (char *) 0, *szOptions = (char *) 0, *szNVRAMContents = (char *) 0;
+    int nEdgeTimeoutMsecs = 0, nBus, nTraceFormat = I2C_TRACE_FORMAT_NONE, nStatsFormat = I2C_TRACE_FORMAT_NONE;
+    int nSlewStepMsecs = 0, nLoopSecs = 0, nToleranceMsecs = 0, nShmUnit = -1, nCacheTtlSecs = 0;
+    int64_t nsStarted = TimingNow (CLOCK_MONOTONIC);
+    char *szBusName = (char *) 0, *szOptions = (char *) 0, *szNVRAMContents = (char *) 0,
+            *szDaemonSocket = (char *) 0, *szCacheBusName, *szKeyValueCommand = (char *) 0,
+            *szNVRAMRange = (char *) 0, *szTimePagePath = (char *) 0, szBusNameBuffer [32 +1], *pszEnd;
     bool bUseComputerClockToSetRTC = false, bSetComputerClockFromRTC = false,
             bDisplayPowerFail = false, bDisplayPowerRestore = false,
             bProcessOptions = false, bDisplayDateTimeAsDateInput = false,
-            bReadNVRAM = false, bWriteNVRAM = false, bMustBeRoot = false;
+            bReadNVRAM = false, bWriteNVRAM = false, bMustBeRoot = false,
+            bBusSelected = false, bAlignToSecond = false, bBootSync = false,
+            bReadNVRAMRange = false, bWriteNVRAMRange = false, bNVRAMHex = false, bPublish;
 
     // Go through the command line arguments
     
-    while ((ch = getopt (argc, argv, "b:cdhi:o:prsuw:")) != -1) {
+    while ((ch = getopt_long (argc, argv, "ab:cD:de:hi:k:o:pR:rSsuvW:w:x", RTCLongOptions, (int *) 0)) != -1) {
         switch (ch) {
+        case 'a':
+            // The user wants the RTC set from the computer clock on a second boundary
+            
+            bAlignToSecond = true;
+            break;
+            
         case 'b':
             // The user wants to set the device id on the bus
             
+            bBusSelected = true;
             nBusDevId = strtol (optarg, (char **) 0, 0);
             if (nBusDevId >= 0x80) {
                 // The bus devid needs to be a 7-bit address for our purposes
@@ -153,12 +250,30 @@ int main (int argc, char **argv)
             bMustBeRoot = true;                     // User must really be root to perform this action
             break;
                 
+        case 'D':
+            // The user wants us to run as the rtcd daemon, listening on the socket specified
+            
+            szDaemonSocket = optarg;
+            bMustBeRoot = true;                     // User must really be root to perform this action
+            break;
+                
         case 'd':
             // The user wants us to display the date in a format suitable as input to the date command
                 
             bDisplayDateTimeAsDateInput = true;
             break;
                 
+        case 'e':
+            // The user wants the time read on the edge of a second, giving up after the number of milliseconds
+            // specified
+            
+            nEdgeTimeoutMsecs = strtol (optarg, (char **) 0, 0);
+            if (nEdgeTimeoutMsecs <= 0) {
+                Usage ();
+                exit (1);
+            }
+            break;
+            
         case 'h':
             // User wants to display some help
                 
@@ -167,13 +282,23 @@ int main (int argc, char **argv)
             break;
                 
         case 'i':
-            // The user is specifying the bus. The single optarg character tells us which bus we are using
+            // The user is specifying the bus, by number. The backend turns it into the bus device's name
                 
-            switch (*optarg) {
-                case '0': szBusName = "/dev/iic0"; break;
-                case '1': szBusName = "/dev/iic1"; break;
-                default: Usage (); exit (1); break;
+            bBusSelected = true;
+            nBus = (int) strtol (optarg, &pszEnd, 10);
+            if ((! isdigit (*optarg)) || (*pszEnd != '\0')) {
+                Usage ();
+                exit (1);
             }
+            (void) snprintf (szBusNameBuffer, sizeof (szBusNameBuffer), I2C_BACKEND_BUS_FORMAT, nBus);
+            szBusName = szBusNameBuffer;
+            break;
+            
+        case 'k':
+            // The user wants to work with the key/value store in the NVRAM
+            
+            szKeyValueCommand = optarg;
+            bMustBeRoot = true;                     // User must really be root to perform this action
             break;
             
         case 'o':
@@ -191,6 +316,14 @@ int main (int argc, char **argv)
             bMustBeRoot = true;                     // User must really be root to perform this action
             break;
                 
+        case 'R':
+            // The user wants part (or all) of the NVRAM written to stdout, as it is
+            
+            szNVRAMRange = optarg;
+            bReadNVRAMRange = true;
+            bMustBeRoot = true;                     // User must really be root to perform this action
+            break;
+            
         case 'r':
             // The user wants to display the NVRAM contents
                 
@@ -198,6 +331,13 @@ int main (int argc, char **argv)
             bMustBeRoot = true;                     // User must really be root to perform this action
             break;
             
+        case 'S':
+            // The user wants the computer clock set from the RTC as quickly as possible, at boot
+            
+            bBootSync = true;
+            bMustBeRoot = true;                     // User must really be root to perform this action
+            break;
+            
         case 's':
             // The user wants to set the computer clock from the RTC
             
@@ -212,6 +352,26 @@ int main (int argc, char **argv)
             bMustBeRoot = true;                     // User must really be root to perform this action
             break;
                 
+        case 'v':
+            // The user wants extra information about what we did
+            
+            bVerbose = true;
+            break;
+            
+        case 'W':
+            // The user wants part (or all) of the NVRAM written from stdin, as it is
+            
+            szNVRAMRange = optarg;
+            bWriteNVRAMRange = true;
+            bMustBeRoot = true;                     // User must really be root to perform this action
+            break;
+            
+        case 'x':
+            // The user wants -R and -W to use hex rather than binary
+            
+            bNVRAMHex = true;
+            break;
+            
         case 'w':
             // The user wants to write to the NVRAM
                 
@@ -220,6 +380,85 @@ int main (int argc, char **argv)
             bMustBeRoot = true;                     // User must really be root to perform this action
             break;
                 
+        case OPTION_TRACE:
+        case OPTION_STATS:
+            // The user wants each bus transaction displayed as it happens, or a summary at the end (or both)
+            
+            if ((optarg != (char *) 0) && (strcmp (optarg, "json") != 0)) {
+                Usage ();
+                exit (1);
+            }
+            
+            if (ch == OPTION_TRACE)
+                nTraceFormat = (optarg != (char *) 0 ? I2C_TRACE_FORMAT_JSON : I2C_TRACE_FORMAT_TEXT);
+            else
+                nStatsFormat = (optarg != (char *) 0 ? I2C_TRACE_FORMAT_JSON : I2C_TRACE_FORMAT_TEXT);
+            break;
+            
+        case OPTION_SLEW:
+            // The user wants the computer clock brought into line with the RTC, slewing it unless it is at least
+            // as far out as the threshold given
+            
+            nSlewStepMsecs = DISCIPLINE_DEFAULT_STEP_MSECS;
+            if (optarg != (char *) 0) {
+                nSlewStepMsecs = (int) strtol (optarg, &pszEnd, 10);
+                if ((! isdigit (*optarg)) || (*pszEnd != '\0') || (nSlewStepMsecs <= 0) || (nSlewStepMsecs > DISCIPLINE_MAX_STEP_MSECS)) {
+                    Usage ();
+                    exit (1);
+                }
+            }
+            bMustBeRoot = true;                     // User must really be root to perform this action
+            break;
+            
+        case OPTION_LOOP:
+            // The user wants the computer clock kept in line with the RTC (or the RTC published) every so many seconds
+            
+            nLoopSecs = (int) strtol (optarg, &pszEnd, 10);
+            if ((! isdigit (*optarg)) || (*pszEnd != '\0') || (nLoopSecs <= 0)) {
+                Usage ();
+                exit (1);
+            }
+            break;
+            
+        case OPTION_SHM:
+            // The user wants the RTC published to ntpd or chronyd as a reference clock, in the NTP shared memory
+            // segment for the unit given
+            
+            nShmUnit = (int) strtol (optarg, &pszEnd, 10);
+            if ((! isdigit (*optarg)) || (*pszEnd != '\0') || (nShmUnit > SHM_MAX_UNIT)) {
+                Usage ();
+                exit (1);
+            }
+            bMustBeRoot = true;                     // User must really be root to perform this action
+            break;
+            
+        case OPTION_CACHE_TTL:
+            // The user will take the date/time extrapolated from an edge read up to this many seconds old
+            
+            nCacheTtlSecs = (int) strtol (optarg, &pszEnd, 10);
+            if ((! isdigit (*optarg)) || (*pszEnd != '\0') || (nCacheTtlSecs <= 0)) {
+                Usage ();
+                exit (1);
+            }
+            break;
+            
+        case OPTION_TIMEPAGE:
+            // The user wants the RTC published in a page that local programs can map, and read without the bus
+            
+            szTimePagePath = optarg;
+            bMustBeRoot = true;                     // User must really be root to perform this action
+            break;
+            
+        case OPTION_TOLERANCE:
+            // The user only wants the RTC set from the computer clock if it has drifted further than this
+            
+            nToleranceMsecs = (int) strtol (optarg, &pszEnd, 10);
+            if ((! isdigit (*optarg)) || (*pszEnd != '\0') || (nToleranceMsecs <= 0)) {
+                Usage ();
+                exit (1);
+            }
+            break;
+            
         default:
             // We received an unknown command line switch
                 
@@ -234,13 +473,52 @@ int main (int argc, char **argv)
     argc -= optind;
     argv += optind;
 
+    // Start tracing, if we were asked to. Everything up to now was starting up
+    
+    if (I2CTraceConfigure (nTraceFormat, nStatsFormat, nsStarted) < 0)
+        exit (1);
+    
+    // Aligning to a second boundary only makes sense when setting the RTC from the computer clock
+    
+    if (bAlignToSecond && (! bUseComputerClockToSetRTC)) {
+        Usage ();
+        exit (1);
+    }
+    
+    // Likewise a tolerance, and it is instead of a date/time to set
+    
+    if ((nToleranceMsecs > 0) && ((! bUseComputerClockToSetRTC) || (argc > 0))) {
+        Usage ();
+        exit (1);
+    }
+    
+    // Slewing the computer clock, and publishing the RTC, are instead of setting either clock (and of each other),
+    // and only they can loop
+    
+    bPublish = ((nShmUnit >= 0) || (szTimePagePath != (char *) 0));
+    if ((((nSlewStepMsecs > 0) || bPublish) && (bUseComputerClockToSetRTC || bSetComputerClockFromRTC || (argc > 0))) ||
+        ((nSlewStepMsecs > 0) && bPublish) || ((nLoopSecs > 0) && (nSlewStepMsecs == 0) && (! bPublish))) {
+        Usage ();
+        exit (1);
+    }
+    
+    // The cache is only for getting the date/time (to display it, set the computer clock from it, or serve it)
+    
+    if ((nCacheTtlSecs > 0) && (bUseComputerClockToSetRTC || (argc > 0) || bDisplayPowerFail || bDisplayPowerRestore ||
+        bProcessOptions || bReadNVRAM || bWriteNVRAM || bReadNVRAMRange || bWriteNVRAMRange || (szKeyValueCommand != (char *) 0) ||
+        bBootSync || (nSlewStepMsecs > 0) || bPublish)) {
+        Usage ();
+        exit (1);
+    }
+    
     // Check to see if we must be root to proceed. The utility runs as suid root so users
     // can query the clock, but most operations require you to actually be root. We set the
     // boolean bMustBeRoot when parsing the command line where the operation requires the
     // user to be root. Here we check if the boolean is set, or if there are remaining arguments
     // on the command line (we assume there is one, and it is a date/time the user wants to set
-    // the clock to).
+    // the clock to). Against the simulator there is nothing to protect, so anyone may do anything.
     
+# ifndef RTCDATE_SIM
     if ((bMustBeRoot == true) || (argc >= 1)) {
         // Check that we really are root
         
@@ -251,6 +529,81 @@ int main (int argc, char **argv)
             exit (1); 
         }
     }    
+# else
+    (void) bMustBeRoot;
+# endif // RTCDATE_SIM
+    
+    // A boot sync does nothing but set the computer clock, before anything else can get in its way
+    
+    if (bBootSync) {
+        if (HWBootSync (szBusName, nBusDevId, nsStarted) < 0) {
+            // An error occurred
+            
+            exit (1);
+        }
+        
+        exit (0);
+    }
+    
+    // If the rtcd daemon is running it already has the bus open, so hand the request to it rather than
+    // opening and probing the bus ourselves. The daemon is tied to its own bus and device, so we only do
+    // this if the user did not pick one. Setting the RTC, edge reads and streaming the NVRAM (which needs
+    // our stdin and stdout) are always done directly, as is anything asked for with -v, --trace or --stats,
+    // which the daemon cannot honour for us. A daemon would be talking to the real RTC, so the simulator never
+    // hands anything to it
+    
+# ifndef RTCDATE_SIM
+    if ((szDaemonSocket == (char *) 0) && (! bBusSelected) && (argc == 0) && (! bUseComputerClockToSetRTC) && (nEdgeTimeoutMsecs == 0) &&
+        (! bReadNVRAMRange) && (! bWriteNVRAMRange) && (nSlewStepMsecs == 0) && (! bPublish) &&
+        (nCacheTtlSecs == 0) && (! bVerbose) && (nTraceFormat == I2C_TRACE_FORMAT_NONE) && (nStatsFormat == I2C_TRACE_FORMAT_NONE)) {
+        int nDaemonCommand, nDaemonFlags = 0, nDaemonStatus;
+        char *szDaemonPayload;
+        
+
+        szDaemonPayload = (char *) 0;
+        
+        if (bDisplayPowerFail)
+            nDaemonCommand = RTCD_PWRFAIL;
+        else if (bDisplayPowerRestore)
+            nDaemonCommand = RTCD_PWRUP;
+        else if (bReadNVRAM)
+            nDaemonCommand = RTCD_NVRAM_READ;
+        else if (bWriteNVRAM) {
+            nDaemonCommand = RTCD_NVRAM_WRITE;
+            szDaemonPayload = szNVRAMContents;
+        }
+        else if (szKeyValueCommand != (char *) 0) {
+            nDaemonCommand = RTCD_KEYVALUE;
+            szDaemonPayload = szKeyValueCommand;
+        }
+        else if (bProcessOptions) {
+            nDaemonCommand = RTCD_OPTION;
+            szDaemonPayload = szOptions;
+        }
+        else {
+            nDaemonCommand = RTCD_GETTIME;
+            nDaemonFlags = (bDisplayDateTimeAsDateInput ? RTCD_FLAG_DATE_INPUT : 0) | (bSetComputerClockFromRTC ? RTCD_FLAG_SET_CLOCK : 0);
+        }
+        
+        if (RTCDaemonRequest (RTCD_SOCKET_PATH, nDaemonCommand, nDaemonFlags, szDaemonPayload, &nDaemonStatus) == 0)
+            exit (nDaemonStatus < 0 ? 1 : 0);
+        
+        // There is no daemon, so carry on and do it ourselves
+    }
+# else
+    (void) bBusSelected;
+# endif // RTCDATE_SIM
+    
+    // If the date/time can come from the cache, we need not even open the bus. The reading has to be of the
+    // bus we would have opened - the one the user named, or the one we found the RTC on last time
+    
+    if ((nCacheTtlSecs > 0) && (szDaemonSocket == (char *) 0)) {
+        szCacheBusName = ((szBusName != (char *) 0) ? szBusName : I2CDiscoverCached (nBusDevId));
+        if (CacheAnswers (szCacheBusName, nBusDevId, nCacheTtlSecs)) {
+            I2CTracePhase ("get");
+            exit ((HWGetTimeOfDay (-1, szCacheBusName, nBusDevId, bDisplayDateTimeAsDateInput, bSetComputerClockFromRTC, nEdgeTimeoutMsecs, nCacheTtlSecs, stdout) < 0) ? 1 : 0);
+        }
+    }
     
     // Open the bus device
     
@@ -261,10 +614,25 @@ int main (int argc, char **argv)
         exit (1);
     }
     
+    // If the user wants us to run as the daemon, do that now. We only return when we are told to stop
+    
+    if (szDaemonSocket != (char *) 0) {
+        I2CTracePhase ("daemon");
+        if (RTCDaemonRun (busfd, nBusDevId, szDaemonSocket, nCacheTtlSecs) < 0) {
+            // An error occurred
+            
+            exit (1);
+        }
+        
+        (void) CloseI2CDevice (busfd);
+        exit (0);
+    }
+    
     // If the user wanted the powerfail or powerrestore date/time, get it
     
     if (bDisplayPowerFail) {
-        if (DisplayPowerFailTime (busfd, nBusDevId) < 0) {
+        I2CTracePhase ("pwrfail");
+        if (DisplayPowerFailTime (busfd, nBusDevId, stdout) < 0) {
             // An error occurred
             
             exit (1);
@@ -274,7 +642,8 @@ int main (int argc, char **argv)
     }
 
     if (bDisplayPowerRestore) {
-        if (DisplayPowerRestoreTime (busfd, nBusDevId) < 0) {
+        I2CTracePhase ("pwrup");
+        if (DisplayPowerRestoreTime (busfd, nBusDevId, stdout) < 0) {
             // An error occurred
             
             exit (1);
@@ -286,7 +655,8 @@ int main (int argc, char **argv)
     // Check whether the user wanted to read from or write to the NVRAM
     
     if (bReadNVRAM) {
-        if (ReadNVRAM (busfd, nBusDevId) < 0) {
+        I2CTracePhase ("nvram-read");
+        if (ReadNVRAM (busfd, nBusDevId, stdout) < 0) {
             // An error occurred
             
             exit (1);
@@ -296,7 +666,43 @@ int main (int argc, char **argv)
     }
     
     if (bWriteNVRAM) {
-        if (WriteNVRAM (busfd, nBusDevId, szNVRAMContents) < 0) {
+        I2CTracePhase ("nvram-write");
+        if (WriteNVRAM (busfd, nBusDevId, szNVRAMContents, stdout) < 0) {
+            // An error occurred
+            
+            exit (1);
+        }
+        
+        exit (0);
+    }
+    
+    if (bReadNVRAMRange) {
+        I2CTracePhase ("nvram-range");
+        if (ReadNVRAMRange (busfd, nBusDevId, szNVRAMRange, bNVRAMHex) < 0) {
+            // An error occurred
+            
+            exit (1);
+        }
+        
+        exit (0);
+    }
+    
+    if (bWriteNVRAMRange) {
+        I2CTracePhase ("nvram-range");
+        if (WriteNVRAMRange (busfd, nBusDevId, szNVRAMRange, bNVRAMHex) < 0) {
+            // An error occurred
+            
+            exit (1);
+        }
+        
+        exit (0);
+    }
+    
+    // Check whether the user wanted to use the key/value store in the NVRAM
+    
+    if (szKeyValueCommand != (char *) 0) {
+        I2CTracePhase ("keyvalue");
+        if (KeyValueCommand (busfd, nBusDevId, szKeyValueCommand, stdout) < 0) {
             // An error occurred
             
             exit (1);
@@ -308,21 +714,85 @@ int main (int argc, char **argv)
     // If the user wanted to process an option, do it now
     
     if (bProcessOptions) {
-        if (ProcessHWClockOption (busfd, nBusDevId, szOptions) < 0) {
+        if (ProcessHWClockOption (busfd, nBusDevId, szOptions, stdout) < 0) {
+            // An error occurred
+            
+            exit (1);
+        }
+        
+        exit (0);
+    }
+    
+    // If the user wants the computer clock slewed into line with the RTC, do that now. When looping we only
+    // return on an error
+    
+    if (nSlewStepMsecs > 0) {
+        I2CTracePhase ("discipline");
+        if (HWDisciplineComputerClock (busfd, nBusDevId, nSlewStepMsecs, nLoopSecs, ((nEdgeTimeoutMsecs > 0) ? nEdgeTimeoutMsecs : EDGE_DEFAULT_TIMEOUT_MSECS)) < 0) {
+            // An error occurred
+            
+            exit (1);
+        }
+        
+        I2CTracePhase ("close");
+        (void) CloseI2CDevice (busfd);
+        exit (0);
+    }
+    
+    // If the user wants the RTC published, for the time daemon or in the time page, do that now. We only return
+    // on an error
+    
+    if (bPublish) {
+        I2CTracePhase ("publish");
+        if (HWPublishRTC (busfd, nBusDevId, nShmUnit, szTimePagePath, ((nLoopSecs > 0) ? nLoopSecs : SHM_DEFAULT_INTERVAL_SECS),
+                          ((nEdgeTimeoutMsecs > 0) ? nEdgeTimeoutMsecs : EDGE_DEFAULT_TIMEOUT_MSECS)) < 0) {
+            // An error occurred
+            
+            exit (1);
+        }
+    }
+    
+    // If the RTC is only to be set from the computer clock when it has drifted too far, measure it and only set
+    // it if it has
+    
+    if (nToleranceMsecs > 0) {
+        I2CTracePhase ("drift");
+        if (HWSetTimeOfDayIfDrifted (busfd, nBusDevId, nToleranceMsecs, bAlignToSecond) < 0) {
             // An error occurred
             
             exit (1);
         }
         
+        I2CTracePhase ("close");
+        (void) CloseI2CDevice (busfd);
         exit (0);
     }
     
+    // If the RTC is being set from the computer clock, see how far it has drifted since it was last set
+    // first, and program the trim that our estimate of its drift calls for. Neither is fatal
+    
+    if (bUseComputerClockToSetRTC) {
+        I2CTracePhase ("drift");
+        (void) HWDriftUpdate (busfd, nBusDevId, (struct rtc_edge_reading *) 0);
+    }
+    
     // Check to see if the user wants to get the time, or set the time
     
-    if (argc == 1 || bUseComputerClockToSetRTC) {
+    if (bAlignToSecond) {
+        // The user wants the time set precisely, on a second boundary
+        
+        I2CTracePhase ("set");
+        if (HWSetTimeOfDayPrecise (busfd, nBusDevId) < 0) {
+            // An error occurred
+            
+            exit (1);
+        }
+    }
+    else if (argc == 1 || bUseComputerClockToSetRTC) {
         // The user wants to set the time
         
-        if (HWSetTimeOfDay (busfd, nBusDevId, argv [0], bUseComputerClockToSetRTC) < 0) {
+        I2CTracePhase ("set");
+        if (HWSetTimeOfDay (busfd, nBusDevId, argv [0], bUseComputerClockToSetRTC, stdout) < 0) {
             // An error occurred
             
             exit (1);
@@ -331,7 +801,8 @@ int main (int argc, char **argv)
     else {
         // The user simply wants the date/time
             
-        if (HWGetTimeOfDay (busfd, nBusDevId, bDisplayDateTimeAsDateInput, bSetComputerClockFromRTC) < 0) {
+        I2CTracePhase ("get");
+        if (HWGetTimeOfDay (busfd, I2CBusName (), nBusDevId, bDisplayDateTimeAsDateInput, bSetComputerClockFromRTC, nEdgeTimeoutMsecs, nCacheTtlSecs, stdout) < 0) {
             // An error occurred
             
             exit (1);
@@ -340,23 +811,30 @@ int main (int argc, char **argv)
     
     // Simply close the device
     
+    I2CTracePhase ("close");
     (void) CloseI2CDevice (busfd);
     
     // Return
     
     exit (0);
 }
+# endif // RTCDATE_NO_MAIN
 
-/* int ProcessHWClockOption (int busfd, int nBusDevId, char *OptionsToProcess)
+/* int ProcessHWClockOption (int busfd, int nBusDevId, char *OptionsToProcess, FILE *fpOutput)
 **
-** This option is used to process options for the PiFace Real Time Clock
+** This option is used to process options for the PiFace Real Time Clock. The options stage their changes in
+** the option plan, and once every option has been processed the plan is flushed to the RTC in one go
 */
 
-int ProcessHWClockOption (int busfd, int nBusDevId, char *szOptionsToProcess)
+int ProcessHWClockOption (int busfd, int nBusDevId, char *szOptionsToProcess, FILE *fpOutput)
 {
     char *szOption;
     struct rtc_option *pOption;
     
+    // Start with an empty plan
+    
+    PlanReset ();
+    
     // Process each of the options specified. Get the first option
     
     szOption = strtok (szOptionsToProcess, ",");
@@ -370,7 +848,8 @@ int ProcessHWClockOption (int busfd, int nBusDevId, char *szOptionsToProcess)
             if (! strcasecmp (szOption, pOption ->m_szOption)) {
                 // We have a match - process it
                 
-                (*pOption ->m_pOptionFunc) (busfd, nBusDevId);
+                I2CTracePhase (pOption ->m_szOption);
+                (*pOption ->m_pOptionFunc) (busfd, nBusDevId, fpOutput);
                 break;
             }
             
@@ -385,7 +864,7 @@ int ProcessHWClockOption (int busfd, int nBusDevId, char *szOptionsToProcess)
         if (pOption ->m_szOption == (char *) 0) {
             // We did get a bogus option
             
-            (void) printf ("WARNING: Invalid option %s specified, ignoring and continuing processing!\n", szOption);
+            (void) fprintf (fpOutput, "WARNING: Invalid option %s specified, ignoring and continuing processing!\n", szOption);
         }
         
         // Get the next option (if there are any more)
@@ -393,22 +872,25 @@ int ProcessHWClockOption (int busfd, int nBusDevId, char *szOptionsToProcess)
         szOption = strtok (0, ",");
     }
     
-    // We never return anything other than 0
+    // Write out everything the options staged, and run anything that was waiting on it. Only a failure
+    // to write is reported back to the caller
     
-    return 0;
+    I2CTracePhase ("flush");
+    return PlanFlush (busfd, nBusDevId, fpOutput);
 }
 
-/* int HWOptionInitRTC (int busfd, int nBusDevId)
+/* int HWOptionInitRTC (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** This option initializes the Real Time Clock, setting the trim value, the date and time, and
-** enabling the battery and external oscillator
+** enabling the battery and external oscillator. The date and time are set once the other changes
+** have been flushed
 */
 
-int HWOptionInitRTC (int busfd, int nBusDevId)
+int HWOptionInitRTC (int busfd, int nBusDevId, FILE *fpOutput)
 {
     // First, set the TRIM value 
     
-    if (HWOptionCalibrateClock (busfd, nBusDevId) < 0) {
+    if (HWOptionCalibrateClock (busfd, nBusDevId, fpOutput) < 0) {
         // An error occurred
         
         (void) fprintf (stderr, "Initialization failed!\n");
@@ -417,7 +899,7 @@ int HWOptionInitRTC (int busfd, int nBusDevId)
     
     // Now, enable the battery
     
-    if (HWOptionBatteryEnable (busfd, nBusDevId) < 0) {
+    if (HWOptionBatteryEnable (busfd, nBusDevId, fpOutput) < 0) {
         // An error occurred
         
         (void) fprintf (stderr, "Initialization failed!\n");
@@ -426,53 +908,71 @@ int HWOptionInitRTC (int busfd, int nBusDevId)
     
     // Now, enable the oscillator
     
-    if (HWOptionOscillatorEnable (busfd, nBusDevId) < 0) {
+    if (HWOptionOscillatorEnable (busfd, nBusDevId, fpOutput) < 0) {
         // An error occurred
         
         (void) fprintf (stderr, "Initialization failed!\n");
         return -1;
     } 
     
-    // Set the date on the RTC using the computer clock
+    // Set the date on the RTC using the computer clock, after the changes above have been written
+    
+    if (PlanAfterFlush (&HWOptionInitRTCSetTime) < 0) {
+        // An error occurred
+        
+        (void) fprintf (stderr, "Initialization failed!\n");
+        return -1;
+    }
     
-    if (HWSetTimeOfDay (busfd, nBusDevId, (char *) 0, true) < 0) {
+    return 0;
+}
+
+/* int HWOptionInitRTCSetTime (int busfd, int nBusDevId, FILE *fpOutput)
+**
+** The last step of initialization, run once the option plan has been flushed. Set the date on the RTC using
+** the computer clock
+*/
+
+int HWOptionInitRTCSetTime (int busfd, int nBusDevId, FILE *fpOutput)
+{
+    if (HWSetTimeOfDay (busfd, nBusDevId, (char *) 0, true, fpOutput) < 0) {
         // An error occurred
         
-         (void) fprintf (stderr, "Initialization failed!\n");
-       return -1;
+        (void) fprintf (stderr, "Initialization failed!\n");
+        return -1;
     }
     
-    (void) printf ("Initialization successful.\n");
+    (void) fprintf (fpOutput, "Initialization successful.\n");
     return 0;
 }
 
-/* int HWOptionBatteryEnable (int busfd, int nBusDevId)
+/* int HWOptionBatteryEnable (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** Set the battery enable flag on the Real Time Clock
 */
 
-int HWOptionBatteryEnable (int busfd, int nBusDevId)
+int HWOptionBatteryEnable (int busfd, int nBusDevId, FILE *fpOutput)
 {   
-    return HWOptionBatteryConfigure (busfd, nBusDevId, true);
+    return HWOptionBatteryConfigure (busfd, nBusDevId, true, fpOutput);
 }
 
-/* int HWOptionBatteryDisable (int busfd, int nBusDevId)
+/* int HWOptionBatteryDisable (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** Set the battery enable flag to false on the Real Time Clock
 */
 
-int HWOptionBatteryDisable (int busfd, int nBusDevId)
+int HWOptionBatteryDisable (int busfd, int nBusDevId, FILE *fpOutput)
 {
-    return HWOptionBatteryConfigure (busfd, nBusDevId, false);
+    return HWOptionBatteryConfigure (busfd, nBusDevId, false, fpOutput);
 }
 
 
-/* int HWOptionBatteryGetSetting (int busfd, int nBusDevId)
+/* int HWOptionBatteryGetSetting (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** This option is used to get the status of the battery enable flag
 */
 
-int HWOptionBatteryGetSetting (int busfd, int nBusDevId)
+int HWOptionBatteryGetSetting (int busfd, int nBusDevId, FILE *fpOutput)
 {
     struct mcp7940n_rtcwkday rtcwkdayBatteryStatus;
     char szErrorString [128 +1];
@@ -483,7 +983,7 @@ int HWOptionBatteryGetSetting (int busfd, int nBusDevId)
        
     // Request the data from the RTC
     
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayBatteryStatus, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
+    if (PlanPeek (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayBatteryStatus, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
         // An error occurred, display details and exit
         
         (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x getting Battery Enable (VBATEN) bit", nBusDevId);
@@ -493,90 +993,138 @@ int HWOptionBatteryGetSetting (int busfd, int nBusDevId)
     
     // Display what was retrieved from memory
     
-    (void) printf ("Battery Enable bit is %s.\n", (rtcwkdayBatteryStatus.vbaten ? "Enabled" : "Disabled"));
+    (void) fprintf (fpOutput, "Battery Enable bit is %s.\n", (rtcwkdayBatteryStatus.vbaten ? "Enabled" : "Disabled"));
     return 0;
 }
 
-/* int HWOptionCalibrateClock (int busfd, int nBusDevId)
+/* int HWOptionCalibrateClock (int busfd, int nBusDevId, FILE *fpOutput)
 **
-** This option is used to calibrate the clock. It is typically called only once.
+** This option is used to calibrate the clock. If the RTC has been set from the computer clock often enough
+** for us to have estimated its drift we use the trim that cancels it, otherwise we fall back to 0x47, the
+** value used by the Linux driver and code for the PiFace RTC. Either way fine trim mode is used
 */
 
-int HWOptionCalibrateClock (int busfd, int nBusDevId)
+int HWOptionCalibrateClock (int busfd, int nBusDevId, FILE *fpOutput)
 {
-    struct mcp7940n_osctrim osctrimTrimValue;
+    struct mcp7940n_osctrim osctrimTrimValue, osctrimCurrentValue;
+    struct mcp7940n_control controlControlRegisters;
+    struct drift_estimate   estimateDrift;
     char szErrorString [128 +1];
     
-    // Set the trim value. We got the value of 0x47 from the Linux driver and code for the PiFace RTC
+    // Work out the trim value
+    
+    if ((DriftLoad (DRIFT_STATE_PATH) == 0) && (DriftEstimate (&estimateDrift) == 0)) {
+        DriftStepsToTrim (estimateDrift.m_nTrimSteps, &osctrimTrimValue);
+        (void) fprintf (fpOutput, "Trimming for a drift of %+.3f ppm (%+d steps), expected residual drift %+.3f ppm.\n",
+            estimateDrift.m_dDriftPPM, estimateDrift.m_nTrimSteps, estimateDrift.m_dResidualPPM);
+    }
+    else {
+        osctrimTrimValue.sign = 0;
+        osctrimTrimValue.trimval = 0x47;
+    }
+    
+    // Get the current trim value and control register, so that we know what we are changing
     
-    osctrimTrimValue.trimval = 0x47;
+    if ((PlanPeek (busfd, nBusDevId, MCP7940N_OSCTRIM_OFFSET, (void *) &osctrimCurrentValue, sizeof (struct mcp7940n_osctrim)) < 0) ||
+        (PlanPeek (busfd, nBusDevId, MCP7940N_CONTROL_OFFSET, (void *) &controlControlRegisters, sizeof (struct mcp7940n_control)) < 0)) {
+        (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x reading trim value", nBusDevId);
+        (void) perror (szErrorString);
+        return -1;
+    }
     
-    // Write out the trim value
+    // Stage the trim value and fine trim mode, they are written out with the other options
     
-    if (WriteI2CDeviceMemory (busfd, nBusDevId, MCP7940N_OSCTRIM_OFFSET, (void *) &osctrimTrimValue, sizeof (struct mcp7940n_osctrim)) < 0) {
+    controlControlRegisters.crstrim = 0;
+    if ((PlanStage (busfd, nBusDevId, MCP7940N_CONTROL_OFFSET, (void *) &controlControlRegisters, sizeof (struct mcp7940n_control)) < 0) ||
+        (PlanStage (busfd, nBusDevId, MCP7940N_OSCTRIM_OFFSET, (void *) &osctrimTrimValue, sizeof (struct mcp7940n_osctrim)) < 0)) {
         // An error occurred
         
-        (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x setting trim value", nBusDevId);
+        (void) sprintf (szErrorString, "Unable to stage write to trim registers for nBusDevId 0x%02x", nBusDevId);
         (void) perror (szErrorString);
         return -1;
     }
     
+    // If the trim changed, the interval since the RTC was last set was run partly on each value, so it
+    // cannot be used for the drift estimate
+    
+    if (DriftTrimToSteps (&osctrimCurrentValue) != DriftTrimToSteps (&osctrimTrimValue)) {
+        DriftRecordBreak ();
+        (void) DriftSave (DRIFT_STATE_PATH);
+    }
+    
     return 0;
 }
     
-/* int HWOptionClearNVRAM (int busfd, int nBusDevId)
+/* int HWOptionClearNVRAM (int busfd, int nBusDevId, FILE *fpOutput)
+**
+** Clear the NVRAM on the Real Time Clock. The NVRAM is not in the snapshot, so rather than staging all 64
+** bytes we clear it once the plan has been flushed, writing only the bytes that are not already zero
+*/
+
+int HWOptionClearNVRAM (int busfd, int nBusDevId, FILE *fpOutput)
+{
+    (void) busfd;               // Every option takes the same arguments, but this one only queues the write
+    (void) nBusDevId;
+    (void) fpOutput;
+    
+    return PlanAfterFlush (&HWOptionClearNVRAMWrite);
+}
+
+/* int HWOptionClearNVRAMWrite (int busfd, int nBusDevId, FILE *fpOutput)
 **
-** Clear the NVRAM on the Real Time Clock
+** Clear the NVRAM, once the option plan has been flushed
 */
 
-int HWOptionClearNVRAM (int busfd, int nBusDevId)
+int HWOptionClearNVRAMWrite (int busfd, int nBusDevId, FILE *fpOutput)
 {
     uint8_t NVRAMBuf [64];          // 64 bytes is the size of the NVRAM on the RTC
+    struct delta_stats statsDelta;
     char szErrorString [128 +1];
     
     // Clear out the buffer we will write data out from (clearing the NVRAM)
     
     bzero ((void *) NVRAMBuf, 64);
             
-    // Write the data out to the RTC
+    // Write out whatever is not already clear, and check it
     
-    if (WriteI2CDeviceMemory (busfd, nBusDevId, MCP7940N_NVRAM_OFFSET, NVRAMBuf, 64) < 0 ) {
+    if (DeltaWrite (busfd, nBusDevId, MCP7940N_NVRAM_OFFSET, (uint8_t *) 0, NVRAMBuf, 64, true, &statsDelta) < 0 ) {
         // An error occurred. All we can do is display the error
         
-        (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x", nBusDevId);
+        (void) sprintf (szErrorString, "clearing NVRAM for nBusDevId 0x%02x", nBusDevId);
         (void) perror (szErrorString);
         return -1;
     }
     
+    DisplayDeltaStats ("NVRAM clear", &statsDelta, fpOutput);
     return 0;
 }
 
-/* int HWOptionOscillatorEnable (int busfd, int nBusDevId)
+/* int HWOptionOscillatorEnable (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** This option is called to enable the external oscillator
 */
 
-int HWOptionOscillatorEnable (int busfd, int nBusDevId)
+int HWOptionOscillatorEnable (int busfd, int nBusDevId, FILE *fpOutput)
 {
-    return HWOptionOscillatorConfigure (busfd, nBusDevId, true);
+    return HWOptionOscillatorConfigure (busfd, nBusDevId, true, fpOutput);
 }
 
-/* int HWOptionOscillatorDisable (int busfd, int nBusDevId)
+/* int HWOptionOscillatorDisable (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** This option is called to disable the external oscillator
 */
 
-int HWOptionOscillatorDisable (int busfd, int nBusDevId)
+int HWOptionOscillatorDisable (int busfd, int nBusDevId, FILE *fpOutput)
 {
-    return HWOptionOscillatorConfigure (busfd, nBusDevId, false);
+    return HWOptionOscillatorConfigure (busfd, nBusDevId, false, fpOutput);
 }
 
-/* int HWOptionOscillatorGetSetting (int busfd, int nBusDevId)
+/* int HWOptionOscillatorGetSetting (int busfd, int nBusDevId, FILE *fpOutput)
  **
  ** This option is used to get the status of the external oscillator
  */
 
-int HWOptionOscillatorGetSetting (int busfd, int nBusDevId)
+int HWOptionOscillatorGetSetting (int busfd, int nBusDevId, FILE *fpOutput)
 {
     struct mcp7940n_rtcsec rtcsecOscillatorSetting;
     char szErrorString [128 +1];
@@ -587,7 +1135,7 @@ int HWOptionOscillatorGetSetting (int busfd, int nBusDevId)
         
     // Request the data from the RTC
     
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &rtcsecOscillatorSetting, sizeof (struct mcp7940n_rtcsec)) < 0 ) {
+    if (PlanPeek (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &rtcsecOscillatorSetting, sizeof (struct mcp7940n_rtcsec)) < 0 ) {
         // An error occurred, display details and exit
         
         (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x", nBusDevId);
@@ -597,16 +1145,16 @@ int HWOptionOscillatorGetSetting (int busfd, int nBusDevId)
     
     // Display what was retrieved from memory
     
-    (void) printf ("Oscillator is %s.\n", (rtcsecOscillatorSetting.st ? "Enabled" : "Disabled"));
+    (void) fprintf (fpOutput, "Oscillator is %s.\n", (rtcsecOscillatorSetting.st ? "Enabled" : "Disabled"));
     return 0;
 }
 
-/* int HWOptionOscillatorGetStatus (int busfd, int nBusDevId)
+/* int HWOptionOscillatorGetStatus (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** This option is used to get the status of the external oscillator
 */
 
-int HWOptionOscillatorGetStatus (int busfd, int nBusDevId)
+int HWOptionOscillatorGetStatus (int busfd, int nBusDevId, FILE *fpOutput)
 {
     struct mcp7940n_rtcwkday rtcwkdayOscillatorStatus;
     char szErrorString [128 +1];
@@ -617,7 +1165,7 @@ int HWOptionOscillatorGetStatus (int busfd, int nBusDevId)
                 
     // Request the data from the RTC
         
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayOscillatorStatus, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
+    if (PlanPeek (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayOscillatorStatus, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
         // An error occurred, display details and exit
             
         (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x", nBusDevId);
@@ -627,16 +1175,16 @@ int HWOptionOscillatorGetStatus (int busfd, int nBusDevId)
         
     // Display what was retrieved from memory
         
-    (void) printf ("%s\n", (rtcwkdayOscillatorStatus.oscrun ? "Oscillator is enabled and running." : "Oscillator has stopped or been disabled."));
+    (void) fprintf (fpOutput, "%s\n", (rtcwkdayOscillatorStatus.oscrun ? "Oscillator is enabled and running." : "Oscillator has stopped or been disabled."));
     return 0;
 }
 
-/* int HWOptionPowerFailStatus (int busfd, int nBusDevId)
+/* int HWOptionPowerFailStatus (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** Get the power fail status flag value
 */
 
-int HWOptionPowerFailStatus (int busfd, int nBusDevId)
+int HWOptionPowerFailStatus (int busfd, int nBusDevId, FILE *fpOutput)
 {
     struct mcp7940n_rtcwkday rtcwkdayPowerFailStatus;
     char szErrorString [128 +1];
@@ -647,7 +1195,7 @@ int HWOptionPowerFailStatus (int busfd, int nBusDevId)
        
     // Request the data from the RTC
     
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
+    if (PlanPeek (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
         // An error occurred, display details and exit
         
         (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x getting Power Fail Status (PWRFAIL) bit", nBusDevId);
@@ -657,16 +1205,16 @@ int HWOptionPowerFailStatus (int busfd, int nBusDevId)
     
     // Display what was retrieved from memory
     
-    (void) printf ("Power Fail Status bit is %s.\n", (rtcwkdayPowerFailStatus.pwrfail ? "Enabled" : "Disabled"));
+    (void) fprintf (fpOutput, "Power Fail Status bit is %s.\n", (rtcwkdayPowerFailStatus.pwrfail ? "Enabled" : "Disabled"));
     return 0;
 }
 
-/* int HWOptionPowerFailClearFlag (int busfd, int nBusDevId)
+/* int HWOptionPowerFailClearFlag (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** This option is used to clear the power fail flag
 */
 
-int HWOptionPowerFailClearFlag (int busfd, int nBusDevId)
+int HWOptionPowerFailClearFlag (int busfd, int nBusDevId, FILE *fpOutput)
 {
     struct mcp7940n_rtcwkday rtcwkdayPowerFailStatus;
     char szErrorString [128 +1];
@@ -677,7 +1225,7 @@ int HWOptionPowerFailClearFlag (int busfd, int nBusDevId)
        
     // Request the data from the RTC
     
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
+    if (PlanPeek (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
         // An error occurred, display details and exit
         
         (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x getting Power Fail Status (PWRFAIL) bit", nBusDevId);
@@ -690,7 +1238,7 @@ int HWOptionPowerFailClearFlag (int busfd, int nBusDevId)
     if (rtcwkdayPowerFailStatus.pwrfail == 0) {
         // The bit is not set, so simply display a message and return
         
-        (void) printf ("The Power Fail Status (PWRFAIL) bit is not set.\n");
+        (void) fprintf (fpOutput, "The Power Fail Status (PWRFAIL) bit is not set.\n");
         return 0;
     }
     
@@ -703,10 +1251,10 @@ int HWOptionPowerFailClearFlag (int busfd, int nBusDevId)
     //
     // TODO: Fix this...
 
-    if (WriteI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
+    if (PlanStage (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
         // An error occurred, display details and exit
         
-        (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x writing cleared Power Fail Status (PWRFAIL) bit", nBusDevId);
+        (void) sprintf (szErrorString, "Unable to stage write to register clearing Power Fail Status (PWRFAIL) bit for nBusDevId 0x%02x", nBusDevId);
         (void) perror (szErrorString);
         return -1;        
     }
@@ -714,23 +1262,80 @@ int HWOptionPowerFailClearFlag (int busfd, int nBusDevId)
     return 0;
 }
 
-/* int HWOptionControlRegistersDisplay (int busfd, int nBusDevId)
+/* int HWOptionStatus (int busfd, int nBusDevId, FILE *fpOutput)
 **
-** This function is called to display the values of the control registers
+** This option displays the battery, oscillator and power fail status together. It is what health checks
+** ask the rtcd daemon for, and as all three come from the register snapshot it costs a single read
 */
 
-int HWOptionControlRegistersDisplay (int busfd, int nBusDevId)
+int HWOptionStatus (int busfd, int nBusDevId, FILE *fpOutput)
 {
-    struct mcp7940n_control controlControlRegisters;
-    char szErrorString [128 +1];
-    
-    // Zero out the control registers ahead of call to read them
-    
-    bzero (&controlControlRegisters, sizeof (struct mcp7940n_control));
+    if ((HWOptionBatteryGetSetting (busfd, nBusDevId, fpOutput) < 0) ||
+        (HWOptionOscillatorGetStatus (busfd, nBusDevId, fpOutput) < 0) ||
+        (HWOptionPowerFailStatus (busfd, nBusDevId, fpOutput) < 0)) {
+        // An error occurred, and has already been displayed
+        
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* int HWOptionDriftReport (int busfd, int nBusDevId, FILE *fpOutput)
+**
+** Display what we know about the RTC's drift, the trim programmed now and the trim we would program
+*/
+
+int HWOptionDriftReport (int busfd, int nBusDevId, FILE *fpOutput)
+{
+    struct mcp7940n_osctrim osctrimCurrentValue;
+    struct drift_estimate   estimateDrift;
+    
+    if (PlanPeek (busfd, nBusDevId, MCP7940N_OSCTRIM_OFFSET, (void *) &osctrimCurrentValue, sizeof (struct mcp7940n_osctrim)) < 0) {
+        (void) perror ("Unable to read trim value from RTC");
+        return -1;
+    }
+    
+    (void) fprintf (fpOutput, "Trim programmed:       %+d steps (%+.3f ppm)\n", DriftTrimToSteps (&osctrimCurrentValue),
+        (DriftTrimToSteps (&osctrimCurrentValue) * DRIFT_PPM_PER_TRIM_STEP));
+    
+    if (DriftLoad (DRIFT_STATE_PATH) < 0)
+        return -1;
+    
+    if (DriftEstimate (&estimateDrift) < 0) {
+        // Not an error, per se, we just have not seen the RTC set from the computer clock often enough
+        
+        (void) fprintf (fpOutput, "Not enough samples to estimate drift yet (need two syncs at least %d seconds apart).\n", DRIFT_MIN_INTERVAL_SECS);
+        return 0;
+    }
+    
+    (void) fprintf (fpOutput, "Crystal drift:         %+.3f ppm (%+.3f s/day), +/- %.3f ppm from %d samples, %d pairs\n",
+        estimateDrift.m_dDriftPPM, (estimateDrift.m_dDriftPPM * 86400.0 / 1000000.0), estimateDrift.m_dSpreadPPM,
+        estimateDrift.m_nSamples, estimateDrift.m_nPairs);
+    (void) fprintf (fpOutput, "Best trim:             %+d steps\n", estimateDrift.m_nTrimSteps);
+    (void) fprintf (fpOutput, "Expected residual:     %+.3f ppm (%+.3f s/day)\n", estimateDrift.m_dResidualPPM,
+        (estimateDrift.m_dResidualPPM * 86400.0 / 1000000.0));
+    
+    return 0;
+}
+
+/* int HWOptionControlRegistersDisplay (int busfd, int nBusDevId, FILE *fpOutput)
+**
+** This function is called to display the values of the control registers
+*/
+
+int HWOptionControlRegistersDisplay (int busfd, int nBusDevId, FILE *fpOutput)
+{
+    struct mcp7940n_control controlControlRegisters;
+    char szErrorString [128 +1];
+    
+    // Zero out the control registers ahead of call to read them
+    
+    bzero (&controlControlRegisters, sizeof (struct mcp7940n_control));
     
     // Read the control registers
     
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_CONTROL_OFFSET, (void *) &controlControlRegisters, sizeof (struct mcp7940n_control)) < 0) {
+    if (PlanPeek (busfd, nBusDevId, MCP7940N_CONTROL_OFFSET, (void *) &controlControlRegisters, sizeof (struct mcp7940n_control)) < 0) {
          // An error occurred, display details and exit
             
         (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x reading control registers", nBusDevId);
@@ -740,34 +1345,35 @@ int HWOptionControlRegistersDisplay (int busfd, int nBusDevId)
 
     // Display the control registers
     
-    (void) printf ("Square Wave Clock Output Frequency Select: %d\n", controlControlRegisters.sqwfs);
-    (void) printf ("Coarse Trim Enable:                        %d\n", controlControlRegisters.crstrim);
-    (void) printf ("External Oscillator Input:                 %d\n", controlControlRegisters.extosc);
-    (void) printf ("Alarm 0 Module Enable:                     %d\n", controlControlRegisters.alm0en);
-    (void) printf ("Alarm 1 Module Enable:                     %d\n", controlControlRegisters.alm1en);
-    (void) printf ("Square Wave Output Enable:                 %d\n", controlControlRegisters.sqwen);
-    (void) printf ("Logic Level for General Purpose Output:    %d\n", controlControlRegisters.out);
+    (void) fprintf (fpOutput, "Square Wave Clock Output Frequency Select: %d\n", controlControlRegisters.sqwfs);
+    (void) fprintf (fpOutput, "Coarse Trim Enable:                        %d\n", controlControlRegisters.crstrim);
+    (void) fprintf (fpOutput, "External Oscillator Input:                 %d\n", controlControlRegisters.extosc);
+    (void) fprintf (fpOutput, "Alarm 0 Module Enable:                     %d\n", controlControlRegisters.alm0en);
+    (void) fprintf (fpOutput, "Alarm 1 Module Enable:                     %d\n", controlControlRegisters.alm1en);
+    (void) fprintf (fpOutput, "Square Wave Output Enable:                 %d\n", controlControlRegisters.sqwen);
+    (void) fprintf (fpOutput, "Logic Level for General Purpose Output:    %d\n", controlControlRegisters.out);
     
     // Just return
     
     return 0;
 }
 
-/* int DisplayPowerFailTime (int busfd, int nBusDevId)
+/* int DisplayPowerFailTime (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** Retrieve the power fail time from the Real Time Clock, and display it
 */
 
-int DisplayPowerFailTime (int busfd, int nBusDevId)
+int DisplayPowerFailTime (int busfd, int nBusDevId, FILE *fpOutput)
 {
     struct mcp7940n_rtcwkday        rtcwkdayPowerFailStatus;
     struct mcp7940n_pwrdn_timestamp timestampPowerDown;
+    struct tm                       tmTimestamp;
  
     // Before we attempt to retrieve the power down timestamp, check to see if the PWRFAIL flag is
     // set or cleared. If it has been cleared we assume that there is no power down time to read
     
     bzero (&rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday));
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
+    if (SnapshotRead (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
         // An error occurred, and we could not read the PWRFAIL flag
         
         (void) perror ("Unable to read PWRFAIL flag, assuming no power down data/time information available.\n");
@@ -780,14 +1386,14 @@ int DisplayPowerFailTime (int busfd, int nBusDevId)
         // This is not an error, per se. The PWRFAIL flag is cleared, so we assume that there is no power fail
         // data available for us to read
         
-        (void) printf ("No power down date/time information available (PWRFAIL bit is cleared).\n");
+        (void) fprintf (fpOutput, "No power down date/time information available (PWRFAIL bit is cleared).\n");
         return 0;
     }
     
     // Read the power down date and time from the RTC
     
     bzero (&timestampPowerDown, sizeof (struct mcp7940n_pwrdn_timestamp));
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCPWRDN_OFFSET, (void *) &timestampPowerDown, sizeof (struct mcp7940n_pwrdn_timestamp)) < 0) {
+    if (SnapshotRead (busfd, nBusDevId, MCP7940N_RTCPWRDN_OFFSET, (void *) &timestampPowerDown, sizeof (struct mcp7940n_pwrdn_timestamp)) < 0) {
         // An error occurred
         
         (void) perror ("Unable to read power down date/time from real time clock.\n");
@@ -796,33 +1402,29 @@ int DisplayPowerFailTime (int busfd, int nBusDevId)
     
     // Display the date and time we just read in
     
-    (void) printf ("%s %s %d %02d:%02d UTC\n",
-        szDisplayWeekday [(timestampPowerDown.pwrdnmth.wkday -1)],
-        szDisplayMonth [((timestampPowerDown.pwrdnmth.mthten *10) + timestampPowerDown.pwrdnmth.mthone -1)],
-        ((timestampPowerDown.pwrdndate.dateten *10) + timestampPowerDown.pwrdndate.dateone),
-        ((timestampPowerDown.pwrdnhour.twentyfourhour.twelvetwentyfour == 0)
-            ? ((timestampPowerDown.pwrdnhour.twentyfourhour.hrten * 10) + timestampPowerDown.pwrdnhour.twentyfourhour.hrone)
-            : (((timestampPowerDown.pwrdnhour.twelvehour.hrten * 10) + timestampPowerDown.pwrdnhour.twelvehour.hrone) + (timestampPowerDown.pwrdnhour.twelvehour.ampm == 1 ? 12 : 0))),
-        ((timestampPowerDown.pwrdnminute.minten * 10) + timestampPowerDown.pwrdnminute.minone));
+    CodecDecodeTimestamp ((void *) &timestampPowerDown, &tmTimestamp);
+    (void) fprintf (fpOutput, "%s %s %d %02d:%02d UTC\n", szDisplayWeekday [tmTimestamp.tm_wday], szDisplayMonth [tmTimestamp.tm_mon],
+        tmTimestamp.tm_mday, tmTimestamp.tm_hour, tmTimestamp.tm_min);
         
     return 0;
 }
 
-/* int DisplayPowerRestoreTime (int busfd, int nBusDevId)
+/* int DisplayPowerRestoreTime (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** Retrieve the power restore time from the Real Time Clock, and display it
 */
 
-int DisplayPowerRestoreTime (int busfd, int nBusDevId)
+int DisplayPowerRestoreTime (int busfd, int nBusDevId, FILE *fpOutput)
 {
     struct mcp7940n_rtcwkday        rtcwkdayPowerFailStatus;
     struct mcp7940n_pwrup_timestamp timestampPowerUp;
+    struct tm                       tmTimestamp;
  
     // Before we attempt to retrieve the power up timestamp, check to see if the PWRFAIL flag is
     // set or cleared. If it has been cleared we assume that there is no power down time to read
     
     bzero (&rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday));
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
+    if (SnapshotRead (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayPowerFailStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
         // An error occurred, and we could not read the PWRFAIL flag
         
         (void) perror ("Unable to read PWRFAIL flag, assuming no power up data/time information available.\n");
@@ -835,14 +1437,14 @@ int DisplayPowerRestoreTime (int busfd, int nBusDevId)
         // This is not an error, per se. The PWRFAIL flag is cleared, so we assume that there is no power fail
         // data available for us to read
         
-        (void) printf ("No power up date/time information available (PWRFAIL bit is cleared).\n");
+        (void) fprintf (fpOutput, "No power up date/time information available (PWRFAIL bit is cleared).\n");
         return 0;
     }
     
     // Read the power up date and time from the RTC
     
     bzero (&timestampPowerUp, sizeof (struct mcp7940n_pwrup_timestamp));
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCPWRUP_OFFSET, (void *) &timestampPowerUp, sizeof (struct mcp7940n_pwrup_timestamp)) < 0) {
+    if (SnapshotRead (busfd, nBusDevId, MCP7940N_RTCPWRUP_OFFSET, (void *) &timestampPowerUp, sizeof (struct mcp7940n_pwrup_timestamp)) < 0) {
         // An error occurred
         
         (void) perror ("Unable to read power down date/time from real time clock.\n");
@@ -851,38 +1453,141 @@ int DisplayPowerRestoreTime (int busfd, int nBusDevId)
     
     // Display the date and time we just read in
     
-    (void) printf ("%s %s %d %02d:%02d UTC\n",
-        szDisplayWeekday [(timestampPowerUp.pwrupmth.wkday -1)],
-        szDisplayMonth [((timestampPowerUp.pwrupmth.mthten *10) + timestampPowerUp.pwrupmth.mthone -1)],
-        ((timestampPowerUp.pwrupdate.dateten *10) + timestampPowerUp.pwrupdate.dateone),
-        ((timestampPowerUp.pwruphour.twentyfourhour.twelvetwentyfour == 0)
-            ? ((timestampPowerUp.pwruphour.twentyfourhour.hrten * 10) + timestampPowerUp.pwruphour.twentyfourhour.hrone)
-            : (((timestampPowerUp.pwruphour.twelvehour.hrten * 10) + timestampPowerUp.pwruphour.twelvehour.hrone) + (timestampPowerUp.pwruphour.twelvehour.ampm == 1 ? 12 : 0))),
-        ((timestampPowerUp.pwrupminute.minten * 10) + timestampPowerUp.pwrupminute.minone));
+    CodecDecodeTimestamp ((void *) &timestampPowerUp, &tmTimestamp);
+    (void) fprintf (fpOutput, "%s %s %d %02d:%02d UTC\n", szDisplayWeekday [tmTimestamp.tm_wday], szDisplayMonth [tmTimestamp.tm_mon],
+        tmTimestamp.tm_mday, tmTimestamp.tm_hour, tmTimestamp.tm_min);
+        
+    return 0;
+}
+
+/* int ParseDateTimeArgument (char *szDateTime, struct tm *ptmDateTime)
+**
+** Parse a date/time given on the command line as [[[[[cc]yy]mm]dd]HH]MM[.ss] into ptmDateTime, which holds the
+** current date/time to start with so that the fields the user leaves out keep their values. Returns -1 if the
+** date/time is not in that format
+*/
+
+int ParseDateTimeArgument (char *szDateTime, struct tm *ptmDateTime)
+{
+    int                         nDateTimeLength;
+    char                        *pszDateTimeDigit;          
+    
+    // Get the length of the date/time specified on the command line
+    
+    nDateTimeLength = strlen (szDateTime);
+    if (nDateTimeLength %2 == 1) {
+        // The string supplied on the command line is an odd length, so we assume it ends in
+        // the characters ".SS", where SS is the seconds in the date/timer we have to write
+        // to the RTC. We validate that assumption, though
+        
+        if ((szDateTime [(nDateTimeLength -3)] != '.') || (! isdigit (szDateTime [(nDateTimeLength -2)])) || (! isdigit (szDateTime [(nDateTimeLength -1)]))) {
+            // The date/time specified on the command line is not in the format we expected
+            
+            goto dateformaterror;   // Ugly hack
+        }
+        
+        // Strip off the seconds
+        
+        ptmDateTime ->tm_sec = (digittoint (szDateTime [(nDateTimeLength -2)]) * 10) + digittoint (szDateTime [(nDateTimeLength -1)]);            
+        if (ptmDateTime ->tm_sec > 59)
+            goto dateformaterror;
+        nDateTimeLength -= 3;       // Strip off the seconds from the length, for our next calculation
+    }
+    
+    // We can figure out what we got based on the length of the date and time (minus seconds if processed)
+    
+    pszDateTimeDigit = szDateTime;
+    switch (nDateTimeLength) {
+    case 12:        // Century, Months, Days, Hours and Minutes
+        // Do nothing and fall through as the RTC does not understand century
+        
+        if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
+            goto dateformaterror;
+            
+        pszDateTimeDigit += 2;          // Remove the century from the calculation and fall through
+        
+    case 10:        // Years, Months, Days, Hours and Minutes
+        // Extract the years from the date specified
+                   
+        if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
+            goto dateformaterror;
+            
+        ptmDateTime ->tm_year = (digittoint (pszDateTimeDigit [0]) * 10) + digittoint (pszDateTimeDigit [1]) + 100; // We assume a base of 2000
+        pszDateTimeDigit += 2;          // Remove the years from the calcultaion and fall through
+        
+    case 8:         // Months, Days, Hours and Minutes
+         // Extract the months from the date specified
+                   
+        if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
+            goto dateformaterror;
+            
+        ptmDateTime ->tm_mon = ((digittoint (pszDateTimeDigit [0]) * 10) + digittoint (pszDateTimeDigit [1]) -1);
+        if (ptmDateTime ->tm_mon > 12)
+            goto dateformaterror;
+        pszDateTimeDigit += 2;          // Remove the months from the calculation and fall through
+        
+    case 6:         // Days, Hours and Minutes
+        // Extract the days from the date specified
+                   
+        if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
+            goto dateformaterror;
+            
+        ptmDateTime ->tm_mday = (digittoint (pszDateTimeDigit [0]) * 10) + digittoint (pszDateTimeDigit [1]);
+        if (ptmDateTime ->tm_mday > 31)
+            goto dateformaterror;
+        pszDateTimeDigit += 2;          // Remove the months from the calculation and fall through
+        
+    case 4:         // Hours and Minutes
+        // Extract the hours from the date specified
+                   
+        if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
+            goto dateformaterror;
+            
+        ptmDateTime ->tm_hour = (digittoint (pszDateTimeDigit [0]) * 10) + digittoint (pszDateTimeDigit [1]);
+        if (ptmDateTime ->tm_hour > 23)
+            goto dateformaterror;
+        pszDateTimeDigit += 2;          // Remove the hours from the calculation and fall through
+        
+    case 2:         // Minutes only
+         // Extract the minutes from the date specified
+                   
+        if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
+            goto dateformaterror;
+            
+        ptmDateTime ->tm_min = (digittoint (pszDateTimeDigit [0]) * 10) + digittoint (pszDateTimeDigit [1]);
+        if (ptmDateTime ->tm_min > 59)
+            goto dateformaterror;
+        break;
         
+    default:
+        // We got something else
+ 
+ dateformaterror:   // Ugly hack...
+        
+        return -1;
+        break;
+    }
+    
     return 0;
 }
 
-/* int HWSetTimeOfDay (int busfd, int nBusDevId, char *szDateTime, bool bUseComputerClockToSetRTC)
+/* int HWSetTimeOfDay (int busfd, int nBusDevId, char *szDateTime, bool bUseComputerClockToSetRTC, FILE *fpOutput)
 **
 ** Set the Real Time Clock with the datetime value passed to us
 */
 
-int HWSetTimeOfDay (int busfd, int nBusDevId, char *szDateTime, bool bUseComputerClockToSetRTC)
+int HWSetTimeOfDay (int busfd, int nBusDevId, char *szDateTime, bool bUseComputerClockToSetRTC, FILE *fpOutput)
 {
     struct mcp7940n_datetime    datetimeRTCClock;
-    struct timeval              tComputerDateTime;
-    struct timezone             tzComputerTimezone;
-    struct tm                   tmRTCDateTime, *ptmComputerDateTime;
+    struct mcp7940n_rtcsec      rtcsecStopped;
+    struct tm                   tmRTCDateTime;
     time_t                      timeComputerDateTime;
-    struct mcp7940n_rtcwkday    rtcwkdayOscillatorStatus;
-    int                         nRetryCount, nDateTimeLength;
-    char                        *pszDateTimeDigit;          
+    int64_t                     nsTargetDateTime, nsTargetMonotonic, nsStopped;
     
     // Get the current date/time from the RTC. It might not be valid, but we need the various
     // flags and other settings mixed amongst the date registers
     
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, (void *) &datetimeRTCClock, sizeof (struct mcp7940n_datetime)) < 0) {
+    if (SnapshotRead (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, (void *) &datetimeRTCClock, sizeof (struct mcp7940n_datetime)) < 0) {
         // An error occurred, and we could not read the current date/time
         
         (void) perror ("Unable to read current date/time from real time clock");
@@ -892,23 +1597,11 @@ int HWSetTimeOfDay (int busfd, int nBusDevId, char *szDateTime, bool bUseCompute
     // Check to see if we are to parse the command line, or if we are to use the computer clock
     
     if (bUseComputerClockToSetRTC) {
-        // Get the current date/time from the computer
+        // Get the current date/time from the computer, and remember when we took it. We work out what to write
+        // to the RTC at the last moment
         
-        if (gettimeofday (&tComputerDateTime, &tzComputerTimezone) < 0) {
-            // An error occurred, and all we can do is display an error message and return
-            
-            (void) perror ("gettimeofday");
-            return -1;
-        }
-        
-        // Convert the date/time from seconds into a broken out structure we can use
-        
-        if ((ptmComputerDateTime = gmtime (&tComputerDateTime.tv_sec)) == (struct tm *) 0) {
-            // An error occurred, so display an error message and return
-            
-            (void) perror ("gmtime");
-            return -1;
-        }        
+        nsTargetDateTime = TimingNow (CLOCK_REALTIME);
+        nsTargetMonotonic = TimingNow (CLOCK_MONOTONIC);
     }
     else {
         // Copy over the date and time read in from the RTC to a tm structure. It will be easier for us to
@@ -920,195 +1613,412 @@ int HWSetTimeOfDay (int busfd, int nBusDevId, char *szDateTime, bool bUseCompute
         // The RTC stores date/time as UTC, but the user will enter the date and time as local time (we
         // assume). Convert the time to local time. 
         
-        timeComputerDateTime = timegm (&tmRTCDateTime);
-        if ((ptmComputerDateTime = localtime (&timeComputerDateTime)) == (struct tm *) 0) {
+        timeComputerDateTime = CivilToEpoch (&tmRTCDateTime);
+        if (localtime_r (&timeComputerDateTime, &tmRTCDateTime) == (struct tm *) 0) {
             // An error occurred, so display an error message and return
             
-            (void) perror ("localtime");
+            (void) perror ("localtime_r");
             return -1;
         }
-        bcopy (ptmComputerDateTime, &tmRTCDateTime, sizeof (struct tm));
         
-        // Get the length of the date/time specified on the command line
+        // Fill in whatever the user gave us on the command line
         
-        nDateTimeLength = strlen (szDateTime);
-        if (nDateTimeLength %2 == 1) {
-            // The string supplied on the command line is an odd length, so we assume it ends in
-            // the characters ".SS", where SS is the seconds in the date/timer we have to write
-            // to the RTC. We validate that assumption, though
-            
-            if ((szDateTime [(nDateTimeLength -3)] != '.') || (! isdigit (szDateTime [(nDateTimeLength -2)])) || (! isdigit (szDateTime [(nDateTimeLength -1)]))) {
-                // The date/time specified on the command line is not in the format we expected
-                
-                goto dateformaterror;   // Ugly hack
-            }
-            
-            // Strip off the seconds
-            
-            tmRTCDateTime.tm_sec = (digittoint (szDateTime [(nDateTimeLength -2)]) * 10) + digittoint (szDateTime [(nDateTimeLength -1)]);            
-            if (tmRTCDateTime.tm_sec > 59)
-                goto dateformaterror;
-            nDateTimeLength -= 3;       // Strip off the seconds from the length, for our next calculation
-        }
+        if (ParseDateTimeArgument (szDateTime, &tmRTCDateTime) < 0)
+            goto dateformaterror;
         
-        // We can figure out what we got based on the length of the date and time (minus seconds if processed)
+        // Convert the local date and time to seconds. The conversion back to UTC, which populates the tm_wday
+        // value, happens when we write it
         
-        pszDateTimeDigit = szDateTime;
-        switch (nDateTimeLength) {
-        case 12:        // Century, Months, Days, Hours and Minutes
-            // Do nothing and fall through as the RTC does not understand century
-            
-            if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
-                goto dateformaterror;
-                
-            pszDateTimeDigit += 2;          // Remove the century from the calculation and fall through
-            
-        case 10:        // Years, Months, Days, Hours and Minutes
-            // Extract the years from the date specified
-                       
-            if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
-                goto dateformaterror;
-                
-            tmRTCDateTime.tm_year = (digittoint (pszDateTimeDigit [0]) * 10) + digittoint (pszDateTimeDigit [1]) + 100; // We assume a base of 2000
-            pszDateTimeDigit += 2;          // Remove the years from the calcultaion and fall through
-            
-        case 8:         // Months, Days, Hours and Minutes
-             // Extract the months from the date specified
-                       
-            if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
-                goto dateformaterror;
-                
-            tmRTCDateTime.tm_mon = ((digittoint (pszDateTimeDigit [0]) * 10) + digittoint (pszDateTimeDigit [1]) -1);
-            if (tmRTCDateTime.tm_mon > 12)
-                goto dateformaterror;
-            pszDateTimeDigit += 2;          // Remove the months from the calculation and fall through
-            
-        case 6:         // Days, Hours and Minutes
-            // Extract the days from the date specified
-                       
-            if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
-                goto dateformaterror;
-                
-            tmRTCDateTime.tm_mday = (digittoint (pszDateTimeDigit [0]) * 10) + digittoint (pszDateTimeDigit [1]);
-            if (tmRTCDateTime.tm_mday > 31)
-                goto dateformaterror;
-            pszDateTimeDigit += 2;          // Remove the months from the calculation and fall through
-            
-        case 4:         // Hours and Minutes
-            // Extract the hours from the date specified
-                       
-            if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
-                goto dateformaterror;
-                
-            tmRTCDateTime.tm_hour = (digittoint (pszDateTimeDigit [0]) * 10) + digittoint (pszDateTimeDigit [1]);
-            if (tmRTCDateTime.tm_hour > 23)
-                goto dateformaterror;
-            pszDateTimeDigit += 2;          // Remove the hours from the calculation and fall through
-            
-        case 2:         // Minutes only
-             // Extract the minutes from the date specified
-                       
-            if (! isdigit (pszDateTimeDigit [0]) || (! isdigit (pszDateTimeDigit [1])))
-                goto dateformaterror;
-                
-            tmRTCDateTime.tm_min = (digittoint (pszDateTimeDigit [0]) * 10) + digittoint (pszDateTimeDigit [1]);
-            if (tmRTCDateTime.tm_min > 59)
-                goto dateformaterror;
-            break;
-            
-        default:
-            // We got something else
- 
- dateformaterror:   // Ugly hack...
-            
+        tmRTCDateTime.tm_isdst = -1;
+        if ((timeComputerDateTime = mktime (&tmRTCDateTime)) == (time_t) -1) {         // Catchall for bad date
+ dateformaterror:
             (void) fprintf (stderr, "Illegal date format, must be [[[[[cc]yy]mm]dd]HH]MM[.ss]\n");
             return -1;
-            break;
         }
         
-        // Convert the tm to time_t, and then back to a tm. This populates the tm_wday value
+        nsTargetDateTime = (int64_t) timeComputerDateTime * NSEC_PER_SEC;
+        nsTargetMonotonic = TimingNow (CLOCK_MONOTONIC);
+    }
+    
+    // Stop the oscillator, so that the date/time cannot roll over while we write it
+    
+    if (HWStopOscillator (busfd, nBusDevId, &datetimeRTCClock, &nsStopped) < 0) {
+        // The error has already been displayed. The ST bit may have been cleared, so set it again
         
-        if ((timeComputerDateTime = mktime (&tmRTCDateTime)) == 0)                      // Catchall for bad date
-            goto dateformaterror;
-        if ((ptmComputerDateTime = gmtime (&timeComputerDateTime)) == (struct tm *) 0)  // Assume bad date
-            goto dateformaterror;
+        (void) HWRestartOscillator (busfd, nBusDevId, &datetimeRTCClock.rtcseconds);
+        return -1;
     }
+    rtcsecStopped = datetimeRTCClock.rtcseconds;
+    
+    // Work out the date/time to write now, rather than when we were asked, so that the time it took us to get
+    // here (including stopping the oscillator) is not lost. We round to the nearest second
+    
+    nsTargetDateTime += TimingNow (CLOCK_MONOTONIC) - nsTargetMonotonic;
+    timeComputerDateTime = (time_t) ((nsTargetDateTime + (NSEC_PER_SEC / 2)) / NSEC_PER_SEC);
     
     // Copy data into the RTC clock structure. We do not zero it out first, as we do not want to
-    // overwrite the flags, etc. we read in earlier
-
-    TranslateTmToRTCDateTime (ptmComputerDateTime, &datetimeRTCClock);      
+    // overwrite the flags, etc. we read in earlier. The ST bit is set, so the oscillator restarts as
+    // soon as the seconds byte arrives - the date/time and the restart are a single write
+    
+    CodecStore (CivilEpochToRegisters (timeComputerDateTime, CodecLoad ((void *) &datetimeRTCClock)), (void *) &datetimeRTCClock);
+    datetimeRTCClock.rtcseconds.st = 1;
+    
+    if (SnapshotWrite (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, &datetimeRTCClock, sizeof (struct mcp7940n_datetime))) {
+        // An error occurred writing out the date/time to the RTC
+        
+        (void) perror ("Unable to write out date and time to RTC");
+        (void) HWRestartOscillator (busfd, nBusDevId, &rtcsecStopped);
+        return -1; 
+    }
+    nsStopped = TimingNow (CLOCK_MONOTONIC) - nsStopped;
+    
+    // Wait for the OSCRUN bit to be set, to make sure that the RTC has detected the oscillator input
+    
+    if (HWWaitForOscillator (busfd, nBusDevId, true, (struct mcp7940n_rtcwkday *) 0) < 0) {
+        // The OSCRUN bit is still clear (or we could not read it), and the error has been displayed
+        
+        return -1;
+    }
+    
+    if (bVerbose)
+        (void) fprintf (fpOutput, "Oscillator was stopped for %.3f ms.\n", ((double) nsStopped / NSEC_PER_MSEC));
+    
+    // Keep the drift estimator up to date. The RTC started counting from timeComputerDateTime at (about) the
+    // system time we worked out above
+    
+    HWDriftRecordSet (busfd, nBusDevId, bUseComputerClockToSetRTC, nsTargetDateTime, (((int64_t) timeComputerDateTime * NSEC_PER_SEC) - nsTargetDateTime));
+    
+    // We are done! Just return
   
-    // Clear the ST bit on the RTC ahead of the write to the device
+    return 0;
+}
+
+/* int HWSetTimeOfDayPrecise (int busfd, int nBusDevId)
+**
+** Set the Real Time Clock from the computer clock, so that the RTC starts counting at the moment the computer
+** clock reaches the start of a second. We prepare the date/time for the next second, sleep until just before
+** the boundary, and only then stop the oscillator - so it is stopped for milliseconds, not for the sleep - and
+** write all seven date/time bytes with the ST bit set, so the oscillator restarts as the seconds byte is
+** written. The residual error of the write is displayed
+*/
+
+int HWSetTimeOfDayPrecise (int busfd, int nBusDevId)
+{
+    struct mcp7940n_datetime    datetimeRTCClock;
+    struct mcp7940n_rtcsec      rtcsecStopped;
+    time_t                      timeTarget;
+    int64_t                     nsBefore, nsAfter, nsLead, nsStopLead, nsNow, nsResidual, nsStopped, nsSleep;
     
-    datetimeRTCClock.rtcseconds.st = 0;
-    if (WriteI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &datetimeRTCClock.rtcseconds, sizeof (struct mcp7940n_rtcsec)) < 0) {
-        // An error occurred, and we could not clear the ST bit
+    // Get the current date/time from the RTC, for the flags mixed amongst the date registers
+    
+    if (SnapshotRead (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, (void *) &datetimeRTCClock, sizeof (struct mcp7940n_datetime)) < 0) {
+        // An error occurred, and we could not read the current date/time
         
-        (void) perror ("Unable to tell RTC that we were about to write out date and time");
+        (void) perror ("Unable to read current date/time from real time clock");
+        return -1;
+    }
+    
+    // Time a one byte read of the seconds register. It puts the same address and register bytes on the bus as
+    // the final write does before its seconds byte, so it tells us how far into that write the RTC restarts,
+    // without writing anything to the timekeeping registers
+    
+    nsBefore = TimingNow (CLOCK_MONOTONIC);
+    if (SnapshotRefresh (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &datetimeRTCClock.rtcseconds, sizeof (struct mcp7940n_rtcsec)) < 0) {
+        (void) perror ("Unable to read from real time clock");
+        return -1;
+    }
+    nsLead = TimingNow (CLOCK_MONOTONIC) - nsBefore;
+    
+    // Stopping the oscillator is a write and a read, and then as long as OSCRUN takes to clear. Allow for all of
+    // it ahead of the write, and pick the second we are going to start the RTC at. If the next boundary is too
+    // close for us to be ready in time, use the one after it
+    
+    nsStopLead = (2 * nsLead) + ((int64_t) OSCILLATOR_WAIT_BUDGET_USECS * NSEC_PER_USEC);
+    nsNow = TimingNow (CLOCK_REALTIME);
+    timeTarget = (time_t) (nsNow / NSEC_PER_SEC) +1;
+    if ((((int64_t) timeTarget * NSEC_PER_SEC) - nsNow) < (nsLead + nsStopLead + PRECISE_SET_MIN_NOTICE_NSECS))
+        timeTarget ++;
+    
+    // Sleep until it is time to stop the oscillator. Nothing has been written yet, so if we are interrupted
+    // the RTC is as it was
+    
+    nsSleep = I2CTraceClock ();
+    if (TimingSleepUntil (CLOCK_REALTIME, (((int64_t) timeTarget * NSEC_PER_SEC) - (nsLead + nsStopLead)), PRECISE_SET_SPIN_NSECS) < 0) {
+        (void) perror ("clock_nanosleep");
         return -1;
     }
+    I2CTraceSlept (nsSleep);
     
-    // Sleep for 1000 microseconds, to make sure that the RTC is settled and ready for us to write. We check
-    // the oscillator status bit to make sure that it is ready for us to write to. We do this up to five times
-    // just "in case"
+    // Now stop the oscillator and wait for it to stop. From here on, any error has to start it again
     
-    for (nRetryCount = 0, rtcwkdayOscillatorStatus.oscrun = 1; ((nRetryCount < 5) && (rtcwkdayOscillatorStatus.oscrun == 1)); nRetryCount ++) {
-        // Sleep for 1000 microseconds. We do this because the OSCRUN bit on the RTC should be cleared
-        // after at most 32 cycles. As the RTC oscillator runs at 32,768Hz that equates to just shy of 1000
-        // microseconds
+    if (HWStopOscillator (busfd, nBusDevId, &datetimeRTCClock, &nsStopped) < 0) {
+        // The error has already been displayed. The ST bit may have been cleared, so set it again
         
-        (void) usleep (1000);
+        (void) HWRestartOscillator (busfd, nBusDevId, &datetimeRTCClock.rtcseconds);
+        return -1;
+    }
+    rtcsecStopped = datetimeRTCClock.rtcseconds;
+    
+    CodecStore (CivilEpochToRegisters (timeTarget, CodecLoad ((void *) &datetimeRTCClock)), (void *) &datetimeRTCClock);
+    datetimeRTCClock.rtcseconds.st = 1;
+    
+    // Wait out what is left of the stop's allowance, so the seconds byte arrives at the RTC on the boundary,
+    // then write. If stopping took longer than we allowed we are already late, and the residual says by how much
+    
+    nsSleep = I2CTraceClock ();
+    if (TimingSleepUntil (CLOCK_REALTIME, (((int64_t) timeTarget * NSEC_PER_SEC) - nsLead), PRECISE_SET_SPIN_NSECS) < 0) {
+        (void) perror ("clock_nanosleep");
+        (void) HWRestartOscillator (busfd, nBusDevId, &rtcsecStopped);
+        return -1;
+    }
+    I2CTraceSlept (nsSleep);
+    
+    nsBefore = TimingNow (CLOCK_REALTIME);
+    if (SnapshotWrite (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, (void *) &datetimeRTCClock, sizeof (struct mcp7940n_datetime)) < 0) {
+        // An error occurred writing out the date/time to the RTC
         
-        // Get the OSRUN status bit from the oscillator
+        (void) perror ("Unable to write out date and time to RTC");
+        (void) HWRestartOscillator (busfd, nBusDevId, &rtcsecStopped);
+        return -1;
+    }
+    nsAfter = TimingNow (CLOCK_REALTIME);
+    nsStopped = TimingNow (CLOCK_MONOTONIC) - nsStopped;
+    
+    // Wait for the oscillator to come back up
+    
+    if (HWWaitForOscillator (busfd, nBusDevId, true, (struct mcp7940n_rtcwkday *) 0) < 0) {
+        // The error has already been displayed
         
-        if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, &rtcwkdayOscillatorStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
-            // An error occurred getting the OSRUN status bit
+        return -1;
+    }
+    
+    // The seconds byte reached the RTC roughly nsLead into the write. That is our best estimate of when the
+    // RTC started, and the difference from the boundary is the error we achieved
+    
+    nsResidual = (nsBefore + nsLead) - ((int64_t) timeTarget * NSEC_PER_SEC);
+    (void) printf ("RTC started at %ld, residual error %+.6f s (write took %.6f s, oscillator stopped for %.3f s).\n",
+        (long) timeTarget, ((double) nsResidual / NSEC_PER_SEC), ((double) (nsAfter - nsBefore) / NSEC_PER_SEC), ((double) nsStopped / NSEC_PER_SEC));
+    
+    HWDriftRecordSet (busfd, nBusDevId, true, (nsBefore + nsLead), -nsResidual);
+    
+    return 0;
+}
+
+/* int HWDriftUpdate (int busfd, int nBusDevId, struct rtc_edge_reading *pEdgeReading)
+**
+** Called before the RTC is set from the computer clock. If it was last set from the computer clock, read it
+** on the edge of a second to see how far it has drifted since and record that (unless the caller has already
+** read it, and passes the reading in pEdgeReading). Then, if we have enough samples for an estimate, program
+** the trim it calls for so it is in effect from the moment the RTC is set
+*/
+
+int HWDriftUpdate (int busfd, int nBusDevId, struct rtc_edge_reading *pEdgeReading)
+{
+    struct rtc_edge_reading     edgereadingRTCClock;
+    struct drift_estimate       estimateDrift;
+    struct mcp7940n_osctrim     osctrimTrimValue;
+    struct mcp7940n_control     controlControlRegisters;
+    int64_t                     nsOffset;
+    
+    if (DriftLoad (DRIFT_STATE_PATH) < 0)
+        return -1;
+    
+    if (DriftIsAnchored ()) {
+        if ((pEdgeReading == (struct rtc_edge_reading *) 0) && (EdgeReadRTC (busfd, nBusDevId, EDGE_DEFAULT_TIMEOUT_MSECS, &edgereadingRTCClock) == 0))
+            pEdgeReading = &edgereadingRTCClock;
+        
+        if (pEdgeReading == (struct rtc_edge_reading *) 0) {
+            (void) fprintf (stderr, "Unable to read the RTC on a second edge, so its drift has not been measured.\n");
+            DriftRecordBreak ();
+        }
+        else {
+            nsOffset = DisciplineOffset (pEdgeReading);
+            if (bVerbose)
+                (void) printf ("RTC was %+.3f ms from the computer clock.\n", ((double) nsOffset / NSEC_PER_MSEC));
             
-            (void) perror ("Unable to read OSCRUN status bit from RTC");
-            return -1;
+            (void) DriftRecordOffset (pEdgeReading ->m_nsEdgeRealtime, nsOffset);
         }
     }
     
-    // Check to see if the OSCRUN bit is still set. If it is we are in an error conditions
+    if (DriftEstimate (&estimateDrift) < 0)
+        return 0;
+    
+    // We have an estimate. Only write the trim (and fine trim mode) if something needs to change
     
-    if (rtcwkdayOscillatorStatus.oscrun == 1) {
-        // The OSCRUN bit is still set - display an error message and return
-        
-        (void) fprintf (stderr, "OSCRUN status bit is still set on the RTC, so date/time cannot be updated.\n");
+    if ((SnapshotRead (busfd, nBusDevId, MCP7940N_CONTROL_OFFSET, (void *) &controlControlRegisters, sizeof (struct mcp7940n_control)) < 0) ||
+        (SnapshotRead (busfd, nBusDevId, MCP7940N_OSCTRIM_OFFSET, (void *) &osctrimTrimValue, sizeof (struct mcp7940n_osctrim)) < 0)) {
+        (void) perror ("Unable to read trim value from RTC");
         return -1;
     }
     
-    if (WriteI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, &datetimeRTCClock, sizeof (struct mcp7940n_datetime))) {
-        // An error occurred writing out the date/time to the RTC
+    if ((DriftTrimToSteps (&osctrimTrimValue) == estimateDrift.m_nTrimSteps) && (controlControlRegisters.crstrim == 0))
+        return 0;
+    
+    (void) printf ("Changing trim from %+d to %+d steps for a drift of %+.3f ppm, expected residual drift %+.3f ppm.\n",
+        DriftTrimToSteps (&osctrimTrimValue), estimateDrift.m_nTrimSteps, estimateDrift.m_dDriftPPM, estimateDrift.m_dResidualPPM);
+    
+    PlanReset ();
+    controlControlRegisters.crstrim = 0;
+    DriftStepsToTrim (estimateDrift.m_nTrimSteps, &osctrimTrimValue);
+    if ((PlanStage (busfd, nBusDevId, MCP7940N_CONTROL_OFFSET, (void *) &controlControlRegisters, sizeof (struct mcp7940n_control)) < 0) ||
+        (PlanStage (busfd, nBusDevId, MCP7940N_OSCTRIM_OFFSET, (void *) &osctrimTrimValue, sizeof (struct mcp7940n_osctrim)) < 0) ||
+        (PlanFlush (busfd, nBusDevId, stdout) < 0)) {
+        (void) perror ("Unable to write trim value to RTC");
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* int HWSetTimeOfDayIfDrifted (int busfd, int nBusDevId, int nToleranceMsecs, bool bAlignToSecond)
+**
+** Set the RTC from the computer clock (on a second boundary, if bAlignToSecond), but only if it has drifted more
+** than nToleranceMsecs from it. The RTC is read on the edge of a second for the offset, which we display, and
+** which is a drift sample either way. If the RTC is left alone the measurement takes the place of setting it
+** - it is where the next drift sample is measured from, with the trim now in effect - so the RTC is neither
+** stopped nor written. If we cannot read it on an edge we cannot tell how far it has drifted, so we set it
+*/
+
+int HWSetTimeOfDayIfDrifted (int busfd, int nBusDevId, int nToleranceMsecs, bool bAlignToSecond)
+{
+    struct rtc_edge_reading     edgereadingRTCClock;
+    int64_t                     nsOffset;
+    
+    if (EdgeReadRTC (busfd, nBusDevId, EDGE_DEFAULT_TIMEOUT_MSECS, &edgereadingRTCClock) < 0) {
+        if (errno != ETIMEDOUT) {
+            (void) perror ("Unable to read current date/time from real time clock");
+            return -1;
+        }
         
-        (void) perror ("Unable to write out date and time to RTC");
-        return -1; 
+        (void) fprintf (stderr, "Unable to read the RTC on a second edge, so it is being set regardless of the tolerance.\n");
+        (void) HWDriftUpdate (busfd, nBusDevId, (struct rtc_edge_reading *) 0);
+    }
+    else {
+        nsOffset = DisciplineOffset (&edgereadingRTCClock);
+        (void) printf ("RTC is %+.3f ms (+/- %.3f ms) from the computer clock, %s the %d ms tolerance",
+                       ((double) nsOffset / NSEC_PER_MSEC), ((double) edgereadingRTCClock.m_nsUncertainty / NSEC_PER_MSEC),
+                       ((llabs (nsOffset) <= ((int64_t) nToleranceMsecs * NSEC_PER_MSEC)) ? "within" : "outside"), nToleranceMsecs);
+        
+        (void) HWDriftUpdate (busfd, nBusDevId, &edgereadingRTCClock);
+        if (llabs (nsOffset) <= ((int64_t) nToleranceMsecs * NSEC_PER_MSEC)) {
+            (void) printf (", so it has been left alone.\n");
+            HWDriftRecordSet (busfd, nBusDevId, true, edgereadingRTCClock.m_nsEdgeRealtime, nsOffset);
+            return 0;
+        }
+        
+        (void) printf (", so it is being set.\n");
     }
     
-    // Now that we have written out the date and time to the RTC we need to turn the ST bit back on
+    I2CTracePhase ("set");
+    if (bAlignToSecond)
+        return HWSetTimeOfDayPrecise (busfd, nBusDevId);
     
-    datetimeRTCClock.rtcseconds.st = 1;
-    if (WriteI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &datetimeRTCClock.rtcseconds, sizeof (struct mcp7940n_rtcsec)) < 0) {
+    return HWSetTimeOfDay (busfd, nBusDevId, (char *) 0, true, stdout);
+}
+
+/* void HWDriftRecordSet (int busfd, int nBusDevId, bool bSetFromComputerClock, int64_t nsSystemTime, int64_t nsOffset)
+**
+** Called once the RTC has been set. If it was set from the computer clock, record when and how far out it was
+** left along with the trim now in effect. If not, we can no longer compare it with the computer clock
+*/
+
+void HWDriftRecordSet (int busfd, int nBusDevId, bool bSetFromComputerClock, int64_t nsSystemTime, int64_t nsOffset)
+{
+    struct mcp7940n_osctrim osctrimTrimValue;
+    
+    if (DriftLoad (DRIFT_STATE_PATH) < 0)
+        return;
+    
+    if (bSetFromComputerClock && (SnapshotRead (busfd, nBusDevId, MCP7940N_OSCTRIM_OFFSET, (void *) &osctrimTrimValue, sizeof (struct mcp7940n_osctrim)) == 0))
+        DriftRecordSet (nsSystemTime, nsOffset, DriftTrimToSteps (&osctrimTrimValue));
+    else
+        DriftRecordBreak ();
+    
+    (void) DriftSave (DRIFT_STATE_PATH);
+}
+
+/* int HWStopOscillator (int busfd, int nBusDevId, struct mcp7940n_datetime *pdatetimeRTCClock, int64_t *pnsStopped)
+**
+** Clear the ST bit and wait for the oscillator to stop. The write and the first check of the OSCRUN bit are
+** made in the same transaction. On return pnsStopped holds the CLOCK_MONOTONIC time the ST bit was cleared at,
+** so that the caller can work out how long the oscillator was stopped for
+*/
+
+int HWStopOscillator (int busfd, int nBusDevId, struct mcp7940n_datetime *pdatetimeRTCClock, int64_t *pnsStopped)
+{
+    struct mcp7940n_rtcwkday    rtcwkdayOscillatorStatus;
+    
+    pdatetimeRTCClock ->rtcseconds.st = 0;
+    *pnsStopped = TimingNow (CLOCK_MONOTONIC);
+    if (WriteThenReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &(pdatetimeRTCClock ->rtcseconds), sizeof (struct mcp7940n_rtcsec),
+                                      MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayOscillatorStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
         // An error occurred, and we could not clear the ST bit
         
-        (void) perror ("Unable to tell RTC to re-enable the oscillator");
+        (void) perror ("Unable to tell RTC that we were about to write out date and time");
+        SnapshotInvalidate ();
         return -1;
     }
- 
-    // Sleep for 1000 microseconds, to make sure that the RTC has detected the oscillator input. We do this up
-    // to five times just "in case"
     
-    for (nRetryCount = 0, rtcwkdayOscillatorStatus.oscrun = 0; ((nRetryCount < 5) && (rtcwkdayOscillatorStatus.oscrun == 0)); nRetryCount ++) {
-        // Sleep for 1000 microseconds. We do this because the OSCRUN bit on the RTC should be set
-        // after at most 32 cycles. As the RTC oscillator runs at 32,768Hz that equates to just shy of 1000
-        // microseconds
-        
-        (void) usleep (1000);
+    SnapshotPatch (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &(pdatetimeRTCClock ->rtcseconds), sizeof (struct mcp7940n_rtcsec));
+    SnapshotPatch (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayOscillatorStatus, sizeof (struct mcp7940n_rtcwkday));
+    
+    // Wait for the OSCRUN bit to clear, so that we know the RTC is settled and ready for us to write
+    
+    return HWWaitForOscillator (busfd, nBusDevId, false, &rtcwkdayOscillatorStatus);
+}
+
+/* int HWRestartOscillator (int busfd, int nBusDevId, struct mcp7940n_rtcsec *prtcsecStopped)
+**
+** Set the ST bit again when setting the RTC has failed after HWStopOscillator, so that it is not left halted.
+** prtcsecStopped is the seconds byte as HWStopOscillator wrote it. The RTC will be out by however long it was
+** stopped, but it is counting, and the caller has already said that setting it failed
+*/
+
+int HWRestartOscillator (int busfd, int nBusDevId, struct mcp7940n_rtcsec *prtcsecStopped)
+{
+    struct mcp7940n_rtcsec rtcsecRestart = *prtcsecStopped;
+    
+    rtcsecRestart.st = 1;
+    if (SnapshotWrite (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &rtcsecRestart, sizeof (struct mcp7940n_rtcsec)) < 0) {
+        (void) perror ("Unable to restart the RTC oscillator, it is halted until it is set again");
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* int HWWaitForOscillator (int busfd, int nBusDevId, bool bRunning, struct mcp7940n_rtcwkday *prtcwkdayAlreadyRead)
+**
+** Wait for the OSCRUN bit to reflect the oscillator state we want (running or stopped). The bit should change
+** after at most 32 cycles, which at 32,768Hz is just shy of 1000 microseconds, but it is usually much quicker
+** than that. Rather than sleeping for the worst case we check straight away (or use the value the caller has
+** just read), and then back off from a couple of cycles up to a millisecond between checks, giving up after
+** OSCILLATOR_WAIT_BUDGET_USECS in all
+*/
+
+int HWWaitForOscillator (int busfd, int nBusDevId, bool bRunning, struct mcp7940n_rtcwkday *prtcwkdayAlreadyRead)
+{
+    struct mcp7940n_rtcwkday    rtcwkdayOscillatorStatus;
+    int                         nSleepUsecs, nSleptUsecs;
+    int64_t                     nsSleep;
+    
+    if (prtcwkdayAlreadyRead != (struct mcp7940n_rtcwkday *) 0)
+        rtcwkdayOscillatorStatus = *prtcwkdayAlreadyRead;
+    else if (SnapshotRefresh (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayOscillatorStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
+        (void) perror ("Unable to read OSCRUN status bit from RTC");
+        return -1;
+    }
+    
+    for (nSleepUsecs = OSCILLATOR_WAIT_FIRST_USECS, nSleptUsecs = 0;
+         (rtcwkdayOscillatorStatus.oscrun != (bRunning ? 1 : 0)) && (nSleptUsecs < OSCILLATOR_WAIT_BUDGET_USECS);
+         nSleptUsecs += nSleepUsecs, nSleepUsecs = (nSleepUsecs * 2 > 1000 ? 1000 : nSleepUsecs * 2)) {
+        nsSleep = I2CTraceClock ();
+        (void) TimingSleepUntil (CLOCK_MONOTONIC, (TimingNow (CLOCK_MONOTONIC) + ((int64_t) nSleepUsecs * NSEC_PER_USEC)), 0);
+        I2CTraceSlept (nsSleep);
         
         // Get the OSRUN status bit from the oscillator
         
-        if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, &rtcwkdayOscillatorStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
+        if (SnapshotRefresh (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayOscillatorStatus, sizeof (struct mcp7940n_rtcwkday)) < 0) {
             // An error occurred getting the OSRUN status bit
             
             (void) perror ("Unable to read OSCRUN status bit from RTC");
@@ -1116,38 +2026,79 @@ int HWSetTimeOfDay (int busfd, int nBusDevId, char *szDateTime, bool bUseCompute
         }
     }
     
-    // Check to see if the OSCRUN bit is still clear. If it is we are in an error conditions
+    // Check to see if the OSCRUN bit is still in the wrong state. If it is we are in an error condition
     
-    if (rtcwkdayOscillatorStatus.oscrun == 0) {
-        // The OSCRUN bit is still set - display an error message and return
-        
-        (void) fprintf (stderr, "OSCRUN status bit is still clear on the RTC, even after enabling oscillator input.\n");
+    if (rtcwkdayOscillatorStatus.oscrun != (bRunning ? 1 : 0)) {
+        (void) fprintf (stderr, (bRunning ? "OSCRUN status bit is still clear on the RTC, even after enabling oscillator input.\n"
+                                          : "OSCRUN status bit is still set on the RTC, so date/time cannot be updated.\n"));
         return -1;
     }
     
-    // We are done! Just return
-  
     return 0;
 }
 
-/* int HWGetTimeOfDay (int busfd, int nBusDevId, bool bDisplayDateTimeAsDateInput, bool bSetComputerClockFromRTC)
+/* int HWGetTimeOfDay (int busfd, char *szBusName, int nBusDevId, bool bDisplayDateTimeAsDateInput, bool bSetComputerClockFromRTC, int nEdgeTimeoutMsecs, int nCacheTtlSecs, FILE *fpOutput)
 **
-** Get the date and tine from the Real Time Clock, and display it in the format the user wants
+** Get the date and tine from the Real Time Clock, and display it in the format the user wants. If nEdgeTimeoutMsecs
+** is not zero we wait (up to that long) for the RTC's seconds to tick over, so that we know the time to the
+** millisecond rather than the second. If we cannot find the edge in time we fall back to a plain read. If
+** nCacheTtlSecs is not zero we answer from an edge read up to that old, extrapolated, if there is one of the RTC on
+** szBusName (busfd is -1 if the caller knows there is), and otherwise read on the edge and keep it for next time
 */
 
-int HWGetTimeOfDay (int busfd, int nBusDevId, bool bDisplayDateTimeAsDateInput, bool bSetComputerClockFromRTC)
+int HWGetTimeOfDay (int busfd, char *szBusName, int nBusDevId, bool bDisplayDateTimeAsDateInput, bool bSetComputerClockFromRTC, int nEdgeTimeoutMsecs, int nCacheTtlSecs, FILE *fpOutput)
 {
     struct mcp7940n_datetime    datetimeRTCClock;
-    struct tm                   tmRTCDateTime;
+    struct rtc_edge_reading     edgereadingRTCClock;
+    struct tm                   tmRTCDateTime, tmDisplayDateTime;
     struct timeval              tvComputerDateTime;
     struct timezone             tzComputerTimezone;
+    struct timespec             tsComputerDateTime;
     time_t                      timeRTCDateTime;
-    char                        *pszRTCDateTime;
+    char                        szRTCDateTime [64 +1];
+    int64_t                     nsRTCDateTime;
+    bool                        bOnEdge = false, bDisplayFraction = (nEdgeTimeoutMsecs > 0);
+    
+    // A reading we took on an earlier edge is as good as one on this edge, allowing for the drift since
+    
+    if ((nCacheTtlSecs > 0) && (CacheLookup (busfd, szBusName, nBusDevId, nCacheTtlSecs, &edgereadingRTCClock) == 0)) {
+        datetimeRTCClock = edgereadingRTCClock.m_datetimeRTCClock;
+        bOnEdge = true;
+    }
+    else if (busfd < 0) {
+        // The cache was good a moment ago, and the caller did not open the bus
+        
+        (void) fprintf (stderr, "The cached RTC reading expired before it could be used.\n");
+        return -1;
+    }
+    
+    // If the user wants the time to better than a second, or to keep it, read it on the edge of a second
+    
+    if ((! bOnEdge) && ((nEdgeTimeoutMsecs > 0) || (nCacheTtlSecs > 0))) {
+        if (nEdgeTimeoutMsecs == 0)
+            nEdgeTimeoutMsecs = EDGE_DEFAULT_TIMEOUT_MSECS;
+        
+        if (EdgeReadRTC (busfd, nBusDevId, nEdgeTimeoutMsecs, &edgereadingRTCClock) == 0) {
+            datetimeRTCClock = edgereadingRTCClock.m_datetimeRTCClock;
+            bOnEdge = true;
+            if (nCacheTtlSecs > 0)
+                CacheStore (szBusName, nBusDevId, &edgereadingRTCClock);
+        }
+        else if (errno == ETIMEDOUT) {
+            // Not an error, per se. The oscillator may be stopped, or the bus slow - carry on with a whole second
+            
+            (void) fprintf (stderr, "Unable to find the RTC second edge within %d ms, using a whole second read.\n", nEdgeTimeoutMsecs);
+        }
+        else {
+            (void) perror ("Unable to read current date/time from real time clock");
+            return -1;
+        }
+    }
     
     // Get the current date/time from the RTC. It might not be valid, but we need the various
     // flags and other settings mixed amongst the date registers
     
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, (void *) &datetimeRTCClock, sizeof (struct mcp7940n_datetime)) < 0) {
+    if ((! bOnEdge) && (SnapshotRead (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, (void *) &datetimeRTCClock, sizeof (struct mcp7940n_datetime)) < 0)) {
         // An error occurred, and we could not read the current date/time
         
         (void) perror ("Unable to read current date/time from real time clock");
@@ -1161,7 +2112,21 @@ int HWGetTimeOfDay (int busfd, int nBusDevId, bool bDisplayDateTimeAsDateInput,
     
     // Check to see of the user wants us to set the computer clock
     
-    if (bSetComputerClockFromRTC) {
+    if (bSetComputerClockFromRTC && bOnEdge) {
+        // The RTC read its current seconds at the edge, so the time now is that plus however long it has been
+        // since. Work it out as late as we can, just before setting the clock
+        
+        timeRTCDateTime = CivilToEpoch (&tmRTCDateTime);
+        nsRTCDateTime = ((int64_t) timeRTCDateTime * NSEC_PER_SEC) + (TimingNow (CLOCK_MONOTONIC) - edgereadingRTCClock.m_nsEdgeMonotonic);
+        TimingToTimespec (nsRTCDateTime, &tsComputerDateTime);
+        if (clock_settime (CLOCK_REALTIME, &tsComputerDateTime) < 0) {
+            // An error occurred, and we are unable to set the computer clock
+            
+            perror ("Call to clock_settime failed, unable to set computer clock");
+            return -1;
+        }
+    }
+    else if (bSetComputerClockFromRTC) {
         // The user wants us to set the clock. Start by getting the current time, as we need the timezone
         
         if (gettimeofday (&tvComputerDateTime, &tzComputerTimezone)) {
@@ -1173,13 +2138,7 @@ int HWGetTimeOfDay (int busfd, int nBusDevId, bool bDisplayDateTimeAsDateInput,
         
         // We convert the RTC date time read into seconds. The RTC uses UTC to record the date and time
         
-        if ((tvComputerDateTime.tv_sec = timegm (&tmRTCDateTime)) == (time_t) 0) {
-            // An error occurred converting the date and time from the RTC into seconds (time_t) so we are
-            // unable to set the RTC
-            
-            perror ("Converting RTC date and time to seconds failed, unable to set clock");
-            return -1;  
-        }
+        tvComputerDateTime.tv_sec = CivilToEpoch (&tmRTCDateTime);
         
         // Set the computer clock
         
@@ -1196,39 +2155,294 @@ int HWGetTimeOfDay (int busfd, int nBusDevId, bool bDisplayDateTimeAsDateInput,
     if (bDisplayDateTimeAsDateInput) {
         // Display as date command line input
         
-        (void) printf ("%d%02d%02d%02d%02d.%02d\n",
+        (void) fprintf (fpOutput, "%d%02d%02d%02d%02d.%02d\n",
             (tmRTCDateTime.tm_year + 1900), (tmRTCDateTime.tm_mon +1), tmRTCDateTime.tm_mday,
             tmRTCDateTime.tm_hour, tmRTCDateTime.tm_min, tmRTCDateTime.tm_sec);
     }
-    else {
-        // Display regular date/time string
+    else if (bOnEdge && bDisplayFraction) {
+        // Display the RTC's time now, to the millisecond, in the same format as ctime(3)
         
-        if ((timeRTCDateTime = timegm (&tmRTCDateTime)) == (time_t) 0) {
+        timeRTCDateTime = CivilToEpoch (&tmRTCDateTime);
+        nsRTCDateTime = ((int64_t) timeRTCDateTime * NSEC_PER_SEC) + (TimingNow (CLOCK_MONOTONIC) - edgereadingRTCClock.m_nsEdgeMonotonic);
+        timeRTCDateTime = (time_t) (nsRTCDateTime / NSEC_PER_SEC);
+        if (localtime_r (&timeRTCDateTime, &tmDisplayDateTime) == (struct tm *) 0) {
             // An error occurred
             
-            perror ("Call to timegm failed");
+            perror ("Call to localtime_r failed");
             return -1;
         }
-                
-        if ((pszRTCDateTime = ctime (&timeRTCDateTime)) == (char *) 0) {
+        
+        (void) strftime (szRTCDateTime, sizeof (szRTCDateTime), "%a %b %e %H:%M:%S", &tmDisplayDateTime);
+        (void) fprintf (fpOutput, "%s.%03d", szRTCDateTime, (int) ((nsRTCDateTime % NSEC_PER_SEC) / NSEC_PER_MSEC));
+        (void) strftime (szRTCDateTime, sizeof (szRTCDateTime), " %Y", &tmDisplayDateTime);
+        (void) fprintf (fpOutput, "%s (+/- %.3f ms)\n", szRTCDateTime, ((double) edgereadingRTCClock.m_nsUncertainty / NSEC_PER_MSEC));
+    }
+    else {
+        // Display regular date/time string, in local time
+        
+        if (CivilFormatLocal (CivilToEpoch (&tmRTCDateTime), szRTCDateTime, sizeof (szRTCDateTime)) < 0) {
             // An error occurred
             
-            perror ("Call to ctime failed");
+            perror ("Call to localtime_r failed");
             return -1;
         }
         
-        printf ("%s", pszRTCDateTime);
+        fprintf (fpOutput, "%s", szRTCDateTime);
     }
    
     return 0;
 }
 
-/* int ReadNVRAM (int busfd, int nBusDevId)
+/* int HWDisciplineComputerClock (int busfd, int nBusDevId, int nStepMsecs, int nLoopSecs, int nEdgeTimeoutMsecs)
+**
+** Bring the computer clock into line with the RTC. The RTC is read on the edge of a second for the offset, which
+** is slewed away with adjtime(2) if it is under nStepMsecs, and stepped otherwise, and we display the offset,
+** what we did and how long a slew will take. If nLoopSecs is not zero we do it again every nLoopSecs seconds,
+** to keep the computer clock locked to the RTC when there is nothing better (NTP) to keep it to. A second edge
+** we cannot find is not an error when looping - we just wait for the next round
+*/
+
+int HWDisciplineComputerClock (int busfd, int nBusDevId, int nStepMsecs, int nLoopSecs, int nEdgeTimeoutMsecs)
+{
+    struct rtc_edge_reading     edgereadingRTCClock;
+    struct discipline_decision  decisionDiscipline;
+    struct timeval              tvDelta;
+    struct timespec             tsComputerDateTime;
+    int64_t                     nsNextRound = TimingNow (CLOCK_MONOTONIC);
+    bool                        bSlewing = false;
+    
+    for (;;) {
+        if (EdgeReadRTC (busfd, nBusDevId, nEdgeTimeoutMsecs, &edgereadingRTCClock) < 0) {
+            if (errno != ETIMEDOUT) {
+                (void) perror ("Unable to read current date/time from real time clock");
+                return -1;
+            }
+            
+            (void) fprintf (stderr, "Unable to find the RTC second edge within %d ms, so the computer clock has been left alone.\n", nEdgeTimeoutMsecs);
+            if (nLoopSecs == 0)
+                return -1;
+        }
+        else {
+            DisciplineDecide (&edgereadingRTCClock, nStepMsecs, &decisionDiscipline);
+            
+            if (decisionDiscipline.m_nAction == DISCIPLINE_SLEW) {
+                // Under a second, so it is all microseconds. A new slew replaces any that is still going
+                
+                tvDelta.tv_sec = 0;
+                tvDelta.tv_usec = (suseconds_t) (decisionDiscipline.m_nsOffset / NSEC_PER_USEC);
+                if (adjtime (&tvDelta, (struct timeval *) 0) < 0) {
+                    perror ("Call to adjtime failed, unable to slew computer clock");
+                    return -1;
+                }
+                bSlewing = true;
+            }
+            else if (decisionDiscipline.m_nAction == DISCIPLINE_STEP) {
+                // Stop any slew we started, or it would carry on from the new time. Then work out the RTC's time
+                // now from the edge, as late as we can
+                
+                if (bSlewing) {
+                    tvDelta.tv_sec = 0;
+                    tvDelta.tv_usec = 0;
+                    (void) adjtime (&tvDelta, (struct timeval *) 0);
+                    bSlewing = false;
+                }
+                
+                TimingToTimespec (TimingNow (CLOCK_REALTIME) + decisionDiscipline.m_nsOffset, &tsComputerDateTime);
+                if (clock_settime (CLOCK_REALTIME, &tsComputerDateTime) < 0) {
+                    perror ("Call to clock_settime failed, unable to set computer clock");
+                    return -1;
+                }
+            }
+            
+            (void) printf ("RTC is %+.3f ms (+/- %.3f ms) from the computer clock: %s",
+                           ((double) decisionDiscipline.m_nsOffset / NSEC_PER_MSEC), ((double) decisionDiscipline.m_nsUncertainty / NSEC_PER_MSEC),
+                           DisciplineActionName (decisionDiscipline.m_nAction));
+            if (decisionDiscipline.m_nAction == DISCIPLINE_SLEW)
+                (void) printf (", converging in %.1f s", ((double) decisionDiscipline.m_nsConvergence / NSEC_PER_SEC));
+            (void) printf (".\n");
+        }
+        
+        if (nLoopSecs == 0)
+            return 0;
+        
+        // Rounds are nLoopSecs apart, however long each one took
+        
+        (void) fflush (stdout);
+        nsNextRound += (int64_t) nLoopSecs * NSEC_PER_SEC;
+        if (TimingSleepUntil (CLOCK_MONOTONIC, nsNextRound, 0) < 0) {
+            perror ("Unable to wait for the next round");
+            return -1;
+        }
+    }
+}
+
+/* int HWPublishRTC (int busfd, int nBusDevId, int nShmUnit, char *szTimePagePath, int nIntervalSecs, int nEdgeTimeoutMsecs)
+**
+** Read the RTC on the edge of a second every nIntervalSecs, and publish each reading. With nShmUnit (not -1)
+** it goes in that NTP shared memory segment, for ntpd (server 127.127.28.nShmUnit) or chronyd (refclock SHM
+** nShmUnit) to use as a reference clock, as the RTC's time at the edge with the computer clock's, and the
+** precision the edge was found to. With szTimePagePath it goes in the time page there (RTCTimePage.h), with
+** the RTC's flags and the drift estimated when we started, for local programs to read without the bus.
+** After the first edge we only poll around where the next must be. If we cannot find an edge nothing is
+** published until we can, so the time daemon sees the reference clock go quiet and the time page goes
+** stale. We only return on an error
+*/
+
+int HWPublishRTC (int busfd, int nBusDevId, int nShmUnit, char *szTimePagePath, int nIntervalSecs, int nEdgeTimeoutMsecs)
+{
+    struct rtc_edge_reading     edgereadingRTCClock;
+    struct shm_sample           sampleRTCClock;
+    struct shm_time             *pShm = (struct shm_time *) 0;
+    struct rtc_time_page        *pTimePage = (struct rtc_time_page *) 0, pageReading;
+    struct drift_estimate       estimateDrift;
+    struct mcp7940n_osctrim     osctrimTrimValue;
+    struct mcp7940n_rtcwkday    *pWeekday;
+    int                         nStatus;
+    bool                        bHaveEdge = false;
+    
+    if ((nShmUnit >= 0) && ((pShm = ShmAttach (nShmUnit)) == (struct shm_time *) 0)) {
+        perror ("Unable to attach to the NTP shared memory segment");
+        return -1;
+    }
+    
+    if ((szTimePagePath != (char *) 0) && ((pTimePage = TimePageCreate (szTimePagePath, nIntervalSecs)) == (struct rtc_time_page *) 0)) {
+        perror (szTimePagePath);
+        return -1;
+    }
+    
+    // The drift the time page extrapolates with is the crystal's, less what the trim programmed corrects.
+    // Without an estimate we can only say how far out a crystal may be
+    
+    bzero ((void *) &pageReading, sizeof (struct rtc_time_page));
+    pageReading.m_nDriftSpreadPPB = TIMEPAGE_UNKNOWN_DRIFT_PPB;
+    if ((pTimePage != (struct rtc_time_page *) 0) && (DriftLoad (DRIFT_STATE_PATH) == 0) && (DriftEstimate (&estimateDrift) == 0) &&
+        (SnapshotRead (busfd, nBusDevId, MCP7940N_OSCTRIM_OFFSET, (void *) &osctrimTrimValue, sizeof (struct mcp7940n_osctrim)) == 0)) {
+        pageReading.m_nDriftPPB = (int32_t) ((estimateDrift.m_dDriftPPM + (DriftTrimToSteps (&osctrimTrimValue) * DRIFT_PPM_PER_TRIM_STEP)) * 1000.0);
+        pageReading.m_nDriftSpreadPPB = (int32_t) (estimateDrift.m_dSpreadPPM * 1000.0);
+        pageReading.m_uiFlags |= TIMEPAGE_FLAG_DRIFT;
+    }
+    
+    for (;;) {
+        if (bHaveEdge)
+            nStatus = EdgeReadRTCNext (busfd, nBusDevId, nIntervalSecs, nEdgeTimeoutMsecs, &edgereadingRTCClock);
+        else
+            nStatus = EdgeReadRTC (busfd, nBusDevId, nEdgeTimeoutMsecs, &edgereadingRTCClock);
+        
+        if (nStatus < 0) {
+            if (errno != ETIMEDOUT) {
+                (void) perror ("Unable to read current date/time from real time clock");
+                if (pShm != (struct shm_time *) 0)
+                    ShmDetach (pShm);
+                if (pTimePage != (struct rtc_time_page *) 0)
+                    TimePageClose (pTimePage);
+                return -1;
+            }
+            
+            // Most likely the oscillator is stopped, in which case EdgeReadRTC gives up straight away
+            
+            (void) fprintf (stderr, "Unable to find the RTC second edge within %d ms, so nothing has been published.\n", nEdgeTimeoutMsecs);
+            bHaveEdge = false;
+            (void) TimingSleepUntil (CLOCK_MONOTONIC, (TimingNow (CLOCK_MONOTONIC) + ((int64_t) nIntervalSecs * NSEC_PER_SEC)), 0);
+            continue;
+        }
+        bHaveEdge = true;
+        
+        // The RTC keeps UTC, and at the edge its time was exactly what the registers hold
+        
+        sampleRTCClock.m_nsClockTime = (int64_t) CivilRegistersToEpoch (CodecLoad ((void *) &edgereadingRTCClock.m_datetimeRTCClock)) * NSEC_PER_SEC;
+        sampleRTCClock.m_nsReceiveTime = edgereadingRTCClock.m_nsEdgeRealtime;
+        sampleRTCClock.m_nLeap = SHM_LEAP_NOWARNING;
+        sampleRTCClock.m_nPrecision = ShmPrecision (2 * edgereadingRTCClock.m_nsUncertainty);
+        if (pShm != (struct shm_time *) 0)
+            ShmPublish (pShm, &sampleRTCClock);
+        
+        if (pTimePage != (struct rtc_time_page *) 0) {
+            pWeekday = &edgereadingRTCClock.m_datetimeRTCClock.rtcweekday;
+            pageReading.m_uiFlags = (pageReading.m_uiFlags & TIMEPAGE_FLAG_DRIFT) | (pWeekday ->oscrun ? TIMEPAGE_FLAG_OSCRUN : 0) |
+                (pWeekday ->vbaten ? TIMEPAGE_FLAG_VBATEN : 0) | (pWeekday ->pwrfail ? TIMEPAGE_FLAG_PWRFAIL : 0);
+            pageReading.m_nsRTCTime = sampleRTCClock.m_nsClockTime;
+            pageReading.m_nsMonotonic = edgereadingRTCClock.m_nsEdgeMonotonic;
+            pageReading.m_nsRealtime = edgereadingRTCClock.m_nsEdgeRealtime;
+            pageReading.m_nsUncertainty = edgereadingRTCClock.m_nsUncertainty;
+            TimePagePublish (pTimePage, &pageReading);
+        }
+        
+        if (bVerbose) {
+            (void) printf ("Published RTC %+.3f ms from the computer clock, precision 2^%d s, %d transactions.\n",
+                           ((double) (sampleRTCClock.m_nsClockTime - sampleRTCClock.m_nsReceiveTime) / NSEC_PER_MSEC),
+                           sampleRTCClock.m_nPrecision, edgereadingRTCClock.m_nTransactions);
+            (void) fflush (stdout);
+        }
+    }
+}
+
+/* int HWBootSync (char *szBusName, int nBusDevId, int64_t nsStarted)
+**
+** Set the computer clock from the RTC as quickly as we can, for use at boot. Opening the bus reads the date/time
+** registers as its check that the RTC is there, and the flags amongst them say whether the time can be trusted -
+** the oscillator has to be enabled (ST) and running (OSCRUN). Without battery backup (VBATEN) the RTC only has
+** the time if the power has not been off, so we warn, once the clock is set. Nothing else is done (no snapshot,
+** no time zone, no drift), and then we display how long it all took, from main () starting (nsStarted) and
+** from the process starting if the system can tell us
+*/
+
+int HWBootSync (char *szBusName, int nBusDevId, int64_t nsStarted)
+{
+    struct mcp7940n_datetime    datetimeRTCClock;
+    struct timespec             tsComputerDateTime;
+    int64_t                     nsProcessAge, nsBeforeSet, nsSet;
+    int                         busfd;
+    
+    if ((busfd = OpenI2CDeviceAndRead (szBusName, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, (void *) &datetimeRTCClock, sizeof (struct mcp7940n_datetime))) < 0) {
+        // The error has already been displayed
+        
+        return -1;
+    }
+    
+    I2CTracePhase ("bootsync");
+    if ((datetimeRTCClock.rtcseconds.st == 0) || (datetimeRTCClock.rtcweekday.oscrun == 0)) {
+        (void) fprintf (stderr, "The RTC's oscillator is %s, so its time cannot be trusted. The computer clock has not been set.\n",
+                        ((datetimeRTCClock.rtcseconds.st == 0) ? "disabled" : "not running"));
+        (void) CloseI2CDevice (busfd);
+        return -1;
+    }
+    
+    // The RTC keeps UTC
+    
+    tsComputerDateTime.tv_sec = CivilRegistersToEpoch (CodecLoad ((void *) &datetimeRTCClock));
+    tsComputerDateTime.tv_nsec = 0;
+    
+    nsProcessAge = TimingProcessAge ();
+    nsBeforeSet = TimingNow (CLOCK_MONOTONIC);
+    if (clock_settime (CLOCK_REALTIME, &tsComputerDateTime) < 0) {
+        // An error occurred, and we are unable to set the computer clock
+        
+        perror ("Call to clock_settime failed, unable to set computer clock");
+        (void) CloseI2CDevice (busfd);
+        return -1;
+    }
+    nsSet = TimingNow (CLOCK_MONOTONIC);
+    
+    I2CTracePhase ("close");
+    (void) CloseI2CDevice (busfd);
+    
+    if (datetimeRTCClock.rtcweekday.vbaten == 0)
+        (void) fprintf (stderr, "Warning: the RTC's battery backup is disabled, so it will lose the time when the power is off.\n");
+    
+    (void) printf ("Computer clock set from the RTC %.3f ms after rtcdate started", ((double) (nsSet - nsStarted) / NSEC_PER_MSEC));
+    if (nsProcessAge >= 0)
+        (void) printf (", %.3f ms after its process started", ((double) (nsProcessAge + (nsSet - nsBeforeSet)) / NSEC_PER_MSEC));
+    (void) printf (".\n");
+    
+    return 0;
+}
+
+/* int ReadNVRAM (int busfd, int nBusDevId, FILE *fpOutput)
 **
 ** Get the contents of the Real Time Clock's NVRAM, and dosplay it
 */
 
-int ReadNVRAM (int busfd, int nBusDevId)
+int ReadNVRAM (int busfd, int nBusDevId, FILE *fpOutput)
 {
     uint8_t NVRAMBuf [64 +1]; // 64 bytes (size of NVRAM) plus room for a NULL
     char szErrorString [128 +1];
@@ -1249,18 +2463,20 @@ int ReadNVRAM (int busfd, int nBusDevId)
     
     // Display what was retrieved from memory
     
-    (void) printf ("%s\n", (char *) NVRAMBuf);
+    (void) fprintf (fpOutput, "%s\n", (char *) NVRAMBuf);
     return 0;
 }
 
-/* int WriteNVRAM (int busfd, int nBusDevId, char *szNVRAMContents)
+/* int WriteNVRAM (int busfd, int nBusDevId, char *szNVRAMContents, FILE *fpOutput)
 **
-** Write to the NVRAM on the Real Time Clock
+** Write to the NVRAM on the Real Time Clock. Only the bytes that change are written, and they are read
+** back to check them
 */
 
-int WriteNVRAM (int busfd, int nBusDevId, char *szNVRAMContents)
+int WriteNVRAM (int busfd, int nBusDevId, char *szNVRAMContents, FILE *fpOutput)
 {
     uint8_t NVRAMBuf [64 +1]; //  64 bytes (size of NVRAM) plus a safety byte for a NULL
+    struct delta_stats statsDelta;
     char szErrorString [128 +1];
     
     // Clear out the buffer we will write data out from
@@ -1273,24 +2489,258 @@ int WriteNVRAM (int busfd, int nBusDevId, char *szNVRAMContents)
     
     // Write out to the RTC's NVRAM
     
-    if (WriteI2CDeviceMemory (busfd, nBusDevId, MCP7940N_NVRAM_OFFSET, szNVRAMContents, 64) < 0 ) {
+    if (DeltaWrite (busfd, nBusDevId, MCP7940N_NVRAM_OFFSET, (uint8_t *) 0, NVRAMBuf, 64, true, &statsDelta) < 0 ) {
         // An error occurred. All we can do is display the error
         
-        (void) sprintf (szErrorString, "malloc failure or ioctl I2CRDWR for nBusDevId 0x%02x", nBusDevId);
+        (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x writing NVRAM", nBusDevId);
+        (void) perror (szErrorString);
+        return -1;
+    }
+
+    DisplayDeltaStats ("NVRAM write", &statsDelta, fpOutput);
+    return 0;
+}
+
+/* int ParseNVRAMRange (char *szRange, int *pnOffset, int *pnLength, bool *pbLengthGiven)
+**
+** Parse an NVRAM range of the form offset[:length]. Both are relative to the start of the NVRAM, and may be
+** given in decimal or (with 0x) hex. Without a length the range runs to the end of the NVRAM
+*/
+
+int ParseNVRAMRange (char *szRange, int *pnOffset, int *pnLength, bool *pbLengthGiven)
+{
+    char *pszEnd;
+    
+    *pnOffset = strtol (szRange, &pszEnd, 0);
+    if ((pszEnd == szRange) || (*pnOffset < 0) || (*pnOffset >= 64))
+        goto rangeerror;
+    
+    *pbLengthGiven = (*pszEnd == ':');
+    if (*pbLengthGiven) {
+        szRange = pszEnd + 1;
+        *pnLength = strtol (szRange, &pszEnd, 0);
+        if ((pszEnd == szRange) || (*pnLength <= 0) || ((*pnOffset + *pnLength) > 64))
+            goto rangeerror;
+    }
+    else
+        *pnLength = 64 - *pnOffset;
+    
+    if (*pszEnd != '\0')
+        goto rangeerror;
+    
+    return 0;
+    
+rangeerror:
+    (void) fprintf (stderr, "Invalid NVRAM range, expected offset[:length] within the 64 bytes of NVRAM.\n");
+    return -1;
+}
+
+/* int ReadNVRAMRange (int busfd, int nBusDevId, char *szRange, bool bHex)
+**
+** Read a range of the NVRAM in one transaction and write it to stdout, either as it is or in hex
+*/
+
+int ReadNVRAMRange (int busfd, int nBusDevId, char *szRange, bool bHex)
+{
+    uint8_t NVRAMBuf [64];
+    char szErrorString [128 +1];
+    int nOffset, nLength, nByte;
+    bool bLengthGiven;
+    
+    if (ParseNVRAMRange (szRange, &nOffset, &nLength, &bLengthGiven) < 0)
+        return -1;
+    
+    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_NVRAM_OFFSET + nOffset, (void *) NVRAMBuf, nLength) < 0) {
+        (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x reading NVRAM", nBusDevId);
         (void) perror (szErrorString);
         return -1;
     }
+    
+    if (bHex) {
+        for (nByte = 0; nByte < nLength; nByte ++)
+            (void) printf ("%02x", NVRAMBuf [nByte]);
+        (void) printf ("\n");
+    }
+    else if (fwrite ((void *) NVRAMBuf, 1, nLength, stdout) != (size_t) nLength) {
+        (void) perror ("Unable to write NVRAM contents to stdout");
+        return -1;
+    }
+    
+    if (fflush (stdout) != 0) {
+        (void) perror ("Unable to write NVRAM contents to stdout");
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* int WriteNVRAMRange (int busfd, int nBusDevId, char *szRange, bool bHex)
+**
+** Read data from stdin, either as it is or in hex (white space is ignored), and write it to a range of the
+** NVRAM in one transaction. If a length was given exactly that much data is expected, otherwise whatever is
+** read (up to the end of the NVRAM) is written
+*/
 
+int WriteNVRAMRange (int busfd, int nBusDevId, char *szRange, bool bHex)
+{
+    uint8_t NVRAMBuf [64 +1];
+    char szErrorString [128 +1];
+    int nOffset, nLength, nRead, ch, nDigits;
+    bool bLengthGiven;
+    
+    if (ParseNVRAMRange (szRange, &nOffset, &nLength, &bLengthGiven) < 0)
+        return -1;
+    
+    // Read the data. We allow for one byte more than will fit, so that we can tell if there was too much
+    
+    if (bHex) {
+        for (nRead = 0, nDigits = 0; ((ch = getchar ()) != EOF); ) {
+            if (isspace (ch))
+                continue;
+            if (! isxdigit (ch)) {
+                (void) fprintf (stderr, "Invalid hex data for NVRAM.\n");
+                return -1;
+            }
+            if (nRead > nLength)
+                break;
+            
+            NVRAMBuf [nRead] = (uint8_t) ((nDigits % 2) == 0 ? (digittoint (ch) << 4) : (NVRAMBuf [nRead] | digittoint (ch)));
+            if ((++ nDigits % 2) == 0)
+                nRead ++;
+        }
+        
+        if ((nDigits % 2) != 0) {
+            (void) fprintf (stderr, "Invalid hex data for NVRAM (odd number of digits).\n");
+            return -1;
+        }
+    }
+    else
+        nRead = fread ((void *) NVRAMBuf, 1, nLength + 1, stdin);
+    
+    if (ferror (stdin)) {
+        (void) perror ("Unable to read NVRAM contents from stdin");
+        return -1;
+    }
+    
+    if ((nRead == 0) || (nRead > nLength) || (bLengthGiven && (nRead != nLength))) {
+        (void) fprintf (stderr, "Expected %s%d bytes of data for the NVRAM, got %s%d.\n", (bLengthGiven ? "" : "up to "), nLength,
+            (nRead > nLength ? "more than " : ""), (nRead > nLength ? nLength : nRead));
+        return -1;
+    }
+    
+    if (WriteI2CDeviceMemory (busfd, nBusDevId, MCP7940N_NVRAM_OFFSET + nOffset, (void *) NVRAMBuf, nRead) < 0) {
+        (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x writing NVRAM", nBusDevId);
+        (void) perror (szErrorString);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* void DisplayDeltaStats (char *szWhat, struct delta_stats *pStats, FILE *fpOutput)
+**
+** If the user asked for extra information, display what a delta write cost
+*/
+
+void DisplayDeltaStats (char *szWhat, struct delta_stats *pStats, FILE *fpOutput)
+{
+    if (! bVerbose)
+        return;
+    
+    (void) fprintf (fpOutput, "%s: %d bytes changed, %d bytes written in %d run%s, %d bytes verified, %d transaction%s.\n", szWhat,
+        pStats ->m_nChangedBytes, pStats ->m_nWrittenBytes, pStats ->m_nRuns, (pStats ->m_nRuns == 1 ? "" : "s"),
+        pStats ->m_nVerifiedBytes, pStats ->m_nTransactions, (pStats ->m_nTransactions == 1 ? "" : "s"));
+}
+
+/* int KeyValueCommand (int busfd, int nBusDevId, char *szCommand, FILE *fpOutput)
+**
+** Work with the key/value store in the NVRAM. The command is one of list, get:key, set:key=value, del:key or
+** init. The NVRAM is read once, and any change is written back in a single transaction
+*/
+
+int KeyValueCommand (int busfd, int nBusDevId, char *szCommand, FILE *fpOutput)
+{
+    struct kv_store kvstoreNVRAM;
+    struct delta_stats statsDelta;
+    char            szKey [KV_MAX_KEY_LENGTH +1], *pszValue, szErrorString [128 +1];
+    uint8_t         *pValue;
+    int             nCursor, nValueLength;
+    
+    // Read the store, whatever the command
+    
+    if (KVLoad (busfd, nBusDevId, &kvstoreNVRAM) < 0) {
+        (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x reading NVRAM", nBusDevId);
+        (void) perror (szErrorString);
+        return -1;
+    }
+    
+    if (strcmp (szCommand, "init") == 0) {
+        // Start a new, empty, store. Anything already in the NVRAM is lost
+        
+        KVFormat (&kvstoreNVRAM);
+    }
+    else if (! KVIsValid (&kvstoreNVRAM)) {
+        (void) fprintf (stderr, "The NVRAM does not hold a key/value store (use -k init to create one).\n");
+        return -1;
+    }
+    else if (strcmp (szCommand, "list") == 0) {
+        for (nCursor = 0; (nCursor = KVNext (&kvstoreNVRAM, nCursor, szKey, &pValue, &nValueLength)) >= 0; )
+            (void) fprintf (fpOutput, "%s=%.*s\n", szKey, nValueLength, (char *) pValue);
+        
+        return 0;
+    }
+    else if (strncmp (szCommand, "get:", 4) == 0) {
+        if ((nValueLength = KVGet (&kvstoreNVRAM, szCommand + 4, &pValue)) < 0) {
+            (void) fprintf (stderr, "Key %s is not in the store.\n", szCommand + 4);
+            return -1;
+        }
+        
+        (void) fprintf (fpOutput, "%.*s\n", nValueLength, (char *) pValue);
+        return 0;
+    }
+    else if (strncmp (szCommand, "set:", 4) == 0) {
+        if ((pszValue = strchr (szCommand + 4, '=')) == (char *) 0) {
+            Usage ();
+            return -1;
+        }
+        
+        *pszValue ++ = '\0';
+        if (KVSet (&kvstoreNVRAM, szCommand + 4, (void *) pszValue, strlen (pszValue)) < 0) {
+            (void) perror (szCommand + 4);
+            return -1;
+        }
+    }
+    else if (strncmp (szCommand, "del:", 4) == 0) {
+        if (KVDelete (&kvstoreNVRAM, szCommand + 4) < 0) {
+            (void) fprintf (stderr, "Key %s is not in the store.\n", szCommand + 4);
+            return -1;
+        }
+    }
+    else {
+        Usage ();
+        return -1;
+    }
+    
+    // Write out whatever changed
+    
+    if (KVCommit (busfd, nBusDevId, &kvstoreNVRAM, &statsDelta) < 0) {
+        (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x writing NVRAM", nBusDevId);
+        (void) perror (szErrorString);
+        return -1;
+    }
+    
+    statsDelta.m_nTransactions ++;                  // Count the read we started with
+    DisplayDeltaStats ("NVRAM store", &statsDelta, fpOutput);
     return 0;
 }
 
-/* int HWOptionBatteryConfigure (int busfd, int nBusDevId, bool bEnable)
+/* int HWOptionBatteryConfigure (int busfd, int nBusDevId, bool bEnable, FILE *fpOutput)
 **
 ** This function is used to configure the battery enable flag. We check to see if the battery enable
-** bit is already set to the state the user wants, and if it is we do not write back out
+** bit is already set to the state the user wants, and if it is we do not stage a write
 */
 
-int HWOptionBatteryConfigure (int busfd, int nBusDevId, bool bEnable)
+int HWOptionBatteryConfigure (int busfd, int nBusDevId, bool bEnable, FILE *fpOutput)
 {
     struct mcp7940n_rtcwkday rtcwkdayBatteryEnable;
     char szErrorString [128 +1];
@@ -1301,7 +2751,7 @@ int HWOptionBatteryConfigure (int busfd, int nBusDevId, bool bEnable)
         
     // Request the data from the RTC
     
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayBatteryEnable, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
+    if (PlanPeek (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayBatteryEnable, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
         // An error occurred, display details and exit
         
         (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x getting Battery Enable (VBATEN) bit value", nBusDevId);
@@ -1316,11 +2766,11 @@ int HWOptionBatteryConfigure (int busfd, int nBusDevId, bool bEnable)
         // The oscillator start bit is already set to the state the user wanted. Display a
         // message to the user and then simply return
         
-        (void) printf ("The Battery Enable (VBATEN) bit was already set to %s.\n", (bEnable ? "Enabled" : "Disabled"));
+        (void) fprintf (fpOutput, "The Battery Enable (VBATEN) bit was already set to %s.\n", (bEnable ? "Enabled" : "Disabled"));
         return 0;
     }
     
-    // Update the VBATEN bit (the Battery Enable bit) write it back out to the RTC
+    // Update the VBATEN bit (the Battery Enable bit) and stage it to be written back out to the RTC
     
     rtcwkdayBatteryEnable.vbaten = (bEnable ? 1 : 0);
     
@@ -1329,10 +2779,10 @@ int HWOptionBatteryConfigure (int busfd, int nBusDevId, bool bEnable)
     //
     // TODO: Fix this...
     
-    if (WriteI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayBatteryEnable, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
+    if (PlanStage (busfd, nBusDevId, MCP7940N_RTCWKDAY_OFFSET, (void *) &rtcwkdayBatteryEnable, sizeof (struct mcp7940n_rtcwkday)) < 0 ) {
         // An error occurred. All we can do is display the error
         
-        (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x writing Battery Enable (VBATEN) bit", nBusDevId);
+        (void) sprintf (szErrorString, "Unable to stage write to register setting Battery Enable (VBATEN) bit for nBusDevId 0x%02x", nBusDevId);
         (void) perror (szErrorString);
         return -1;
     }
@@ -1340,13 +2790,13 @@ int HWOptionBatteryConfigure (int busfd, int nBusDevId, bool bEnable)
     return 0;
 }
 
-/* int HWOptionOscillatorConfigure (int busfd, int nBusDevId, bool bEnable)
+/* int HWOptionOscillatorConfigure (int busfd, int nBusDevId, bool bEnable, FILE *fpOutput)
 **
 ** This function is called to actually set the oscillator configuration bit. It reads the byte that the bit is
-** in, sets the bit to 1 or 0 based on bEnable, and then writes it back out to Real Time Clock
+** in, sets the bit to 1 or 0 based on bEnable, and then stages it to be written back out to Real Time Clock
 */
 
-int HWOptionOscillatorConfigure (int busfd, int nBusDevId, bool bEnable)
+int HWOptionOscillatorConfigure (int busfd, int nBusDevId, bool bEnable, FILE *fpOutput)
 {
     struct mcp7940n_rtcsec rtcsecStartOscillator;
     char szErrorString [128 +1];
@@ -1357,7 +2807,7 @@ int HWOptionOscillatorConfigure (int busfd, int nBusDevId, bool bEnable)
         
     // Request the data from the RTC
     
-    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &rtcsecStartOscillator, sizeof (struct mcp7940n_rtcsec)) < 0 ) {
+    if (PlanPeek (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &rtcsecStartOscillator, sizeof (struct mcp7940n_rtcsec)) < 0 ) {
         // An error occurred, display details and exit
         
         (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x getting Oscillator Status (ST) bit", nBusDevId);
@@ -1372,17 +2822,17 @@ int HWOptionOscillatorConfigure (int busfd, int nBusDevId, bool bEnable)
         // The oscillator start bit is already set to the state the user wanted. Display a
         // message to the user and then simply return
         
-        (void) printf ("The Oscillator Start (ST) bit was already set to %s.\n", (bEnable ? "Enabled" : "Disabled"));
+        (void) fprintf (fpOutput, "The Oscillator Start (ST) bit was already set to %s.\n", (bEnable ? "Enabled" : "Disabled"));
         return 0;
     }
     
-    // Update the ST bit (the oscillator start bit) and write it out to the RTC
+    // Update the ST bit (the oscillator start bit) and stage it to be written out to the RTC
     
     rtcsecStartOscillator.st = (bEnable ? 1 : 0);    
-    if (WriteI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &rtcsecStartOscillator, sizeof (struct mcp7940n_rtcsec)) < 0 ) {
+    if (PlanStage (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &rtcsecStartOscillator, sizeof (struct mcp7940n_rtcsec)) < 0 ) {
         // An error occurred. All we can do is display the error
         
-        (void) sprintf (szErrorString, "malloc or ioctl I2CRDWR for nBusDevId 0x%02x writing Oscillator Status (ST) bit", nBusDevId);
+        (void) sprintf (szErrorString, "Unable to stage write to register setting Oscillator Status (ST) bit for nBusDevId 0x%02x", nBusDevId);
         (void) perror (szErrorString);
         return -1;
     }
@@ -1397,40 +2847,18 @@ int HWOptionOscillatorConfigure (int busfd, int nBusDevId, bool bEnable)
 
 void TranslateRTCDateTimeToTm (struct mcp7940n_datetime *pdatetimeRTCClock, struct tm *ptmRTCDateTime)
 {
-    ptmRTCDateTime ->tm_sec = (pdatetimeRTCClock ->rtcseconds.secten * 10) + pdatetimeRTCClock ->rtcseconds.secone;
-    ptmRTCDateTime ->tm_min = (pdatetimeRTCClock ->rtcminutes.minten * 10) + pdatetimeRTCClock ->rtcminutes.minone;
-    ptmRTCDateTime ->tm_hour =
-                        ((pdatetimeRTCClock ->rtchour.twentyfourhour.twelvetwentyfour == 0)
-                            ? ((pdatetimeRTCClock ->rtchour.twentyfourhour.hrten * 10) + pdatetimeRTCClock ->rtchour.twentyfourhour.hrone)
-                            : ((pdatetimeRTCClock ->rtchour.twelvehour.hrten * 10) + pdatetimeRTCClock ->rtchour.twelvehour.hrone + ((pdatetimeRTCClock ->rtchour.twelvehour.ampm == 0) ? 0 : 12))
-                        );
-    ptmRTCDateTime ->tm_wday = ((pdatetimeRTCClock ->rtcweekday.wkday == 0) ? 0 : (pdatetimeRTCClock ->rtcweekday.wkday -1));
-    ptmRTCDateTime ->tm_mday = (pdatetimeRTCClock ->rtcdate.dateten * 10) + pdatetimeRTCClock ->rtcdate.dateone;
-    ptmRTCDateTime ->tm_mon = ((pdatetimeRTCClock ->rtcmonth.mthten * 10) + pdatetimeRTCClock ->rtcmonth.mthone -1);
-    ptmRTCDateTime ->tm_year = ((pdatetimeRTCClock ->rtcyear.yrten * 10) + pdatetimeRTCClock ->rtcyear.yrone + 100);    // The RTC does not know about century, and we assue we are in the 21st Century    
+    CodecDecodeDateTime (CodecLoad ((void *) pdatetimeRTCClock), ptmRTCDateTime);
 }
 
 /* void TranslateTmToRTCDateTime (struct tm *ptmRTCDateTime, struct mcp7940n_datetime *pdatetimeRTCClock)
 **
-** This function is used to convert from the date time in struct tm format to date/time in RTC format.
+** This function is used to convert from the date time in struct tm format to date/time in RTC format. The
+** flags mixed amongst the date registers are left as they are
 */
 
 void TranslateTmToRTCDateTime (struct tm *ptmRTCDateTime, struct mcp7940n_datetime *pdatetimeRTCClock)
 {
-    pdatetimeRTCClock ->rtcseconds.secone = ptmRTCDateTime ->tm_sec % 10;
-    pdatetimeRTCClock ->rtcseconds.secten = ptmRTCDateTime ->tm_sec / 10;
-    pdatetimeRTCClock ->rtcminutes.minone = ptmRTCDateTime ->tm_min % 10;
-    pdatetimeRTCClock ->rtcminutes.minten = ptmRTCDateTime ->tm_min / 10;
-    pdatetimeRTCClock ->rtchour.twentyfourhour.twelvetwentyfour = 0;                        // 24 hour clock format
-    pdatetimeRTCClock ->rtchour.twentyfourhour.hrone = ptmRTCDateTime ->tm_hour % 10;
-    pdatetimeRTCClock ->rtchour.twentyfourhour.hrten = ptmRTCDateTime ->tm_hour / 10;
-    pdatetimeRTCClock ->rtcweekday.wkday = (ptmRTCDateTime ->tm_wday +1);                // 1 is a Sunday on the RTC
-    pdatetimeRTCClock ->rtcdate.dateone = ptmRTCDateTime ->tm_mday % 10;
-    pdatetimeRTCClock ->rtcdate.dateten = ptmRTCDateTime ->tm_mday / 10;
-    pdatetimeRTCClock ->rtcmonth.mthone = (ptmRTCDateTime ->tm_mon +1) % 10;
-    pdatetimeRTCClock ->rtcmonth.mthten = (ptmRTCDateTime ->tm_mon +1) / 10;
-    pdatetimeRTCClock ->rtcyear.yrone = (ptmRTCDateTime ->tm_year) % 10;         
-    pdatetimeRTCClock ->rtcyear.yrten = ((ptmRTCDateTime ->tm_year) % 100) / 10;       // The RTC does not know about century  
+    CodecStore (CodecEncodeDateTime (ptmRTCDateTime, CodecLoad ((void *) pdatetimeRTCClock)), (void *) pdatetimeRTCClock);
 }
 
 /* void Usage (void)
@@ -1440,36 +2868,79 @@ void TranslateTmToRTCDateTime (struct tm *ptmRTCDateTime, struct mcp7940n_dateti
 
 void Usage (void)
 {
-    (void) printf ("pifacertc [-d nBusDevId] [-i 0|1] [-o option]\n");
-    (void) printf ("pifacertc [-d nBusDevId] [-i 0|1] [-p] [-u]\n");
-    (void) printf ("pifacertc [-d nBusDevId] [-i 0|1] [-r] [-w \"...\"]\n");
-    (void) printf ("pifacertc [-d nBusDevId] [-i 0|1] [-c] [[[[[cc]yy]mm]dd]HH]MM[.ss]\n");
-    (void) printf ("pifacertc [-d nBusDevId] [-i 0|1] [-s]\n");
-    (void) printf ("pifacertc [-d nBusDevId] [-i 0|1] [-d]\n\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] [-o option]\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] [-p] [-u]\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] [-r] [-w \"...\"]\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] [-x] -R|-W offset[:length]\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] -k list|get:key|set:key=value|del:key|init\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] [-c] [[[[[cc]yy]mm]dd]HH]MM[.ss]\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] -c -a\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] -c [-a] --tolerance=ms\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] [-e ms] [-s] [--cache-ttl=secs]\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] -S\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] [-e ms] --slew[=ms] [--loop=secs]\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] [-e ms] [-v] [--shm=unit] [--timepage=path] [--loop=secs]\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] [-d]\n");
+    (void) printf ("pifacertc [-d nBusDevId] [-i n] -D socket [--cache-ttl=secs]\n\n");
     (void) printf ("Set or get the current date/time from the PiFace RTC, or get or set options.\n\n");
+    (void) printf ("-a                 With -c, start the RTC exactly on a second boundary of the computer clock\n");
+    (void) printf ("                   and display the residual error.\n");
     (void) printf ("-b nn              Use the nBusDevId specified (7-bit address)\n");
     (void) printf ("-c                 Set the real time clock from the computer clock.\n");
+    (void) printf ("--cache-ttl=secs   Get the date/time from a read on the edge of a second up to secs old, by\n");
+    (void) printf ("                   CLOCK_MONOTONIC, rather than the bus (checking RTCSEC every %d s).\n", CACHE_CONFIRM_SECS);
+    (void) printf ("-D socket          Run as the rtcd daemon, serving requests on the socket (%s).\n", RTCD_SOCKET_PATH);
     (void) printf ("-d                 Output the date/time as input to the date command.\n");
+    (void) printf ("-e ms              Read the RTC on the edge of a second, to the millisecond, giving up after\n");
+    (void) printf ("                   ms milliseconds (%d is enough for every pass).\n", EDGE_DEFAULT_TIMEOUT_MSECS);
     (void) printf ("-h                 Prints this help.\n");
-    (void) printf ("-i 0|1             Use /dev/iic0 or /dev/iic1 (will guess without).\n");
+    (void) printf ("-i n               Use bus n, which is %s (without, every bus is searched, and the one the\n"
+                   "                   RTC is on remembered in %s).\n", I2C_BACKEND_BUS_USAGE, I2C_DISCOVER_CACHE_PATH);
+    (void) printf ("-k command         Use the key/value store in the NVRAM - list, get:key, set:key=value,\n");
+    (void) printf ("                   del:key, or init to create an empty store (keys up to %d characters).\n", KV_MAX_KEY_LENGTH);
     (void) printf ("-o option          Set an option on the HW RTC.\n\nThe following options are supported\n\n");
     (void) printf ("  init      Initialize the RTC, and set the date to the current date/time\n");
     (void) printf ("  bat       Enable battery backup (*)\n");
     (void) printf ("  nobat     Disable battery backup (*)\n");
     (void) printf ("  batstat   Show the battery status\n");
     (void) printf ("  clrnvram  Clear the NVRAM\n");
-    (void) printf ("  cal       Calibrate the device (write 0x47 to TRIM register)\n");
+    (void) printf ("  cal       Calibrate the device (write the estimated trim, or 0x47, to TRIM register)\n");
     (void) printf ("  osc       Enable the oscillator (*)\n");
     (void) printf ("  noosc     Disable the oscillator (*)\n");
     (void) printf ("  oscset    Get the oscillator setting\n");
     (void) printf ("  oscstat   Display the oscialltor status\n");
     (void) printf ("  pwrstat   Get the power fail status\n");
-    (void) printf ("  clrpwr    Clear the powerfail status bit if set\n\n");
+    (void) printf ("  clrpwr    Clear the powerfail status bit if set\n");
+    (void) printf ("  status    Show the battery, oscillator and power fail status\n");
+    (void) printf ("  drift     Show the estimated drift of the RTC and the trim that would correct it\n\n");
     (void) printf ("Options can be separated with a comma, e.g. \"pifacertc -o bat,osc\".\n");
     (void) printf ("(*) indicates options that can corrupt the RTC if used incorrectly.\n\n");
     (void) printf ("-p                 Print the time that the power was turned off at or failed\n");
+    (void) printf ("--loop=secs        With --slew, do it again every secs seconds, to keep the computer clock\n");
+    (void) printf ("                   locked to the RTC. With --shm or --timepage, publish every secs seconds (%d).\n", SHM_DEFAULT_INTERVAL_SECS);
+    (void) printf ("--stats[=json]     Display how long each phase of the run took, its bus transactions and\n");
+    (void) printf ("                   their latency, on stderr at exit.\n");
+    (void) printf ("--timepage=path    Publish the RTC, read on the edge of each second, in a page at path that\n");
+    (void) printf ("                   programs map to read the RTC's time without the bus (see RTCTimePage.h).\n");
+    (void) printf ("--tolerance=ms     With -c, only set the RTC if it is more than ms from the computer clock,\n");
+    (void) printf ("                   measuring it on the edge of a second and displaying how far out it is.\n");
+    (void) printf ("--trace[=json]     Display each bus transaction on stderr as it happens.\n");
+    (void) printf ("-R offset[:length] Write the NVRAM (from offset, to the end or for length bytes) to stdout.\n");
     (void) printf ("-r                 Read the contents of the NVRAM from the Real Time Clock.\n");
+    (void) printf ("--shm=unit         Publish the RTC, read on the edge of each second, to ntpd or chronyd as a\n");
+    (void) printf ("                   reference clock in NTP shared memory segment unit (127.127.28.unit).\n");
+    (void) printf ("-S                 Set the computer clock from the RTC as quickly as possible (for use at\n");
+    (void) printf ("                   boot), and display how long it took from starting up.\n");
+    (void) printf ("--slew[=ms]        Read the RTC on the edge of a second and slew the computer clock into line\n");
+    (void) printf ("                   with it, or step it if it is %d ms or more out (or ms, up to %d).\n",
+                   DISCIPLINE_DEFAULT_STEP_MSECS, DISCIPLINE_MAX_STEP_MSECS);
     (void) printf ("-s                 Set the computer clock from the RTC.\n");
     (void) printf ("-u                 Print the time that the power was turned on or restored\n");
+    (void) printf ("-v                 Display extra information (how long the oscillator was stopped for, how\n");
+    (void) printf ("                   many bytes an NVRAM update wrote, etc.)\n");
+    (void) printf ("-W offset[:length] Write the NVRAM (from offset) with data read from stdin.\n");
     (void) printf ("-w \"...\"           Write to the NVRAM on the Real Time Clock.\n");
+    (void) printf ("-x                 Use hex rather than binary for -R and -W.\n\n");
+    (void) printf ("If rtcd is running on %s, requests other than setting the RTC are sent to it\n", RTCD_SOCKET_PATH);
+    (void) printf ("unless -b or -i is given.\n");
 }
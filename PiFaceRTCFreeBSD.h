@@ -0,0 +1,69 @@
+/*
+**  PiFaceRTCFreeBSD.h
+**
+**  This header file contains the function prototypes for the commands implemented in PiFaceRTCFreeBSD.c,
+**  so that they can be called from the other parts of the application (the rtcd daemon, for example).
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef PiFaceRTCFreeBSD_h
+#define PiFaceRTCFreeBSD_h
+
+# include <stdbool.h>
+# include <stdio.h>
+# include <stdint.h>
+# include <time.h>
+
+# include "PiFaceRTC.h"
+# include "RTCEdge.h"
+
+int DisplayPowerFailTime (int busfd, int nBusDevId, FILE *fpOutput);
+int DisplayPowerRestoreTime (int busfd, int nBusDevId, FILE *fpOutput);
+int ParseDateTimeArgument (char *szDateTime, struct tm *ptmDateTime);
+int HWSetTimeOfDay (int busfd, int nBusDevId, char *szDatetime, bool bUseComputerClockToSetRTC, FILE *fpOutput);
+int HWSetTimeOfDayPrecise (int busfd, int nBusDevId);
+int HWBootSync (char *szBusName, int nBusDevId, int64_t nsStarted);
+int HWDisciplineComputerClock (int busfd, int nBusDevId, int nStepMsecs, int nLoopSecs, int nEdgeTimeoutMsecs);
+int HWPublishRTC (int busfd, int nBusDevId, int nShmUnit, char *szTimePagePath, int nIntervalSecs, int nEdgeTimeoutMsecs);
+int HWGetTimeOfDay (int busfd, char *szBusName, int nBusDevId, bool bDisplayDateTimeAsDateInput, bool bSetComputerClockFromRTC, int nEdgeTimeoutMsecs, int nCacheTtlSecs, FILE *fpOutput);
+int ReadNVRAM (int busfd, int nBusDevId, FILE *fpOutput);
+int WriteNVRAM (int busfd, int nBusDevId, char *szNVRAMContents, FILE *fpOutput);
+int ReadNVRAMRange (int busfd, int nBusDevId, char *szRange, bool bHex);
+int WriteNVRAMRange (int busfd, int nBusDevId, char *szRange, bool bHex);
+int KeyValueCommand (int busfd, int nBusDevId, char *szCommand, FILE *fpOutput);
+int ProcessHWClockOption (int busfd, int nBusDevId, char *szOptionsToProcess, FILE *fpOutput);
+int HWSetTimeOfDayIfDrifted (int busfd, int nBusDevId, int nToleranceMsecs, bool bAlignToSecond);
+int HWDriftUpdate (int busfd, int nBusDevId, struct rtc_edge_reading *pEdgeReading);
+
+void TranslateRTCDateTimeToTm (struct mcp7940n_datetime *pdatetimeRTCClock, struct tm *ptmRTCDateTime);
+void TranslateTmToRTCDateTime (struct tm *ptmRTCDateTime, struct mcp7940n_datetime *pdatetimeRTCClock);
+
+#endif // PiFaceRTCFreeBSD_h
@@ -0,0 +1,1543 @@
+/*
+**  RTCBench.c
+**
+**  This source file contains rtcbench, the benchmarks. It times decoding and encoding register dumps with the
+**  codec against the bitfield code it replaced (kept here as the Legacy functions), converting to and from
+**  seconds against timegm(3) and gmtime_r(3), parsing the command line date/time, framing writes to the bus,
+**  and whole commands against the simulator (RTCSim.c), and checks that each pair agree. Results are displayed
+**  as text, CSV or JSON, with the same names from one release to the next. Run it with 'make bench'. With -m it
+**  stands in for ntpd instead, reading what --shm publishes from the NTP shared memory segment, and for a
+**  program reading the time page --timepage publishes.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <errno.h>
+# include <fcntl.h>
+# include <signal.h>
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <stdbool.h>
+# include <string.h>
+# include <strings.h>
+# include <time.h>
+# include <unistd.h>
+# include <sys/wait.h>
+
+# include "PiFaceRTC.h"
+# include "PiFaceRTCFreeBSD.h"
+# include "I2CBackend.h"
+# include "I2CRoutines.h"
+# include "RTCTiming.h"
+# include "RTCCodec.h"
+# include "RTCCivil.h"
+# include "RTCSim.h"
+# include "RTCSnapshot.h"
+# include "RTCDrift.h"
+# include "RTCEdge.h"
+# include "RTCDiscipline.h"
+# include "RTCShm.h"
+# include "RTCTimePage.h"
+# include "RTCCache.h"
+# include "RTCDelta.h"
+# include "RTCKeyValue.h"
+# include "I2CTrace.h"
+# include "I2CDiscover.h"
+
+# define BENCH_DUMPS            4096            // Register dumps, cycled through so they stay in the cache
+# define BENCH_DEFAULT_ROUNDS   10000000        // Conversions timed per function
+# define BENCH_DEFAULT_REPEATS  5
+# define BENCH_MAX_REPEATS      101
+# define BENCH_DEFAULT_SIM      "clock=virtual,start=1700000000"
+# define BENCH_BUDGET_SIM       "clock=lockstep,start=1700000000,powerfail=3600"   // The edge reads poll the same way every run
+# define BENCH_SHM_SIM          "clock=real,offset=-25000"                     // The RTC 25 ms behind the computer
+# define BENCH_SHM_OFFSET_NSECS (-25 * NSEC_PER_MSEC)
+# define BENCH_SHM_SAMPLES      5
+# define BENCH_TIMEPAGE_PATH    "/tmp/rtcbench.timepage"
+# define BENCH_PARSER_INPUTS    8
+# define BENCH_VERSION          1               // Bumped when the results stop being comparable with older ones
+
+# define BENCH_FORMAT_TEXT      0
+# define BENCH_FORMAT_CSV       1
+# define BENCH_FORMAT_JSON      2
+
+static struct mcp7940n_datetime datetimeBenchDumps [BENCH_DUMPS];
+static struct tm                tmBenchDates [BENCH_DUMPS];
+static time_t                   timeBenchTimes [BENCH_DUMPS];
+static uint8_t                  uiBenchData [64];
+static struct rtc_time_page     pageBench;
+static int                      busfdBench = -1, nBenchNull;
+static int64_t                  nsBenchBusTime;
+static FILE                     *fileBenchLog;
+
+/*
+** Every form of date/time the command line takes, and what each should set (-1 for fields it leaves alone)
+*/
+
+static char *szBenchDateTimes [BENCH_PARSER_INPUTS] = {
+    "30", "1530", "041530", "03041530", "1203041530", "201203041530", "1530.45", "201203041530.45"
+};
+
+static int nBenchParsed [BENCH_PARSER_INPUTS][6] = {
+    // sec, min, hour, mday, mon, year
+    { -1, 30, -1, -1, -1, -1 }, { -1, 30, 15, -1, -1, -1 }, { -1, 30, 15, 4, -1, -1 }, { -1, 30, 15, 4, 2, -1 },
+    { -1, 30, 15, 4, 2, 112 }, { -1, 30, 15, 4, 2, 112 }, { 45, 30, 15, -1, -1, -1 }, { 45, 30, 15, 4, 2, 112 }
+};
+
+/* static void LegacyTranslateRTCDateTimeToTm (struct mcp7940n_datetime *pdatetimeRTCClock, struct tm *ptmRTCDateTime)
+**
+** The bitfield decode the codec replaced
+*/
+
+static void LegacyTranslateRTCDateTimeToTm (struct mcp7940n_datetime *pdatetimeRTCClock, struct tm *ptmRTCDateTime)
+{
+    ptmRTCDateTime ->tm_sec = (pdatetimeRTCClock ->rtcseconds.secten * 10) + pdatetimeRTCClock ->rtcseconds.secone;
+    ptmRTCDateTime ->tm_min = (pdatetimeRTCClock ->rtcminutes.minten * 10) + pdatetimeRTCClock ->rtcminutes.minone;
+    ptmRTCDateTime ->tm_hour =
+                        ((pdatetimeRTCClock ->rtchour.twentyfourhour.twelvetwentyfour == 0)
+                            ? ((pdatetimeRTCClock ->rtchour.twentyfourhour.hrten * 10) + pdatetimeRTCClock ->rtchour.twentyfourhour.hrone)
+                            : ((pdatetimeRTCClock ->rtchour.twelvehour.hrten * 10) + pdatetimeRTCClock ->rtchour.twelvehour.hrone + ((pdatetimeRTCClock ->rtchour.twelvehour.ampm == 0) ? 0 : 12))
+                        );
+    ptmRTCDateTime ->tm_wday = ((pdatetimeRTCClock ->rtcweekday.wkday == 0) ? 0 : (pdatetimeRTCClock ->rtcweekday.wkday -1));
+    ptmRTCDateTime ->tm_mday = (pdatetimeRTCClock ->rtcdate.dateten * 10) + pdatetimeRTCClock ->rtcdate.dateone;
+    ptmRTCDateTime ->tm_mon = ((pdatetimeRTCClock ->rtcmonth.mthten * 10) + pdatetimeRTCClock ->rtcmonth.mthone -1);
+    ptmRTCDateTime ->tm_year = ((pdatetimeRTCClock ->rtcyear.yrten * 10) + pdatetimeRTCClock ->rtcyear.yrone + 100);
+}
+
+/* static void LegacyTranslateTmToRTCDateTime (struct tm *ptmRTCDateTime, struct mcp7940n_datetime *pdatetimeRTCClock)
+**
+** The bitfield encode the codec replaced
+*/
+
+static void LegacyTranslateTmToRTCDateTime (struct tm *ptmRTCDateTime, struct mcp7940n_datetime *pdatetimeRTCClock)
+{
+    pdatetimeRTCClock ->rtcseconds.secone = ptmRTCDateTime ->tm_sec % 10;
+    pdatetimeRTCClock ->rtcseconds.secten = ptmRTCDateTime ->tm_sec / 10;
+    pdatetimeRTCClock ->rtcminutes.minone = ptmRTCDateTime ->tm_min % 10;
+    pdatetimeRTCClock ->rtcminutes.minten = ptmRTCDateTime ->tm_min / 10;
+    pdatetimeRTCClock ->rtchour.twentyfourhour.twelvetwentyfour = 0;
+    pdatetimeRTCClock ->rtchour.twentyfourhour.hrone = ptmRTCDateTime ->tm_hour % 10;
+    pdatetimeRTCClock ->rtchour.twentyfourhour.hrten = ptmRTCDateTime ->tm_hour / 10;
+    pdatetimeRTCClock ->rtcweekday.wkday = (ptmRTCDateTime ->tm_wday +1);
+    pdatetimeRTCClock ->rtcdate.dateone = ptmRTCDateTime ->tm_mday % 10;
+    pdatetimeRTCClock ->rtcdate.dateten = ptmRTCDateTime ->tm_mday / 10;
+    pdatetimeRTCClock ->rtcmonth.mthone = (ptmRTCDateTime ->tm_mon +1) % 10;
+    pdatetimeRTCClock ->rtcmonth.mthten = (ptmRTCDateTime ->tm_mon +1) / 10;
+    pdatetimeRTCClock ->rtcyear.yrone = (ptmRTCDateTime ->tm_year) % 10;
+    pdatetimeRTCClock ->rtcyear.yrten = ((ptmRTCDateTime ->tm_year) % 100) / 10;
+}
+
+/* static void BenchMakeDumps (void)
+**
+** Fill the register dumps with random, valid, dates and times. A quarter of them use the 12 hour format, and
+** all of them have random flag bits set so that we can check encoding leaves them alone
+*/
+
+static void BenchMakeDumps (void)
+{
+    int nDump, nHour;
+    
+    srandom (1);
+    for (nDump = 0; nDump < BENCH_DUMPS; nDump ++) {
+        tmBenchDates [nDump].tm_sec = random () % 60;
+        tmBenchDates [nDump].tm_min = random () % 60;
+        tmBenchDates [nDump].tm_hour = random () % 24;
+        tmBenchDates [nDump].tm_wday = random () % 7;
+        tmBenchDates [nDump].tm_mday = (random () % 28) +1;
+        tmBenchDates [nDump].tm_mon = random () % 12;
+        tmBenchDates [nDump].tm_year = 100 + (random () % 100);
+        timeBenchTimes [nDump] = (time_t) (random () % (200LL * 365 * CIVIL_SECS_PER_DAY));
+        
+        LegacyTranslateTmToRTCDateTime (&tmBenchDates [nDump], &datetimeBenchDumps [nDump]);
+        datetimeBenchDumps [nDump].rtcseconds.st = random () & 1;
+        datetimeBenchDumps [nDump].rtcweekday.vbaten = random () & 1;
+        datetimeBenchDumps [nDump].rtcweekday.pwrfail = random () & 1;
+        datetimeBenchDumps [nDump].rtcweekday.oscrun = random () & 1;
+        datetimeBenchDumps [nDump].rtcmonth.lpyr = random () & 1;
+        
+        if ((nDump % 4) == 0) {
+            // 12 hour format - hours 1 to 12
+            
+            nHour = tmBenchDates [nDump].tm_hour % 12;
+            nHour = ((nHour == 0) ? 12 : nHour);
+            datetimeBenchDumps [nDump].rtchour.twelvehour.twelvetwentyfour = 1;
+            datetimeBenchDumps [nDump].rtchour.twelvehour.ampm = (tmBenchDates [nDump].tm_hour >= 12);
+            datetimeBenchDumps [nDump].rtchour.twelvehour.hrten = nHour / 10;
+            datetimeBenchDumps [nDump].rtchour.twelvehour.hrone = nHour % 10;
+        }
+    }
+}
+
+/* static bool BenchCheck (void)
+**
+** Check that the codec and the legacy code agree on every dump. The legacy code gets 12 AM and 12 PM wrong
+** (it adds 12 to both), so for those we check the codec against the right answer instead
+*/
+
+static bool BenchCheck (void)
+{
+    struct mcp7940n_datetime datetimeLegacy;
+    struct tm tmLegacy, tmCodec;
+    uint64_t uiCodec;
+    int nDump, nMismatches = 0, nLegacyHourBugs = 0;
+    bool bTwelveHour;
+    
+    for (nDump = 0; nDump < BENCH_DUMPS; nDump ++) {
+        bzero ((void *) &tmLegacy, sizeof (struct tm));
+        bzero ((void *) &tmCodec, sizeof (struct tm));
+        LegacyTranslateRTCDateTimeToTm (&datetimeBenchDumps [nDump], &tmLegacy);
+        CodecDecodeDateTime (CodecLoad ((void *) &datetimeBenchDumps [nDump]), &tmCodec);
+        
+        bTwelveHour = (datetimeBenchDumps [nDump].rtchour.twelvehour.twelvetwentyfour != 0);
+        if (bTwelveHour && (tmLegacy.tm_hour != tmCodec.tm_hour) && ((tmBenchDates [nDump].tm_hour % 12) == 0)) {
+            nLegacyHourBugs ++;
+            tmLegacy.tm_hour = tmBenchDates [nDump].tm_hour;
+        }
+        
+        if (bcmp ((void *) &tmLegacy, (void *) &tmCodec, sizeof (struct tm)) != 0)
+            nMismatches ++;
+        
+        // Encoding (always 24 hour) must give the same date and time registers, and leave the flags alone
+        
+        datetimeLegacy = datetimeBenchDumps [nDump];
+        LegacyTranslateTmToRTCDateTime (&tmBenchDates [nDump], &datetimeLegacy);
+        uiCodec = CodecEncodeDateTime (&tmBenchDates [nDump], CodecLoad ((void *) &datetimeBenchDumps [nDump]));
+        if (((CodecLoad ((void *) &datetimeLegacy) ^ uiCodec) & ~CODEC_DATETIME_KEEP) != 0)
+            nMismatches ++;
+        if (((CodecLoad ((void *) &datetimeBenchDumps [nDump]) ^ uiCodec) & CODEC_DATETIME_KEEP) != 0)
+            nMismatches ++;
+    }
+    
+    (void) fprintf (fileBenchLog, "Checked %d dumps: %d mismatches, %d 12 AM/PM hours the legacy code got wrong.\n", BENCH_DUMPS, nMismatches, nLegacyHourBugs);
+    return (nMismatches == 0);
+}
+
+/* static bool BenchCheckCivil (void)
+**
+** Check the civil date layer against the C library, on every day from 1600 to 2400 and on the random times
+*/
+
+static bool BenchCheckCivil (void)
+{
+    struct tm tmLibrary, tmCivil;
+    time_t timeDateTime;
+    int64_t nDays;
+    int nDump, nMismatches = 0, nChecked = 0;
+    
+    for (nDays = CivilDaysFromDate (1600, 1, 1); nDays < CivilDaysFromDate (2400, 1, 1); nDays ++, nChecked ++) {
+        timeDateTime = (time_t) ((nDays * CIVIL_SECS_PER_DAY) + (nDays % CIVIL_SECS_PER_DAY));
+        if ((gmtime_r (&timeDateTime, &tmLibrary) == (struct tm *) 0) || (timegm (&tmLibrary) != timeDateTime))
+            continue;           // Out of range for this C library
+        
+        CivilFromEpoch (timeDateTime, &tmCivil);
+        if ((tmCivil.tm_sec != tmLibrary.tm_sec) || (tmCivil.tm_min != tmLibrary.tm_min) || (tmCivil.tm_hour != tmLibrary.tm_hour) ||
+            (tmCivil.tm_mday != tmLibrary.tm_mday) || (tmCivil.tm_mon != tmLibrary.tm_mon) || (tmCivil.tm_year != tmLibrary.tm_year) ||
+            (tmCivil.tm_wday != tmLibrary.tm_wday) || (tmCivil.tm_yday != tmLibrary.tm_yday) || (CivilToEpoch (&tmLibrary) != timeDateTime))
+            nMismatches ++;
+    }
+    
+    for (nDump = 0; nDump < BENCH_DUMPS; nDump ++, nChecked ++) {
+        tmLibrary = tmBenchDates [nDump];
+        if (CivilToEpoch (&tmBenchDates [nDump]) != timegm (&tmLibrary))
+            nMismatches ++;
+    }
+    
+    (void) fprintf (fileBenchLog, "Checked %d dates and times against the C library: %d mismatches.\n", nChecked, nMismatches);
+    return (nMismatches == 0);
+}
+
+/* static bool BenchCheckParse (void)
+**
+** Check the command line date/time parser on every form it takes, and that it turns down some it should not
+*/
+
+static bool BenchCheckParse (void)
+{
+    static char *szBad [] = {"", "2a", "60", "2460", "320000", "1201320000", "1530.60", "1530x45", "1530.4"};
+    struct tm tmDateTime;
+    int nInput, nMismatches = 0, nField, nExpected, nParsed;
+    
+    for (nInput = 0; nInput < BENCH_PARSER_INPUTS; nInput ++) {
+        bzero ((void *) &tmDateTime, sizeof (struct tm));
+        tmDateTime.tm_sec = tmDateTime.tm_min = tmDateTime.tm_hour = tmDateTime.tm_mday = tmDateTime.tm_mon = tmDateTime.tm_year = -1;
+        if (ParseDateTimeArgument (szBenchDateTimes [nInput], &tmDateTime) < 0) {
+            nMismatches ++;
+            continue;
+        }
+        
+        for (nField = 0; nField < 6; nField ++) {
+            nExpected = nBenchParsed [nInput][nField];
+            switch (nField) {
+            case 0: nParsed = tmDateTime.tm_sec; break;
+            case 1: nParsed = tmDateTime.tm_min; break;
+            case 2: nParsed = tmDateTime.tm_hour; break;
+            case 3: nParsed = tmDateTime.tm_mday; break;
+            case 4: nParsed = tmDateTime.tm_mon; break;
+            default: nParsed = tmDateTime.tm_year; break;
+            }
+            if (nParsed != nExpected)
+                nMismatches ++;
+        }
+    }
+    
+    for (nInput = 0; nInput < (int) (sizeof (szBad) / sizeof (szBad [0])); nInput ++) {
+        if (ParseDateTimeArgument (szBad [nInput], &tmDateTime) == 0)
+            nMismatches ++;
+    }
+    
+    (void) fprintf (fileBenchLog, "Checked %d command line date/times: %d mismatches.\n", nInput + BENCH_PARSER_INPUTS, nMismatches);
+    return (nMismatches == 0);
+}
+
+/* static bool BenchCheckDelta (void)
+**
+** Check the runs the delta write engine builds. Changes a couple of bytes apart share a run, and with more runs
+** than it may use the closest are merged. Then, on random changes, check that every changed byte is written by
+** no more runs than allowed, each starting and ending on a changed byte, in order and pointing into the image
+*/
+
+# define BENCH_DELTA_OFFSET     0x20
+# define BENCH_DELTA_LENGTH     64
+# define BENCH_DELTA_RANDOM     10000
+
+static bool BenchCheckDelta (void)
+{
+    static int nMerged [] = {0, 10, 30, 50, 60}, nMergedRuns [][2] = {{0, 11}, {30, 1}, {50, 11}};
+    static int nBridged [] = {5, 7, 20}, nBridgedRuns [][2] = {{5, 3}, {20, 1}};
+    struct i2c_write_run writerunRuns [I2C_MAX_WRITE_RUNS];
+    uint8_t uiCurrent [BENCH_DELTA_LENGTH], uiImage [BENCH_DELTA_LENGTH];
+    int nCase, nRuns, nRun, nByte, nMaxRuns, nChanged, nCovered, nMismatches = 0;
+    
+    // Five changes for three runs: the first two are the closest (bar the last, which extends the run before it)
+    
+    bzero ((void *) uiCurrent, sizeof (uiCurrent));
+    bzero ((void *) uiImage, sizeof (uiImage));
+    for (nByte = 0; nByte < (int) (sizeof (nMerged) / sizeof (nMerged [0])); nByte ++)
+        uiImage [nMerged [nByte]] = 0xff;
+    
+    nRuns = DeltaBuildRuns (BENCH_DELTA_OFFSET, uiCurrent, uiImage, BENCH_DELTA_LENGTH, writerunRuns, 3);
+    if (nRuns != (int) (sizeof (nMergedRuns) / sizeof (nMergedRuns [0])))
+        nMismatches ++;
+    for (nRun = 0; (nRun < nRuns) && (nRun < (int) (sizeof (nMergedRuns) / sizeof (nMergedRuns [0]))); nRun ++) {
+        if ((writerunRuns [nRun].m_nOffset != (BENCH_DELTA_OFFSET + nMergedRuns [nRun][0])) || (writerunRuns [nRun].m_nWriteLength != nMergedRuns [nRun][1]))
+            nMismatches ++;
+    }
+    
+    // Changes no more than DELTA_MESSAGE_COST_BYTES apart are bridged, even with runs to spare
+    
+    bzero ((void *) uiImage, sizeof (uiImage));
+    for (nByte = 0; nByte < (int) (sizeof (nBridged) / sizeof (nBridged [0])); nByte ++)
+        uiImage [nBridged [nByte]] = 0xff;
+    
+    nRuns = DeltaBuildRuns (BENCH_DELTA_OFFSET, uiCurrent, uiImage, BENCH_DELTA_LENGTH, writerunRuns, I2C_MAX_WRITE_RUNS);
+    if (nRuns != (int) (sizeof (nBridgedRuns) / sizeof (nBridgedRuns [0])))
+        nMismatches ++;
+    for (nRun = 0; (nRun < nRuns) && (nRun < (int) (sizeof (nBridgedRuns) / sizeof (nBridgedRuns [0]))); nRun ++) {
+        if ((writerunRuns [nRun].m_nOffset != (BENCH_DELTA_OFFSET + nBridgedRuns [nRun][0])) || (writerunRuns [nRun].m_nWriteLength != nBridgedRuns [nRun][1]))
+            nMismatches ++;
+    }
+    
+    // Random changes, with anything from one run to all of them
+    
+    srandom (1);
+    for (nCase = 0; nCase < BENCH_DELTA_RANDOM; nCase ++) {
+        nMaxRuns = (random () % I2C_MAX_WRITE_RUNS) +1;
+        for (nByte = 0, nChanged = 0; nByte < BENCH_DELTA_LENGTH; nByte ++) {
+            uiImage [nByte] = (((random () % 8) == 0) ? 0xff : 0);
+            nChanged += (uiImage [nByte] != uiCurrent [nByte]);
+        }
+        
+        nRuns = DeltaBuildRuns (BENCH_DELTA_OFFSET, uiCurrent, uiImage, BENCH_DELTA_LENGTH, writerunRuns, nMaxRuns);
+        if ((nRuns > nMaxRuns) || ((nRuns == 0) != (nChanged == 0))) {
+            nMismatches ++;
+            continue;
+        }
+        
+        for (nRun = 0, nCovered = 0; nRun < nRuns; nRun ++) {
+            nByte = writerunRuns [nRun].m_nOffset - BENCH_DELTA_OFFSET;
+            if ((nByte < 0) || (writerunRuns [nRun].m_nWriteLength <= 0) || ((nByte + writerunRuns [nRun].m_nWriteLength) > BENCH_DELTA_LENGTH) ||
+                ((nRun > 0) && (writerunRuns [nRun].m_nOffset <= (writerunRuns [nRun - 1].m_nOffset + writerunRuns [nRun - 1].m_nWriteLength))) ||
+                (writerunRuns [nRun].m_lpBuffer != (void *) &(uiImage [nByte])) || (uiImage [nByte] == uiCurrent [nByte]) ||
+                (uiImage [(nByte + writerunRuns [nRun].m_nWriteLength - 1)] == uiCurrent [(nByte + writerunRuns [nRun].m_nWriteLength - 1)])) {
+                nMismatches ++;
+                break;
+            }
+            
+            for (; nByte < (writerunRuns [nRun].m_nOffset - BENCH_DELTA_OFFSET + writerunRuns [nRun].m_nWriteLength); nByte ++)
+                nCovered += (uiImage [nByte] != uiCurrent [nByte]);
+        }
+        
+        if ((nRun == nRuns) && (nCovered != nChanged))
+            nMismatches ++;
+    }
+    
+    (void) fprintf (fileBenchLog, "Checked %d delta write run builds: %d mismatches.\n", BENCH_DELTA_RANDOM + 2, nMismatches);
+    return (nMismatches == 0);
+}
+
+/* static bool BenchCheckDrift (void)
+**
+** Check the drift estimator on a made up RTC, set from the computer clock every day and measured before each
+** set. After three days the trim changes, on the eighth the RTC is set without being measured (so the samples
+** fall into two segments, and no pair may span them), and the last measurement is 50 ms out, as if the computer
+** clock had been stepped. The estimate must still be the crystal's drift, with the trim that cancels it - or
+** as much trim as there is. Then every trim from -127 to +127 steps must go to OSCTRIM and back, SIGN set for
+** the positive ones
+*/
+
+# define BENCH_DRIFT_PATH       "/tmp/rtcbench.drift"       // Only ever loaded, absent, for empty state
+# define BENCH_DRIFT_DAYS       12
+# define BENCH_DRIFT_PAIRS      38                          // 8 samples in the first segment, 5 in the second
+
+static bool BenchCheckDrift (void)
+{
+    static double dDriftPPM [] = {12.5, -3.0, 200.0, -200.0};
+    static int nDriftSteps [] = {-12, 3, -DRIFT_MAX_TRIM_STEPS, DRIFT_MAX_TRIM_STEPS};
+    struct drift_estimate estimateDrift;
+    struct mcp7940n_osctrim osctrimTrimValue;
+    int64_t nsSystemTime, nsOffset;
+    int nCase, nDay, nTrimSteps, nSteps, nMismatches = 0;
+    uint8_t uiTrim;
+    
+    (void) unlink (BENCH_DRIFT_PATH);
+    for (nCase = 0; nCase < (int) (sizeof (dDriftPPM) / sizeof (dDriftPPM [0])); nCase ++) {
+        DriftUnload ();
+        if (DriftLoad (BENCH_DRIFT_PATH) < 0)
+            return false;
+        
+        nTrimSteps = 0;
+        nsSystemTime = (int64_t) 1700000000 * NSEC_PER_SEC;
+        DriftRecordSet (nsSystemTime, 0, nTrimSteps);
+        for (nDay = 1; nDay <= BENCH_DRIFT_DAYS; nDay ++) {
+            nsSystemTime += (int64_t) CIVIL_SECS_PER_DAY * NSEC_PER_SEC;
+            if (nDay == 8) {
+                DriftRecordSet (nsSystemTime, 0, nTrimSteps);
+                continue;
+            }
+            
+            // Over the day the RTC gains what the crystal does, plus what the trim adds
+            
+            nsOffset = (int64_t) ((dDriftPPM [nCase] + (nTrimSteps * DRIFT_PPM_PER_TRIM_STEP)) * (double) CIVIL_SECS_PER_DAY * 1000.0);
+            if (nDay == BENCH_DRIFT_DAYS)
+                nsOffset += 50 * NSEC_PER_MSEC;
+            if (DriftRecordOffset (nsSystemTime, nsOffset) < 0)
+                nMismatches ++;
+            
+            if (nDay == 3)
+                nTrimSteps = -10;
+            DriftRecordSet (nsSystemTime, 0, nTrimSteps);
+        }
+        
+        if ((DriftEstimate (&estimateDrift) < 0) || (estimateDrift.m_nPairs != BENCH_DRIFT_PAIRS) ||
+            (estimateDrift.m_dDriftPPM < (dDriftPPM [nCase] - 0.001)) || (estimateDrift.m_dDriftPPM > (dDriftPPM [nCase] + 0.001)) || (estimateDrift.m_nTrimSteps != nDriftSteps [nCase]))
+            nMismatches ++;
+    }
+    DriftUnload ();
+    
+    for (nSteps = -DRIFT_MAX_TRIM_STEPS; nSteps <= DRIFT_MAX_TRIM_STEPS; nSteps ++) {
+        DriftStepsToTrim (nSteps, &osctrimTrimValue);
+        (void) memcpy ((void *) &uiTrim, (void *) &osctrimTrimValue, sizeof (uiTrim));
+        if ((DriftTrimToSteps (&osctrimTrimValue) != nSteps) || (uiTrim != (((nSteps > 0) ? 0x80 : 0) | abs (nSteps))))
+            nMismatches ++;
+    }
+    
+    (void) fprintf (fileBenchLog, "Checked %d drift estimates and %d trims: %d mismatches.\n", nCase, (2 * DRIFT_MAX_TRIM_STEPS) + 1, nMismatches);
+    return (nMismatches == 0);
+}
+
+/* static void BenchKVSeal (struct kv_store *pStore, int nLength)
+**
+** Set the length in the header and a CRC to match, worked out here rather than by the store, so the check can
+** make images that are sealed but malformed
+*/
+
+static void BenchKVSeal (struct kv_store *pStore, int nLength)
+{
+    uint16_t uiCRC = 0xffff;
+    int nByte, nBit;
+    
+    pStore ->m_uiImage [KV_LENGTH_OFFSET] = (uint8_t) nLength;
+    for (nByte = KV_VERSION_OFFSET; nByte < (KV_HEADER_LENGTH + nLength); nByte ++) {
+        if (nByte == KV_CRC_OFFSET)
+            nByte = KV_HEADER_LENGTH;
+        uiCRC ^= (uint16_t) (pStore ->m_uiImage [nByte] << 8);
+        for (nBit = 0; nBit < 8; nBit ++)
+            uiCRC = ((uiCRC & 0x8000) ? ((uiCRC << 1) ^ 0x1021) : (uiCRC << 1));
+    }
+    
+    pStore ->m_uiImage [KV_CRC_OFFSET] = (uint8_t) (uiCRC >> 8);
+    pStore ->m_uiImage [KV_CRC_OFFSET + 1] = (uint8_t) (uiCRC & 0xff);
+}
+
+/* static bool BenchCheckKeyValue (void)
+**
+** Check the NVRAM key/value store on an image: set and get, an update in place (which must not move the record
+** or touch its neighbour), an update that changes the length, delete, and a store filled to the last byte. Then
+** check KVIsValid turns down images whose CRC is good but whose records are not - one running past the length,
+** one with an empty key - as well as one whose CRC is bad
+*/
+
+static bool BenchCheckKeyValue (void)
+{
+    static uint8_t uiDrift [] = {1, 2, 3, 4}, uiNewDrift [] = {5, 6, 7, 8}, uiTrim [] = {0x8a}, uiFill [KV_MAX_RECORDS_LENGTH];
+    struct kv_store kvstoreStore;
+    char szKey [KV_MAX_KEY_LENGTH + 1];
+    uint8_t *pValue, *pOldValue;
+    int nLength, nCursor, nRecords, nMismatches = 0;
+    
+    bzero ((void *) &kvstoreStore, sizeof (kvstoreStore));
+    KVFormat (&kvstoreStore);
+    if ((! KVIsValid (&kvstoreStore)) || (KVGet (&kvstoreStore, "drift", &pValue) >= 0) || (errno != ENOENT))
+        nMismatches ++;
+    
+    // Set and get, and a bad key
+    
+    if ((KVSet (&kvstoreStore, "drift", uiDrift, sizeof (uiDrift)) < 0) || (KVSet (&kvstoreStore, "trim", uiTrim, sizeof (uiTrim)) < 0) ||
+        (KVGet (&kvstoreStore, "drift", &pValue) != sizeof (uiDrift)) || (memcmp (pValue, uiDrift, sizeof (uiDrift)) != 0))
+        nMismatches ++;
+    if ((KVSet (&kvstoreStore, "", uiTrim, sizeof (uiTrim)) >= 0) || (errno != EINVAL) ||
+        (KVSet (&kvstoreStore, "a key that is too long", uiTrim, sizeof (uiTrim)) >= 0) || (errno != EINVAL))
+        nMismatches ++;
+    
+    // The same length is written where it is; a new length moves the record to the end
+    
+    (void) KVGet (&kvstoreStore, "drift", &pOldValue);
+    nLength = kvstoreStore.m_uiImage [KV_LENGTH_OFFSET];
+    if ((KVSet (&kvstoreStore, "drift", uiNewDrift, sizeof (uiNewDrift)) < 0) || (kvstoreStore.m_uiImage [KV_LENGTH_OFFSET] != nLength) ||
+        (KVGet (&kvstoreStore, "drift", &pValue) != sizeof (uiNewDrift)) || (pValue != pOldValue) || (memcmp (pValue, uiNewDrift, sizeof (uiNewDrift)) != 0) ||
+        (KVGet (&kvstoreStore, "trim", &pValue) != sizeof (uiTrim)) || (*pValue != uiTrim [0]) || (! KVIsValid (&kvstoreStore)))
+        nMismatches ++;
+    if ((KVSet (&kvstoreStore, "drift", uiDrift, 2) < 0) || (kvstoreStore.m_uiImage [KV_LENGTH_OFFSET] != (nLength - 2)) ||
+        (KVGet (&kvstoreStore, "drift", &pValue) != 2) || (pValue <= pOldValue) || (memcmp (pValue, uiDrift, 2) != 0) ||
+        (KVGet (&kvstoreStore, "trim", &pValue) != sizeof (uiTrim)) || (*pValue != uiTrim [0]) || (! KVIsValid (&kvstoreStore)))
+        nMismatches ++;
+    
+    // Delete, twice, leaving the other record as it was
+    
+    if ((KVDelete (&kvstoreStore, "drift") < 0) || (KVGet (&kvstoreStore, "drift", &pValue) >= 0) || (errno != ENOENT) ||
+        (KVDelete (&kvstoreStore, "drift") >= 0) || (errno != ENOENT) ||
+        (KVGet (&kvstoreStore, "trim", &pValue) != sizeof (uiTrim)) || (*pValue != uiTrim [0]) || (! KVIsValid (&kvstoreStore)))
+        nMismatches ++;
+    
+    // Fill the store to the last byte. Nothing more fits, not even a replacement one byte longer, and what is
+    // there is left alone
+    
+    memset ((void *) uiFill, 0x5a, sizeof (uiFill));
+    nLength = KV_MAX_RECORDS_LENGTH - kvstoreStore.m_uiImage [KV_LENGTH_OFFSET] - KV_RECORD_HEADER - 4;
+    if ((KVSet (&kvstoreStore, "fill", uiFill, nLength + 1) >= 0) || (errno != ENOSPC) ||
+        (KVSet (&kvstoreStore, "fill", uiFill, nLength) < 0) || (kvstoreStore.m_uiImage [KV_LENGTH_OFFSET] != KV_MAX_RECORDS_LENGTH) ||
+        (KVSet (&kvstoreStore, "x", uiFill, 0) >= 0) || (errno != ENOSPC) ||
+        (KVSet (&kvstoreStore, "fill", uiFill, nLength + 1) >= 0) || (errno != ENOSPC) ||
+        (KVGet (&kvstoreStore, "fill", &pValue) != nLength) || (memcmp (pValue, uiFill, nLength) != 0) ||
+        (KVGet (&kvstoreStore, "trim", &pValue) != sizeof (uiTrim)) || (*pValue != uiTrim [0]) || (! KVIsValid (&kvstoreStore)))
+        nMismatches ++;
+    
+    for (nCursor = 0, nRecords = 0; (nCursor = KVNext (&kvstoreStore, nCursor, szKey, &pValue, &nLength)) >= 0; nRecords ++)
+        ;
+    if (nRecords != 2)
+        nMismatches ++;
+    
+    // Sealed, but the record runs one byte past the length
+    
+    KVFormat (&kvstoreStore);
+    (void) KVSet (&kvstoreStore, "drift", uiDrift, sizeof (uiDrift));
+    kvstoreStore.m_uiImage [KV_HEADER_LENGTH + 1] ++;
+    BenchKVSeal (&kvstoreStore, kvstoreStore.m_uiImage [KV_LENGTH_OFFSET]);
+    if (KVIsValid (&kvstoreStore) || (KVGet (&kvstoreStore, "drift", &pValue) >= 0))
+        nMismatches ++;
+    
+    // Sealed, but the key is empty
+    
+    KVFormat (&kvstoreStore);
+    kvstoreStore.m_uiImage [KV_HEADER_LENGTH] = 0;
+    kvstoreStore.m_uiImage [KV_HEADER_LENGTH + 1] = 1;
+    kvstoreStore.m_uiImage [KV_HEADER_LENGTH + KV_RECORD_HEADER] = 0;
+    BenchKVSeal (&kvstoreStore, KV_RECORD_HEADER + 1);
+    if (KVIsValid (&kvstoreStore))
+        nMismatches ++;
+    
+    // Well formed, and the seal here agrees with the store's, until a byte changes under it
+    
+    KVFormat (&kvstoreStore);
+    (void) KVSet (&kvstoreStore, "drift", uiDrift, sizeof (uiDrift));
+    BenchKVSeal (&kvstoreStore, kvstoreStore.m_uiImage [KV_LENGTH_OFFSET]);
+    if (! KVIsValid (&kvstoreStore))
+        nMismatches ++;
+    kvstoreStore.m_uiImage [KV_HEADER_LENGTH + KV_RECORD_HEADER + 5] ^= 0x01;
+    if (KVIsValid (&kvstoreStore))
+        nMismatches ++;
+    
+    (void) fprintf (fileBenchLog, "Checked the key/value store and 3 malformed images: %d mismatches.\n", nMismatches);
+    return (nMismatches == 0);
+}
+
+/*
+** The benchmarks. Each runs its operation lRounds times and returns a checksum of the results, so the compiler
+** cannot throw the work away (and a change in behaviour shows up as a change in checksum). Those that use the
+** bus leave how long it spent on it in nsBenchBusTime
+*/
+
+/* static uint32_t BenchLegacyDecode (long lRounds)
+** static uint32_t BenchCodecDecode (long lRounds)
+** static uint32_t BenchTranslateToTm (long lRounds)
+**
+** Decoding the date/time registers - the bitfield code the codec replaced, the codec, and the function the
+** commands call
+*/
+
+static uint32_t BenchLegacyDecode (long lRounds)
+{
+    struct tm tmDateTime;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    bzero ((void *) &tmDateTime, sizeof (struct tm));
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        LegacyTranslateRTCDateTimeToTm (&datetimeBenchDumps [(lRound % BENCH_DUMPS)], &tmDateTime);
+        uiChecksum += tmDateTime.tm_sec + tmDateTime.tm_hour + tmDateTime.tm_mday + tmDateTime.tm_year;
+    }
+    
+    return uiChecksum;
+}
+
+static uint32_t BenchCodecDecode (long lRounds)
+{
+    struct tm tmDateTime;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    bzero ((void *) &tmDateTime, sizeof (struct tm));
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        CodecDecodeDateTime (CodecLoad ((void *) &datetimeBenchDumps [(lRound % BENCH_DUMPS)]), &tmDateTime);
+        uiChecksum += tmDateTime.tm_sec + tmDateTime.tm_hour + tmDateTime.tm_mday + tmDateTime.tm_year;
+    }
+    
+    return uiChecksum;
+}
+
+static uint32_t BenchTranslateToTm (long lRounds)
+{
+    struct tm tmDateTime;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    bzero ((void *) &tmDateTime, sizeof (struct tm));
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        TranslateRTCDateTimeToTm (&datetimeBenchDumps [(lRound % BENCH_DUMPS)], &tmDateTime);
+        uiChecksum += tmDateTime.tm_sec + tmDateTime.tm_hour + tmDateTime.tm_mday + tmDateTime.tm_year;
+    }
+    
+    return uiChecksum;
+}
+
+/* static uint32_t BenchLegacyEncode (long lRounds)
+** static uint32_t BenchCodecEncode (long lRounds)
+** static uint32_t BenchTranslateFromTm (long lRounds)
+**
+** And encoding them
+*/
+
+static uint32_t BenchLegacyEncode (long lRounds)
+{
+    struct mcp7940n_datetime datetimeRTCClock;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    bzero ((void *) &datetimeRTCClock, sizeof (datetimeRTCClock));
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        LegacyTranslateTmToRTCDateTime (&tmBenchDates [(lRound % BENCH_DUMPS)], &datetimeRTCClock);
+        uiChecksum += ((uint8_t *) &datetimeRTCClock) [0] + ((uint8_t *) &datetimeRTCClock) [6];
+    }
+    
+    return uiChecksum;
+}
+
+static uint32_t BenchCodecEncode (long lRounds)
+{
+    struct mcp7940n_datetime datetimeRTCClock;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    bzero ((void *) &datetimeRTCClock, sizeof (datetimeRTCClock));
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        CodecStore (CodecEncodeDateTime (&tmBenchDates [(lRound % BENCH_DUMPS)], CodecLoad ((void *) &datetimeRTCClock)), (void *) &datetimeRTCClock);
+        uiChecksum += ((uint8_t *) &datetimeRTCClock) [0] + ((uint8_t *) &datetimeRTCClock) [6];
+    }
+    
+    return uiChecksum;
+}
+
+static uint32_t BenchTranslateFromTm (long lRounds)
+{
+    struct mcp7940n_datetime datetimeRTCClock;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    bzero ((void *) &datetimeRTCClock, sizeof (datetimeRTCClock));
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        TranslateTmToRTCDateTime (&tmBenchDates [(lRound % BENCH_DUMPS)], &datetimeRTCClock);
+        uiChecksum += ((uint8_t *) &datetimeRTCClock) [0] + ((uint8_t *) &datetimeRTCClock) [6];
+    }
+    
+    return uiChecksum;
+}
+
+/* static uint32_t BenchTimegm (long lRounds)
+** static uint32_t BenchCivilToEpoch (long lRounds)
+** static uint32_t BenchGmtime (long lRounds)
+** static uint32_t BenchCivilFromEpoch (long lRounds)
+**
+** Converting to and from seconds, with the C library and the civil date layer
+*/
+
+static uint32_t BenchTimegm (long lRounds)
+{
+    struct tm tmDateTime;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        tmDateTime = tmBenchDates [(lRound % BENCH_DUMPS)];
+        uiChecksum += (uint32_t) timegm (&tmDateTime);
+    }
+    
+    return uiChecksum;
+}
+
+static uint32_t BenchCivilToEpoch (long lRounds)
+{
+    struct tm tmDateTime;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        tmDateTime = tmBenchDates [(lRound % BENCH_DUMPS)];
+        uiChecksum += (uint32_t) CivilToEpoch (&tmDateTime);
+    }
+    
+    return uiChecksum;
+}
+
+static uint32_t BenchGmtime (long lRounds)
+{
+    struct tm tmDateTime;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        (void) gmtime_r (&timeBenchTimes [(lRound % BENCH_DUMPS)], &tmDateTime);
+        uiChecksum += tmDateTime.tm_sec + tmDateTime.tm_wday + tmDateTime.tm_mday + tmDateTime.tm_year;
+    }
+    
+    return uiChecksum;
+}
+
+static uint32_t BenchCivilFromEpoch (long lRounds)
+{
+    struct tm tmDateTime;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        CivilFromEpoch (timeBenchTimes [(lRound % BENCH_DUMPS)], &tmDateTime);
+        uiChecksum += tmDateTime.tm_sec + tmDateTime.tm_wday + tmDateTime.tm_mday + tmDateTime.tm_year;
+    }
+    
+    return uiChecksum;
+}
+
+/* static uint32_t BenchLibcSetChain (long lRounds)
+** static uint32_t BenchCivilSetChain (long lRounds)
+**
+** The chain setting the RTC from the command line used to go through: registers to UTC seconds, to local time
+** for the user's fields, back to seconds, and to UTC for the registers. And the same now, less the local time
+** step which only the command line parsing still needs
+*/
+
+static uint32_t BenchLibcSetChain (long lRounds)
+{
+    struct mcp7940n_datetime datetimeRTCClock;
+    struct tm tmDateTime;
+    time_t timeDateTime;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    bzero ((void *) &datetimeRTCClock, sizeof (datetimeRTCClock));
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        LegacyTranslateRTCDateTimeToTm (&datetimeBenchDumps [(lRound % BENCH_DUMPS)], &tmDateTime);
+        timeDateTime = timegm (&tmDateTime);
+        (void) localtime_r (&timeDateTime, &tmDateTime);
+        timeDateTime = mktime (&tmDateTime);
+        (void) gmtime_r (&timeDateTime, &tmDateTime);
+        LegacyTranslateTmToRTCDateTime (&tmDateTime, &datetimeRTCClock);
+        uiChecksum += ((uint8_t *) &datetimeRTCClock) [0] + ((uint8_t *) &datetimeRTCClock) [6];
+    }
+    
+    return uiChecksum;
+}
+
+static uint32_t BenchCivilSetChain (long lRounds)
+{
+    struct mcp7940n_datetime datetimeRTCClock;
+    time_t timeDateTime;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    bzero ((void *) &datetimeRTCClock, sizeof (datetimeRTCClock));
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        timeDateTime = CivilRegistersToEpoch (CodecLoad ((void *) &datetimeBenchDumps [(lRound % BENCH_DUMPS)]));
+        CodecStore (CivilEpochToRegisters (timeDateTime, CodecLoad ((void *) &datetimeRTCClock)), (void *) &datetimeRTCClock);
+        uiChecksum += ((uint8_t *) &datetimeRTCClock) [0] + ((uint8_t *) &datetimeRTCClock) [6];
+    }
+    
+    return uiChecksum;
+}
+
+/* static uint32_t BenchParse (long lRounds)
+**
+** Parsing the date/time given on the command line, cycling through every form of it
+*/
+
+static uint32_t BenchParse (long lRounds)
+{
+    struct tm tmDateTime;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        tmDateTime = tmBenchDates [(lRound % BENCH_DUMPS)];
+        if (ParseDateTimeArgument (szBenchDateTimes [(lRound % BENCH_PARSER_INPUTS)], &tmDateTime) == 0)
+            uiChecksum += tmDateTime.tm_sec + tmDateTime.tm_min + tmDateTime.tm_mday + tmDateTime.tm_year;
+    }
+    
+    return uiChecksum;
+}
+
+/* static uint32_t BenchFrameWrite (long lRounds, int nLength)
+**
+** Writing nLength bytes of the NVRAM through WriteI2CDeviceMemory, which builds a transaction for it on the
+** stack - the offset, then the caller's buffer, as the simulator can carry a write on without a start
+*/
+
+static uint32_t BenchFrameWrite (long lRounds, int nLength)
+{
+    struct sim_stats statsBefore, statsAfter;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    SimGetStats (&statsBefore);
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        uiBenchData [0] = (uint8_t) lRound;
+        if (WriteI2CDeviceMemory (busfdBench, SIM_DEFAULT_ADDRESS, MCP7940N_NVRAM_OFFSET, (void *) uiBenchData, nLength) == 0)
+            uiChecksum += nLength;
+    }
+    SimGetStats (&statsAfter);
+    nsBenchBusTime = statsAfter.m_nsBusTime - statsBefore.m_nsBusTime;
+    
+    return uiChecksum;
+}
+
+static uint32_t BenchFrameWrite1 (long lRounds) { return BenchFrameWrite (lRounds, 1); }
+static uint32_t BenchFrameWrite8 (long lRounds) { return BenchFrameWrite (lRounds, 8); }
+static uint32_t BenchFrameWrite64 (long lRounds) { return BenchFrameWrite (lRounds, 64); }
+
+/* static uint32_t BenchFrameCopy8 (long lRounds)
+**
+** The same write of eight bytes as a backend that cannot carry a write on has it sent - copied in behind its
+** offset in the transaction, and sent as one message
+*/
+
+static uint32_t BenchFrameCopy8 (long lRounds)
+{
+    uint32_t uiChecksum;
+    
+    bI2CBackendNoStart = false;
+    uiChecksum = BenchFrameWrite (lRounds, 8);
+    bI2CBackendNoStart = true;
+    
+    return uiChecksum;
+}
+
+/* static uint32_t BenchTransferWrite8 (long lRounds)
+**
+** The same write of eight bytes, from a buffer framed once up front, so that the difference from the above is
+** the cost of the framing
+*/
+
+static uint32_t BenchTransferWrite8 (long lRounds)
+{
+    struct sim_stats statsBefore, statsAfter;
+    uint8_t uiFramed [8 +1];
+    i2c_backend_msg i2cMsg[1];
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    uiFramed [0] = MCP7940N_NVRAM_OFFSET;
+    bcopy ((void *) uiBenchData, (void *) &(uiFramed [1]), 8);
+    I2CBackendMessage (&i2cMsg[0], SIM_DEFAULT_ADDRESS, I2C_BACKEND_WR, uiFramed, sizeof (uiFramed));
+    
+    SimGetStats (&statsBefore);
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        uiFramed [1] = (uint8_t) lRound;
+        if (I2CBackendTransfer (busfdBench, i2cMsg, 1) == 0)
+            uiChecksum += 8;
+    }
+    SimGetStats (&statsAfter);
+    nsBenchBusTime = statsAfter.m_nsBusTime - statsBefore.m_nsBusTime;
+    
+    return uiChecksum;
+}
+
+/* static int BenchRunCommand (int busfd, int nCommand, char *szArgument)
+**
+** Run one of rtcdate's commands, as main () would once it has parsed its arguments. szArgument is changed by
+** some of them, so it has to be the caller's to lose
+*/
+
+# define BENCH_COMMAND_GET          0       // (no arguments)
+# define BENCH_COMMAND_SET          1       // date/time
+# define BENCH_COMMAND_SET_COMPUTER 2       // -c
+# define BENCH_COMMAND_SET_CLOCK    3       // -s
+# define BENCH_COMMAND_PWRFAIL      4       // -p
+# define BENCH_COMMAND_PWRUP        5       // -u
+# define BENCH_COMMAND_NVRAM_READ   6       // -r
+# define BENCH_COMMAND_NVRAM_WRITE  7       // -w contents
+# define BENCH_COMMAND_SET_PRECISE  8       // -c -a
+# define BENCH_COMMAND_OPTION       9       // -o options
+# define BENCH_COMMAND_SLEW         10      // --slew
+# define BENCH_COMMAND_SET_TOLERANT 11      // -c -a --tolerance=ms
+# define BENCH_COMMAND_GET_CACHED   12      // --cache-ttl=secs
+
+static int BenchRunCommand (int busfd, int nCommand, char *szArgument)
+{
+    switch (nCommand) {
+    case BENCH_COMMAND_GET:             return HWGetTimeOfDay (busfd, I2CBusName (), SIM_DEFAULT_ADDRESS, false, false, 0, 0, stdout);
+    case BENCH_COMMAND_SET:             return HWSetTimeOfDay (busfd, SIM_DEFAULT_ADDRESS, szArgument, false, stdout);
+    case BENCH_COMMAND_SET_COMPUTER:
+        (void) HWDriftUpdate (busfd, SIM_DEFAULT_ADDRESS, (struct rtc_edge_reading *) 0);
+        return HWSetTimeOfDay (busfd, SIM_DEFAULT_ADDRESS, (char *) 0, true, stdout);
+    case BENCH_COMMAND_SET_CLOCK:       return HWGetTimeOfDay (busfd, I2CBusName (), SIM_DEFAULT_ADDRESS, false, true, 0, 0, stdout);
+    case BENCH_COMMAND_PWRFAIL:         return DisplayPowerFailTime (busfd, SIM_DEFAULT_ADDRESS, stdout);
+    case BENCH_COMMAND_PWRUP:           return DisplayPowerRestoreTime (busfd, SIM_DEFAULT_ADDRESS, stdout);
+    case BENCH_COMMAND_NVRAM_READ:      return ReadNVRAM (busfd, SIM_DEFAULT_ADDRESS, stdout);
+    case BENCH_COMMAND_NVRAM_WRITE:     return WriteNVRAM (busfd, SIM_DEFAULT_ADDRESS, szArgument, stdout);
+    case BENCH_COMMAND_SET_PRECISE:
+        (void) HWDriftUpdate (busfd, SIM_DEFAULT_ADDRESS, (struct rtc_edge_reading *) 0);
+        return HWSetTimeOfDayPrecise (busfd, SIM_DEFAULT_ADDRESS);
+    case BENCH_COMMAND_SET_TOLERANT:    return HWSetTimeOfDayIfDrifted (busfd, SIM_DEFAULT_ADDRESS, atoi (szArgument), true);
+    case BENCH_COMMAND_GET_CACHED:      return HWGetTimeOfDay (busfd, I2CBusName (), SIM_DEFAULT_ADDRESS, false, false, 0, atoi (szArgument), stdout);
+    case BENCH_COMMAND_SLEW:
+        return HWDisciplineComputerClock (busfd, SIM_DEFAULT_ADDRESS, DISCIPLINE_DEFAULT_STEP_MSECS, 0, EDGE_DEFAULT_TIMEOUT_MSECS);
+    default:                            return ProcessHWClockOption (busfd, SIM_DEFAULT_ADDRESS, szArgument, stdout);
+    }
+}
+
+/* static void BenchQuiet (bool bQuiet)
+**
+** Throw away what the commands display, and then put stdout back
+*/
+
+static void BenchQuiet (bool bQuiet)
+{
+    static int nStdout = -1;
+    
+    (void) fflush (stdout);
+    if (bQuiet) {
+        if (((nStdout = dup (STDOUT_FILENO)) < 0) || (dup2 (nBenchNull, STDOUT_FILENO) < 0)) {
+            (void) perror ("dup");
+            exit (1);
+        }
+    }
+    else {
+        (void) dup2 (nStdout, STDOUT_FILENO);
+        (void) close (nStdout);
+    }
+}
+
+/* static uint32_t BenchCommand (long lRounds, int nCommand)
+**
+** A command from end to end, as rtcdate runs it after parsing its arguments - open and probe the bus, the
+** command, and close. Each starts without a snapshot of the registers, as a new rtcdate would, and what the
+** commands display is thrown away
+*/
+
+static uint32_t BenchCommand (long lRounds, int nCommand)
+{
+    struct sim_stats statsCommand;
+    char szArgument [32 +1];
+    uint32_t uiChecksum = 0;
+    long lRound;
+    int busfd, nStatus;
+    
+    BenchQuiet (true);
+    for (lRound = 0, nsBenchBusTime = 0; lRound < lRounds; lRound ++) {
+        SnapshotInvalidate ();
+        if ((busfd = OpenI2CDevice ((char *) 0, SIM_DEFAULT_ADDRESS)) < 0)
+            exit (1);
+        
+        switch (nCommand) {
+        case BENCH_COMMAND_SET:
+            (void) strcpy (szArgument, szBenchDateTimes [(lRound % BENCH_PARSER_INPUTS)]);
+            break;
+        case BENCH_COMMAND_OPTION:
+            (void) strcpy (szArgument, "status");
+            break;
+        default:
+            (void) snprintf (szArgument, sizeof (szArgument), "rtcbench %ld", (lRound % 10));
+            break;
+        }
+        nStatus = BenchRunCommand (busfd, nCommand, szArgument);
+        
+        SimGetStats (&statsCommand);
+        nsBenchBusTime += statsCommand.m_nsBusTime;
+        uiChecksum += (uint32_t) (nStatus + 1 + statsCommand.m_lBytesRead + statsCommand.m_lBytesWritten);
+        (void) CloseI2CDevice (busfd);
+    }
+    BenchQuiet (false);
+    
+    return uiChecksum;
+}
+
+static uint32_t BenchCommandGet (long lRounds) { return BenchCommand (lRounds, BENCH_COMMAND_GET); }
+static uint32_t BenchCommandSet (long lRounds) { return BenchCommand (lRounds, BENCH_COMMAND_SET); }
+static uint32_t BenchCommandPwrFail (long lRounds) { return BenchCommand (lRounds, BENCH_COMMAND_PWRFAIL); }
+static uint32_t BenchCommandStatus (long lRounds) { return BenchCommand (lRounds, BENCH_COMMAND_OPTION); }
+static uint32_t BenchCommandNVRAM (long lRounds) { return BenchCommand (lRounds, BENCH_COMMAND_NVRAM_WRITE); }
+
+/* static uint32_t BenchTimePageSnapshot (long lRounds)
+** static uint32_t BenchTimePageNow (long lRounds)
+**
+** Reading the time page, as a program would with RTCTimePage.h: copying it under the sequence count, and
+** working out the RTC's time now from it
+*/
+
+static void BenchTimePagePublish (void)
+{
+    struct rtc_time_page pageReading;
+    
+    bzero ((void *) &pageReading, sizeof (struct rtc_time_page));
+    pageReading.m_uiFlags = TIMEPAGE_FLAG_OSCRUN | TIMEPAGE_FLAG_VBATEN | TIMEPAGE_FLAG_DRIFT;
+    pageReading.m_nsRTCTime = 1700000000LL * NSEC_PER_SEC;
+    pageReading.m_nsMonotonic = TimingNow (CLOCK_MONOTONIC);
+    pageReading.m_nsUncertainty = NSEC_PER_MSEC;
+    pageReading.m_nDriftPPB = 1500;
+    pageReading.m_nDriftSpreadPPB = 200;
+    
+    pageBench.m_uiMagic = TIMEPAGE_MAGIC;
+    pageBench.m_uiVersion = TIMEPAGE_VERSION;
+    pageBench.m_nIntervalSecs = 1;
+    TimePagePublish (&pageBench, &pageReading);
+}
+
+static uint32_t BenchTimePageSnapshot (long lRounds)
+{
+    struct rtc_time_page pageCopy;
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    BenchTimePagePublish ();
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        (void) TimePageSnapshot (&pageBench, &pageCopy);
+        uiChecksum += (uint32_t) pageCopy.m_nsMonotonic;
+    }
+    return uiChecksum;
+}
+
+static uint32_t BenchTimePageNow (long lRounds)
+{
+    struct rtc_time_page_now nowRTC = { 0, 0, 0 };       // TimePageNow leaves it alone if the page is not ready
+    uint32_t uiChecksum = 0;
+    long lRound;
+    
+    BenchTimePagePublish ();
+    for (lRound = 0; lRound < lRounds; lRound ++) {
+        (void) TimePageNow (&pageBench, &nowRTC);
+        uiChecksum += nowRTC.m_uiFlags;
+    }
+    return uiChecksum;
+}
+
+/*
+** Every benchmark, in the order they are run and reported. The operations on the bus and the commands are far
+** slower than the conversions, so they run fewer rounds
+*/
+
+static struct bench {
+    char        *m_szGroup;
+    char        *m_szName;
+    long        m_lRoundsDivisor;
+    uint32_t    (*m_pBenchFunc) (long lRounds);
+} benchAll [] = {
+    { "codec", "legacy decode", 1, BenchLegacyDecode },
+    { "codec", "codec decode", 1, BenchCodecDecode },
+    { "codec", "translate to tm", 1, BenchTranslateToTm },
+    { "codec", "legacy encode", 1, BenchLegacyEncode },
+    { "codec", "codec encode", 1, BenchCodecEncode },
+    { "codec", "translate from tm", 1, BenchTranslateFromTm },
+    { "civil", "timegm", 1, BenchTimegm },
+    { "civil", "civil to epoch", 1, BenchCivilToEpoch },
+    { "civil", "gmtime_r", 1, BenchGmtime },
+    { "civil", "civil from epoch", 1, BenchCivilFromEpoch },
+    { "civil", "libc set chain", 1, BenchLibcSetChain },
+    { "civil", "civil set chain", 1, BenchCivilSetChain },
+    { "parse", "parse date/time", 1, BenchParse },
+    { "frame", "write 1 framed", 100, BenchFrameWrite1 },
+    { "frame", "write 8 framed", 100, BenchFrameWrite8 },
+    { "frame", "write 8 copied", 100, BenchFrameCopy8 },
+    { "frame", "write 8 unframed", 100, BenchTransferWrite8 },
+    { "frame", "write 64 framed", 100, BenchFrameWrite64 },
+    { "timepage", "timepage snapshot", 1, BenchTimePageSnapshot },
+    { "timepage", "timepage now", 10, BenchTimePageNow },
+    { "command", "get", 10000, BenchCommandGet },
+    { "command", "set", 10000, BenchCommandSet },
+    { "command", "pwrfail", 10000, BenchCommandPwrFail },
+    { "command", "status", 10000, BenchCommandStatus },
+    { "command", "nvram write", 10000, BenchCommandNVRAM },
+    { (char *) 0, (char *) 0, 0, 0 }
+};
+
+/* static int BenchCompare (const void *lpFirst, const void *lpSecond)
+**
+** For sorting the times of the repeats
+*/
+
+static int BenchCompare (const void *lpFirst, const void *lpSecond)
+{
+    double dFirst = *((const double *) lpFirst), dSecond = *((const double *) lpSecond);
+    
+    return ((dFirst < dSecond) ? -1 : ((dFirst > dSecond) ? 1 : 0));
+}
+
+/* static void BenchRun (struct bench *pBench, long lRounds, int nRepeats, int nFormat, bool bFirst)
+**
+** Run a benchmark nRepeats times, and report the fastest and the median time per operation. Only the median of
+** an odd number of repeats is a time we actually measured
+*/
+
+static void BenchRun (struct bench *pBench, long lRounds, int nRepeats, int nFormat, bool bFirst)
+{
+    double dTimes [BENCH_MAX_REPEATS], dBusTime = 0;
+    uint32_t uiChecksum = 0;
+    int64_t nsStart;
+    int nRepeat;
+    
+    lRounds = ((lRounds / pBench ->m_lRoundsDivisor) > 0 ? (lRounds / pBench ->m_lRoundsDivisor) : 1);
+    
+    for (nRepeat = 0; nRepeat < nRepeats; nRepeat ++) {
+        nsBenchBusTime = 0;
+        nsStart = TimingNow (CLOCK_MONOTONIC);
+        uiChecksum = (*pBench ->m_pBenchFunc) (lRounds);
+        dTimes [nRepeat] = (double) (TimingNow (CLOCK_MONOTONIC) - nsStart) / lRounds;
+        dBusTime = (double) nsBenchBusTime / lRounds;
+    }
+    qsort ((void *) dTimes, nRepeats, sizeof (double), BenchCompare);
+    
+    switch (nFormat) {
+    case BENCH_FORMAT_CSV:
+        (void) printf ("%s,%s,%ld,%d,%.2f,%.2f,%.0f,%08x\n", pBench ->m_szGroup, pBench ->m_szName, lRounds, nRepeats,
+                       dTimes [0], dTimes [(nRepeats / 2)], dBusTime, uiChecksum);
+        break;
+    case BENCH_FORMAT_JSON:
+        (void) printf ("%s\n    {\"group\":\"%s\",\"name\":\"%s\",\"rounds\":%ld,\"repeats\":%d,\"min_ns_per_op\":%.2f,\"median_ns_per_op\":%.2f,"
+                       "\"bus_ns_per_op\":%.0f,\"checksum\":\"%08x\"}", (bFirst ? "" : ","), pBench ->m_szGroup, pBench ->m_szName,
+                       lRounds, nRepeats, dTimes [0], dTimes [(nRepeats / 2)], dBusTime, uiChecksum);
+        break;
+    default:
+        (void) printf ("%-8s %-18s %12.2f ns/op  median %12.2f", pBench ->m_szGroup, pBench ->m_szName, dTimes [0], dTimes [(nRepeats / 2)]);
+        if (dBusTime > 0)
+            (void) printf ("  bus %10.0f ns/op", dBusTime);
+        (void) printf ("  (%ld ops x %d, checksum %08x)\n", lRounds, nRepeats, uiChecksum);
+        break;
+    }
+    (void) fflush (stdout);
+}
+
+/*
+** What each of rtcdate's modes may cost on the bus, from a fresh simulator, with the bus already found (the
+** first mode finds it, and discovery is not traced). The simulator runs in lockstep with our clocks, so the edge
+** reads poll and sleep the same way every time. The transactions, bytes and sleeps are what the modes take
+** today, with a couple of polls to spare where there is an edge read, so any change that adds to them shows
+** up. A mode that keeps the state (the drift, and the read cache) runs after the one before it, as a second -c
+** would. The RTC starts years away from the computer clock, so --tolerance always finds it out and sets it
+*/
+
+static struct budget {
+    char        *m_szMode;              // As it would be given to rtcdate
+    int         m_nCommand;
+    char        *m_szArgument;
+    bool        m_bKeepState;           // Leave the drift state and read cache from the mode before
+    long        m_lMaxTransactions;
+    long        m_lMaxBytes;
+    int64_t     m_nsMaxSleeps;
+} budgetAll [] = {
+    { "(get)", BENCH_COMMAND_GET, "", false, 2, 32, 0 },
+    { "YYMMDDhhmm", BENCH_COMMAND_SET, "2311221333", false, 8, 45, 2 * NSEC_PER_MSEC },
+    { "-s", BENCH_COMMAND_SET_CLOCK, "", false, 2, 32, 0 },
+    { "-c", BENCH_COMMAND_SET_COMPUTER, "", false, 8, 45, 2 * NSEC_PER_MSEC },
+    { "-c (drift known)", BENCH_COMMAND_SET_COMPUTER, "", true, 65, 108, 2981 * NSEC_PER_MSEC },
+    { "-c -a", BENCH_COMMAND_SET_PRECISE, "", false, 66, 109, 3953 * NSEC_PER_MSEC },
+    { "-c -a --tolerance=50", BENCH_COMMAND_SET_TOLERANT, "50", true, 66, 109, 3976 * NSEC_PER_MSEC },
+    { "--cache-ttl=60", BENCH_COMMAND_GET_CACHED, "60", false, 60, 96, 2980 * NSEC_PER_MSEC },
+    { "--cache-ttl=60 (hit)", BENCH_COMMAND_GET_CACHED, "60", true, 1, 0, 0 },
+    { "--slew", BENCH_COMMAND_SLEW, "", false, 60, 96, 2980 * NSEC_PER_MSEC },
+    { "-p", BENCH_COMMAND_PWRFAIL, "", false, 2, 32, 0 },
+    { "-u", BENCH_COMMAND_PWRUP, "", false, 2, 32, 0 },
+    { "-r", BENCH_COMMAND_NVRAM_READ, "", false, 2, 64, 0 },
+    { "-w", BENCH_COMMAND_NVRAM_WRITE, "rtcbench budget", false, 4, 94, 0 },
+    { "-o init", BENCH_COMMAND_OPTION, "init", false, 9, 46, 2 * NSEC_PER_MSEC },
+    { "-o bat", BENCH_COMMAND_OPTION, "bat", false, 2, 32, 0 },
+    { "-o nobat", BENCH_COMMAND_OPTION, "nobat", false, 3, 33, 0 },
+    { "-o batset", BENCH_COMMAND_OPTION, "batset", false, 2, 32, 0 },
+    { "-o cal", BENCH_COMMAND_OPTION, "cal", false, 3, 33, 0 },
+    { "-o clrnvram", BENCH_COMMAND_OPTION, "clrnvram", false, 2, 64, 0 },
+    { "-o control", BENCH_COMMAND_OPTION, "control", false, 2, 32, 0 },
+    { "-o osc", BENCH_COMMAND_OPTION, "osc", false, 3, 33, 2 * NSEC_PER_MSEC },
+    { "-o noosc", BENCH_COMMAND_OPTION, "noosc", false, 4, 34, 1 * NSEC_PER_MSEC },
+    { "-o oscset", BENCH_COMMAND_OPTION, "oscset", false, 2, 32, 0 },
+    { "-o oscstat", BENCH_COMMAND_OPTION, "oscstat", false, 2, 32, 0 },
+    { "-o pwrstat", BENCH_COMMAND_OPTION, "pwrstat", false, 2, 32, 0 },
+    { "-o clrpwr", BENCH_COMMAND_OPTION, "clrpwr", false, 3, 33, 0 },
+    { "-o status", BENCH_COMMAND_OPTION, "status", false, 2, 32, 0 },
+    { "-o drift", BENCH_COMMAND_OPTION, "drift", false, 2, 32, 0 },
+    { "-o osc,bat,clrpwr", BENCH_COMMAND_OPTION, "osc,bat,clrpwr", false, 3, 33, 2 * NSEC_PER_MSEC },
+    { (char *) 0, 0, (char *) 0, false, 0, 0, 0 }
+};
+
+/* static int BenchBudgets (int nFormat)
+**
+** Run each of rtcdate's modes once, count what it did on the bus with the trace, and check it against its
+** budget. Returns the number of modes over budget (or that failed)
+*/
+
+static int BenchBudgets (int nFormat)
+{
+    struct budget *pBudget;
+    struct i2c_trace_phase phaseTotal;
+    char szArgument [32 +1];
+    int busfd, nStatus, nOver = 0;
+    bool bOver, bFirst = true;
+    
+    if (nFormat == BENCH_FORMAT_CSV)
+        (void) printf ("mode,status,transactions,max_transactions,bytes,max_bytes,sleep_ns,max_sleep_ns,result\n");
+    else if (nFormat == BENCH_FORMAT_JSON)
+        (void) printf ("{\"rtcbench\":%d,\"budgets\":[", BENCH_VERSION);
+    else
+        (void) printf ("%-20s %6s %14s %14s %24s  %s\n", "mode", "status", "transactions", "bytes", "sleep (us)", "result");
+    
+    I2CDiscoverForget ();
+    
+    for (pBudget = budgetAll; pBudget ->m_szMode != (char *) 0; pBudget ++) {
+        if (! pBudget ->m_bKeepState) {
+            (void) unlink (DRIFT_STATE_PATH);
+            CacheForget ();
+        }
+        SnapshotInvalidate ();
+        (void) strcpy (szArgument, pBudget ->m_szArgument);
+        
+        // Everything from opening the bus to closing it counts, as it would for rtcdate
+        
+        BenchQuiet (true);
+        (void) I2CTraceConfigure (I2C_TRACE_FORMAT_NONE, I2C_TRACE_FORMAT_QUIET, TimingNow (CLOCK_MONOTONIC));
+        if ((busfd = OpenI2CDevice ((char *) 0, SIM_DEFAULT_ADDRESS)) >= 0) {
+            nStatus = BenchRunCommand (busfd, pBudget ->m_nCommand, szArgument);
+            (void) CloseI2CDevice (busfd);
+        }
+        else
+            nStatus = -1;
+        I2CTraceTotal (&phaseTotal);
+        (void) I2CTraceConfigure (I2C_TRACE_FORMAT_NONE, I2C_TRACE_FORMAT_NONE, 0);
+        BenchQuiet (false);
+        
+        bOver = ((nStatus < 0) || (phaseTotal.m_lTransactions > pBudget ->m_lMaxTransactions) ||
+                 ((phaseTotal.m_lBytesRead + phaseTotal.m_lBytesWritten) > pBudget ->m_lMaxBytes) ||
+                 (phaseTotal.m_nsSleeps > pBudget ->m_nsMaxSleeps));
+        nOver += (bOver ? 1 : 0);
+        
+        switch (nFormat) {
+        case BENCH_FORMAT_CSV:
+            (void) printf ("%s,%d,%ld,%ld,%ld,%ld,%lld,%lld,%s\n", pBudget ->m_szMode, nStatus, phaseTotal.m_lTransactions,
+                           pBudget ->m_lMaxTransactions, phaseTotal.m_lBytesRead + phaseTotal.m_lBytesWritten, pBudget ->m_lMaxBytes,
+                           (long long) phaseTotal.m_nsSleeps, (long long) pBudget ->m_nsMaxSleeps, (bOver ? "FAIL" : "PASS"));
+            break;
+        case BENCH_FORMAT_JSON:
+            (void) printf ("%s\n    {\"mode\":\"%s\",\"status\":%d,\"transactions\":%ld,\"max_transactions\":%ld,\"bytes\":%ld,"
+                           "\"max_bytes\":%ld,\"sleep_ns\":%lld,\"max_sleep_ns\":%lld,\"pass\":%s}", (bFirst ? "" : ","),
+                           pBudget ->m_szMode, nStatus, phaseTotal.m_lTransactions, pBudget ->m_lMaxTransactions,
+                           phaseTotal.m_lBytesRead + phaseTotal.m_lBytesWritten, pBudget ->m_lMaxBytes,
+                           (long long) phaseTotal.m_nsSleeps, (long long) pBudget ->m_nsMaxSleeps, (bOver ? "false" : "true"));
+            break;
+        default:
+            (void) printf ("%-20s %6d %6ld / %-5ld %6ld / %-5ld %11lld / %-10lld  %s\n", pBudget ->m_szMode, nStatus,
+                           phaseTotal.m_lTransactions, pBudget ->m_lMaxTransactions,
+                           phaseTotal.m_lBytesRead + phaseTotal.m_lBytesWritten, pBudget ->m_lMaxBytes,
+                           (long long) (phaseTotal.m_nsSleeps / NSEC_PER_USEC), (long long) (pBudget ->m_nsMaxSleeps / NSEC_PER_USEC),
+                           (bOver ? "FAIL" : "PASS"));
+            break;
+        }
+        (void) fflush (stdout);
+        bFirst = false;
+    }
+    
+    if (nFormat == BENCH_FORMAT_JSON)
+        (void) printf ("\n]}\n");
+    else if (nFormat == BENCH_FORMAT_TEXT)
+        (void) printf ("%d mode%s over budget.\n", nOver, (nOver == 1 ? "" : "s"));
+    
+    (void) unlink (DRIFT_STATE_PATH);
+    CacheForget ();
+    return nOver;
+}
+
+/* static int BenchShm (int nUnit)
+**
+** Stand in for ntpd: run --shm and --timepage in a child against the simulator, and read the samples it
+** publishes from the segment for nUnit the way ntpd's SHM driver does. Each must be a new second, with the
+** RTC's offset from the computer clock that the simulator was set up with (to within the precision published).
+** With each, the time page must give the RTC's time now with the same offset (to within its uncertainty).
+** Returns 0 if they all are
+*/
+
+static int BenchShm (int nUnit)
+{
+    struct shm_sample sampleRead;
+    struct shm_time *pShm;
+    const struct rtc_time_page *pTimePage = (const struct rtc_time_page *) 0;
+    struct rtc_time_page_now nowRTC;
+    int64_t nsDeadline, nsLastClockTime = 0, nsOffset, nsPrecision, nsRealtime;
+    pid_t pidPublisher;
+    int busfd, nSamples = 0, nBad = 0;
+    
+    if ((pShm = ShmAttach (nUnit)) == (struct shm_time *) 0) {
+        (void) perror ("rtcbench");
+        return 1;
+    }
+    
+    // Anything left in the segment from before is not ours
+    
+    pShm ->m_nValid = 0;
+    (void) unlink (BENCH_TIMEPAGE_PATH);
+    
+    if ((pidPublisher = fork ()) < 0) {
+        (void) perror ("rtcbench");
+        return 1;
+    }
+    
+    if (pidPublisher == 0) {
+        if ((busfd = OpenI2CDevice ((char *) 0, SIM_DEFAULT_ADDRESS)) < 0)
+            _exit (1);
+        _exit ((HWPublishRTC (busfd, SIM_DEFAULT_ADDRESS, nUnit, BENCH_TIMEPAGE_PATH, 1, EDGE_DEFAULT_TIMEOUT_MSECS) < 0) ? 1 : 0);
+    }
+    
+    // The first sample takes a full search for the edge, so allow for that as well as one a second after it
+    
+    nsDeadline = TimingNow (CLOCK_MONOTONIC) + ((int64_t) (BENCH_SHM_SAMPLES + 5) * NSEC_PER_SEC);
+    while ((nSamples < BENCH_SHM_SAMPLES) && (TimingNow (CLOCK_MONOTONIC) < nsDeadline)) {
+        (void) TimingSleepUntil (CLOCK_MONOTONIC, TimingNow (CLOCK_MONOTONIC) + (100 * NSEC_PER_MSEC), 0);
+        if (ShmConsume (pShm, &sampleRead) < 0) {
+            if (errno == EAGAIN)
+                continue;
+            (void) printf ("Sample changed while it was being read.\n");
+            continue;
+        }
+        
+        nsOffset = sampleRead.m_nsClockTime - sampleRead.m_nsReceiveTime;
+        nsPrecision = ((sampleRead.m_nPrecision < 0) ? (NSEC_PER_SEC >> -sampleRead.m_nPrecision) : NSEC_PER_SEC);
+        (void) printf ("clock %lld.%09lld  receive %lld.%09lld  offset %+.3f ms  precision 2^%d s\n",
+                       (long long) (sampleRead.m_nsClockTime / NSEC_PER_SEC), (long long) (sampleRead.m_nsClockTime % NSEC_PER_SEC),
+                       (long long) (sampleRead.m_nsReceiveTime / NSEC_PER_SEC), (long long) (sampleRead.m_nsReceiveTime % NSEC_PER_SEC),
+                       ((double) nsOffset / NSEC_PER_MSEC), sampleRead.m_nPrecision);
+        
+        if ((sampleRead.m_nsClockTime <= nsLastClockTime) || (llabs (nsOffset - BENCH_SHM_OFFSET_NSECS) > nsPrecision))
+            nBad ++;
+        
+        // The publisher created the time page before it started looking for the edge
+        
+        if (pTimePage == (const struct rtc_time_page *) 0)
+            pTimePage = TimePageOpen (BENCH_TIMEPAGE_PATH);
+        if ((pTimePage == (const struct rtc_time_page *) 0) || (TimePageNow (pTimePage, &nowRTC) != TIMEPAGE_OK))
+            nBad ++;
+        else {
+            nsRealtime = TimingNow (CLOCK_REALTIME);
+            nsOffset = nowRTC.m_nsRTCTime - nsRealtime;
+            (void) printf ("time page %+.3f ms (+/- %.3f ms)  flags 0x%02x\n", ((double) nsOffset / NSEC_PER_MSEC),
+                           ((double) nowRTC.m_nsUncertainty / NSEC_PER_MSEC), nowRTC.m_uiFlags);
+            if (llabs (nsOffset - BENCH_SHM_OFFSET_NSECS) > (nowRTC.m_nsUncertainty + NSEC_PER_MSEC))
+                nBad ++;
+        }
+        nsLastClockTime = sampleRead.m_nsClockTime;
+        nSamples ++;
+    }
+    
+    (void) kill (pidPublisher, SIGTERM);
+    (void) waitpid (pidPublisher, (int *) 0, 0);
+    ShmDetach (pShm);
+    if (pTimePage != (const struct rtc_time_page *) 0)
+        TimePageClose (pTimePage);
+    (void) unlink (BENCH_TIMEPAGE_PATH);
+    
+    (void) printf ("%d sample%s read, %d bad: %s\n", nSamples, ((nSamples == 1) ? "" : "s"), nBad,
+                   (((nSamples == BENCH_SHM_SAMPLES) && (nBad == 0)) ? "PASS" : "FAIL"));
+    return (((nSamples == BENCH_SHM_SAMPLES) && (nBad == 0)) ? 0 : 1);
+}
+
+/* static void BenchUsage (void)
+**
+** How to run rtcbench
+*/
+
+static void BenchUsage (void)
+{
+    (void) fprintf (stderr, "usage: rtcbench [-f text|csv|json] [-g group] [-n rounds] [-r repeats] [-s rtcsim-settings]\n");
+    (void) fprintf (stderr, "       rtcbench -b [-f text|csv|json] [-s rtcsim-settings]\n");
+    (void) fprintf (stderr, "       rtcbench -m unit\n");
+}
+
+/* int main (int argc, char **argv)
+**
+** The entry point for rtcbench. The commands run against the simulator, in virtual time from a fixed date
+** unless -s says otherwise, and in UTC, so that every run does the same work. -g runs just one group, and -b
+** checks each of rtcdate's modes against its budget instead, exiting with 1 if any is over. -m reads what
+** --shm publishes in the NTP shared memory segment for the unit given, exiting with 1 if it is wrong
+*/
+
+int main (int argc, char **argv)
+{
+    struct bench *pBench;
+    char *szGroup = (char *) 0, *szSimSettings = (char *) 0;
+    long lRounds = BENCH_DEFAULT_ROUNDS;
+    int ch, nRepeats = BENCH_DEFAULT_REPEATS, nFormat = BENCH_FORMAT_TEXT, nShmUnit = -1;
+    bool bFirst = true, bBudgets = false;
+    
+    while ((ch = getopt (argc, argv, "bf:g:m:n:r:s:")) != -1) {
+        switch (ch) {
+        case 'b':
+            bBudgets = true;
+            break;
+        case 'f':
+            if (strcmp (optarg, "csv") == 0)
+                nFormat = BENCH_FORMAT_CSV;
+            else if (strcmp (optarg, "json") == 0)
+                nFormat = BENCH_FORMAT_JSON;
+            else if (strcmp (optarg, "text") == 0)
+                nFormat = BENCH_FORMAT_TEXT;
+            else {
+                BenchUsage ();
+                return 1;
+            }
+            break;
+        case 'g':
+            szGroup = optarg;
+            break;
+        case 'm':
+            nShmUnit = (int) strtol (optarg, (char **) 0, 0);
+            if ((nShmUnit < 0) || (nShmUnit > SHM_MAX_UNIT)) {
+                BenchUsage ();
+                return 1;
+            }
+            break;
+        case 'n':
+            lRounds = strtol (optarg, (char **) 0, 0);
+            break;
+        case 'r':
+            nRepeats = (int) strtol (optarg, (char **) 0, 0);
+            break;
+        case 's':
+            szSimSettings = optarg;
+            break;
+        default:
+            BenchUsage ();
+            return 1;
+        }
+    }
+    
+    if ((lRounds <= 0) || (nRepeats <= 0) || (nRepeats > BENCH_MAX_REPEATS) || (optind != argc)) {
+        BenchUsage ();
+        return 1;
+    }
+    
+    // The checks go to stderr unless we are just displaying the results, so that the CSV or JSON is all that is
+    // on stdout
+    
+    fileBenchLog = ((nFormat == BENCH_FORMAT_TEXT) ? stdout : stderr);
+    
+    if (szSimSettings == (char *) 0)
+        szSimSettings = ((nShmUnit >= 0) ? BENCH_SHM_SIM : (bBudgets ? BENCH_BUDGET_SIM : BENCH_DEFAULT_SIM));
+    
+    (void) setenv ("TZ", "UTC", 1);
+    tzset ();
+    (void) setenv (SIM_ENVIRONMENT, szSimSettings, 1);
+    
+    if (nShmUnit >= 0)
+        return BenchShm (nShmUnit);
+    
+    if (bBudgets) {
+        if ((nBenchNull = open ("/dev/null", O_WRONLY)) < 0) {
+            (void) perror ("rtcbench");
+            return 1;
+        }
+        
+        return ((BenchBudgets (nFormat) == 0) ? 0 : 1);
+    }
+    
+    BenchMakeDumps ();
+    if ((! BenchCheck ()) || (! BenchCheckCivil ()) || (! BenchCheckParse ()) || (! BenchCheckDelta ()) || (! BenchCheckDrift ()) || (! BenchCheckKeyValue ()))
+        return 1;
+    
+    if (((nBenchNull = open ("/dev/null", O_WRONLY)) < 0) || ((busfdBench = OpenI2CDevice ((char *) 0, SIM_DEFAULT_ADDRESS)) < 0)) {
+        (void) perror ("rtcbench");
+        return 1;
+    }
+    
+    if (nFormat == BENCH_FORMAT_CSV)
+        (void) printf ("group,name,rounds,repeats,min_ns_per_op,median_ns_per_op,bus_ns_per_op,checksum\n");
+    else if (nFormat == BENCH_FORMAT_JSON)
+        (void) printf ("{\"rtcbench\":%d,\"sim\":\"%s\",\"results\":[", BENCH_VERSION, szSimSettings);
+    
+    for (pBench = benchAll; pBench ->m_szName != (char *) 0; pBench ++) {
+        if ((szGroup != (char *) 0) && (strcmp (szGroup, pBench ->m_szGroup) != 0))
+            continue;
+        
+        // The commands open the bus themselves, and the simulator starts afresh each time it is opened
+        
+        if ((strcmp (pBench ->m_szGroup, "command") == 0) && (busfdBench >= 0)) {
+            (void) CloseI2CDevice (busfdBench);
+            busfdBench = -1;
+        }
+        
+        BenchRun (pBench, lRounds, nRepeats, nFormat, bFirst);
+        bFirst = false;
+    }
+    
+    if (nFormat == BENCH_FORMAT_JSON)
+        (void) printf ("\n]}\n");
+    
+    return 0;
+}
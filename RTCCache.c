@@ -0,0 +1,286 @@
+/*
+**  RTCCache.c
+**
+**  This source file contains the read cache. Once the RTC has been read on the edge of a second we know what
+**  it reads at any later moment, by CLOCK_MONOTONIC, to within the crystal's drift - so until the reading is too
+**  old, or the computer clock jumps, we answer from it rather than the bus. Every so often a single byte read of
+**  RTCSEC checks that the RTC agrees. The reading is kept in a file, so rapid runs of rtcdate share it, and
+**  anything that writes the date/time registers deletes it.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <unistd.h>
+# include <errno.h>
+
+# include "PiFaceRTC.h"
+# include "I2CRoutines.h"
+# include "I2CDiscover.h"
+# include "RTCTiming.h"
+# include "RTCCodec.h"
+# include "RTCCivil.h"
+# include "RTCCache.h"
+
+/*
+** The reading, as it was at the edge, and when it was last checked against RTCSEC (by CLOCK_MONOTONIC). It is
+** of the RTC at m_nBusDevId on m_szBusName - the same address on another bus is another RTC
+*/
+
+static struct cache_entry {
+    char        m_szBusName [I2C_DISCOVER_NAME_SIZE];
+    int         m_nBusDevId;
+    uint64_t    m_uiRegisters;
+    int64_t     m_nsEdgeMonotonic;
+    int64_t     m_nsEdgeRealtime;
+    int64_t     m_nsUncertainty;
+    int64_t     m_nsConfirmed;
+} entryCache;
+
+/* static int CacheLoad (void)
+**
+** Read the reading we, or a previous run, left, if there is one. We read it every time rather than keeping it,
+** so that a long running process (rtcd) sees another run set the RTC
+*/
+
+static int CacheLoad (void)
+{
+    FILE                *fileCache;
+    unsigned long long  ullRegisters;
+    long long           llEdgeMonotonic, llEdgeRealtime, llUncertainty, llConfirmed;
+    char                szBusName [I2C_DISCOVER_NAME_SIZE];
+    int                 nBusDevId, nFields;
+    
+    if ((fileCache = fopen (CACHE_STATE_PATH, "r")) == (FILE *) 0)
+        return -1;
+    
+    nFields = fscanf (fileCache, "%63s %i %llx %lld %lld %lld %lld", szBusName, &nBusDevId, &ullRegisters, &llEdgeMonotonic, &llEdgeRealtime,
+                      &llUncertainty, &llConfirmed);
+    (void) fclose (fileCache);
+    if (nFields != 7)
+        return -1;
+    
+    (void) strcpy (entryCache.m_szBusName, szBusName);
+    entryCache.m_nBusDevId = nBusDevId;
+    entryCache.m_uiRegisters = (uint64_t) ullRegisters;
+    entryCache.m_nsEdgeMonotonic = (int64_t) llEdgeMonotonic;
+    entryCache.m_nsEdgeRealtime = (int64_t) llEdgeRealtime;
+    entryCache.m_nsUncertainty = (int64_t) llUncertainty;
+    entryCache.m_nsConfirmed = (int64_t) llConfirmed;
+    return 0;
+}
+
+/* static void CacheSave (void)
+**
+** Keep the reading for the next run. It is written aside and renamed into place, so that a run reading it at
+** the same moment sees all of the old one or all of the new. Only when root ran us: rtcdate may be setuid, and
+** then anyone could have us write the fixed path as root. Anyone else's next run just reads the RTC itself.
+** The simulator's path is the user's own, so it always saves
+*/
+
+static void CacheSave (void)
+{
+    FILE *fileCache;
+    char szTempPath [128 +1];
+    
+# if ! defined (RTCDATE_SIM)
+    if (getuid () != 0)
+        return;
+# endif
+    
+    (void) snprintf (szTempPath, sizeof (szTempPath), "%s.%d", CACHE_STATE_PATH, (int) getpid ());
+    if ((fileCache = fopen (szTempPath, "w")) == (FILE *) 0)
+        return;
+    
+    (void) fprintf (fileCache, "%s 0x%02x %016llx %lld %lld %lld %lld\n", entryCache.m_szBusName, entryCache.m_nBusDevId, (unsigned long long) entryCache.m_uiRegisters,
+                    (long long) entryCache.m_nsEdgeMonotonic, (long long) entryCache.m_nsEdgeRealtime,
+                    (long long) entryCache.m_nsUncertainty, (long long) entryCache.m_nsConfirmed);
+    if ((fclose (fileCache) != 0) || (rename (szTempPath, CACHE_STATE_PATH) < 0))
+        (void) unlink (szTempPath);
+}
+
+/* static int64_t CacheUncertainty (int64_t nsElapsed)
+**
+** How far out the extrapolation may be, nsElapsed after the edge
+*/
+
+static int64_t CacheUncertainty (int64_t nsElapsed)
+{
+    return entryCache.m_nsUncertainty + ((nsElapsed / 1000000) * CACHE_DRIFT_PPM);
+}
+
+/* static bool CacheHolds (char *szBusName, int nBusDevId, int nTtlSecs, int64_t nsMonotonic)
+**
+** Whether the reading is of nBusDevId on szBusName, and under nTtlSecs old at nsMonotonic. One from before
+** CLOCK_MONOTONIC started (an earlier boot) is no good either, and nor is any if we do not know the bus
+*/
+
+static bool CacheHolds (char *szBusName, int nBusDevId, int nTtlSecs, int64_t nsMonotonic)
+{
+    int64_t nsElapsed = nsMonotonic - entryCache.m_nsEdgeMonotonic;
+    
+    return ((szBusName != (char *) 0) && (strcmp (entryCache.m_szBusName, szBusName) == 0) &&
+            (entryCache.m_nBusDevId == nBusDevId) && (nsElapsed >= 0) && (nsElapsed < ((int64_t) nTtlSecs * NSEC_PER_SEC)));
+}
+
+/* static bool CacheJumped (void)
+**
+** Whether the computer clock has moved against CLOCK_MONOTONIC since the reading. Either it was stepped, or the
+** computer slept - which CLOCK_MONOTONIC does not count, and the RTC does. Slewing moves it too, but at most
+** 500 ppm, well under CACHE_MAX_JUMP_MSECS in any sensible TTL
+*/
+
+static bool CacheJumped (void)
+{
+    int64_t nsMonotonic = TimingNow (CLOCK_MONOTONIC), nsRealtime = TimingNow (CLOCK_REALTIME);
+    
+    return (llabs ((nsRealtime - nsMonotonic) - (entryCache.m_nsEdgeRealtime - entryCache.m_nsEdgeMonotonic)) > (CACHE_MAX_JUMP_MSECS * NSEC_PER_MSEC));
+}
+
+/* static int CacheConfirm (int busfd, int nBusDevId)
+**
+** Read RTCSEC, a single byte, and check that it is a second the extrapolation says the RTC could be in while
+** we read it. Returns -1 if it is not (or the oscillator has been stopped), and the cache must go
+*/
+
+static int CacheConfirm (int busfd, int nBusDevId)
+{
+    struct mcp7940n_rtcsec  rtcsecRTCClock;
+    int64_t                 nsEdgeTime, nsBefore, nsAfter, nsEarliest, nsLatest;
+    int                     nSeconds;
+    
+    nsBefore = TimingNow (CLOCK_MONOTONIC);
+    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &rtcsecRTCClock, sizeof (struct mcp7940n_rtcsec)) < 0)
+        return -1;
+    nsAfter = TimingNow (CLOCK_MONOTONIC);
+    
+    nsEdgeTime = (int64_t) CivilRegistersToEpoch (entryCache.m_uiRegisters) * NSEC_PER_SEC;
+    nsEarliest = nsEdgeTime + (nsBefore - entryCache.m_nsEdgeMonotonic) - CacheUncertainty (nsAfter - entryCache.m_nsEdgeMonotonic);
+    nsLatest = nsEdgeTime + (nsAfter - entryCache.m_nsEdgeMonotonic) + CacheUncertainty (nsAfter - entryCache.m_nsEdgeMonotonic);
+    nSeconds = (rtcsecRTCClock.secten * 10) + rtcsecRTCClock.secone;
+    
+    if ((! rtcsecRTCClock.st) || ((nsLatest - nsEarliest) >= NSEC_PER_SEC) ||
+        ((nSeconds != ((nsEarliest / NSEC_PER_SEC) % 60)) && (nSeconds != ((nsLatest / NSEC_PER_SEC) % 60))))
+        return -1;
+    
+    entryCache.m_nsConfirmed = nsAfter;
+    CacheSave ();
+    return 0;
+}
+
+/* int CacheLookup (int busfd, char *szBusName, int nBusDevId, int nTtlSecs, struct rtc_edge_reading *pEdgeReading)
+**
+** Fill in pEdgeReading as if the RTC had just been read on the edge of its latest second, from the cached
+** reading, if there is one for nBusDevId on szBusName less than nTtlSecs old and the computer clock has not jumped since.
+** If it is CACHE_CONFIRM_SECS since RTCSEC was last checked, we check it now - unless busfd is -1, when the
+** caller has not opened the bus because CacheAnswers said a moment ago that it need not. Returns -1 if the
+** caller must read the RTC itself
+*/
+
+int CacheLookup (int busfd, char *szBusName, int nBusDevId, int nTtlSecs, struct rtc_edge_reading *pEdgeReading)
+{
+    int64_t nsMonotonic = TimingNow (CLOCK_MONOTONIC), nsElapsed, nsSeconds;
+    
+    if ((CacheLoad () < 0) || (! CacheHolds (szBusName, nBusDevId, nTtlSecs, nsMonotonic)))
+        return -1;
+    
+    if (CacheJumped ()) {
+        CacheForget ();
+        return -1;
+    }
+    
+    nsElapsed = nsMonotonic - entryCache.m_nsEdgeMonotonic;
+    pEdgeReading ->m_nTransactions = 0;
+    if ((busfd >= 0) && ((nsMonotonic - entryCache.m_nsConfirmed) >= (CACHE_CONFIRM_SECS * NSEC_PER_SEC))) {
+        if (CacheConfirm (busfd, nBusDevId) < 0) {
+            CacheForget ();
+            return -1;
+        }
+        pEdgeReading ->m_nTransactions = 1;
+    }
+    
+    // The RTC has ticked over this many times since the edge we have. Move the reading to the latest
+    
+    nsSeconds = (nsElapsed / NSEC_PER_SEC) * NSEC_PER_SEC;
+    CodecStore (CivilEpochToRegisters (CivilRegistersToEpoch (entryCache.m_uiRegisters) + (time_t) (nsElapsed / NSEC_PER_SEC), entryCache.m_uiRegisters),
+                (void *) &pEdgeReading ->m_datetimeRTCClock);
+    pEdgeReading ->m_nsEdgeMonotonic = entryCache.m_nsEdgeMonotonic + nsSeconds;
+    pEdgeReading ->m_nsEdgeRealtime = entryCache.m_nsEdgeRealtime + nsSeconds;
+    pEdgeReading ->m_nsUncertainty = CacheUncertainty (nsElapsed);
+    return 0;
+}
+
+/* bool CacheAnswers (char *szBusName, int nBusDevId, int nTtlSecs)
+**
+** Whether CacheLookup will answer without the bus for at least the next CACHE_MARGIN_MSECS, so that the caller
+** need not open it
+*/
+
+bool CacheAnswers (char *szBusName, int nBusDevId, int nTtlSecs)
+{
+    int64_t nsMonotonic = TimingNow (CLOCK_MONOTONIC) + (CACHE_MARGIN_MSECS * NSEC_PER_MSEC);
+    
+    return ((CacheLoad () == 0) && CacheHolds (szBusName, nBusDevId, nTtlSecs, nsMonotonic) && (! CacheJumped ()) &&
+            ((nsMonotonic - entryCache.m_nsConfirmed) < (CACHE_CONFIRM_SECS * NSEC_PER_SEC)));
+}
+
+/* void CacheStore (char *szBusName, int nBusDevId, struct rtc_edge_reading *pEdgeReading)
+**
+** Remember a reading taken on the edge of a second. Reading it on the edge was as good as checking RTCSEC
+*/
+
+void CacheStore (char *szBusName, int nBusDevId, struct rtc_edge_reading *pEdgeReading)
+{
+    if (szBusName == (char *) 0)
+        return;
+    
+    (void) snprintf (entryCache.m_szBusName, sizeof (entryCache.m_szBusName), "%s", szBusName);
+    entryCache.m_nBusDevId = nBusDevId;
+    entryCache.m_uiRegisters = CodecLoad ((void *) &pEdgeReading ->m_datetimeRTCClock);
+    entryCache.m_nsEdgeMonotonic = pEdgeReading ->m_nsEdgeMonotonic;
+    entryCache.m_nsEdgeRealtime = pEdgeReading ->m_nsEdgeRealtime;
+    entryCache.m_nsUncertainty = pEdgeReading ->m_nsUncertainty;
+    entryCache.m_nsConfirmed = pEdgeReading ->m_nsEdgeMonotonic;
+    CacheSave ();
+}
+
+/* void CacheForget (void)
+**
+** The RTC has been set, or the reading no longer holds, so read it afresh next time
+*/
+
+void CacheForget (void)
+{
+    (void) unlink (CACHE_STATE_PATH);
+}
@@ -0,0 +1,63 @@
+/*
+**  RTCCache.h
+**
+**  This header file contains the definitions and function prototypes for the read cache, which answers what
+**  the PiFace Real Time Clock reads now from a reading taken on the edge of an earlier second.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCCache_h
+#define RTCCache_h
+
+# include <stdbool.h>
+# include <stdint.h>
+
+# include "RTCEdge.h"
+
+# if defined (RTCDATE_SIM)
+# define CACHE_STATE_PATH               "/tmp/rtcsim.cache"         // Not the real RTC's
+# elif defined (__linux__)
+# define CACHE_STATE_PATH               "/var/lib/rtcdate.cache"    // Linux has no /var/db
+# else
+# define CACHE_STATE_PATH               "/var/db/rtcdate.cache"
+# endif
+# define CACHE_CONFIRM_SECS             10          // How often RTCSEC is read to check the extrapolation still holds
+# define CACHE_MAX_JUMP_MSECS           100         // The computer clock moving this far against CLOCK_MONOTONIC
+                                                    // means it was stepped, or the computer slept
+# define CACHE_DRIFT_PPM                20          // How far the crystal may be out, for the uncertainty
+# define CACHE_MARGIN_MSECS             1000        // CacheAnswers allows this long before the caller's lookup
+
+int CacheLookup (int busfd, char *szBusName, int nBusDevId, int nTtlSecs, struct rtc_edge_reading *pEdgeReading);
+bool CacheAnswers (char *szBusName, int nBusDevId, int nTtlSecs);
+void CacheStore (char *szBusName, int nBusDevId, struct rtc_edge_reading *pEdgeReading);
+void CacheForget (void);
+
+#endif // RTCCache_h
@@ -0,0 +1,183 @@
+/*
+**  RTCCivil.c
+**
+**  This source file contains the civil date layer. Days are counted from the epoch with the usual era arithmetic
+**  (400 year eras of 146097 days, with years starting on the 1st March so that the leap day comes last), so each
+**  conversion is a handful of multiplies and divides, takes the same time for any date, uses no static buffers
+**  and never consults the time zone. The C library is only used when a local time has to be displayed.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <stdint.h>
+# include <stdio.h>
+# include <time.h>
+
+# include "RTCCodec.h"
+# include "RTCCivil.h"
+
+# define CIVIL_DAYS_PER_ERA             146097          // Days in 400 Gregorian years
+# define CIVIL_EPOCH_DAYS               719468          // Days from 0000-03-01 to 1970-01-01
+
+/* int64_t CivilDaysFromDate (int64_t nYear, int nMonth, int nDay)
+**
+** The number of days from 1st January 1970 to the given date, which may be before it. The month runs from 1 to
+** 12, and the day of the month from 1
+*/
+
+int64_t CivilDaysFromDate (int64_t nYear, int nMonth, int nDay)
+{
+    int64_t nEra, nYearOfEra, nDayOfYear, nDayOfEra;
+    
+    // Count years from March, so January and February belong to the year before
+    
+    nYear -= (nMonth <= 2);
+    nEra = ((nYear >= 0) ? nYear : (nYear - 399)) / 400;
+    nYearOfEra = nYear - (nEra * 400);
+    nDayOfYear = (((153 * (nMonth + ((nMonth > 2) ? -3 : 9))) + 2) / 5) + nDay -1;
+    nDayOfEra = (nYearOfEra * 365) + (nYearOfEra / 4) - (nYearOfEra / 100) + nDayOfYear;
+    
+    return (nEra * CIVIL_DAYS_PER_ERA) + nDayOfEra - CIVIL_EPOCH_DAYS;
+}
+
+/* void CivilDateFromDays (int64_t nDays, int64_t *pnYear, int *pnMonth, int *pnDay)
+**
+** The date a number of days from 1st January 1970. The inverse of CivilDaysFromDate()
+*/
+
+void CivilDateFromDays (int64_t nDays, int64_t *pnYear, int *pnMonth, int *pnDay)
+{
+    int64_t nEra, nDayOfEra, nYearOfEra, nDayOfYear, nMonthFromMarch;
+    
+    nDays += CIVIL_EPOCH_DAYS;
+    nEra = ((nDays >= 0) ? nDays : (nDays - (CIVIL_DAYS_PER_ERA -1))) / CIVIL_DAYS_PER_ERA;
+    nDayOfEra = nDays - (nEra * CIVIL_DAYS_PER_ERA);
+    nYearOfEra = (nDayOfEra - (nDayOfEra / 1460) + (nDayOfEra / 36524) - (nDayOfEra / (CIVIL_DAYS_PER_ERA -1))) / 365;
+    nDayOfYear = nDayOfEra - ((365 * nYearOfEra) + (nYearOfEra / 4) - (nYearOfEra / 100));
+    nMonthFromMarch = ((5 * nDayOfYear) + 2) / 153;
+    
+    *pnDay = (int) (nDayOfYear - (((153 * nMonthFromMarch) + 2) / 5) + 1);
+    *pnMonth = (int) ((nMonthFromMarch < 10) ? (nMonthFromMarch + 3) : (nMonthFromMarch - 9));
+    *pnYear = nYearOfEra + (nEra * 400) + (*pnMonth <= 2);
+}
+
+/* time_t CivilToEpoch (struct tm *ptmDateTime)
+**
+** Convert a UTC date and time to seconds since the epoch, as timegm(3) does. Fields outside their usual range
+** carry into the next field up, but unlike timegm(3) the struct tm is not changed
+*/
+
+time_t CivilToEpoch (struct tm *ptmDateTime)
+{
+    int64_t nYear, nMonth;
+    
+    // Bring the month into range first, as the day count needs it to be. Everything below the month is linear
+    
+    nMonth = ptmDateTime ->tm_mon;
+    nYear = (int64_t) ptmDateTime ->tm_year + 1900 + ((nMonth >= 0) ? (nMonth / 12) : (((nMonth +1) / 12) -1));
+    nMonth -= ((nMonth >= 0) ? (nMonth / 12) : (((nMonth +1) / 12) -1)) * 12;
+    
+    return (time_t) ((((CivilDaysFromDate (nYear, (int) nMonth +1, 1) + ptmDateTime ->tm_mday -1) * CIVIL_SECS_PER_DAY) +
+                      ((int64_t) ptmDateTime ->tm_hour * 3600) + ((int64_t) ptmDateTime ->tm_min * 60) + ptmDateTime ->tm_sec));
+}
+
+/* void CivilFromEpoch (time_t timeDateTime, struct tm *ptmDateTime)
+**
+** Convert seconds since the epoch to a UTC date and time, as gmtime_r(3) does. All of the standard fields are
+** filled in, including the day of the week and of the year
+*/
+
+void CivilFromEpoch (time_t timeDateTime, struct tm *ptmDateTime)
+{
+    int64_t nDays, nSecs, nYear;
+    int nMonth, nDay;
+    
+    nDays = (int64_t) timeDateTime / CIVIL_SECS_PER_DAY;
+    nSecs = (int64_t) timeDateTime % CIVIL_SECS_PER_DAY;
+    if (nSecs < 0) {
+        nSecs += CIVIL_SECS_PER_DAY;
+        nDays --;
+    }
+    
+    CivilDateFromDays (nDays, &nYear, &nMonth, &nDay);
+    
+    ptmDateTime ->tm_sec = (int) (nSecs % 60);
+    ptmDateTime ->tm_min = (int) ((nSecs / 60) % 60);
+    ptmDateTime ->tm_hour = (int) (nSecs / 3600);
+    ptmDateTime ->tm_mday = nDay;
+    ptmDateTime ->tm_mon = nMonth -1;
+    ptmDateTime ->tm_year = (int) (nYear - 1900);
+    ptmDateTime ->tm_wday = (int) ((nDays >= -4) ? ((nDays + 4) % 7) : (((nDays + 5) % 7) + 6));    // 1st January 1970 was a Thursday
+    ptmDateTime ->tm_yday = (int) (nDays - CivilDaysFromDate (nYear, 1, 1));
+    ptmDateTime ->tm_isdst = 0;
+}
+
+/* time_t CivilRegistersToEpoch (uint64_t uiRegisters)
+**
+** The date and time held in the RTC's date/time registers (as loaded by CodecLoad()) in seconds since the epoch
+*/
+
+time_t CivilRegistersToEpoch (uint64_t uiRegisters)
+{
+    struct tm tmDateTime;
+    
+    CodecDecodeDateTime (uiRegisters, &tmDateTime);
+    return CivilToEpoch (&tmDateTime);
+}
+
+/* uint64_t CivilEpochToRegisters (time_t timeDateTime, uint64_t uiRegisters)
+**
+** Encode seconds since the epoch into the RTC's date/time registers. The flags in uiRegisters are kept
+*/
+
+uint64_t CivilEpochToRegisters (time_t timeDateTime, uint64_t uiRegisters)
+{
+    struct tm tmDateTime;
+    
+    CivilFromEpoch (timeDateTime, &tmDateTime);
+    return CodecEncodeDateTime (&tmDateTime, uiRegisters);
+}
+
+/* int CivilFormatLocal (time_t timeDateTime, char *szDateTime, size_t nLength)
+**
+** Format seconds since the epoch as local time, in the format ctime(3) uses, but into the caller's buffer. This
+** is the only place the time zone is looked up. Returns -1 (and sets errno) if the time cannot be converted
+*/
+
+int CivilFormatLocal (time_t timeDateTime, char *szDateTime, size_t nLength)
+{
+    struct tm tmLocalDateTime;
+    
+    if (localtime_r (&timeDateTime, &tmLocalDateTime) == (struct tm *) 0)
+        return -1;
+    
+    (void) strftime (szDateTime, nLength, "%a %b %e %H:%M:%S %Y\n", &tmLocalDateTime);
+    return 0;
+}
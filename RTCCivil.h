@@ -0,0 +1,55 @@
+/*
+**  RTCCivil.h
+**
+**  This header file contains the function prototypes for the civil date layer, which converts between seconds
+**  since the epoch, a UTC struct tm and the PiFace Real Time Clock's date/time registers without going through
+**  the C library's time zone code.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCCivil_h
+#define RTCCivil_h
+
+# include <stdint.h>
+# include <time.h>
+
+# define CIVIL_SECS_PER_DAY             86400
+# define CIVIL_CTIME_LENGTH             26              // As ctime(3), with the newline and NULL
+
+int64_t CivilDaysFromDate (int64_t nYear, int nMonth, int nDay);
+void CivilDateFromDays (int64_t nDays, int64_t *pnYear, int *pnMonth, int *pnDay);
+time_t CivilToEpoch (struct tm *ptmDateTime);
+void CivilFromEpoch (time_t timeDateTime, struct tm *ptmDateTime);
+time_t CivilRegistersToEpoch (uint64_t uiRegisters);
+uint64_t CivilEpochToRegisters (time_t timeDateTime, uint64_t uiRegisters);
+int CivilFormatLocal (time_t timeDateTime, char *szDateTime, size_t nLength);
+
+#endif // RTCCivil_h
@@ -0,0 +1,191 @@
+/*
+**  RTCCodec.c
+**
+**  This source file contains the date/time codec for the PiFace Real Time Clock. Rather than pick each BCD
+**  field out of a bitfield and multiply the tens by ten, the seven date/time registers are loaded into one
+**  64-bit word and every field is decoded with a single table lookup - including the hour, whose table covers
+**  both the 12 hour and 24 hour formats. There are no branches on the data at all, which matters to tools that
+**  decode millions of register dumps.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <stdint.h>
+# include <time.h>
+
+# include "RTCCodec.h"
+
+/*
+** A BCD byte to its value. Bytes with a nibble above 9 decode as the tens times ten plus the ones, as the
+** bitfield code always did
+*/
+
+static const uint8_t uiCodecFromBCD [256] = {
+      0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,  15,
+     10,  11,  12,  13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,
+     20,  21,  22,  23,  24,  25,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,
+     30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,  41,  42,  43,  44,  45,
+     40,  41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51,  52,  53,  54,  55,
+     50,  51,  52,  53,  54,  55,  56,  57,  58,  59,  60,  61,  62,  63,  64,  65,
+     60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,
+     70,  71,  72,  73,  74,  75,  76,  77,  78,  79,  80,  81,  82,  83,  84,  85,
+     80,  81,  82,  83,  84,  85,  86,  87,  88,  89,  90,  91,  92,  93,  94,  95,
+     90,  91,  92,  93,  94,  95,  96,  97,  98,  99, 100, 101, 102, 103, 104, 105,
+    100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115,
+    110, 111, 112, 113, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125,
+    120, 121, 122, 123, 124, 125, 126, 127, 128, 129, 130, 131, 132, 133, 134, 135,
+    130, 131, 132, 133, 134, 135, 136, 137, 138, 139, 140, 141, 142, 143, 144, 145,
+    140, 141, 142, 143, 144, 145, 146, 147, 148, 149, 150, 151, 152, 153, 154, 155,
+    150, 151, 152, 153, 154, 155, 156, 157, 158, 159, 160, 161, 162, 163, 164, 165
+};
+
+/*
+** A value from 0 to 99 to BCD
+*/
+
+static const uint8_t uiCodecToBCD [100] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+    0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99
+};
+
+/*
+** The hour register (without its unimplemented top bit) to an hour from 0 to 23. With bit 6 clear the hour is
+** 24 hour BCD in bits 0 - 5. With it set the hour is 12 hour BCD (1 - 12) in bits 0 - 4 and bit 5 is set for PM,
+** so 12 AM is hour 0 and 12 PM is hour 12
+*/
+
+static const uint8_t uiCodecHour [128] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+    10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,
+    20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
+    30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11,  0,  1,  2,  3,
+    10, 11,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11,  0,  1,
+    12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 12, 13, 14, 15,
+    22, 23, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 12, 13
+};
+
+/*
+** The RTC's day of the week (1 is a Sunday) to tm_wday. A zero, which the RTC should never hold, is Sunday
+*/
+
+static const uint8_t uiCodecWeekday [8] = { 0, 0, 1, 2, 3, 4, 5, 6 };
+
+/* uint64_t CodecLoad (void *lpRegisters)
+**
+** Load the seven date/time registers into a word, register 0x00 in the bottom byte
+*/
+
+uint64_t CodecLoad (void *lpRegisters)
+{
+    uint8_t *puiRegisters = (uint8_t *) lpRegisters;
+    
+    return ((uint64_t) puiRegisters [0]) | ((uint64_t) puiRegisters [1] << 8) | ((uint64_t) puiRegisters [2] << 16) |
+           ((uint64_t) puiRegisters [3] << 24) | ((uint64_t) puiRegisters [4] << 32) | ((uint64_t) puiRegisters [5] << 40) |
+           ((uint64_t) puiRegisters [6] << 48);
+}
+
+/* void CodecStore (uint64_t uiRegisters, void *lpRegisters)
+**
+** Store a word back into the seven date/time registers
+*/
+
+void CodecStore (uint64_t uiRegisters, void *lpRegisters)
+{
+    uint8_t *puiRegisters = (uint8_t *) lpRegisters;
+    
+    puiRegisters [0] = (uint8_t) uiRegisters;
+    puiRegisters [1] = (uint8_t) (uiRegisters >> 8);
+    puiRegisters [2] = (uint8_t) (uiRegisters >> 16);
+    puiRegisters [3] = (uint8_t) (uiRegisters >> 24);
+    puiRegisters [4] = (uint8_t) (uiRegisters >> 32);
+    puiRegisters [5] = (uint8_t) (uiRegisters >> 40);
+    puiRegisters [6] = (uint8_t) (uiRegisters >> 48);
+}
+
+/* void CodecDecodeDateTime (uint64_t uiRegisters, struct tm *ptmDateTime)
+**
+** Decode the date/time registers into the date and time fields of a struct tm. The RTC does not know about
+** centuries, so we assume the 21st
+*/
+
+void CodecDecodeDateTime (uint64_t uiRegisters, struct tm *ptmDateTime)
+{
+    ptmDateTime ->tm_sec = uiCodecFromBCD [(uiRegisters & 0x7f)];
+    ptmDateTime ->tm_min = uiCodecFromBCD [((uiRegisters >> 8) & 0x7f)];
+    ptmDateTime ->tm_hour = uiCodecHour [((uiRegisters >> 16) & 0x7f)];
+    ptmDateTime ->tm_wday = uiCodecWeekday [((uiRegisters >> 24) & 0x07)];
+    ptmDateTime ->tm_mday = uiCodecFromBCD [((uiRegisters >> 32) & 0x3f)];
+    ptmDateTime ->tm_mon = uiCodecFromBCD [((uiRegisters >> 40) & 0x1f)] -1;
+    ptmDateTime ->tm_year = uiCodecFromBCD [((uiRegisters >> 48) & 0xff)] + 100;
+}
+
+/* uint64_t CodecEncodeDateTime (struct tm *ptmDateTime, uint64_t uiRegisters)
+**
+** Encode the date and time from a struct tm into the date/time registers, in 24 hour format. The bits in
+** uiRegisters that are not part of the date or time are kept. The fields must be in range
+*/
+
+uint64_t CodecEncodeDateTime (struct tm *ptmDateTime, uint64_t uiRegisters)
+{
+    return (uiRegisters & CODEC_DATETIME_KEEP) |
+           ((uint64_t) uiCodecToBCD [ptmDateTime ->tm_sec]) |
+           ((uint64_t) uiCodecToBCD [ptmDateTime ->tm_min] << 8) |
+           ((uint64_t) uiCodecToBCD [ptmDateTime ->tm_hour] << 16) |
+           ((uint64_t) (ptmDateTime ->tm_wday +1) << 24) |              // 1 is a Sunday on the RTC
+           ((uint64_t) uiCodecToBCD [ptmDateTime ->tm_mday] << 32) |
+           ((uint64_t) uiCodecToBCD [(ptmDateTime ->tm_mon +1)] << 40) |
+           ((uint64_t) uiCodecToBCD [(ptmDateTime ->tm_year % 100)] << 48);
+}
+
+/* void CodecDecodeTimestamp (void *lpRegisters, struct tm *ptmTimestamp)
+**
+** Decode a power fail or power restore timestamp into the minute, hour, day, month and day of the week of a
+** struct tm. The timestamps have no seconds or year
+*/
+
+void CodecDecodeTimestamp (void *lpRegisters, struct tm *ptmTimestamp)
+{
+    uint8_t *puiRegisters = (uint8_t *) lpRegisters;
+    
+    ptmTimestamp ->tm_min = uiCodecFromBCD [(puiRegisters [0] & 0x7f)];
+    ptmTimestamp ->tm_hour = uiCodecHour [(puiRegisters [1] & 0x7f)];
+    ptmTimestamp ->tm_mday = uiCodecFromBCD [(puiRegisters [2] & 0x3f)];
+    ptmTimestamp ->tm_mon = uiCodecFromBCD [(puiRegisters [3] & 0x1f)] -1;
+    ptmTimestamp ->tm_wday = uiCodecWeekday [(puiRegisters [3] >> 5)];
+}
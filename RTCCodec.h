@@ -0,0 +1,65 @@
+/*
+**  RTCCodec.h
+**
+**  This header file contains the function prototypes for the date/time codec, which converts between the
+**  PiFace Real Time Clock's BCD date/time registers and a struct tm.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCCodec_h
+#define RTCCodec_h
+
+# include <stdint.h>
+# include <time.h>
+
+/*
+** The seven date/time registers (0x00 - 0x06) are handled as a single 64-bit word, register 0x00 in the
+** bottom byte. CODEC_DATETIME_KEEP covers the bits that are not part of the date or time - ST, VBATEN,
+** PWRFAIL, OSCRUN, LPYR and the unimplemented bits - which encoding leaves alone
+*/
+
+# define CODEC_DATETIME_LENGTH          7
+# define CODEC_DATETIME_KEEP            0x0000e0c0f8808080ULL
+
+/*
+** The power fail and power restore timestamps are four registers each - minute, hour, date, and month with the
+** day of the week in its top three bits
+*/
+
+# define CODEC_TIMESTAMP_LENGTH         4
+
+uint64_t CodecLoad (void *lpRegisters);
+void CodecStore (uint64_t uiRegisters, void *lpRegisters);
+void CodecDecodeDateTime (uint64_t uiRegisters, struct tm *ptmDateTime);
+uint64_t CodecEncodeDateTime (struct tm *ptmDateTime, uint64_t uiRegisters);
+void CodecDecodeTimestamp (void *lpRegisters, struct tm *ptmTimestamp);
+
+#endif // RTCCodec_h
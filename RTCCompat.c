@@ -0,0 +1,81 @@
+/*
+**  RTCCompat.c
+**
+**  This source file contains our own versions of the FreeBSD library functions we use that other operating
+**  systems do not have.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# ifndef __FreeBSD__
+
+# define _GNU_SOURCE                    // For struct ucred
+
+# include <ctype.h>
+# include <sys/types.h>
+# include <sys/socket.h>
+
+# include "RTCCompat.h"
+
+/* int digittoint (int c)
+**
+** The value of a hex digit, as digittoint(3) on FreeBSD. Anything else is 0
+*/
+
+int digittoint (int c)
+{
+    if (isdigit (c))
+        return c - '0';
+    if (isxdigit (c))
+        return tolower (c) - 'a' + 10;
+    
+    return 0;
+}
+
+/* int getpeereid (int s, uid_t *puid, gid_t *pgid)
+**
+** The effective user and group of the process at the other end of a UNIX domain socket, as getpeereid(3) on
+** FreeBSD
+*/
+
+int getpeereid (int s, uid_t *puid, gid_t *pgid)
+{
+    struct ucred ucredPeer;
+    socklen_t nLength = sizeof (ucredPeer);
+    
+    if (getsockopt (s, SOL_SOCKET, SO_PEERCRED, &ucredPeer, &nLength) < 0)
+        return -1;
+    
+    *puid = ucredPeer.uid;
+    *pgid = ucredPeer.gid;
+    return 0;
+}
+
+# endif // __FreeBSD__
@@ -0,0 +1,461 @@
+/*
+**  RTCDaemon.c
+**
+**  This source file contains rtcd, the daemon mode of rtcdate, and the client side of its protocol. The
+**  daemon holds the I2C bus open, accepts requests on a Unix-domain socket, runs them through the same
+**  functions the command line uses and sends back whatever they would have displayed.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <stdbool.h>
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <strings.h>
+# include <errno.h>
+# include <signal.h>
+# include <poll.h>
+# include <unistd.h>
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/time.h>
+# include <sys/un.h>
+
+# include "PiFaceRTCFreeBSD.h"
+# include "I2CRoutines.h"
+# include "RTCSnapshot.h"
+# include "RTCDrift.h"
+# include "RTCTiming.h"
+# include "RTCDaemon.h"
+# include "RTCCompat.h"
+
+# define RTCD_LISTEN_BACKLOG    16
+# define RTCD_MAX_CLIENTS       16
+# define RTCD_REQUEST_MSECS     250     // A client has this long after connecting to send its whole request
+# define RTCD_RESPONSE_MSECS    250     // and this long to take its response
+# define RTCD_CLIENT_MSECS      1000    // The client gives the daemon this long before going to the bus itself
+
+/*
+** A connection we are waiting on for (the rest of) a request
+*/
+
+struct rtcd_client {
+    int                 m_nSocket;
+    int64_t             m_nsDeadline;           // Monotonic time by which the whole request must have arrived
+    size_t              m_nReceived;            // Bytes of the header and payload received so far
+    struct rtcd_request m_requestClient;
+    char                m_szPayload [RTCD_MAX_PAYLOAD +1];
+};
+
+static volatile sig_atomic_t bRTCDaemonStop = 0;
+static int nRTCDaemonCacheTtlSecs = 0;
+
+/* static void RTCDaemonSignalHandler (int nSignal)
+**
+** Ask the daemon to stop after the current request
+*/
+
+static void RTCDaemonSignalHandler (int nSignal)
+{
+    (void) nSignal;             // SIGINT and SIGTERM both mean stop
+    bRTCDaemonStop = 1;
+}
+
+/* static int RTCDaemonReadFully (int nSocket, void *lpBuffer, size_t nLength)
+**
+** Read exactly nLength bytes from the socket, or fail
+*/
+
+static int RTCDaemonReadFully (int nSocket, void *lpBuffer, size_t nLength)
+{
+    ssize_t nRead;
+    
+    while (nLength > 0) {
+        nRead = read (nSocket, lpBuffer, nLength);
+        if (nRead < 0 && errno == EINTR)
+            continue;
+        if (nRead <= 0)
+            return -1;
+        
+        lpBuffer = (void *) ((char *) lpBuffer + nRead);
+        nLength -= nRead;
+    }
+    
+    return 0;
+}
+
+/* static int RTCDaemonWriteFully (int nSocket, void *lpBuffer, size_t nLength)
+**
+** Write exactly nLength bytes to the socket, or fail
+*/
+
+static int RTCDaemonWriteFully (int nSocket, void *lpBuffer, size_t nLength)
+{
+    ssize_t nWritten;
+    
+    while (nLength > 0) {
+        nWritten = write (nSocket, lpBuffer, nLength);
+        if (nWritten < 0 && errno == EINTR)
+            continue;
+        if (nWritten <= 0)
+            return -1;
+        
+        lpBuffer = (void *) ((char *) lpBuffer + nWritten);
+        nLength -= nWritten;
+    }
+    
+    return 0;
+}
+
+/* static int RTCDaemonDispatch (int busfd, int nBusDevId, struct rtcd_request *pRequest, char *szPayload, FILE *fpOutput)
+**
+** Run a request through the same function the command line would use, with what it displays going to fpOutput
+** to be sent back to the client. Error messages go to our own stderr; the client only gets the status
+*/
+
+static int RTCDaemonDispatch (int busfd, int nBusDevId, struct rtcd_request *pRequest, char *szPayload, FILE *fpOutput)
+{
+    // The registers may have changed since the last request (the clock has certainly moved on), so every
+    // request starts with a fresh snapshot. Likewise the drift state, which rtcdate -c updates behind our back
+    
+    SnapshotInvalidate ();
+    DriftUnload ();
+    
+    switch (pRequest ->m_uiCommand) {
+    case RTCD_GETTIME:
+        return (HWGetTimeOfDay (busfd, I2CBusName (), nBusDevId, (pRequest ->m_uiFlags & RTCD_FLAG_DATE_INPUT) != 0, (pRequest ->m_uiFlags & RTCD_FLAG_SET_CLOCK) != 0, 0,
+                                nRTCDaemonCacheTtlSecs, fpOutput) < 0 ? RTCD_STATUS_FAILED : RTCD_STATUS_OK);
+    
+    case RTCD_PWRFAIL:      return (DisplayPowerFailTime (busfd, nBusDevId, fpOutput) < 0 ? RTCD_STATUS_FAILED : RTCD_STATUS_OK);
+    case RTCD_PWRUP:        return (DisplayPowerRestoreTime (busfd, nBusDevId, fpOutput) < 0 ? RTCD_STATUS_FAILED : RTCD_STATUS_OK);
+    case RTCD_NVRAM_READ:   return (ReadNVRAM (busfd, nBusDevId, fpOutput) < 0 ? RTCD_STATUS_FAILED : RTCD_STATUS_OK);
+    case RTCD_NVRAM_WRITE:  return (WriteNVRAM (busfd, nBusDevId, szPayload, fpOutput) < 0 ? RTCD_STATUS_FAILED : RTCD_STATUS_OK);
+    case RTCD_OPTION:       return (ProcessHWClockOption (busfd, nBusDevId, szPayload, fpOutput) < 0 ? RTCD_STATUS_FAILED : RTCD_STATUS_OK);
+    case RTCD_KEYVALUE:     return (KeyValueCommand (busfd, nBusDevId, szPayload, fpOutput) < 0 ? RTCD_STATUS_FAILED : RTCD_STATUS_OK);
+    default:                return RTCD_STATUS_UNKNOWN;
+    }
+}
+
+/* static int RTCDaemonReceive (struct rtcd_client *pClient)
+**
+** Read whatever has arrived of a client's request without waiting for more. Returns 1 once the whole request is
+** in, 0 if there is more to come and -1 if the client has gone away or sent something that is not a request
+*/
+
+static int RTCDaemonReceive (struct rtcd_client *pClient)
+{
+    size_t nWanted;
+    ssize_t nRead;
+    
+    for (;;) {
+        // The header comes first, and says how much payload follows it
+        
+        if (pClient ->m_nReceived < sizeof (pClient ->m_requestClient)) {
+            nWanted = sizeof (pClient ->m_requestClient) - pClient ->m_nReceived;
+            nRead = recv (pClient ->m_nSocket, (char *) &(pClient ->m_requestClient) + pClient ->m_nReceived, nWanted, MSG_DONTWAIT);
+        }
+        else if (pClient ->m_requestClient.m_uiLength > RTCD_MAX_PAYLOAD)
+            return -1;
+        else if (pClient ->m_nReceived < (sizeof (pClient ->m_requestClient) + pClient ->m_requestClient.m_uiLength)) {
+            nWanted = sizeof (pClient ->m_requestClient) + pClient ->m_requestClient.m_uiLength - pClient ->m_nReceived;
+            nRead = recv (pClient ->m_nSocket, pClient ->m_szPayload + (pClient ->m_nReceived - sizeof (pClient ->m_requestClient)), nWanted, MSG_DONTWAIT);
+        }
+        else {
+            pClient ->m_szPayload [pClient ->m_requestClient.m_uiLength] = '\0';
+            return 1;
+        }
+        
+        if (nRead < 0 && errno == EINTR)
+            continue;
+        if (nRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (nRead <= 0)
+            return -1;
+        
+        pClient ->m_nReceived += nRead;
+    }
+}
+
+/* static void RTCDaemonServe (int busfd, int nBusDevId, struct rtcd_client *pClient)
+**
+** Carry out a client's request and send back the response
+*/
+
+static void RTCDaemonServe (int busfd, int nBusDevId, struct rtcd_client *pClient)
+{
+    struct rtcd_response responseClient;
+    struct timeval tvTimeout;
+    char szOutput [RTCD_MAX_OUTPUT];
+    FILE *fpOutput;
+    uid_t uidClient;
+    gid_t gidClient;
+    
+    // The output is collected in a buffer so that we can send its length ahead of it
+    
+    bzero ((void *) szOutput, sizeof (szOutput));
+    if ((fpOutput = fmemopen (szOutput, sizeof (szOutput), "w")) == (FILE *) 0)
+        return;
+    
+    // Anyone can ask for the time. Everything else needs root, just as it does on the command line
+    
+    if (getpeereid (pClient ->m_nSocket, &uidClient, &gidClient) < 0 ||
+        (uidClient != 0 && ! (pClient ->m_requestClient.m_uiCommand == RTCD_GETTIME && (pClient ->m_requestClient.m_uiFlags & RTCD_FLAG_SET_CLOCK) == 0)))
+        responseClient.m_nStatus = RTCD_STATUS_DENIED;
+    else
+        responseClient.m_nStatus = RTCDaemonDispatch (busfd, nBusDevId, &(pClient ->m_requestClient), pClient ->m_szPayload, fpOutput);
+    
+    (void) fflush (fpOutput);
+    responseClient.m_uiLength = strnlen (szOutput, sizeof (szOutput));
+    (void) fclose (fpOutput);
+    
+    // The response almost always fits in the socket buffer, but a client that is not reading cannot hold us up
+    // for long if it does not
+    
+    tvTimeout.tv_sec = 0;
+    tvTimeout.tv_usec = RTCD_RESPONSE_MSECS * 1000;
+    (void) setsockopt (pClient ->m_nSocket, SOL_SOCKET, SO_SNDTIMEO, &tvTimeout, sizeof (tvTimeout));
+    
+    if (RTCDaemonWriteFully (pClient ->m_nSocket, &responseClient, sizeof (responseClient)) == 0)
+        (void) RTCDaemonWriteFully (pClient ->m_nSocket, szOutput, responseClient.m_uiLength);
+}
+
+/* int RTCDaemonRun (int busfd, int nBusDevId, char *szSocketPath, int nCacheTtlSecs)
+**
+** Listen on the Unix-domain socket and serve requests until we are told to stop (SIGINT or SIGTERM). The
+** connections are waited on together with poll, and one that has not sent its whole request within
+** RTCD_REQUEST_MSECS is dropped, so a client that connects and sends nothing holds up no one but itself. The
+** requests themselves are carried out one at a time - there is only one bus, and they take microseconds. If
+** nCacheTtlSecs is not zero, requests for the date/time are answered from the read cache (RTCCache.c)
+*/
+
+int RTCDaemonRun (int busfd, int nBusDevId, char *szSocketPath, int nCacheTtlSecs)
+{
+    struct sockaddr_un sunDaemon;
+    struct sigaction saStop;
+    struct pollfd pollfdSockets [(RTCD_MAX_CLIENTS +1)];
+    struct rtcd_client clientClients [RTCD_MAX_CLIENTS];
+    int nListen, nSocket, nClients = 0, nClient, nReceived, nWaitMsecs;
+    int64_t nsNow;
+    
+    nRTCDaemonCacheTtlSecs = nCacheTtlSecs;
+    if (strlen (szSocketPath) >= sizeof (sunDaemon.sun_path)) {
+        (void) fprintf (stderr, "rtcd: socket path %s is too long\n", szSocketPath);
+        return -1;
+    }
+    
+    // Stop cleanly on SIGINT or SIGTERM, and do not die if a client goes away before reading its response
+    
+    bzero ((void *) &saStop, sizeof (saStop));
+    saStop.sa_handler = RTCDaemonSignalHandler;
+    (void) sigemptyset (&saStop.sa_mask);
+    (void) sigaction (SIGINT, &saStop, (struct sigaction *) 0);
+    (void) sigaction (SIGTERM, &saStop, (struct sigaction *) 0);
+    (void) signal (SIGPIPE, SIG_IGN);
+    
+    // Create the socket, replacing any left behind by a previous instance
+    
+    if ((nListen = socket (AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        (void) perror ("rtcd: socket");
+        return -1;
+    }
+    
+    bzero ((void *) &sunDaemon, sizeof (sunDaemon));
+    sunDaemon.sun_family = AF_UNIX;
+    (void) strncpy (sunDaemon.sun_path, szSocketPath, sizeof (sunDaemon.sun_path) -1);
+    (void) unlink (szSocketPath);
+    
+    if (bind (nListen, (struct sockaddr *) &sunDaemon, sizeof (sunDaemon)) < 0 || listen (nListen, RTCD_LISTEN_BACKLOG) < 0) {
+        (void) perror ("rtcd: bind");
+        (void) close (nListen);
+        return -1;
+    }
+    
+    // Anyone may connect, we check what they are allowed to do per request
+    
+    (void) chmod (szSocketPath, 0666);
+    
+    while (! bRTCDaemonStop) {
+        // Wait for a new connection (if we have room for one) or more of a request, but no longer than it is
+        // until the next client runs out of time
+        
+        nsNow = TimingNow (CLOCK_MONOTONIC);
+        nWaitMsecs = -1;
+        
+        pollfdSockets [0].fd = (nClients < RTCD_MAX_CLIENTS ? nListen : -1);
+        pollfdSockets [0].events = POLLIN;
+        pollfdSockets [0].revents = 0;
+        for (nClient = 0; nClient < nClients; nClient ++) {
+            pollfdSockets [(nClient +1)].fd = clientClients [nClient].m_nSocket;
+            pollfdSockets [(nClient +1)].events = POLLIN;
+            pollfdSockets [(nClient +1)].revents = 0;
+            
+            if (clientClients [nClient].m_nsDeadline <= nsNow)
+                nWaitMsecs = 0;
+            else if ((nWaitMsecs < 0) || (((clientClients [nClient].m_nsDeadline - nsNow) / NSEC_PER_MSEC) +1 < nWaitMsecs))
+                nWaitMsecs = (int) (((clientClients [nClient].m_nsDeadline - nsNow) / NSEC_PER_MSEC) +1);
+        }
+        
+        if (poll (pollfdSockets, (nfds_t) (nClients +1), nWaitMsecs) < 0) {
+            if (errno == EINTR)
+                continue;
+            
+            (void) perror ("rtcd: poll");
+            break;
+        }
+        
+        // Serve each client whose request is now complete, and drop those that have gone away or run out of
+        // time. We work down from the end so that a finished client can be replaced by the last one
+        
+        nsNow = TimingNow (CLOCK_MONOTONIC);
+        for (nClient = (nClients -1); nClient >= 0; nClient --) {
+            nReceived = 0;
+            if (pollfdSockets [(nClient +1)].revents != 0)
+                nReceived = RTCDaemonReceive (&(clientClients [nClient]));
+            if (nReceived > 0)
+                RTCDaemonServe (busfd, nBusDevId, &(clientClients [nClient]));
+            
+            if ((nReceived != 0) || (clientClients [nClient].m_nsDeadline <= nsNow)) {
+                (void) close (clientClients [nClient].m_nSocket);
+                clientClients [nClient] = clientClients [(-- nClients)];
+            }
+        }
+        
+        // Take on a new client
+        
+        if ((pollfdSockets [0].revents & POLLIN) != 0) {
+            if ((nSocket = accept (nListen, (struct sockaddr *) 0, (socklen_t *) 0)) < 0) {
+                if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK)
+                    continue;
+                
+                (void) perror ("rtcd: accept");
+                break;
+            }
+            
+            clientClients [nClients].m_nSocket = nSocket;
+            clientClients [nClients].m_nsDeadline = nsNow + (RTCD_REQUEST_MSECS * NSEC_PER_MSEC);
+            clientClients [nClients].m_nReceived = 0;
+            nClients ++;
+        }
+    }
+    
+    for (nClient = 0; nClient < nClients; nClient ++)
+        (void) close (clientClients [nClient].m_nSocket);
+    (void) close (nListen);
+    (void) unlink (szSocketPath);
+    
+    return (bRTCDaemonStop ? 0 : -1);
+}
+
+/* int RTCDaemonRequest (char *szSocketPath, int nCommand, int nFlags, char *szPayload, int *pnStatus)
+**
+** Send a request to a running daemon, display its output and return its status in pnStatus. Returns -1 if
+** there is no daemon to talk to, or it does not answer within RTCD_CLIENT_MSECS and the request only reads
+** the RTC, so the caller can fall back to doing the work itself
+*/
+
+int RTCDaemonRequest (char *szSocketPath, int nCommand, int nFlags, char *szPayload, int *pnStatus)
+{
+    struct sockaddr_un sunDaemon;
+    struct rtcd_request requestDaemon;
+    struct rtcd_response responseDaemon;
+    struct timeval tvTimeout;
+    char szOutput [RTCD_MAX_OUTPUT];
+    size_t nPayloadLength;
+    bool bReadOnly;
+    int nSocket;
+    
+    nPayloadLength = (szPayload == (char *) 0 ? 0 : strlen (szPayload));
+    if (nPayloadLength > RTCD_MAX_PAYLOAD || strlen (szSocketPath) >= sizeof (sunDaemon.sun_path))
+        return -1;
+    
+    if ((nSocket = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    
+    // A daemon that is busy or wedged must not hold us up for long
+    
+    tvTimeout.tv_sec = RTCD_CLIENT_MSECS / 1000;
+    tvTimeout.tv_usec = (RTCD_CLIENT_MSECS % 1000) * 1000;
+    (void) setsockopt (nSocket, SOL_SOCKET, SO_RCVTIMEO, &tvTimeout, sizeof (tvTimeout));
+    (void) setsockopt (nSocket, SOL_SOCKET, SO_SNDTIMEO, &tvTimeout, sizeof (tvTimeout));
+    
+    bzero ((void *) &sunDaemon, sizeof (sunDaemon));
+    sunDaemon.sun_family = AF_UNIX;
+    (void) strncpy (sunDaemon.sun_path, szSocketPath, sizeof (sunDaemon.sun_path) -1);
+    
+    if (connect (nSocket, (struct sockaddr *) &sunDaemon, sizeof (sunDaemon)) < 0) {
+        // No daemon (or not one we can talk to)
+        
+        (void) close (nSocket);
+        return -1;
+    }
+    
+    // If we cannot get the request to the daemon it cannot have been carried out, so we can still do it
+    // ourselves
+    
+    requestDaemon.m_uiCommand = (uint8_t) nCommand;
+    requestDaemon.m_uiFlags = (uint8_t) nFlags;
+    requestDaemon.m_uiLength = (uint16_t) nPayloadLength;
+    
+    if (RTCDaemonWriteFully (nSocket, &requestDaemon, sizeof (requestDaemon)) < 0 ||
+        RTCDaemonWriteFully (nSocket, szPayload, nPayloadLength) < 0) {
+        (void) close (nSocket);
+        return -1;
+    }
+    
+    // Once it has our request it may carry it out whether or not we see the response, so without one we only
+    // do it ourselves if it just reads the RTC
+    
+    if (RTCDaemonReadFully (nSocket, &responseDaemon, sizeof (responseDaemon)) < 0 ||
+        responseDaemon.m_uiLength > sizeof (szOutput) ||
+        RTCDaemonReadFully (nSocket, szOutput, responseDaemon.m_uiLength) < 0) {
+        bReadOnly = ((nCommand == RTCD_GETTIME && (nFlags & RTCD_FLAG_SET_CLOCK) == 0) ||
+                     nCommand == RTCD_PWRFAIL || nCommand == RTCD_PWRUP || nCommand == RTCD_NVRAM_READ);
+        if (! bReadOnly)
+            (void) perror ("rtcd request");
+        (void) close (nSocket);
+        *pnStatus = -1;
+        return (bReadOnly ? -1 : 0);
+    }
+    
+    (void) close (nSocket);
+    
+    (void) fwrite (szOutput, 1, responseDaemon.m_uiLength, stdout);
+    switch (responseDaemon.m_nStatus) {
+    case RTCD_STATUS_OK:        break;
+    case RTCD_STATUS_DENIED:    (void) fprintf (stderr, "You must be root to perform action(s).\n"); break;
+    case RTCD_STATUS_UNKNOWN:   (void) fprintf (stderr, "rtcd does not know that request.\n"); break;
+    default:                    (void) fprintf (stderr, "rtcd was unable to carry out the request, see its log for why.\n"); break;
+    }
+    *pnStatus = (responseDaemon.m_nStatus == RTCD_STATUS_OK ? 0 : -1);
+    
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+**  RTCDaemon.h
+**
+**  This header file contains the request/response protocol and function prototypes for rtcd, the daemon
+**  mode of rtcdate. The daemon keeps the I2C bus open and answers requests from rtcdate over a Unix-domain
+**  socket, so a query costs one socket round trip rather than a process start, bus open and probe.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCDaemon_h
+#define RTCDaemon_h
+
+# include <stdint.h>
+
+# define RTCD_SOCKET_PATH       "/var/run/rtcd.sock"
+# define RTCD_MAX_PAYLOAD       256
+# define RTCD_MAX_OUTPUT        4096
+
+/*
+** Request commands
+*/
+
+# define RTCD_GETTIME           1       // Get (and optionally set the computer clock from) the RTC date/time
+# define RTCD_PWRFAIL           2       // Display the power fail time
+# define RTCD_PWRUP             3       // Display the power restore time
+# define RTCD_NVRAM_READ        4       // Display the NVRAM contents
+# define RTCD_NVRAM_WRITE       5       // Write the payload to the NVRAM
+# define RTCD_OPTION            6       // Process the payload as a comma separated list of -o options
+# define RTCD_KEYVALUE          7       // Process the payload as a -k key/value store command
+
+/*
+** Request flags
+*/
+
+# define RTCD_FLAG_DATE_INPUT   0x01    // Display the date/time as input to the date command
+# define RTCD_FLAG_SET_CLOCK    0x02    // Set the computer clock from the RTC
+
+/*
+** Response status
+*/
+
+# define RTCD_STATUS_OK         0
+# define RTCD_STATUS_FAILED     -1      // The command failed, rtcd has written why to its stderr
+# define RTCD_STATUS_DENIED     -2      // Only root may make this request
+# define RTCD_STATUS_UNKNOWN    -3      // The command is not one rtcd knows
+
+/*
+** A request is the fixed header followed by m_uiLength bytes of payload. A response is the fixed header
+** followed by m_uiLength bytes of output, which the client writes to its standard output; errors are only
+** reported in the status. Both are sent in host byte order, as the socket never leaves the machine
+*/
+
+struct rtcd_request {
+    uint8_t     m_uiCommand;
+    uint8_t     m_uiFlags;
+    uint16_t    m_uiLength;
+};
+
+struct rtcd_response {
+    int32_t     m_nStatus;
+    uint32_t    m_uiLength;
+};
+
+int RTCDaemonRun (int busfd, int nBusDevId, char *szSocketPath, int nCacheTtlSecs);
+int RTCDaemonRequest (char *szSocketPath, int nCommand, int nFlags, char *szPayload, int *pnStatus);
+
+#endif // RTCDaemon_h
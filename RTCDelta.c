@@ -0,0 +1,185 @@
+/*
+**  RTCDelta.c
+**
+**  This source file contains the delta write engine. The bytes we want are compared with the bytes already
+**  there, the changed runs are merged wherever one longer write is cheaper than two messages, and everything is
+**  sent in one I2CRDWR transaction. Optionally the runs written are read back (and only those) to check them.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <string.h>
+# include <strings.h>
+# include <stdbool.h>
+# include <errno.h>
+# include <sys/types.h>
+
+# include "I2CRoutines.h"
+# include "RTCDelta.h"
+
+/* static void DeltaMergeRun (struct i2c_write_run *pWriteRuns, int nRuns, int nRun)
+**
+** Merge a run into the one before it, taking in the bytes between them
+*/
+
+static void DeltaMergeRun (struct i2c_write_run *pWriteRuns, int nRuns, int nRun)
+{
+    pWriteRuns [nRun - 1].m_nWriteLength = (pWriteRuns [nRun].m_nOffset + pWriteRuns [nRun].m_nWriteLength) - pWriteRuns [nRun - 1].m_nOffset;
+    memmove (&pWriteRuns [nRun], &pWriteRuns [nRun + 1], (nRuns - nRun - 1) * sizeof (struct i2c_write_run));
+}
+
+/* int DeltaBuildRuns (int nOffset, uint8_t *pCurrent, uint8_t *pImage, int nLength, struct i2c_write_run *pWriteRuns, int nMaxRuns)
+**
+** Compare the image with the current contents and build the runs needed to write the difference, pointing
+** into the image. Runs no more than DELTA_MESSAGE_COST_BYTES apart are merged, and if that still leaves more
+** than nMaxRuns the closest pairs are merged until it does not. Returns the number of runs (0 if nothing
+** changed)
+*/
+
+int DeltaBuildRuns (int nOffset, uint8_t *pCurrent, uint8_t *pImage, int nLength, struct i2c_write_run *pWriteRuns, int nMaxRuns)
+{
+    int nByte, nRuns, nRun, nGap, nSmallest, nSmallestGap, nRunEnd;
+    
+    for (nByte = 0, nRuns = 0; nByte < nLength; nByte ++) {
+        if (pImage [nByte] == pCurrent [nByte])
+            continue;
+        
+        nRunEnd = ((nRuns > 0) ? (pWriteRuns [nRuns - 1].m_nOffset + pWriteRuns [nRuns - 1].m_nWriteLength - nOffset) : 0);
+        if ((nRuns > 0) && ((nByte - nRunEnd) <= DELTA_MESSAGE_COST_BYTES))
+            pWriteRuns [nRuns - 1].m_nWriteLength = (nByte + 1) - (pWriteRuns [nRuns - 1].m_nOffset - nOffset);
+        else if (nRuns < nMaxRuns) {
+            pWriteRuns [nRuns].m_nOffset = nOffset + nByte;
+            pWriteRuns [nRuns].m_lpBuffer = (void *) &(pImage [nByte]);
+            pWriteRuns [nRuns].m_nWriteLength = 1;
+            nRuns ++;
+        }
+        else {
+            // Out of runs. Make room by merging the two closest runs we already have, or by extending the
+            // last run if this gap is the smallest
+            
+            for (nRun = 1, nSmallest = nRuns, nSmallestGap = nByte - nRunEnd; nRun < nRuns; nRun ++) {
+                nGap = pWriteRuns [nRun].m_nOffset - (pWriteRuns [nRun - 1].m_nOffset + pWriteRuns [nRun - 1].m_nWriteLength);
+                if (nGap < nSmallestGap) {
+                    nSmallestGap = nGap;
+                    nSmallest = nRun;
+                }
+            }
+            
+            if (nSmallest < nRuns) {
+                DeltaMergeRun (pWriteRuns, nRuns, nSmallest);
+                nRuns --;
+                nByte --;               // Look at this byte again, now there is a run free
+            }
+            else
+                pWriteRuns [nRuns - 1].m_nWriteLength = (nByte + 1) - (pWriteRuns [nRuns - 1].m_nOffset - nOffset);
+        }
+    }
+    
+    return nRuns;
+}
+
+/* int DeltaWrite (int busfd, int nBusDevId, int nOffset, uint8_t *pCurrent, uint8_t *pImage, int nLength, bool bVerify, struct delta_stats *pStats)
+**
+** Make nLength bytes at nOffset on the device match the image. If pCurrent is NULL the current contents are
+** read first (one transaction), otherwise it must hold what is on the device now. If bVerify is set the runs
+** written are read back and compared, and a mismatch fails with errno set to EIO. pStats may be NULL
+*/
+
+int DeltaWrite (int busfd, int nBusDevId, int nOffset, uint8_t *pCurrent, uint8_t *pImage, int nLength, bool bVerify, struct delta_stats *pStats)
+{
+    uint8_t                 uiCurrent [DELTA_MAX_LENGTH], uiReadBack [DELTA_MAX_LENGTH];
+    struct i2c_write_run    writerunRuns [I2C_MAX_WRITE_RUNS];
+    struct i2c_read_run     readrunRuns [I2C_MAX_WRITE_RUNS];
+    struct delta_stats      statsDelta;
+    int                     nByte, nRuns, nRun, nReadBack;
+    
+    if ((nLength <= 0) || (nLength > DELTA_MAX_LENGTH)) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    bzero ((void *) &statsDelta, sizeof (struct delta_stats));
+    if (pStats == (struct delta_stats *) 0)
+        pStats = &statsDelta;
+    else
+        bzero ((void *) pStats, sizeof (struct delta_stats));
+    
+    // Get the current contents if the caller does not already have them
+    
+    if (pCurrent == (uint8_t *) 0) {
+        if (ReadI2CDeviceMemory (busfd, nBusDevId, nOffset, (void *) uiCurrent, nLength) < 0)
+            return -1;
+        
+        pCurrent = uiCurrent;
+        pStats ->m_nTransactions ++;
+    }
+    
+    for (nByte = 0; nByte < nLength; nByte ++) {
+        if (pImage [nByte] != pCurrent [nByte])
+            pStats ->m_nChangedBytes ++;
+    }
+    
+    if ((nRuns = DeltaBuildRuns (nOffset, pCurrent, pImage, nLength, writerunRuns, I2C_MAX_WRITE_RUNS)) == 0)
+        return 0;
+    
+    for (nRun = 0; nRun < nRuns; nRun ++)
+        pStats ->m_nWrittenBytes += writerunRuns [nRun].m_nWriteLength;
+    pStats ->m_nRuns = nRuns;
+    
+    if (WriteI2CDeviceMemoryRuns (busfd, nBusDevId, writerunRuns, nRuns) < 0)
+        return -1;
+    pStats ->m_nTransactions ++;
+    
+    if (! bVerify)
+        return 0;
+    
+    // Read back just the runs we wrote, into the same places in a scratch copy, and compare
+    
+    for (nRun = 0, nReadBack = 0; nRun < nRuns; nRun ++) {
+        readrunRuns [nRun].m_nOffset = writerunRuns [nRun].m_nOffset;
+        readrunRuns [nRun].m_lpBuffer = (void *) &(uiReadBack [(writerunRuns [nRun].m_nOffset - nOffset)]);
+        readrunRuns [nRun].m_nReadLength = writerunRuns [nRun].m_nWriteLength;
+        nReadBack += writerunRuns [nRun].m_nWriteLength;
+    }
+    
+    if (ReadI2CDeviceMemoryRuns (busfd, nBusDevId, readrunRuns, nRuns) < 0)
+        return -1;
+    pStats ->m_nTransactions ++;
+    pStats ->m_nVerifiedBytes = nReadBack;
+    
+    for (nRun = 0; nRun < nRuns; nRun ++) {
+        if (bcmp ((void *) writerunRuns [nRun].m_lpBuffer, readrunRuns [nRun].m_lpBuffer, writerunRuns [nRun].m_nWriteLength) != 0) {
+            errno = EIO;
+            return -1;
+        }
+    }
+    
+    return 0;
+}
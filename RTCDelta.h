@@ -0,0 +1,69 @@
+/*
+**  RTCDelta.h
+**
+**  This header file contains the structures and function prototypes for the delta write engine, which updates
+**  the NVRAM (or any other range) on the PiFace Real Time Clock by writing only the bytes that change.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCDelta_h
+#define RTCDelta_h
+
+# include <stdbool.h>
+# include <stdint.h>
+
+# include "I2CRoutines.h"
+
+# define DELTA_MAX_LENGTH           0x60    // The registers and the NVRAM - the most we can diff in one go
+
+/*
+** Each extra write message in a transaction costs a repeated start, the device address and the offset byte,
+** so two unchanged bytes between two runs are cheaper to rewrite than to skip
+*/
+
+# define DELTA_MESSAGE_COST_BYTES   2
+
+/*
+** What a delta write cost. Bytes written and verified do not include the offset bytes
+*/
+
+struct delta_stats {
+    int     m_nChangedBytes;        // Bytes that differed
+    int     m_nWrittenBytes;        // Bytes sent (changed bytes plus any bridged between runs)
+    int     m_nRuns;                // Separate runs written, each its own message
+    int     m_nVerifiedBytes;       // Bytes read back
+    int     m_nTransactions;        // I2CRDWR transactions, including reading the current contents
+};
+
+int DeltaBuildRuns (int nOffset, uint8_t *pCurrent, uint8_t *pImage, int nLength, struct i2c_write_run *pWriteRuns, int nMaxRuns);
+int DeltaWrite (int busfd, int nBusDevId, int nOffset, uint8_t *pCurrent, uint8_t *pImage, int nLength, bool bVerify, struct delta_stats *pStats);
+
+#endif // RTCDelta_h
@@ -0,0 +1,101 @@
+/*
+**  RTCDiscipline.c
+**
+**  This file contains the routines that decide how to bring the computer clock into line with the PiFace
+**  Real Time Clock. A small offset is slewed away with adjtime(2), so that time never jumps under the programs
+**  that are running, and a large one is stepped. The RTC is read on the edge of a second, so the offset is known
+**  to a millisecond or so.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <sys/types.h>
+
+# include "PiFaceRTC.h"
+# include "RTCTiming.h"
+# include "RTCEdge.h"
+# include "RTCCodec.h"
+# include "RTCCivil.h"
+# include "RTCDiscipline.h"
+
+/* int64_t DisciplineOffset (struct rtc_edge_reading *pEdgeReading)
+**
+** How far the RTC is from the computer clock. The registers were read just after the seconds ticked over, so
+** at the edge the RTC's time was exactly what they hold. The RTC keeps UTC
+*/
+
+int64_t DisciplineOffset (struct rtc_edge_reading *pEdgeReading)
+{
+    time_t timeRTCDateTime = CivilRegistersToEpoch (CodecLoad ((void *) &pEdgeReading ->m_datetimeRTCClock));
+    
+    return (((int64_t) timeRTCDateTime * NSEC_PER_SEC) - pEdgeReading ->m_nsEdgeRealtime);
+}
+
+/* void DisciplineDecide (struct rtc_edge_reading *pEdgeReading, int nStepMsecs, struct discipline_decision *pDecision)
+**
+** Work out the offset from an edge reading, and whether to leave it, slew it or step it. An offset we cannot
+** tell from zero is left alone, one under nStepMsecs is slewed and anything else is stepped
+*/
+
+void DisciplineDecide (struct rtc_edge_reading *pEdgeReading, int nStepMsecs, struct discipline_decision *pDecision)
+{
+    int64_t nsMagnitude;
+    
+    pDecision ->m_nsOffset = DisciplineOffset (pEdgeReading);
+    pDecision ->m_nsUncertainty = pEdgeReading ->m_nsUncertainty;
+    pDecision ->m_nsConvergence = 0;
+    
+    nsMagnitude = llabs (pDecision ->m_nsOffset);
+    if (nsMagnitude <= pDecision ->m_nsUncertainty)
+        pDecision ->m_nAction = DISCIPLINE_NONE;
+    else if (nsMagnitude < ((int64_t) nStepMsecs * NSEC_PER_MSEC)) {
+        pDecision ->m_nAction = DISCIPLINE_SLEW;
+        pDecision ->m_nsConvergence = nsMagnitude * (1000000 / DISCIPLINE_SLEW_PPM);
+    }
+    else
+        pDecision ->m_nAction = DISCIPLINE_STEP;
+}
+
+/* char *DisciplineActionName (int nAction)
+**
+** What we did, for display
+*/
+
+char *DisciplineActionName (int nAction)
+{
+    switch (nAction) {
+    case DISCIPLINE_SLEW:   return "slewing";
+    case DISCIPLINE_STEP:   return "stepped";
+    default:                return "left alone";
+    }
+}
@@ -0,0 +1,71 @@
+/*
+**  RTCDiscipline.h
+**
+**  This header file contains the structures and function prototypes for keeping the computer clock to the
+**  PiFace Real Time Clock, by slewing it when it is close and stepping it when it is not.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCDiscipline_h
+#define RTCDiscipline_h
+
+# include <stdint.h>
+
+# include "RTCEdge.h"
+
+# define DISCIPLINE_DEFAULT_STEP_MSECS  128     // ntpd's step threshold
+# define DISCIPLINE_MAX_STEP_MSECS      1000    // Beyond a second FreeBSD's adjtime(2) slews ten times faster
+# define DISCIPLINE_SLEW_PPM            500     // adjtime(2) slews by half a millisecond a second
+
+/*
+** What to do about the offset
+*/
+
+# define DISCIPLINE_NONE                0       // Within the uncertainty of the measurement, so left alone
+# define DISCIPLINE_SLEW                1
+# define DISCIPLINE_STEP                2
+
+/*
+** The offset is the RTC less the computer clock, so positive when the computer clock is behind
+*/
+
+struct discipline_decision {
+    int64_t     m_nsOffset;
+    int64_t     m_nsUncertainty;
+    int         m_nAction;              // DISCIPLINE_...
+    int64_t     m_nsConvergence;        // How long a slew will take to remove the offset
+};
+
+int64_t DisciplineOffset (struct rtc_edge_reading *pEdgeReading);
+void DisciplineDecide (struct rtc_edge_reading *pEdgeReading, int nStepMsecs, struct discipline_decision *pDecision);
+char *DisciplineActionName (int nAction);
+
+#endif // RTCDiscipline_h
@@ -0,0 +1,379 @@
+/*
+**  RTCDrift.c
+**
+**  This source file contains the drift estimator for the PiFace Real Time Clock. Every time the RTC is set from
+**  the computer clock we first measure how far it has wandered since it was last set. Laying those intervals end
+**  to end (with the effect of whatever trim was programmed taken out) gives the phase of the untrimmed crystal
+**  against the computer clock, and the slope of that is the crystal's drift. We use a Theil-Sen estimate (the
+**  median of the slopes between every pair of samples) so that one bad sync - the computer clock stepping, say -
+**  does not throw it off.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <string.h>
+# include <strings.h>
+# include <unistd.h>
+# include <errno.h>
+# include <sys/types.h>
+
+# include "PiFaceRTC.h"
+# include "RTCTiming.h"
+# include "RTCDrift.h"
+
+# define DRIFT_MAX_PAIRS    ((DRIFT_MAX_SAMPLES * (DRIFT_MAX_SAMPLES - 1)) / 2)
+
+/*
+** A sample is the phase of the untrimmed crystal against the computer clock at a moment in time. Samples are
+** only comparable with others in the same segment - a segment ends whenever the RTC is set to something other
+** than the computer clock, or is set without us measuring it first
+*/
+
+struct drift_sample {
+    int64_t     m_nsSystemTime;
+    int64_t     m_nsPhase;
+    int         m_nSegment;
+};
+
+static struct drift_sample  sampleDriftSamples [DRIFT_MAX_SAMPLES];
+static int                  nDriftSamples = 0;
+static int                  nDriftSegment = 0;
+static bool                 bDriftLoaded = false;
+static bool                 bDriftMeasured = false;     // A sample was taken since the RTC was last set
+
+/*
+** The anchor is the last time the RTC was set from the computer clock: how far off it was left, the phase of
+** the crystal at that moment, and the trim that has been in effect since
+*/
+
+static bool                 bDriftAnchored = false;
+static int64_t              nsAnchorSystemTime, nsAnchorOffset, nsAnchorPhase;
+static int                  nAnchorTrimSteps;
+
+/* static void DriftAddSample (int64_t nsSystemTime, int64_t nsPhase, int nSegment)
+**
+** Append a sample, dropping the oldest if we are full
+*/
+
+static void DriftAddSample (int64_t nsSystemTime, int64_t nsPhase, int nSegment)
+{
+    if (nDriftSamples == DRIFT_MAX_SAMPLES) {
+        memmove (&sampleDriftSamples [0], &sampleDriftSamples [1], (DRIFT_MAX_SAMPLES - 1) * sizeof (struct drift_sample));
+        nDriftSamples --;
+    }
+    
+    sampleDriftSamples [nDriftSamples].m_nsSystemTime = nsSystemTime;
+    sampleDriftSamples [nDriftSamples].m_nsPhase = nsPhase;
+    sampleDriftSamples [nDriftSamples].m_nSegment = nSegment;
+    nDriftSamples ++;
+}
+
+/* static int DriftCompareDoubles (const void *lpFirst, const void *lpSecond)
+**
+** qsort comparison function for doubles
+*/
+
+static int DriftCompareDoubles (const void *lpFirst, const void *lpSecond)
+{
+    double dFirst = *((const double *) lpFirst), dSecond = *((const double *) lpSecond);
+    
+    return ((dFirst < dSecond) ? -1 : ((dFirst > dSecond) ? 1 : 0));
+}
+
+/* static double DriftMedian (double *pdValues, int nValues)
+**
+** Sort the values in place and return their median
+*/
+
+static double DriftMedian (double *pdValues, int nValues)
+{
+    qsort (pdValues, nValues, sizeof (double), &DriftCompareDoubles);
+    
+    if ((nValues % 2) == 1)
+        return pdValues [nValues / 2];
+    
+    return (pdValues [(nValues / 2) - 1] + pdValues [nValues / 2]) / 2.0;
+}
+
+/* int DriftLoad (char *szStatePath)
+**
+** Read the saved samples and anchor. A missing state file is not an error - it just means we have not
+** measured anything yet. Loading a second time does nothing, so callers need not keep track
+*/
+
+int DriftLoad (char *szStatePath)
+{
+    FILE        *fileDriftState;
+    char        szLine [128 +1];
+    long long   llSystemTime, llOffset, llPhase;
+    int         nTrimSteps, nSegment;
+    
+    if (bDriftLoaded)
+        return 0;
+    
+    nDriftSamples = 0;
+    nDriftSegment = 0;
+    bDriftAnchored = false;
+    bDriftMeasured = false;
+    
+    if ((fileDriftState = fopen (szStatePath, "r")) == (FILE *) 0) {
+        if (errno != ENOENT) {
+            (void) perror (szStatePath);
+            return -1;
+        }
+        
+        bDriftLoaded = true;
+        return 0;
+    }
+    
+    while (fgets (szLine, sizeof (szLine), fileDriftState) != (char *) 0) {
+        if (sscanf (szLine, "sample %lld %lld %d", &llSystemTime, &llPhase, &nSegment) == 3) {
+            DriftAddSample (llSystemTime, llPhase, nSegment);
+            if (nSegment > nDriftSegment)
+                nDriftSegment = nSegment;
+        }
+        else if (sscanf (szLine, "anchor %lld %lld %lld %d", &llSystemTime, &llOffset, &llPhase, &nTrimSteps) == 4) {
+            nsAnchorSystemTime = llSystemTime;
+            nsAnchorOffset = llOffset;
+            nsAnchorPhase = llPhase;
+            nAnchorTrimSteps = nTrimSteps;
+            bDriftAnchored = true;
+        }
+        
+        // Anything else (comments, blank lines) is ignored
+    }
+    
+    (void) fclose (fileDriftState);
+    
+    bDriftLoaded = true;
+    return 0;
+}
+
+/* int DriftSave (char *szStatePath)
+**
+** Write the samples and anchor out. We write to a temporary file and rename it over the old one, so a crash
+** part way through never leaves a truncated state file behind
+*/
+
+int DriftSave (char *szStatePath)
+{
+    FILE    *fileDriftState;
+    char    szTempPath [256 +1];
+    int     nSample;
+    
+    (void) snprintf (szTempPath, sizeof (szTempPath), "%s.tmp", szStatePath);
+    if ((fileDriftState = fopen (szTempPath, "w")) == (FILE *) 0) {
+        (void) perror (szTempPath);
+        return -1;
+    }
+    
+    (void) fprintf (fileDriftState, "# rtcdate drift state - phase of the untrimmed RTC crystal against the system clock\n");
+    for (nSample = 0; nSample < nDriftSamples; nSample ++)
+        (void) fprintf (fileDriftState, "sample %lld %lld %d\n", (long long) sampleDriftSamples [nSample].m_nsSystemTime,
+            (long long) sampleDriftSamples [nSample].m_nsPhase, sampleDriftSamples [nSample].m_nSegment);
+    if (bDriftAnchored)
+        (void) fprintf (fileDriftState, "anchor %lld %lld %lld %d\n", (long long) nsAnchorSystemTime, (long long) nsAnchorOffset,
+            (long long) nsAnchorPhase, nAnchorTrimSteps);
+    
+    if ((fclose (fileDriftState) != 0) || (rename (szTempPath, szStatePath) < 0)) {
+        (void) perror (szStatePath);
+        (void) unlink (szTempPath);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* void DriftUnload (void)
+**
+** Forget what we loaded, so that the next DriftLoad reads the state file again. Anything not saved is lost
+*/
+
+void DriftUnload (void)
+{
+    bDriftLoaded = false;
+}
+
+/* int DriftRecordOffset (int64_t nsSystemTime, int64_t nsOffset)
+**
+** Record that at nsSystemTime the RTC was nsOffset ahead of the computer clock (behind, if negative). We
+** take the trim that was in effect since the RTC was set back out, and add a sample. Returns -1 with errno
+** set to ENOENT if the RTC has not been set from the computer clock since we started keeping track
+*/
+
+int DriftRecordOffset (int64_t nsSystemTime, int64_t nsOffset)
+{
+    int64_t nsElapsed, nsPhase;
+    
+    if (! bDriftAnchored) {
+        errno = ENOENT;
+        return -1;
+    }
+    
+    nsElapsed = nsSystemTime - nsAnchorSystemTime;
+    if (nsElapsed <= 0) {
+        // The computer clock has gone backwards since the RTC was set, so this interval is no use to us
+        
+        DriftRecordBreak ();
+        errno = EINVAL;
+        return -1;
+    }
+    
+    nsPhase = nsAnchorPhase + (nsOffset - nsAnchorOffset) - (int64_t) (nAnchorTrimSteps * DRIFT_PPM_PER_TRIM_STEP * ((double) nsElapsed / 1000000.0));
+    DriftAddSample (nsSystemTime, nsPhase, nDriftSegment);
+    
+    nsAnchorPhase = nsPhase;
+    bDriftMeasured = true;
+    return 0;
+}
+
+/* void DriftRecordSet (int64_t nsSystemTime, int64_t nsOffset, int nTrimSteps)
+**
+** Record that the RTC has just been set from the computer clock, leaving it nsOffset out, and that the trim
+** is now nTrimSteps. If we did not measure the RTC first the new interval cannot be joined to the last one,
+** so it starts a new segment
+*/
+
+void DriftRecordSet (int64_t nsSystemTime, int64_t nsOffset, int nTrimSteps)
+{
+    if ((! bDriftAnchored) || (! bDriftMeasured)) {
+        nDriftSegment ++;
+        nsAnchorPhase = 0;
+        DriftAddSample (nsSystemTime, nsAnchorPhase, nDriftSegment);
+    }
+    
+    nsAnchorSystemTime = nsSystemTime;
+    nsAnchorOffset = nsOffset;
+    nAnchorTrimSteps = nTrimSteps;
+    bDriftAnchored = true;
+    bDriftMeasured = false;
+}
+
+/* void DriftRecordBreak (void)
+**
+** Forget the anchor, because the RTC has been set to something we cannot compare with the computer clock
+** (or the trim changed part way through an interval). The samples we have are kept
+*/
+
+void DriftRecordBreak (void)
+{
+    bDriftAnchored = false;
+    bDriftMeasured = false;
+}
+
+/* bool DriftIsAnchored (void)
+**
+** Returns true if the RTC has been set from the computer clock since we started keeping track, so that it is
+** worth measuring how far it has drifted
+*/
+
+bool DriftIsAnchored (void)
+{
+    return bDriftAnchored;
+}
+
+/* int DriftEstimate (struct drift_estimate *pEstimate)
+**
+** Estimate the crystal's drift from the samples, and work out the trim that best cancels it. Returns -1 with
+** errno set to ENOENT if no two samples in the same segment are far enough apart to use
+*/
+
+int DriftEstimate (struct drift_estimate *pEstimate)
+{
+    static double   dSlopes [DRIFT_MAX_PAIRS];
+    int             nFirst, nSecond, nPairs, nSteps;
+    int64_t         nsInterval;
+    
+    for (nFirst = 0, nPairs = 0; nFirst < nDriftSamples; nFirst ++) {
+        for (nSecond = nFirst + 1; nSecond < nDriftSamples; nSecond ++) {
+            if (sampleDriftSamples [nFirst].m_nSegment != sampleDriftSamples [nSecond].m_nSegment)
+                continue;
+            
+            nsInterval = sampleDriftSamples [nSecond].m_nsSystemTime - sampleDriftSamples [nFirst].m_nsSystemTime;
+            if (nsInterval < ((int64_t) DRIFT_MIN_INTERVAL_SECS * NSEC_PER_SEC))
+                continue;
+            
+            dSlopes [nPairs ++] = ((double) (sampleDriftSamples [nSecond].m_nsPhase - sampleDriftSamples [nFirst].m_nsPhase) * 1000000.0) / (double) nsInterval;
+        }
+    }
+    
+    if (nPairs == 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    
+    bzero ((void *) pEstimate, sizeof (struct drift_estimate));
+    pEstimate ->m_nSamples = nDriftSamples;
+    pEstimate ->m_nPairs = nPairs;
+    pEstimate ->m_dDriftPPM = DriftMedian (dSlopes, nPairs);
+    
+    // The spread is the median distance of the pairwise estimates from the median
+    
+    for (nFirst = 0; nFirst < nPairs; nFirst ++)
+        dSlopes [nFirst] = ((dSlopes [nFirst] < pEstimate ->m_dDriftPPM) ? (pEstimate ->m_dDriftPPM - dSlopes [nFirst]) : (dSlopes [nFirst] - pEstimate ->m_dDriftPPM));
+    pEstimate ->m_dSpreadPPM = DriftMedian (dSlopes, nPairs);
+    
+    // A positive drift (the RTC gaining time) needs clocks taken away, which is a negative trim
+    
+    nSteps = (int) ((-pEstimate ->m_dDriftPPM / DRIFT_PPM_PER_TRIM_STEP) + ((pEstimate ->m_dDriftPPM > 0) ? -0.5 : 0.5));
+    if (nSteps > DRIFT_MAX_TRIM_STEPS)
+        nSteps = DRIFT_MAX_TRIM_STEPS;
+    else if (nSteps < -DRIFT_MAX_TRIM_STEPS)
+        nSteps = -DRIFT_MAX_TRIM_STEPS;
+    
+    pEstimate ->m_nTrimSteps = nSteps;
+    pEstimate ->m_dResidualPPM = pEstimate ->m_dDriftPPM + (nSteps * DRIFT_PPM_PER_TRIM_STEP);
+    
+    return 0;
+}
+
+/* int DriftTrimToSteps (struct mcp7940n_osctrim *posctrimTrimValue)
+**
+** Convert the OSCTRIM register to a signed number of steps. The SIGN bit set means clocks are added
+*/
+
+int DriftTrimToSteps (struct mcp7940n_osctrim *posctrimTrimValue)
+{
+    return (posctrimTrimValue ->sign ? (int) posctrimTrimValue ->trimval : -((int) posctrimTrimValue ->trimval));
+}
+
+/* void DriftStepsToTrim (int nTrimSteps, struct mcp7940n_osctrim *posctrimTrimValue)
+**
+** Convert a signed number of steps to the OSCTRIM register
+*/
+
+void DriftStepsToTrim (int nTrimSteps, struct mcp7940n_osctrim *posctrimTrimValue)
+{
+    posctrimTrimValue ->sign = ((nTrimSteps > 0) ? 1 : 0);
+    posctrimTrimValue ->trimval = ((nTrimSteps < 0) ? -nTrimSteps : nTrimSteps);
+}
@@ -0,0 +1,88 @@
+/*
+**  RTCDrift.h
+**
+**  This header file contains the structures and function prototypes for estimating how fast or slow the
+**  PiFace Real Time Clock's crystal runs, and for working out the OSCTRIM value that corrects for it.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCDrift_h
+#define RTCDrift_h
+
+# include <stdbool.h>
+# include <stdint.h>
+
+# include "PiFaceRTC.h"
+
+# if defined (RTCDATE_SIM)
+# define DRIFT_STATE_PATH           "/tmp/rtcsim.drift"         // Not the real RTC's
+# elif defined (__linux__)
+# define DRIFT_STATE_PATH           "/var/lib/rtcdate.drift"    // Linux has no /var/db
+# else
+# define DRIFT_STATE_PATH           "/var/db/rtcdate.drift"
+# endif
+# define DRIFT_MAX_SAMPLES          32          // Older samples are dropped once we have this many
+# define DRIFT_MIN_INTERVAL_SECS    3600        // Samples closer together than this are too noisy to use
+# define DRIFT_MAX_TRIM_STEPS       127         // The largest value TRIMVAL can hold
+
+/*
+** In fine trim mode (CRSTRIM clear) the RTC adds or subtracts two clocks per TRIMVAL step once a minute, and
+** two clocks a minute at 32,768Hz is just over one part per million
+*/
+
+# define DRIFT_PPM_PER_TRIM_STEP    (2.0 * 1000000.0 / (32768.0 * 60.0))
+
+/*
+** The result of an estimate. Drift is in parts per million, positive when the RTC gains time, and is what the
+** crystal would do with no trim at all. Trim steps are signed, positive when the RTC should add clocks
+*/
+
+struct drift_estimate {
+    double  m_dDriftPPM;            // The crystal's own drift
+    double  m_dSpreadPPM;           // Median absolute deviation of the pairwise estimates
+    double  m_dResidualPPM;         // What we expect the RTC to drift by with m_nTrimSteps programmed
+    int     m_nTrimSteps;           // The trim that best cancels the drift
+    int     m_nSamples;             // How many samples the estimate was made from
+    int     m_nPairs;               // How many pairs of samples were far enough apart to use
+};
+
+int DriftLoad (char *szStatePath);
+int DriftSave (char *szStatePath);
+void DriftUnload (void);
+int DriftRecordOffset (int64_t nsSystemTime, int64_t nsOffset);
+void DriftRecordSet (int64_t nsSystemTime, int64_t nsOffset, int nTrimSteps);
+void DriftRecordBreak (void);
+bool DriftIsAnchored (void);
+int DriftEstimate (struct drift_estimate *pEstimate);
+int DriftTrimToSteps (struct mcp7940n_osctrim *posctrimTrimValue);
+void DriftStepsToTrim (int nTrimSteps, struct mcp7940n_osctrim *posctrimTrimValue);
+
+#endif // RTCDrift_h
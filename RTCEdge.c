@@ -0,0 +1,258 @@
+/*
+**  RTCEdge.c
+**
+**  This source file contains the edge read for the PiFace Real Time Clock. The RTC only tells us the time to
+**  the second, but we can find the moment its seconds counter ticks over by polling RTCSEC, one byte at a
+**  time. We do that in passes - a coarse pass to find roughly where in the second the edge falls, and then
+**  finer passes around the following edges, a second apart - which keeps the number of bus transactions small.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <stdbool.h>
+# include <errno.h>
+# include <time.h>
+# include <sys/types.h>
+
+# include "PiFaceRTC.h"
+# include "I2CRoutines.h"
+# include "I2CTrace.h"
+# include "RTCSnapshot.h"
+# include "RTCTiming.h"
+# include "RTCEdge.h"
+
+# define EDGE_GOOD_ENOUGH_NSECS         (1 * NSEC_PER_MSEC)     // A bracket this narrow needs no further passes
+# define EDGE_WAKE_MARGIN_NSECS         (1 * NSEC_PER_MSEC)     // We can wake, and poll, this much later than asked
+# define EDGE_NEXT_PPM                  500                     // How far apart the clocks can run, with adjtime(2)
+
+/*
+** How often we poll in each pass. The first pass covers a whole second, and each pass after it only has to
+** cover the bracket the pass before it found, so none of them takes more than about 25 reads
+*/
+
+static int64_t nsEdgePassIntervals [] = { (50 * NSEC_PER_MSEC), (2 * NSEC_PER_MSEC), (250 * NSEC_PER_USEC) };
+
+# define EDGE_PASSES    ((int) (sizeof (nsEdgePassIntervals) / sizeof (nsEdgePassIntervals [0])))
+
+/*
+** One poll of RTCSEC, with the time on both clocks at the start of the read and on the monotonic clock at the end
+*/
+
+struct edge_sample {
+    uint8_t     m_uiSeconds;
+    int64_t     m_nsStartMonotonic;
+    int64_t     m_nsStartRealtime;
+    int64_t     m_nsEndMonotonic;
+};
+
+/* static int EdgePoll (int busfd, int nBusDevId, struct edge_sample *pSample)
+**
+** Read RTCSEC (without the ST bit) and timestamp the read
+*/
+
+static int EdgePoll (int busfd, int nBusDevId, struct edge_sample *pSample)
+{
+    pSample ->m_nsStartMonotonic = TimingNow (CLOCK_MONOTONIC);
+    pSample ->m_nsStartRealtime = TimingNow (CLOCK_REALTIME);
+    
+    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCSEC_OFFSET, (void *) &(pSample ->m_uiSeconds), 1) < 0)
+        return -1;
+    
+    pSample ->m_nsEndMonotonic = TimingNow (CLOCK_MONOTONIC);
+    pSample ->m_uiSeconds &= 0x7f;
+    
+    return 0;
+}
+
+/* static int EdgeFind (int busfd, int nBusDevId, struct edge_sample *pLast, int64_t nsInterval, int64_t nsDeadline,
+**                      int *pnPolls, struct edge_sample *pFirst)
+**
+** Poll every nsInterval until RTCSEC changes from the value in pLast. On return pLast is the last poll that saw
+** the old value and pFirst the first that saw the new one, so the edge lies between the start of one and the
+** end of the other
+*/
+
+static int EdgeFind (int busfd, int nBusDevId, struct edge_sample *pLast, int64_t nsInterval, int64_t nsDeadline, int *pnPolls, struct edge_sample *pFirst)
+{
+    int64_t nsSleep;
+    
+    for (;;) {
+        if ((*pnPolls >= EDGE_MAX_POLLS) || (TimingNow (CLOCK_MONOTONIC) >= nsDeadline)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        
+        nsSleep = I2CTraceClock ();
+        if (TimingSleepUntil (CLOCK_MONOTONIC, (pLast ->m_nsStartMonotonic + nsInterval), 0) < 0)
+            return -1;
+        I2CTraceSlept (nsSleep);
+        
+        (*pnPolls) ++;
+        if (EdgePoll (busfd, nBusDevId, pFirst) < 0)
+            return -1;
+        
+        if (pFirst ->m_uiSeconds != pLast ->m_uiSeconds)
+            return 0;
+        
+        *pLast = *pFirst;
+    }
+}
+
+/* static int EdgeFinish (int busfd, int nBusDevId, struct edge_sample *pLast, struct edge_sample *pFirst, int nPolls,
+**                         struct rtc_edge_reading *pEdgeReading)
+**
+** The RTC ticked between the start of pLast and the end of pFirst, so read the date/time registers and fill in
+** the reading, with the edge in the middle of the bracket
+*/
+
+static int EdgeFinish (int busfd, int nBusDevId, struct edge_sample *pLast, struct edge_sample *pFirst, int nPolls,
+                       struct rtc_edge_reading *pEdgeReading)
+{
+    // The RTC has just ticked, so we have the best part of a second to read the rest of the registers
+    
+    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, (void *) &(pEdgeReading ->m_datetimeRTCClock), sizeof (struct mcp7940n_datetime)) < 0) {
+        pEdgeReading ->m_nTransactions = nPolls;
+        return -1;
+    }
+    SnapshotPatch (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, (void *) &(pEdgeReading ->m_datetimeRTCClock), sizeof (struct mcp7940n_datetime));
+    
+    pEdgeReading ->m_nsUncertainty = (pFirst ->m_nsEndMonotonic - pLast ->m_nsStartMonotonic) / 2;
+    pEdgeReading ->m_nsEdgeMonotonic = pLast ->m_nsStartMonotonic + pEdgeReading ->m_nsUncertainty;
+    pEdgeReading ->m_nsEdgeRealtime = pLast ->m_nsStartRealtime + pEdgeReading ->m_nsUncertainty;
+    pEdgeReading ->m_nTransactions = nPolls +1;
+    
+    return 0;
+}
+
+/* int EdgeReadRTC (int busfd, int nBusDevId, int nTimeoutMsecs, struct rtc_edge_reading *pEdgeReading)
+**
+** Wait for the RTC's seconds counter to tick over, timestamp the moment it did and read the date/time registers
+** straight afterwards. Gives up, with errno set to ETIMEDOUT, if that takes longer than nTimeoutMsecs or more
+** than EDGE_MAX_POLLS reads, and straight away if the oscillator is not running (there will be no edge)
+*/
+
+int EdgeReadRTC (int busfd, int nBusDevId, int nTimeoutMsecs, struct rtc_edge_reading *pEdgeReading)
+{
+    struct edge_sample sampleLast, sampleFirst, sampleNext;
+    int64_t nsDeadline, nsSleep;
+    int nPolls = 0, nPass;
+    
+    nsDeadline = TimingNow (CLOCK_MONOTONIC) + ((int64_t) nTimeoutMsecs * NSEC_PER_MSEC);
+    pEdgeReading ->m_nTransactions = 0;
+    
+    // Check the oscillator is running before we wait for it to tick
+    
+    if (SnapshotRead (busfd, nBusDevId, MCP7940N_RTCDATETIME_OFFSET, (void *) &(pEdgeReading ->m_datetimeRTCClock), sizeof (struct mcp7940n_datetime)) < 0)
+        return -1;
+    if ((pEdgeReading ->m_datetimeRTCClock.rtcseconds.st == 0) || (pEdgeReading ->m_datetimeRTCClock.rtcweekday.oscrun == 0)) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    
+    // Coarse pass: find the edge to within the first interval
+    
+    nPolls ++;
+    if (EdgePoll (busfd, nBusDevId, &sampleLast) < 0)
+        goto edgeerror;
+    if (EdgeFind (busfd, nBusDevId, &sampleLast, nsEdgePassIntervals [0], nsDeadline, &nPolls, &sampleFirst) < 0)
+        goto edgeerror;
+    
+    // Finer passes: until the bracket is narrow enough, sleep until a little before the earliest the next edge
+    // (a second after this one) can be and poll at the next interval until it arrives. If we woke too late and
+    // the RTC has already ticked, the edge is the bracket we had moved on a second, so we settle for that
+    
+    for (nPass = 1; (nPass < EDGE_PASSES) && ((sampleFirst.m_nsEndMonotonic - sampleLast.m_nsStartMonotonic) > EDGE_GOOD_ENOUGH_NSECS); nPass ++) {
+        nsSleep = I2CTraceClock ();
+        if (TimingSleepUntil (CLOCK_MONOTONIC, (sampleLast.m_nsStartMonotonic + NSEC_PER_SEC - nsEdgePassIntervals [nPass] - EDGE_WAKE_MARGIN_NSECS), 0) < 0)
+            goto edgeerror;
+        I2CTraceSlept (nsSleep);
+        
+        nPolls ++;
+        if (EdgePoll (busfd, nBusDevId, &sampleNext) < 0)
+            goto edgeerror;
+        if (sampleNext.m_uiSeconds != sampleFirst.m_uiSeconds) {
+            sampleLast.m_nsStartMonotonic += NSEC_PER_SEC;
+            sampleLast.m_nsStartRealtime += NSEC_PER_SEC;
+            sampleFirst.m_nsEndMonotonic += NSEC_PER_SEC;
+            break;
+        }
+        
+        sampleLast = sampleNext;
+        if (EdgeFind (busfd, nBusDevId, &sampleLast, nsEdgePassIntervals [nPass], nsDeadline, &nPolls, &sampleFirst) < 0)
+            goto edgeerror;
+    }
+    
+    return EdgeFinish (busfd, nBusDevId, &sampleLast, &sampleFirst, nPolls, pEdgeReading);
+    
+edgeerror:
+    pEdgeReading ->m_nTransactions = nPolls;
+    return -1;
+}
+
+/* int EdgeReadRTCNext (int busfd, int nBusDevId, int nSeconds, int nTimeoutMsecs, struct rtc_edge_reading *pEdgeReading)
+**
+** Read the RTC on the edge nSeconds after the one in pEdgeReading, which holds an earlier reading and is
+** replaced by the new one. The RTC ticks a whole number of seconds after it last did, so rather than search for
+** the edge afresh we only poll around where it must be, at the finest interval - a handful of reads instead of
+** fifty, and no waiting for the coarse passes. The window grows with nSeconds, as the clocks can drift apart,
+** so beyond about ten seconds it is no better than searching. If the edge is not there (the RTC was set, or we
+** were held up and it has gone) we fall back to EdgeReadRTC
+*/
+
+int EdgeReadRTCNext (int busfd, int nBusDevId, int nSeconds, int nTimeoutMsecs, struct rtc_edge_reading *pEdgeReading)
+{
+    struct edge_sample sampleLast, sampleFirst;
+    int64_t nsExpected, nsWindow, nsSleep;
+    int nPolls = 0;
+    
+    nsExpected = pEdgeReading ->m_nsEdgeMonotonic + ((int64_t) nSeconds * NSEC_PER_SEC);
+    nsWindow = pEdgeReading ->m_nsUncertainty + nsEdgePassIntervals [(EDGE_PASSES -1)] + EDGE_WAKE_MARGIN_NSECS +
+               ((int64_t) nSeconds * EDGE_NEXT_PPM * NSEC_PER_USEC);
+    if ((TimingNow (CLOCK_MONOTONIC) >= (nsExpected - nsWindow)) ||
+        ((2 * nsWindow) > ((EDGE_MAX_POLLS / 2) * nsEdgePassIntervals [(EDGE_PASSES -1)])))
+        return EdgeReadRTC (busfd, nBusDevId, nTimeoutMsecs, pEdgeReading);
+    
+    nsSleep = I2CTraceClock ();
+    if (TimingSleepUntil (CLOCK_MONOTONIC, (nsExpected - nsWindow), 0) < 0)
+        return -1;
+    I2CTraceSlept (nsSleep);
+    
+    nPolls ++;
+    if (EdgePoll (busfd, nBusDevId, &sampleLast) < 0)
+        return -1;
+    if (EdgeFind (busfd, nBusDevId, &sampleLast, nsEdgePassIntervals [(EDGE_PASSES -1)], (nsExpected + nsWindow), &nPolls, &sampleFirst) < 0) {
+        if (errno != ETIMEDOUT)
+            return -1;
+        
+        return EdgeReadRTC (busfd, nBusDevId, nTimeoutMsecs, pEdgeReading);
+    }
+    
+    return EdgeFinish (busfd, nBusDevId, &sampleLast, &sampleFirst, nPolls, pEdgeReading);
+}
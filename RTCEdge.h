@@ -0,0 +1,63 @@
+/*
+**  RTCEdge.h
+**
+**  This header file contains the structures and function prototypes for reading the PiFace Real Time Clock
+**  on the edge of a second, so that the time read is accurate to a millisecond or so rather than a second.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCEdge_h
+#define RTCEdge_h
+
+# include <stdint.h>
+
+# include "PiFaceRTC.h"
+
+# define EDGE_DEFAULT_TIMEOUT_MSECS     3500    // Long enough for every pass, each a second apart
+# define EDGE_MAX_POLLS                 100     // The most one-byte reads of RTCSEC we will make
+
+/*
+** The result of an edge read. The date/time registers were read just after the RTC's seconds counter ticked
+** over, and the edge itself is timestamped on both the monotonic and the real time clocks
+*/
+
+struct rtc_edge_reading {
+    struct mcp7940n_datetime    m_datetimeRTCClock;
+    int64_t                     m_nsEdgeMonotonic;      // CLOCK_MONOTONIC at the edge
+    int64_t                     m_nsEdgeRealtime;       // CLOCK_REALTIME at the edge
+    int64_t                     m_nsUncertainty;        // The edge is within this much of the timestamps
+    int                         m_nTransactions;        // The number of bus transactions used
+};
+
+int EdgeReadRTC (int busfd, int nBusDevId, int nTimeoutMsecs, struct rtc_edge_reading *pEdgeReading);
+int EdgeReadRTCNext (int busfd, int nBusDevId, int nSeconds, int nTimeoutMsecs, struct rtc_edge_reading *pEdgeReading);
+
+#endif // RTCEdge_h
@@ -0,0 +1,316 @@
+/*
+**  RTCKeyValue.c
+**
+**  This source file contains the key/value store kept in the NVRAM on the PiFace Real Time Clock. The whole
+**  NVRAM is read in one transaction, changes are made to a copy of it, and only the bytes that differ are
+**  written back - in one transaction, however many separate places they are in.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <stdbool.h>
+# include <string.h>
+# include <strings.h>
+# include <errno.h>
+# include <sys/types.h>
+
+# include "PiFaceRTC.h"
+# include "I2CRoutines.h"
+# include "RTCDelta.h"
+# include "RTCKeyValue.h"
+
+/* static uint16_t KVChecksumBytes (uint16_t uiCRC, uint8_t *pBytes, int nLength)
+**
+** Run bytes through the CRC16 (CCITT polynomial)
+*/
+
+static uint16_t KVChecksumBytes (uint16_t uiCRC, uint8_t *pBytes, int nLength)
+{
+    int nBit;
+    
+    while (nLength -- > 0) {
+        uiCRC ^= (uint16_t) (*pBytes ++ << 8);
+        for (nBit = 0; nBit < 8; nBit ++)
+            uiCRC = ((uiCRC & 0x8000) ? ((uiCRC << 1) ^ 0x1021) : (uiCRC << 1));
+    }
+    
+    return uiCRC;
+}
+
+/* static uint16_t KVChecksum (uint8_t *pImage)
+**
+** Work out the CRC over the version, length and records, starting from 0xffff
+*/
+
+static uint16_t KVChecksum (uint8_t *pImage)
+{
+    uint16_t    uiCRC;
+    int         nLength;
+    
+    nLength = pImage [KV_LENGTH_OFFSET];
+    if (nLength > KV_MAX_RECORDS_LENGTH)
+        nLength = KV_MAX_RECORDS_LENGTH;
+    
+    uiCRC = KVChecksumBytes (0xffff, &(pImage [KV_VERSION_OFFSET]), (KV_CRC_OFFSET - KV_VERSION_OFFSET));
+    return KVChecksumBytes (uiCRC, &(pImage [KV_HEADER_LENGTH]), nLength);
+}
+
+/* static void KVSeal (struct kv_store *pStore, int nLength)
+**
+** Set the length of the records in the header, and update the CRC to match
+*/
+
+static void KVSeal (struct kv_store *pStore, int nLength)
+{
+    uint16_t uiCRC;
+    
+    pStore ->m_uiImage [KV_LENGTH_OFFSET] = (uint8_t) nLength;
+    uiCRC = KVChecksum (pStore ->m_uiImage);
+    pStore ->m_uiImage [KV_CRC_OFFSET] = (uint8_t) (uiCRC >> 8);
+    pStore ->m_uiImage [KV_CRC_OFFSET + 1] = (uint8_t) (uiCRC & 0xff);
+}
+
+/* static int KVRecordEnd (struct kv_store *pStore, int nRecord)
+**
+** Returns the offset just past the record at nRecord, or -1 if there is no whole record there - one that runs
+** past the end of the records, or has a key we could not have written
+*/
+
+static int KVRecordEnd (struct kv_store *pStore, int nRecord)
+{
+    int nEnd = KV_HEADER_LENGTH + pStore ->m_uiImage [KV_LENGTH_OFFSET];
+    
+    if ((nRecord < KV_HEADER_LENGTH) || ((nRecord + KV_RECORD_HEADER) > nEnd))
+        return -1;
+    if ((pStore ->m_uiImage [nRecord] == 0) || (pStore ->m_uiImage [nRecord] > KV_MAX_KEY_LENGTH))
+        return -1;
+    
+    nRecord += KV_RECORD_HEADER + pStore ->m_uiImage [nRecord] + pStore ->m_uiImage [nRecord + 1];
+    return ((nRecord > nEnd) ? -1 : nRecord);
+}
+
+/* static int KVFind (struct kv_store *pStore, char *szKey)
+**
+** Returns the offset of the record for the key, or -1 if there is not one
+*/
+
+static int KVFind (struct kv_store *pStore, char *szKey)
+{
+    int nRecord, nNext, nKeyLength = strlen (szKey);
+    
+    for (nRecord = KV_HEADER_LENGTH; (nNext = KVRecordEnd (pStore, nRecord)) >= 0; nRecord = nNext) {
+        if ((pStore ->m_uiImage [nRecord] == nKeyLength) &&
+            (memcmp (&(pStore ->m_uiImage [nRecord + KV_RECORD_HEADER]), szKey, nKeyLength) == 0))
+            return nRecord;
+    }
+    
+    return -1;
+}
+
+/* int KVLoad (int busfd, int nBusDevId, struct kv_store *pStore)
+**
+** Read the whole NVRAM in one transaction. The store may not be valid - check with KVIsValid
+*/
+
+int KVLoad (int busfd, int nBusDevId, struct kv_store *pStore)
+{
+    if (ReadI2CDeviceMemory (busfd, nBusDevId, MCP7940N_NVRAM_OFFSET, (void *) pStore ->m_uiDevice, KV_NVRAM_LENGTH) < 0)
+        return -1;
+    
+    bcopy ((void *) pStore ->m_uiDevice, (void *) pStore ->m_uiImage, KV_NVRAM_LENGTH);
+    return 0;
+}
+
+/* bool KVIsValid (struct kv_store *pStore)
+**
+** Returns true if the NVRAM holds a store we understand, with a good CRC
+*/
+
+bool KVIsValid (struct kv_store *pStore)
+{
+    uint8_t *pImage = pStore ->m_uiImage;
+    int nRecord, nEnd;
+    
+    if ((pImage [KV_MAGIC_OFFSET] != KV_MAGIC_0) || (pImage [KV_MAGIC_OFFSET + 1] != KV_MAGIC_1) ||
+        (pImage [KV_VERSION_OFFSET] != KV_VERSION) || (pImage [KV_LENGTH_OFFSET] > KV_MAX_RECORDS_LENGTH) ||
+        (KVChecksum (pImage) != ((pImage [KV_CRC_OFFSET] << 8) | pImage [KV_CRC_OFFSET + 1])))
+        return false;
+    
+    // A good CRC only says the bytes are as they were written, so check the records fit exactly in the length
+    
+    nEnd = KV_HEADER_LENGTH + pImage [KV_LENGTH_OFFSET];
+    for (nRecord = KV_HEADER_LENGTH; nRecord < nEnd; ) {
+        if ((nRecord = KVRecordEnd (pStore, nRecord)) < 0)
+            return false;
+    }
+    
+    return true;
+}
+
+/* void KVFormat (struct kv_store *pStore)
+**
+** Make the image an empty store. Only the header is touched, whatever follows it is left alone
+*/
+
+void KVFormat (struct kv_store *pStore)
+{
+    pStore ->m_uiImage [KV_MAGIC_OFFSET] = KV_MAGIC_0;
+    pStore ->m_uiImage [KV_MAGIC_OFFSET + 1] = KV_MAGIC_1;
+    pStore ->m_uiImage [KV_VERSION_OFFSET] = KV_VERSION;
+    KVSeal (pStore, 0);
+}
+
+/* int KVGet (struct kv_store *pStore, char *szKey, uint8_t **ppValue)
+**
+** Look up a key. Returns the length of the value, with ppValue pointing at it, or -1 with errno set to
+** ENOENT if the key is not in the store
+*/
+
+int KVGet (struct kv_store *pStore, char *szKey, uint8_t **ppValue)
+{
+    int nRecord;
+    
+    if ((nRecord = KVFind (pStore, szKey)) < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    
+    *ppValue = &(pStore ->m_uiImage [nRecord + KV_RECORD_HEADER + pStore ->m_uiImage [nRecord]]);
+    return pStore ->m_uiImage [nRecord + 1];
+}
+
+/* int KVSet (struct kv_store *pStore, char *szKey, void *lpValue, int nValueLength)
+**
+** Add a key, or change its value. A value the same length as the old one is overwritten where it is, so only
+** the bytes that differ (and the CRC) change. Otherwise the old record is removed and the new one added at the
+** end. Returns -1 with errno set to EINVAL for a bad key, or ENOSPC if it will not fit
+*/
+
+int KVSet (struct kv_store *pStore, char *szKey, void *lpValue, int nValueLength)
+{
+    int nRecord, nLength, nKeyLength = strlen (szKey);
+    
+    if ((nKeyLength == 0) || (nKeyLength > KV_MAX_KEY_LENGTH) || (nValueLength < 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    nRecord = KVFind (pStore, szKey);
+    if ((nRecord >= 0) && (pStore ->m_uiImage [nRecord + 1] == nValueLength)) {
+        bcopy (lpValue, (void *) &(pStore ->m_uiImage [nRecord + KV_RECORD_HEADER + nKeyLength]), nValueLength);
+        KVSeal (pStore, pStore ->m_uiImage [KV_LENGTH_OFFSET]);
+        return 0;
+    }
+    
+    // Check there is room before we remove anything
+    
+    nLength = pStore ->m_uiImage [KV_LENGTH_OFFSET];
+    if (nRecord >= 0)
+        nLength -= KV_RECORD_HEADER + nKeyLength + pStore ->m_uiImage [nRecord + 1];
+    if ((nLength + KV_RECORD_HEADER + nKeyLength + nValueLength) > KV_MAX_RECORDS_LENGTH) {
+        errno = ENOSPC;
+        return -1;
+    }
+    
+    if (nRecord >= 0)
+        (void) KVDelete (pStore, szKey);
+    
+    nRecord = KV_HEADER_LENGTH + nLength;
+    pStore ->m_uiImage [nRecord] = (uint8_t) nKeyLength;
+    pStore ->m_uiImage [nRecord + 1] = (uint8_t) nValueLength;
+    bcopy ((void *) szKey, (void *) &(pStore ->m_uiImage [nRecord + KV_RECORD_HEADER]), nKeyLength);
+    bcopy (lpValue, (void *) &(pStore ->m_uiImage [nRecord + KV_RECORD_HEADER + nKeyLength]), nValueLength);
+    KVSeal (pStore, nLength + KV_RECORD_HEADER + nKeyLength + nValueLength);
+    
+    return 0;
+}
+
+/* int KVDelete (struct kv_store *pStore, char *szKey)
+**
+** Remove a key. The records after it are moved down to close the gap. Returns -1 with errno set to ENOENT
+** if the key is not in the store
+*/
+
+int KVDelete (struct kv_store *pStore, char *szKey)
+{
+    int nRecord, nRecordLength, nEnd;
+    
+    if ((nRecord = KVFind (pStore, szKey)) < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    
+    nRecordLength = KV_RECORD_HEADER + pStore ->m_uiImage [nRecord] + pStore ->m_uiImage [nRecord + 1];
+    nEnd = KV_HEADER_LENGTH + pStore ->m_uiImage [KV_LENGTH_OFFSET];
+    memmove (&(pStore ->m_uiImage [nRecord]), &(pStore ->m_uiImage [nRecord + nRecordLength]), nEnd - (nRecord + nRecordLength));
+    KVSeal (pStore, pStore ->m_uiImage [KV_LENGTH_OFFSET] - nRecordLength);
+    
+    return 0;
+}
+
+/* int KVNext (struct kv_store *pStore, int nCursor, char *szKey, uint8_t **ppValue, int *pnValueLength)
+**
+** Walk the store. Start with a cursor of 0, and pass back the value returned each time until it returns -1.
+** szKey must have room for KV_MAX_KEY_LENGTH characters and a NULL
+*/
+
+int KVNext (struct kv_store *pStore, int nCursor, char *szKey, uint8_t **ppValue, int *pnValueLength)
+{
+    int nKeyLength, nNext;
+    
+    if (nCursor < KV_HEADER_LENGTH)
+        nCursor = KV_HEADER_LENGTH;
+    if ((nNext = KVRecordEnd (pStore, nCursor)) < 0)
+        return -1;
+    
+    nKeyLength = pStore ->m_uiImage [nCursor];
+    bcopy ((void *) &(pStore ->m_uiImage [nCursor + KV_RECORD_HEADER]), (void *) szKey, nKeyLength);
+    szKey [nKeyLength] = '\0';
+    
+    *ppValue = &(pStore ->m_uiImage [nCursor + KV_RECORD_HEADER + nKeyLength]);
+    *pnValueLength = pStore ->m_uiImage [nCursor + 1];
+    
+    return nNext;
+}
+
+/* int KVCommit (int busfd, int nBusDevId, struct kv_store *pStore, struct delta_stats *pStats)
+**
+** Write the bytes of the image that differ from the NVRAM, in one transaction, and read them back to check
+** them. pStats may be NULL
+*/
+
+int KVCommit (int busfd, int nBusDevId, struct kv_store *pStore, struct delta_stats *pStats)
+{
+    if (DeltaWrite (busfd, nBusDevId, MCP7940N_NVRAM_OFFSET, pStore ->m_uiDevice, pStore ->m_uiImage, KV_NVRAM_LENGTH, true, pStats) < 0)
+        return -1;
+    
+    bcopy ((void *) pStore ->m_uiImage, (void *) pStore ->m_uiDevice, KV_NVRAM_LENGTH);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+**  RTCKeyValue.h
+**
+**  This header file contains the structures and function prototypes for the key/value store kept in the 64
+**  bytes of NVRAM on the PiFace Real Time Clock.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCKeyValue_h
+#define RTCKeyValue_h
+
+# include <stdbool.h>
+# include <stdint.h>
+
+# include "RTCDelta.h"
+
+/*
+** The store starts with a six byte header - a two byte magic number, a version, the number of bytes of records
+** that follow, and a CRC16 (CCITT, big endian) over the version, length and records. Each record is a key
+** length, a value length, the key and then the value. Bytes after the last record are unused and may hold
+** anything
+*/
+
+# define KV_NVRAM_LENGTH        64
+# define KV_MAGIC_0             'K'
+# define KV_MAGIC_1             'V'
+# define KV_VERSION             1
+
+# define KV_MAGIC_OFFSET        0
+# define KV_VERSION_OFFSET      2
+# define KV_LENGTH_OFFSET       3
+# define KV_CRC_OFFSET          4
+# define KV_HEADER_LENGTH       6
+
+# define KV_RECORD_HEADER       2       // Key length and value length
+# define KV_MAX_KEY_LENGTH      16
+# define KV_MAX_RECORDS_LENGTH  (KV_NVRAM_LENGTH - KV_HEADER_LENGTH)
+
+/*
+** A store being worked on. m_uiDevice is what is in the NVRAM, and m_uiImage what we want there - commit
+** writes the differences with the delta write engine
+*/
+
+struct kv_store {
+    uint8_t m_uiDevice [KV_NVRAM_LENGTH];
+    uint8_t m_uiImage [KV_NVRAM_LENGTH];
+};
+
+int KVLoad (int busfd, int nBusDevId, struct kv_store *pStore);
+bool KVIsValid (struct kv_store *pStore);
+void KVFormat (struct kv_store *pStore);
+int KVGet (struct kv_store *pStore, char *szKey, uint8_t **ppValue);
+int KVSet (struct kv_store *pStore, char *szKey, void *lpValue, int nValueLength);
+int KVDelete (struct kv_store *pStore, char *szKey);
+int KVNext (struct kv_store *pStore, int nCursor, char *szKey, uint8_t **ppValue, int *pnValueLength);
+int KVCommit (int busfd, int nBusDevId, struct kv_store *pStore, struct delta_stats *pStats);
+
+#endif // RTCKeyValue_h
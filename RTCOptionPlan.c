@@ -0,0 +1,255 @@
+/*
+**  RTCOptionPlan.c
+**
+**  This source file contains the option planner for the PiFace Real Time Clock. Each option processed
+**  with -o stages the bytes it wants to change rather than doing its own read-modify-write, and the planner
+**  keeps a dirty flag for every register and NVRAM byte. When all of the options have been processed the
+**  dirty bytes are sent to the device as one I2CRDWR transaction, with one message per run of bytes.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <strings.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <stdio.h>
+# include <errno.h>
+# include <sys/types.h>
+
+# include "PiFaceRTC.h"
+# include "I2CRoutines.h"
+# include "RTCSnapshot.h"
+# include "RTCOptionPlan.h"
+# include "RTCCache.h"
+
+/*
+** Clean registers between two dirty ones are written back with their snapshot value, rather than starting a
+** new message, if the gap is no bigger than this. A new message costs a (re)start, the address and an offset
+** byte, so bridging a gap of two bytes or less is never more expensive. We never bridge the timekeeping
+** registers as writing back a stale value there would set the clock back
+*/
+
+# define PLAN_MAX_BRIDGED_GAP           2
+
+static uint8_t  uiPlanImage [MCP7940N_PLAN_LENGTH];
+static bool     bPlanDirty [MCP7940N_PLAN_LENGTH];
+static int      (*pfnPlanActions [MCP7940N_PLAN_MAX_ACTIONS]) (int busfd, int nBusDevId, FILE *fpOutput);
+static int      nPlanActions = 0;
+
+/* static bool PlanRangeIsValid (int nOffset, int nLength)
+**
+** Returns true if the range lies within the registers and NVRAM the planner knows about
+*/
+
+static bool PlanRangeIsValid (int nOffset, int nLength)
+{
+    return ((nOffset >= 0) && (nLength > 0) && ((nOffset + nLength) <= MCP7940N_PLAN_LENGTH));
+}
+
+/* void PlanReset (void)
+**
+** Throw away any staged changes and deferred actions
+*/
+
+void PlanReset (void)
+{
+    bzero ((void *) bPlanDirty, sizeof (bPlanDirty));
+    nPlanActions = 0;
+}
+
+/* int PlanPeek (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nPeekLength)
+**
+** Read registers (or NVRAM) as they will be once the plan has been flushed. Bytes that have not been staged
+** come from the snapshot (or the device, for the NVRAM), and staged bytes are laid over the top
+*/
+
+int PlanPeek (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nPeekLength)
+{
+    int nIndex;
+    
+    if (! PlanRangeIsValid (nOffset, nPeekLength)) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    if (SnapshotRead (busfd, nBusDevId, nOffset, lpBuffer, nPeekLength) < 0)
+        return -1;
+    
+    for (nIndex = 0; nIndex < nPeekLength; nIndex ++) {
+        if (bPlanDirty [(nOffset + nIndex)])
+            ((uint8_t *) lpBuffer) [nIndex] = uiPlanImage [(nOffset + nIndex)];
+    }
+    
+    return 0;
+}
+
+/* int PlanStage (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nStageLength)
+**
+** Stage bytes to be written when the plan is flushed. A register that already holds the value being staged
+** (according to the snapshot) is not marked dirty, so it costs nothing on the bus
+*/
+
+int PlanStage (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nStageLength)
+{
+    uint8_t uiCurrent [MCP7940N_SNAPSHOT_LENGTH];
+    int nIndex, nRegisterLength;
+    
+    if (! PlanRangeIsValid (nOffset, nStageLength)) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    // Get the current values of any registers we are staging, so that we can skip the ones that do not change
+    
+    nRegisterLength = (nOffset >= MCP7940N_SNAPSHOT_LENGTH ? 0 :
+                        ((nOffset + nStageLength) > MCP7940N_SNAPSHOT_LENGTH ? (MCP7940N_SNAPSHOT_LENGTH - nOffset) : nStageLength));
+    if (nRegisterLength > 0) {
+        if (SnapshotRead (busfd, nBusDevId, nOffset, (void *) uiCurrent, nRegisterLength) < 0)
+            return -1;
+    }
+    
+    for (nIndex = 0; nIndex < nStageLength; nIndex ++) {
+        if ((nIndex < nRegisterLength) && (! bPlanDirty [(nOffset + nIndex)]) && (uiCurrent [nIndex] == ((uint8_t *) lpBuffer) [nIndex]))
+            continue;
+        
+        uiPlanImage [(nOffset + nIndex)] = ((uint8_t *) lpBuffer) [nIndex];
+        bPlanDirty [(nOffset + nIndex)] = true;
+    }
+    
+    return 0;
+}
+
+/* int PlanAfterFlush (int (*pfnAction) (int busfd, int nBusDevId, FILE *fpOutput))
+**
+** Queue an action to be run once the staged changes have been written out, for options (like init) that
+** need more than a simple register write
+*/
+
+int PlanAfterFlush (int (*pfnAction) (int busfd, int nBusDevId, FILE *fpOutput))
+{
+    int nAction;
+    
+    // An action only needs to run once, however many times it was asked for
+    
+    for (nAction = 0; nAction < nPlanActions; nAction ++) {
+        if (pfnPlanActions [nAction] == pfnAction)
+            return 0;
+    }
+    
+    if (nPlanActions >= MCP7940N_PLAN_MAX_ACTIONS) {
+        errno = ENOSPC;
+        return -1;
+    }
+    
+    pfnPlanActions [nPlanActions ++] = pfnAction;
+    return 0;
+}
+
+/* int PlanFlush (int busfd, int nBusDevId, FILE *fpOutput)
+**
+** Write every dirty byte out to the device, then run any deferred actions (which display to fpOutput). The
+** dirty bytes are grouped into runs and all of the runs are sent in one I2CRDWR transaction (more only if there
+** are an unusually large number of runs)
+*/
+
+int PlanFlush (int busfd, int nBusDevId, FILE *fpOutput)
+{
+    struct i2c_write_run writerunRuns [I2C_MAX_WRITE_RUNS];
+    int nOffset, nRunStart, nGap, nRuns, nRun, nAction, nStatus = 0;
+    char szErrorString [128 +1];
+    
+    for (nOffset = 0, nRuns = 0; nOffset <= MCP7940N_PLAN_LENGTH; nOffset ++) {
+        if ((nOffset < MCP7940N_PLAN_LENGTH) && (! bPlanDirty [nOffset]))
+            continue;
+        
+        // Send what we have if we have run out of room for more runs, or we have been through every byte
+        
+        if ((nRuns == I2C_MAX_WRITE_RUNS) || ((nOffset == MCP7940N_PLAN_LENGTH) && (nRuns > 0))) {
+            if (writerunRuns [0].m_nOffset <= MCP7940N_OSCTRIM_OFFSET)
+                CacheForget ();             // The runs are in order, so this one changes what the RTC will read
+            
+            if (WriteI2CDeviceMemoryRuns (busfd, nBusDevId, writerunRuns, nRuns) < 0) {
+                // An error occurred. We do not know which of the writes made it, so throw the snapshot away
+                
+                (void) sprintf (szErrorString, "ioctl I2CRDWR for nBusDevId 0x%02x writing option changes", nBusDevId);
+                (void) perror (szErrorString);
+                SnapshotInvalidate ();
+                PlanReset ();
+                return -1;
+            }
+            
+            for (nRun = 0; nRun < nRuns; nRun ++)
+                SnapshotPatch (busfd, nBusDevId, writerunRuns [nRun].m_nOffset, writerunRuns [nRun].m_lpBuffer, writerunRuns [nRun].m_nWriteLength);
+            nRuns = 0;
+        }
+        
+        if (nOffset == MCP7940N_PLAN_LENGTH)
+            break;
+        
+        // Start a new run here and extend it over every dirty byte that follows, bridging small gaps of
+        // clean control registers
+        
+        nRunStart = nOffset;
+        for (;;) {
+            while ((nOffset < MCP7940N_PLAN_LENGTH) && bPlanDirty [nOffset])
+                nOffset ++;
+            
+            for (nGap = 0; (nGap < PLAN_MAX_BRIDGED_GAP) && ((nOffset + nGap) < MCP7940N_PLAN_LENGTH) && (! bPlanDirty [(nOffset + nGap)]); nGap ++)
+                ;
+            if ((nGap == 0) || ((nOffset + nGap) >= MCP7940N_SNAPSHOT_LENGTH) || (! bPlanDirty [(nOffset + nGap)]) || (nOffset <= MCP7940N_RTCYEAR_OFFSET))
+                break;
+            if (SnapshotRead (busfd, nBusDevId, nOffset, (void *) &(uiPlanImage [nOffset]), nGap) < 0)
+                break;
+            for (; nGap > 0; nGap --)
+                bPlanDirty [nOffset ++] = true;
+        }
+        
+        writerunRuns [nRuns].m_nOffset = nRunStart;
+        writerunRuns [nRuns].m_lpBuffer = (void *) &(uiPlanImage [nRunStart]);
+        writerunRuns [nRuns].m_nWriteLength = nOffset - nRunStart;
+        nRuns ++;
+        
+        // Step back one so the loop revisits the byte that ended the run (it may be the end of the plan)
+        
+        nOffset --;
+    }
+    
+    bzero ((void *) bPlanDirty, sizeof (bPlanDirty));
+    
+    // Now run any actions that were waiting for the writes to complete
+    
+    for (nAction = 0; nAction < nPlanActions; nAction ++) {
+        if ((*pfnPlanActions [nAction]) (busfd, nBusDevId, fpOutput) < 0)
+            nStatus = -1;
+    }
+    nPlanActions = 0;
+    
+    return nStatus;
+}
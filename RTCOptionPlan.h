@@ -0,0 +1,52 @@
+/*
+**  RTCOptionPlan.h
+**
+**  This header file contains the function prototypes for the option planner. Options processed with -o
+**  stage their register changes in the plan instead of writing them straight away, and the plan is then
+**  flushed to the PiFace Real Time Clock in a single I2CRDWR transaction.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCOptionPlan_h
+#define RTCOptionPlan_h
+
+# include <stdio.h>
+
+# define MCP7940N_PLAN_LENGTH           0x60    // Registers (0x00 - 0x1f) and NVRAM (0x20 - 0x5f)
+# define MCP7940N_PLAN_MAX_ACTIONS      4
+
+void PlanReset (void);
+int PlanPeek (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nPeekLength);
+int PlanStage (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nStageLength);
+int PlanAfterFlush (int (*pfnAction) (int busfd, int nBusDevId, FILE *fpOutput));
+int PlanFlush (int busfd, int nBusDevId, FILE *fpOutput);
+
+#endif // RTCOptionPlan_h
@@ -0,0 +1,164 @@
+/*
+**  RTCShm.c
+**
+**  This file contains the routines that publish samples of the PiFace Real Time Clock in the NTP shared
+**  memory segment, for ntpd's SHM reference clock driver (or chronyd's refclock SHM) to read. Each sample is
+**  written under the segment's count/valid protocol, so a reader never takes one that is half written, and the
+**  time daemon gets a sample every second or so without starting a process. There is also the reader's side of
+**  the protocol, as ntpd has it, so that rtcbench can check what we publish.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdatomic.h>
+# include <errno.h>
+# include <sys/types.h>
+# include <sys/ipc.h>
+# include <sys/shm.h>
+
+# include "RTCTiming.h"
+# include "RTCShm.h"
+
+/* struct shm_time *ShmAttach (int nUnit)
+**
+** Attach to the segment for nUnit, creating it if the time daemon has not yet. Units 0 and 1 are only for root,
+** as ntpd expects. Returns a null pointer, with errno set, if we cannot
+*/
+
+struct shm_time *ShmAttach (int nUnit)
+{
+    struct shm_time *pShm;
+    int nShmId;
+    
+    if ((nUnit < 0) || (nUnit > SHM_MAX_UNIT)) {
+        errno = EINVAL;
+        return (struct shm_time *) 0;
+    }
+    
+    nShmId = shmget ((key_t) (SHM_NTP_KEY + nUnit), sizeof (struct shm_time), IPC_CREAT | ((nUnit < SHM_PRIVATE_UNITS) ? 0600 : 0666));
+    if (nShmId < 0)
+        return (struct shm_time *) 0;
+    
+    if ((pShm = (struct shm_time *) shmat (nShmId, (void *) 0, 0)) == (struct shm_time *) -1)
+        return (struct shm_time *) 0;
+    
+    return pShm;
+}
+
+/* void ShmDetach (struct shm_time *pShm)
+**
+** Detach from the segment. It stays for the time daemon
+*/
+
+void ShmDetach (struct shm_time *pShm)
+{
+    (void) shmdt ((void *) pShm);
+}
+
+/* int ShmPrecision (int64_t nsPrecision)
+**
+** The precision as the segment has it, log2 of seconds - the smallest power of two at least nsPrecision
+*/
+
+int ShmPrecision (int64_t nsPrecision)
+{
+    int nPrecision = 0;
+    
+    while ((nPrecision > -30) && ((NSEC_PER_SEC >> (1 - nPrecision)) >= nsPrecision))
+        nPrecision --;
+    
+    return nPrecision;
+}
+
+/* void ShmPublish (struct shm_time *pShm, struct shm_sample *pSample)
+**
+** Write a sample into the segment. It is marked invalid and count made odd while we write, and count moves on
+** again and it is marked valid once we have, with barriers between so that a reader on another CPU sees them
+** in that order
+*/
+
+void ShmPublish (struct shm_time *pShm, struct shm_sample *pSample)
+{
+    pShm ->m_nValid = 0;
+    pShm ->m_nCount ++;
+    atomic_thread_fence (memory_order_seq_cst);
+    
+    pShm ->m_nMode = SHM_MODE_COUNTED;
+    pShm ->m_timeClockTimeStampSec = (time_t) (pSample ->m_nsClockTime / NSEC_PER_SEC);
+    pShm ->m_nClockTimeStampUSec = (int) ((pSample ->m_nsClockTime % NSEC_PER_SEC) / NSEC_PER_USEC);
+    pShm ->m_uiClockTimeStampNSec = (unsigned) (pSample ->m_nsClockTime % NSEC_PER_SEC);
+    pShm ->m_timeReceiveTimeStampSec = (time_t) (pSample ->m_nsReceiveTime / NSEC_PER_SEC);
+    pShm ->m_nReceiveTimeStampUSec = (int) ((pSample ->m_nsReceiveTime % NSEC_PER_SEC) / NSEC_PER_USEC);
+    pShm ->m_uiReceiveTimeStampNSec = (unsigned) (pSample ->m_nsReceiveTime % NSEC_PER_SEC);
+    pShm ->m_nLeap = pSample ->m_nLeap;
+    pShm ->m_nPrecision = pSample ->m_nPrecision;
+    pShm ->m_nSamples = 0;
+    
+    atomic_thread_fence (memory_order_seq_cst);
+    pShm ->m_nCount ++;
+    atomic_thread_fence (memory_order_seq_cst);
+    pShm ->m_nValid = 1;
+}
+
+/* int ShmConsume (struct shm_time *pShm, struct shm_sample *pSample)
+**
+** Take a sample out of the segment, as ntpd does in mode 1. Returns -1 with errno set to EAGAIN if there is no
+** new sample, or EBUSY if one was being written while we read it (it is left for next time)
+*/
+
+int ShmConsume (struct shm_time *pShm, struct shm_sample *pSample)
+{
+    int nCount;
+    
+    if (! pShm ->m_nValid) {
+        errno = EAGAIN;
+        return -1;
+    }
+    
+    nCount = pShm ->m_nCount;
+    atomic_thread_fence (memory_order_seq_cst);
+    
+    pSample ->m_nsClockTime = ((int64_t) pShm ->m_timeClockTimeStampSec * NSEC_PER_SEC) + pShm ->m_uiClockTimeStampNSec;
+    pSample ->m_nsReceiveTime = ((int64_t) pShm ->m_timeReceiveTimeStampSec * NSEC_PER_SEC) + pShm ->m_uiReceiveTimeStampNSec;
+    pSample ->m_nLeap = pShm ->m_nLeap;
+    pSample ->m_nPrecision = pShm ->m_nPrecision;
+    
+    atomic_thread_fence (memory_order_seq_cst);
+    if ((nCount != pShm ->m_nCount) || ((nCount & 1) != 0)) {
+        errno = EBUSY;
+        return -1;
+    }
+    
+    pShm ->m_nValid = 0;
+    return 0;
+}
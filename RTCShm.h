@@ -0,0 +1,89 @@
+/*
+**  RTCShm.h
+**
+**  This header file contains the structures and function prototypes for publishing the PiFace Real Time
+**  Clock to ntpd or chronyd as a reference clock, through the NTP shared memory (SHM) segment.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCShm_h
+#define RTCShm_h
+
+# include <stdint.h>
+# include <time.h>
+
+# define SHM_NTP_KEY                    0x4e545030      // "NTP0", plus the unit
+# define SHM_MAX_UNIT                   255
+# define SHM_PRIVATE_UNITS              2               // Units 0 and 1 are root's alone, the rest anyone's
+# define SHM_DEFAULT_INTERVAL_SECS      1               // ntpd reads the segment once a second
+# define SHM_MODE_COUNTED               1               // The reader checks count is the same either side
+
+# define SHM_LEAP_NOWARNING             0               // The RTC knows nothing of leap seconds
+
+/*
+** The segment, laid out as ntpd's refclock_shm.c (and chronyd, and gpsd) have it. The clock time stamp is the
+** reference clock's time, and the receive time stamp the computer clock's at the same moment
+*/
+
+struct shm_time {
+    int             m_nMode;
+    volatile int    m_nCount;
+    time_t          m_timeClockTimeStampSec;
+    int             m_nClockTimeStampUSec;
+    time_t          m_timeReceiveTimeStampSec;
+    int             m_nReceiveTimeStampUSec;
+    int             m_nLeap;
+    int             m_nPrecision;           // log2 of the sample's precision in seconds
+    int             m_nSamples;
+    volatile int    m_nValid;
+    unsigned        m_uiClockTimeStampNSec;
+    unsigned        m_uiReceiveTimeStampNSec;
+    int             m_nDummy [8];
+};
+
+/*
+** A sample, as a reader takes it out of the segment
+*/
+
+struct shm_sample {
+    int64_t     m_nsClockTime;
+    int64_t     m_nsReceiveTime;
+    int         m_nLeap;
+    int         m_nPrecision;
+};
+
+struct shm_time *ShmAttach (int nUnit);
+void ShmDetach (struct shm_time *pShm);
+int ShmPrecision (int64_t nsPrecision);
+void ShmPublish (struct shm_time *pShm, struct shm_sample *pSample);
+int ShmConsume (struct shm_time *pShm, struct shm_sample *pSample);
+
+#endif // RTCShm_h
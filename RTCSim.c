@@ -0,0 +1,757 @@
+/*
+**  RTCSim.c
+**
+**  This source file contains rtcsim, a software model of the MCP7940N on the PiFace Real Time Clock. It models the
+**  register file (0x00 - 0x5f) with its read-only bits and address pointer wrap, the calendar counting at the
+**  crystal's rate (including OSCTRIM and a configurable crystal error), the delay between ST changing and OSCRUN
+**  following it, and the power-fail timestamps. Time can be real (CLOCK_MONOTONIC) or virtual, in which case it
+**  only moves as the bus is used, at the configured bus speed - or lockstep, where our clocks are virtual too,
+**  and move as the bus is used and as we sleep. Latency, NAKs and bit errors can be injected. The
+**  configuration comes from the RTCSIM environment variable, e.g.
+**  
+**      RTCSIM=clock=virtual,state=/tmp/rtc.sim,latency=200,nak=0.01,report
+**  
+**  and the register file can be kept in a state file so that one run carries on from the last.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <errno.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <strings.h>
+# include <time.h>
+
+# include "PiFaceRTC.h"
+# include "RTCTiming.h"
+# include "RTCCodec.h"
+# include "RTCCivil.h"
+# include "RTCSim.h"
+
+# define SIM_STATE_MAGIC        0x53435452          // "RTCS"
+# define SIM_STATE_VERSION      1
+# define SIM_NSEC_PER_DAY       ((int64_t) CIVIL_SECS_PER_DAY * NSEC_PER_SEC)
+# define SIM_CRYSTAL_HZ         32768
+# define SIM_LOCKSTEP_MONOTONIC (1000 * NSEC_PER_SEC)      // Where CLOCK_MONOTONIC starts in lockstep. Not 0, which means unset
+
+/*
+** The bits of the register file the model has to know about
+*/
+
+# define SIM_RTCSEC_ST          0x80
+# define SIM_RTCHOUR_12HOUR     0x40
+# define SIM_RTCHOUR_PM         0x20
+# define SIM_RTCWKDAY_OSCRUN    0x20
+# define SIM_RTCWKDAY_PWRFAIL   0x10
+# define SIM_RTCWKDAY_VBATEN    0x08
+# define SIM_RTCWKDAY_WKDAY     0x07
+# define SIM_RTCMTH_LPYR        0x20
+# define SIM_CONTROL_CRSTRIM    0x04
+# define SIM_OSCTRIM_SIGN       0x80
+# define SIM_OSCTRIM_TRIMVAL    0x7f
+
+static struct {
+    bool        m_bVirtualClock;
+    bool        m_bLockstep;            // CLOCK_MONOTONIC is virtual as well, and is the simulator's clock
+    bool        m_bBlank;               // Start with the register file cleared, as from the factory
+    bool        m_bReport;              // Display the statistics when we exit
+    char        *m_szStatePath;
+    int         m_nAddress;
+    int         m_nBusKHz;
+    int64_t     m_nsLatency;
+    int64_t     m_nsJitter;
+    int64_t     m_nsOscillatorStart;
+    int64_t     m_nsOscillatorStop;
+    double      m_dCrystalPPM;          // How fast the crystal runs, before trimming
+    int64_t     m_nStartSecs;           // The time to start at, if not now
+    int64_t     m_nsStartOffset;        // How far ahead of that to start
+    int64_t     m_nPowerFailSecs;       // Simulate a power failure this long, when attached
+    double      m_dNAK;
+    double      m_dBitError;
+    long        m_lNAKAt;
+    long        m_lBitErrorAt;
+    long        m_lSeed;                // Where the fault injection's random numbers start, or -1 to carry on
+} configSim;
+
+/*
+** Everything needed to carry on where we left off. The registers hold the time as it was at m_nsClockAtBase,
+** when the RTC's time was m_nsTimeAtBase (which has the fraction of a second the registers do not)
+*/
+
+static struct {
+    uint32_t    m_uiMagic;
+    uint32_t    m_uiVersion;
+    uint8_t     m_uiRegisters [SIM_REGISTERS];
+    int         m_nPointer;
+    unsigned    m_uiRandom;
+    int64_t     m_nsTimeAtBase;
+    int64_t     m_nsClockAtBase;
+    int64_t     m_nsOscillatorChange;   // When OSCRUN will follow a change to ST, or 0
+    int64_t     m_nsVirtualClock;
+} stateSim;
+
+static struct sim_stats statsSim;
+static bool bSimReportRegistered = false;   // We are attached again once discovery has found the bus
+
+/* static int64_t SimNow (void)
+**
+** The simulator's clock
+*/
+
+static int64_t SimNow (void)
+{
+    return (configSim.m_bVirtualClock ? stateSim.m_nsVirtualClock : TimingNow (CLOCK_MONOTONIC));
+}
+
+/* static bool SimChance (double dProbability)
+**
+** Roll the dice
+*/
+
+static bool SimChance (double dProbability)
+{
+    return ((dProbability > 0) && (((double) rand_r (&stateSim.m_uiRandom) / ((double) RAND_MAX + 1)) < dProbability));
+}
+
+/* static uint8_t SimBCD (int nValue)
+**
+** A value (0 - 99) in BCD
+*/
+
+static uint8_t SimBCD (int nValue)
+{
+    return (uint8_t) (((nValue / 10) << 4) | (nValue % 10));
+}
+
+/* static uint8_t SimEncodeHour (int nHour, bool bTwelveHour)
+**
+** The hour in the format the hour register is in
+*/
+
+static uint8_t SimEncodeHour (int nHour, bool bTwelveHour)
+{
+    if (! bTwelveHour)
+        return SimBCD (nHour);
+    
+    return (uint8_t) (SIM_RTCHOUR_12HOUR | ((nHour >= 12) ? SIM_RTCHOUR_PM : 0) | SimBCD (((nHour % 12) == 0) ? 12 : (nHour % 12)));
+}
+
+/* static int SimWeekdayAfter (int nWeekday, int64_t nDays)
+**
+** The day of the week register counts 1 to 7 on its own, whatever the date. This is where it is after nDays
+** midnights (which may be negative)
+*/
+
+static int SimWeekdayAfter (int nWeekday, int64_t nDays)
+{
+    if (nWeekday == 0)
+        return 0;
+    
+    return (int) ((((nWeekday -1 + nDays) % 7) + 7) % 7) +1;
+}
+
+/* static double SimRate (void)
+**
+** How fast the RTC counts, relative to our clock. The crystal is out by its error, and the trim adds (or takes
+** away) two clocks per step every minute - or 128 times a second in coarse trim mode
+*/
+
+static double SimRate (void)
+{
+    uint8_t *puiRegisters = stateSim.m_uiRegisters;
+    double dTrimClocks;
+    
+    dTrimClocks = (double) ((puiRegisters [MCP7940N_OSCTRIM_OFFSET] & SIM_OSCTRIM_TRIMVAL) * 2);
+    dTrimClocks = (((puiRegisters [MCP7940N_CONTROL_OFFSET] & SIM_CONTROL_CRSTRIM) != 0) ? (dTrimClocks * 128) : (dTrimClocks / 60));
+    if ((puiRegisters [MCP7940N_OSCTRIM_OFFSET] & SIM_OSCTRIM_SIGN) == 0)
+        dTrimClocks = -dTrimClocks;
+    
+    return 1.0 + (configSim.m_dCrystalPPM / 1e6) + (dTrimClocks / SIM_CRYSTAL_HZ);
+}
+
+/* static void SimStoreTime (int64_t nsTime, bool bWeekdayFromDate)
+**
+** Put the time into the date/time registers, leaving the flags as they are. The day of the week register
+** moves on by however many midnights have passed since m_nsTimeAtBase, unless we are told to set it
+*/
+
+static void SimStoreTime (int64_t nsTime, bool bWeekdayFromDate)
+{
+    uint8_t *puiRegisters = stateSim.m_uiRegisters;
+    struct tm tmTime;
+    bool bTwelveHour;
+    int nWeekday;
+    
+    bTwelveHour = ((puiRegisters [MCP7940N_RTCHOUR_OFFSET] & SIM_RTCHOUR_12HOUR) != 0);
+    nWeekday = SimWeekdayAfter ((puiRegisters [MCP7940N_RTCWKDAY_OFFSET] & SIM_RTCWKDAY_WKDAY),
+                                ((nsTime / SIM_NSEC_PER_DAY) - (stateSim.m_nsTimeAtBase / SIM_NSEC_PER_DAY)));
+    
+    CivilFromEpoch ((time_t) (nsTime / NSEC_PER_SEC), &tmTime);
+    CodecStore (CodecEncodeDateTime (&tmTime, CodecLoad ((void *) puiRegisters)), (void *) puiRegisters);
+    
+    puiRegisters [MCP7940N_RTCHOUR_OFFSET] = (puiRegisters [MCP7940N_RTCHOUR_OFFSET] & 0x80) | SimEncodeHour (tmTime.tm_hour, bTwelveHour);
+    if (! bWeekdayFromDate)
+        puiRegisters [MCP7940N_RTCWKDAY_OFFSET] = (puiRegisters [MCP7940N_RTCWKDAY_OFFSET] & ~SIM_RTCWKDAY_WKDAY) | nWeekday;
+    puiRegisters [MCP7940N_RTCMTH_OFFSET] = (puiRegisters [MCP7940N_RTCMTH_OFFSET] & ~SIM_RTCMTH_LPYR) |
+                                            (((tmTime.tm_year % 4) == 0) ? SIM_RTCMTH_LPYR : 0);
+}
+
+/* static void SimCount (int64_t nsNow)
+**
+** Count the RTC on to where it is at nsNow
+*/
+
+static void SimCount (int64_t nsNow)
+{
+    int64_t nsTime;
+    
+    nsTime = stateSim.m_nsTimeAtBase + (int64_t) ((double) (nsNow - stateSim.m_nsClockAtBase) * SimRate ());
+    SimStoreTime (nsTime, false);
+    
+    stateSim.m_nsTimeAtBase = nsTime;
+    stateSim.m_nsClockAtBase = nsNow;
+}
+
+/* static void SimAdvance (int64_t nsNow)
+**
+** Bring the register file up to nsNow. If OSCRUN was due to follow ST in the meantime, the RTC counted (or not)
+** up to then, and then stopped (or started)
+*/
+
+static void SimAdvance (int64_t nsNow)
+{
+    uint8_t *puiRegisters = stateSim.m_uiRegisters;
+    
+    if ((stateSim.m_nsOscillatorChange != 0) && (nsNow >= stateSim.m_nsOscillatorChange)) {
+        if ((puiRegisters [MCP7940N_RTCSEC_OFFSET] & SIM_RTCSEC_ST) != 0) {
+            puiRegisters [MCP7940N_RTCWKDAY_OFFSET] |= SIM_RTCWKDAY_OSCRUN;
+            stateSim.m_nsClockAtBase = stateSim.m_nsOscillatorChange;
+        }
+        else {
+            SimCount (stateSim.m_nsOscillatorChange);
+            puiRegisters [MCP7940N_RTCWKDAY_OFFSET] &= ~SIM_RTCWKDAY_OSCRUN;
+        }
+        stateSim.m_nsOscillatorChange = 0;
+    }
+    
+    if ((puiRegisters [MCP7940N_RTCWKDAY_OFFSET] & SIM_RTCWKDAY_OSCRUN) != 0)
+        SimCount (nsNow);
+    else
+        stateSim.m_nsClockAtBase = nsNow;
+}
+
+/* static void SimTimeWritten (bool bSecondsWritten, int64_t nsNow)
+**
+** The date/time registers were written, so the RTC carries on from what they now hold. Writing the seconds
+** clears the divider, so the new second starts now
+*/
+
+static void SimTimeWritten (bool bSecondsWritten, int64_t nsNow)
+{
+    struct tm tmTime;
+    int64_t nsFraction;
+    
+    nsFraction = (bSecondsWritten ? 0 : (stateSim.m_nsTimeAtBase % NSEC_PER_SEC));
+    CodecDecodeDateTime (CodecLoad ((void *) stateSim.m_uiRegisters), &tmTime);
+    
+    stateSim.m_nsTimeAtBase = ((int64_t) CivilToEpoch (&tmTime) * NSEC_PER_SEC) + nsFraction;
+    stateSim.m_nsClockAtBase = nsNow;
+}
+
+/* static void SimStoreTimestamp (int nOffset, int64_t nsTime)
+**
+** Capture a power-fail timestamp - minute, hour, date, and month with the day of the week in its top bits
+*/
+
+static void SimStoreTimestamp (int nOffset, int64_t nsTime)
+{
+    uint8_t *puiRegisters = stateSim.m_uiRegisters;
+    struct tm tmTime;
+    int nWeekday;
+    
+    CivilFromEpoch ((time_t) (nsTime / NSEC_PER_SEC), &tmTime);
+    nWeekday = SimWeekdayAfter ((puiRegisters [MCP7940N_RTCWKDAY_OFFSET] & SIM_RTCWKDAY_WKDAY),
+                                ((nsTime / SIM_NSEC_PER_DAY) - (stateSim.m_nsTimeAtBase / SIM_NSEC_PER_DAY)));
+    
+    puiRegisters [nOffset] = SimBCD (tmTime.tm_min);
+    puiRegisters [nOffset +1] = SimEncodeHour (tmTime.tm_hour, ((puiRegisters [MCP7940N_RTCHOUR_OFFSET] & SIM_RTCHOUR_12HOUR) != 0));
+    puiRegisters [nOffset +2] = SimBCD (tmTime.tm_mday);
+    puiRegisters [nOffset +3] = (uint8_t) ((nWeekday << 5) | SimBCD (tmTime.tm_mon +1));
+}
+
+/* static void SimPowerFail (int64_t nSecs)
+**
+** The power went off nSecs ago, and has just come back. On the battery the RTC kept counting and captured when
+** the power went and came back (unless PWRFAIL was still set from last time). Without it, everything is lost
+*/
+
+static void SimPowerFail (int64_t nSecs)
+{
+    uint8_t *puiRegisters = stateSim.m_uiRegisters;
+    int64_t nsNow = SimNow ();
+    
+    SimAdvance (nsNow);
+    
+    if ((puiRegisters [MCP7940N_RTCWKDAY_OFFSET] & SIM_RTCWKDAY_VBATEN) == 0) {
+        bzero ((void *) puiRegisters, SIM_REGISTERS);
+        stateSim.m_nsOscillatorChange = 0;
+        SimTimeWritten (true, nsNow);
+        return;
+    }
+    
+    if ((puiRegisters [MCP7940N_RTCWKDAY_OFFSET] & SIM_RTCWKDAY_PWRFAIL) == 0) {
+        SimStoreTimestamp (MCP7940N_RTCPWRDN_OFFSET,
+                           (((puiRegisters [MCP7940N_RTCWKDAY_OFFSET] & SIM_RTCWKDAY_OSCRUN) != 0)
+                                ? (stateSim.m_nsTimeAtBase - (nSecs * NSEC_PER_SEC)) : stateSim.m_nsTimeAtBase));
+        SimStoreTimestamp (MCP7940N_RTCPWRUP_OFFSET, stateSim.m_nsTimeAtBase);
+        puiRegisters [MCP7940N_RTCWKDAY_OFFSET] |= SIM_RTCWKDAY_PWRFAIL;
+    }
+}
+
+/* static void SimWriteRegister (int nOffset, uint8_t uiValue)
+**
+** Write one register, honouring its read-only bits. Clearing PWRFAIL clears the timestamps as well
+*/
+
+static void SimWriteRegister (int nOffset, uint8_t uiValue)
+{
+    uint8_t *puiRegisters = stateSim.m_uiRegisters;
+    
+    switch (nOffset) {
+    case MCP7940N_RTCWKDAY_OFFSET:
+        if (((uiValue & SIM_RTCWKDAY_PWRFAIL) == 0) && ((puiRegisters [nOffset] & SIM_RTCWKDAY_PWRFAIL) != 0))
+            bzero ((void *) &(puiRegisters [MCP7940N_RTCPWRDNUP_OFFSET]), (MCP7940N_NVRAM_OFFSET - MCP7940N_RTCPWRDNUP_OFFSET));
+        puiRegisters [nOffset] = (uiValue & ~(SIM_RTCWKDAY_OSCRUN | SIM_RTCWKDAY_PWRFAIL)) |
+                                 (puiRegisters [nOffset] & SIM_RTCWKDAY_OSCRUN) | (uiValue & puiRegisters [nOffset] & SIM_RTCWKDAY_PWRFAIL);
+        break;
+        
+    case MCP7940N_RTCMTH_OFFSET:
+        puiRegisters [nOffset] = (uiValue & ~SIM_RTCMTH_LPYR) | (puiRegisters [nOffset] & SIM_RTCMTH_LPYR);
+        break;
+        
+    case MCP7940N_PWRDNMIN_OFFSET: case MCP7940N_PWRDNHOUR_OFFSET: case MCP7940N_PWRDNDATE_OFFSET: case MCP7940N_PWRDNMTH_OFFSET:
+    case MCP7940N_PWRUPMIN_OFFSET: case MCP7940N_PWRUPHOUR_OFFSET: case MCP7940N_PWRUPDATE_OFFSET: case MCP7940N_PWRUPMTH_OFFSET:
+        break;                  // The timestamps are read only
+        
+    default:
+        puiRegisters [nOffset] = uiValue;
+        break;
+    }
+}
+
+/* static int SimNextPointer (int nPointer)
+**
+** The address pointer after a byte is read or written. It wraps within the registers and within the SRAM
+*/
+
+static int SimNextPointer (int nPointer)
+{
+    if (nPointer == (MCP7940N_NVRAM_OFFSET -1))
+        return 0;
+    if (nPointer == (SIM_REGISTERS -1))
+        return MCP7940N_NVRAM_OFFSET;
+    
+    return nPointer +1;
+}
+
+/* static void SimWrite (struct sim_msg *pMsg, int64_t nsNow)
+**
+** A write message. The first byte sets the address pointer (unless the message carries on from the last one)
+** and the rest are written from there. Changing ST sets OSCRUN following it after the crystal starts, or stops
+*/
+
+static void SimWrite (struct sim_msg *pMsg, int64_t nsNow)
+{
+    uint8_t *puiRegisters = stateSim.m_uiRegisters;
+    bool bTimeWritten = false, bSecondsWritten = false;
+    uint8_t uiOldSeconds = puiRegisters [MCP7940N_RTCSEC_OFFSET];
+    int nByte = 0;
+    
+    if ((pMsg ->m_nFlags & SIM_MSG_NOSTART) == 0) {
+        stateSim.m_nPointer = pMsg ->m_puiBuffer [0] % SIM_REGISTERS;
+        nByte = 1;
+    }
+    
+    for (; nByte < pMsg ->m_nLength; nByte ++) {
+        if (stateSim.m_nPointer <= MCP7940N_RTCYEAR_OFFSET)
+            bTimeWritten = true;
+        if (stateSim.m_nPointer == MCP7940N_RTCSEC_OFFSET)
+            bSecondsWritten = true;
+        
+        SimWriteRegister (stateSim.m_nPointer, pMsg ->m_puiBuffer [nByte]);
+        stateSim.m_nPointer = SimNextPointer (stateSim.m_nPointer);
+    }
+    statsSim.m_lBytesWritten += pMsg ->m_nLength;
+    
+    if (bTimeWritten)
+        SimTimeWritten (bSecondsWritten, nsNow);
+    
+    if (((uiOldSeconds ^ puiRegisters [MCP7940N_RTCSEC_OFFSET]) & SIM_RTCSEC_ST) != 0) {
+        if ((((puiRegisters [MCP7940N_RTCSEC_OFFSET] & SIM_RTCSEC_ST) != 0) == ((puiRegisters [MCP7940N_RTCWKDAY_OFFSET] & SIM_RTCWKDAY_OSCRUN) != 0)))
+            stateSim.m_nsOscillatorChange = 0;
+        else
+            stateSim.m_nsOscillatorChange = nsNow + (((puiRegisters [MCP7940N_RTCSEC_OFFSET] & SIM_RTCSEC_ST) != 0)
+                                                        ? configSim.m_nsOscillatorStart : configSim.m_nsOscillatorStop);
+    }
+}
+
+/* static void SimRead (struct sim_msg *pMsg)
+**
+** A read message, from the address pointer on
+*/
+
+static void SimRead (struct sim_msg *pMsg)
+{
+    int nByte;
+    
+    for (nByte = 0; nByte < pMsg ->m_nLength; nByte ++) {
+        pMsg ->m_puiBuffer [nByte] = stateSim.m_uiRegisters [stateSim.m_nPointer];
+        stateSim.m_nPointer = SimNextPointer (stateSim.m_nPointer);
+    }
+    statsSim.m_lBytesRead += pMsg ->m_nLength;
+}
+
+/* static int64_t SimBusTime (struct sim_msg *pMsg)
+**
+** How long a message takes on the wire - a start, the address byte and the data, each byte nine clocks with
+** its acknowledge. A message that carries on from the last one has neither the start nor the address
+*/
+
+static int64_t SimBusTime (struct sim_msg *pMsg)
+{
+    int64_t nClocks = pMsg ->m_nLength * 9;
+    
+    if ((pMsg ->m_nFlags & SIM_MSG_NOSTART) == 0)
+        nClocks += 1 + 9;
+    
+    return (nClocks * NSEC_PER_SEC) / ((int64_t) configSim.m_nBusKHz * 1000);
+}
+
+/* static void SimSave (void)
+**
+** Keep the state for the next run, if we have been asked to
+*/
+
+static void SimSave (void)
+{
+    FILE *fileState;
+    
+    if (configSim.m_szStatePath == (char *) 0)
+        return;
+    
+    if ((fileState = fopen (configSim.m_szStatePath, "w")) == (FILE *) 0)
+        return;
+    (void) fwrite ((void *) &stateSim, sizeof (stateSim), 1, fileState);
+    (void) fclose (fileState);
+}
+
+/* static bool SimLoad (void)
+**
+** Pick up the state from the last run, if there is one
+*/
+
+static bool SimLoad (void)
+{
+    FILE *fileState;
+    bool bLoaded;
+    
+    if ((configSim.m_szStatePath == (char *) 0) || ((fileState = fopen (configSim.m_szStatePath, "r")) == (FILE *) 0))
+        return false;
+    
+    bLoaded = ((fread ((void *) &stateSim, sizeof (stateSim), 1, fileState) == 1) &&
+               (stateSim.m_uiMagic == SIM_STATE_MAGIC) && (stateSim.m_uiVersion == SIM_STATE_VERSION));
+    (void) fclose (fileState);
+    
+    return bLoaded;
+}
+
+/* static int SimConfigure (char *szConfig)
+**
+** Parse the comma separated settings in szConfig (which may be null, for all the defaults)
+*/
+
+static int SimConfigure (char *szConfig)
+{
+    char *szCopy, *szSetting, *szValue, *szLast;
+    
+    bzero ((void *) &configSim, sizeof (configSim));
+    configSim.m_nAddress = SIM_DEFAULT_ADDRESS;
+    configSim.m_nBusKHz = SIM_DEFAULT_BUS_KHZ;
+    configSim.m_nsOscillatorStart = SIM_DEFAULT_OSC_START_USECS * NSEC_PER_USEC;
+    configSim.m_nsOscillatorStop = SIM_DEFAULT_OSC_STOP_USECS * NSEC_PER_USEC;
+    configSim.m_nStartSecs = -1;
+    configSim.m_lSeed = -1;
+    
+    if ((szConfig == (char *) 0) || (*szConfig == '\0'))
+        return 0;
+    if ((szCopy = strdup (szConfig)) == (char *) 0)
+        return -1;
+    
+    for (szSetting = strtok_r (szCopy, ",", &szLast); szSetting != (char *) 0; szSetting = strtok_r ((char *) 0, ",", &szLast)) {
+        if ((szValue = strchr (szSetting, '=')) != (char *) 0)
+            *szValue ++ = '\0';
+        else
+            szValue = "";
+        
+        if (strcmp (szSetting, "clock") == 0 && (strcmp (szValue, "virtual") == 0 || strcmp (szValue, "real") == 0 ||
+                                                 strcmp (szValue, "lockstep") == 0)) {
+            configSim.m_bVirtualClock = (strcmp (szValue, "virtual") == 0);
+            configSim.m_bLockstep = (strcmp (szValue, "lockstep") == 0);
+        }
+        else if (strcmp (szSetting, "init") == 0 && (strcmp (szValue, "blank") == 0 || strcmp (szValue, "running") == 0))
+            configSim.m_bBlank = (strcmp (szValue, "blank") == 0);
+        else if (strcmp (szSetting, "report") == 0)
+            configSim.m_bReport = true;
+        else if (strcmp (szSetting, "state") == 0 && *szValue != '\0')
+            configSim.m_szStatePath = strdup (szValue);
+        else if (strcmp (szSetting, "addr") == 0)
+            configSim.m_nAddress = (int) strtol (szValue, (char **) 0, 0);
+        else if (strcmp (szSetting, "khz") == 0 && atoi (szValue) > 0)
+            configSim.m_nBusKHz = atoi (szValue);
+        else if (strcmp (szSetting, "latency") == 0)
+            configSim.m_nsLatency = strtoll (szValue, (char **) 0, 0) * NSEC_PER_USEC;
+        else if (strcmp (szSetting, "jitter") == 0)
+            configSim.m_nsJitter = strtoll (szValue, (char **) 0, 0) * NSEC_PER_USEC;
+        else if (strcmp (szSetting, "oscstart") == 0)
+            configSim.m_nsOscillatorStart = strtoll (szValue, (char **) 0, 0) * NSEC_PER_USEC;
+        else if (strcmp (szSetting, "oscstop") == 0)
+            configSim.m_nsOscillatorStop = strtoll (szValue, (char **) 0, 0) * NSEC_PER_USEC;
+        else if (strcmp (szSetting, "ppm") == 0)
+            configSim.m_dCrystalPPM = strtod (szValue, (char **) 0);
+        else if (strcmp (szSetting, "start") == 0)
+            configSim.m_nStartSecs = strtoll (szValue, (char **) 0, 0);
+        else if (strcmp (szSetting, "offset") == 0)
+            configSim.m_nsStartOffset = strtoll (szValue, (char **) 0, 0) * NSEC_PER_USEC;
+        else if (strcmp (szSetting, "powerfail") == 0)
+            configSim.m_nPowerFailSecs = strtoll (szValue, (char **) 0, 0);
+        else if (strcmp (szSetting, "nak") == 0)
+            configSim.m_dNAK = strtod (szValue, (char **) 0);
+        else if (strcmp (szSetting, "nakat") == 0)
+            configSim.m_lNAKAt = strtol (szValue, (char **) 0, 0);
+        else if (strcmp (szSetting, "biterr") == 0)
+            configSim.m_dBitError = strtod (szValue, (char **) 0);
+        else if (strcmp (szSetting, "biterrat") == 0)
+            configSim.m_lBitErrorAt = strtol (szValue, (char **) 0, 0);
+        else if (strcmp (szSetting, "seed") == 0)
+            configSim.m_lSeed = (long) strtoul (szValue, (char **) 0, 0);
+        else {
+            (void) fprintf (stderr, "rtcsim: unknown or bad setting '%s' in %s\n", szSetting, SIM_ENVIRONMENT);
+            free ((void *) szCopy);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    
+    free ((void *) szCopy);
+    return 0;
+}
+
+/* int SimAttach (char *szConfig)
+**
+** Configure the simulator, and load the state from the last run or start afresh. Unless told otherwise a fresh
+** RTC is set to the computer clock and running on the battery, as a board that has been set up would be
+*/
+
+int SimAttach (char *szConfig)
+{
+    int64_t nsStart;
+    
+    if (SimConfigure (szConfig) < 0)
+        return -1;
+    
+    // In lockstep our clocks start on a second (the next, so that no deadline on the real clock is passed), and
+    // carry on from one attach to the next
+    
+    if (configSim.m_bLockstep && (! TimingIsLockstep ()))
+        TimingLockstep (SIM_LOCKSTEP_MONOTONIC, (((TimingNow (CLOCK_REALTIME) / NSEC_PER_SEC) +1) * NSEC_PER_SEC));
+    
+    if (! SimLoad ()) {
+        bzero ((void *) &stateSim, sizeof (stateSim));
+        stateSim.m_uiMagic = SIM_STATE_MAGIC;
+        stateSim.m_uiVersion = SIM_STATE_VERSION;
+        stateSim.m_uiRandom = 1;
+        
+        if (configSim.m_bBlank)
+            SimTimeWritten (true, SimNow ());
+        else {
+            nsStart = ((configSim.m_nStartSecs >= 0) ? (configSim.m_nStartSecs * NSEC_PER_SEC) : TimingNow (CLOCK_REALTIME)) + configSim.m_nsStartOffset;
+            
+            stateSim.m_uiRegisters [MCP7940N_RTCSEC_OFFSET] = SIM_RTCSEC_ST;
+            stateSim.m_uiRegisters [MCP7940N_RTCWKDAY_OFFSET] = SIM_RTCWKDAY_OSCRUN | SIM_RTCWKDAY_VBATEN;
+            stateSim.m_nsTimeAtBase = nsStart;
+            SimStoreTime (nsStart, true);
+            stateSim.m_nsClockAtBase = SimNow ();
+        }
+    }
+    
+    if (configSim.m_lSeed >= 0)
+        stateSim.m_uiRandom = (unsigned) configSim.m_lSeed;
+    
+    bzero ((void *) &statsSim, sizeof (statsSim));
+    if (configSim.m_nPowerFailSecs > 0)
+        SimPowerFail (configSim.m_nPowerFailSecs);
+    if ((configSim.m_bReport) && (! bSimReportRegistered))
+        bSimReportRegistered = (atexit (SimReport) == 0);
+    
+    SimSave ();
+    return 0;
+}
+
+/* int SimTransfer (struct sim_msg *pMsgs, int nMsgs)
+**
+** Carry out one bus transaction. Each message moves the clock on by its time on the wire (in real time we
+** sleep for the transaction's time at the end, so callers see the cost of it; in lockstep our clocks move too). A NAK stops the transaction at
+** the message it happens on, with ENXIO
+*/
+
+int SimTransfer (struct sim_msg *pMsgs, int nMsgs)
+{
+    struct timespec tsDelay;
+    int64_t nsDelay, nsMessage;
+    int nMsg, nReadBytes, nFlip;
+    bool bNAK;
+    
+    statsSim.m_lTransactions ++;
+    
+    nsDelay = configSim.m_nsLatency + ((configSim.m_nsJitter > 0) ? (rand_r (&stateSim.m_uiRandom) % configSim.m_nsJitter) : 0);
+    if (configSim.m_bVirtualClock)
+        stateSim.m_nsVirtualClock += nsDelay;
+    TimingAdvance (nsDelay);
+    statsSim.m_nsBusTime += nsDelay;
+    
+    bNAK = ((statsSim.m_lTransactions == configSim.m_lNAKAt) || SimChance (configSim.m_dNAK));
+    
+    for (nMsg = 0, nReadBytes = 0; nMsg < nMsgs; nMsg ++) {
+        nsMessage = SimBusTime (&pMsgs [nMsg]);
+        if (configSim.m_bVirtualClock)
+            stateSim.m_nsVirtualClock += nsMessage;
+        TimingAdvance (nsMessage);
+        statsSim.m_nsBusTime += nsMessage;
+        statsSim.m_lMessages ++;
+        
+        if (bNAK || (pMsgs [nMsg].m_nAddress != configSim.m_nAddress)) {
+            statsSim.m_lNAKs ++;
+            SimSave ();
+            errno = ENXIO;
+            return -1;
+        }
+        
+        SimAdvance (SimNow ());
+        if ((pMsgs [nMsg].m_nFlags & SIM_MSG_RD) != 0) {
+            SimRead (&pMsgs [nMsg]);
+            nReadBytes += pMsgs [nMsg].m_nLength;
+        }
+        else
+            SimWrite (&pMsgs [nMsg], SimNow ());
+    }
+    
+    // Flip a bit in one of the bytes we read, if it is time for a bit error
+    
+    if ((nReadBytes > 0) && ((statsSim.m_lTransactions == configSim.m_lBitErrorAt) || SimChance (configSim.m_dBitError))) {
+        nFlip = rand_r (&stateSim.m_uiRandom) % (nReadBytes * 8);
+        for (nMsg = 0; nMsg < nMsgs; nMsg ++) {
+            if ((pMsgs [nMsg].m_nFlags & SIM_MSG_RD) == 0)
+                continue;
+            if (nFlip < (pMsgs [nMsg].m_nLength * 8)) {
+                pMsgs [nMsg].m_puiBuffer [(nFlip / 8)] ^= (uint8_t) (1 << (nFlip % 8));
+                break;
+            }
+            nFlip -= pMsgs [nMsg].m_nLength * 8;
+        }
+        statsSim.m_lBitErrors ++;
+    }
+    
+    SimSave ();
+    
+    if ((! configSim.m_bVirtualClock) && (! configSim.m_bLockstep)) {
+        for (nMsg = 0, nsDelay = 0; nMsg < nMsgs; nMsg ++)
+            nsDelay += SimBusTime (&pMsgs [nMsg]);
+        TimingToTimespec (nsDelay + configSim.m_nsLatency, &tsDelay);
+        (void) nanosleep (&tsDelay, (struct timespec *) 0);
+    }
+    
+    return 0;
+}
+
+/* void SimGetStats (struct sim_stats *pStats)
+**
+** What the simulator has seen since it was attached
+*/
+
+void SimGetStats (struct sim_stats *pStats)
+{
+    *pStats = statsSim;
+}
+
+/* int SimSetComputerClock (int64_t nsTime)
+**
+** rtcdate-sim sets the computer clock through here, so that it is left alone and the setting is counted instead
+*/
+
+int SimSetComputerClock (int64_t nsTime)
+{
+    statsSim.m_lClockSets ++;
+    statsSim.m_nsClockSetTo = nsTime;
+    
+    return 0;
+}
+
+/* int SimSlewComputerClock (int64_t nsDelta)
+**
+** Likewise for slewing the computer clock with adjtime(2)
+*/
+
+int SimSlewComputerClock (int64_t nsDelta)
+{
+    statsSim.m_lClockSlews ++;
+    statsSim.m_nsClockSlewedBy = nsDelta;
+    
+    return 0;
+}
+
+/* void SimReport (void)
+**
+** Display what the simulator has seen since it was attached
+*/
+
+void SimReport (void)
+{
+    (void) fprintf (stderr, "rtcsim: %ld transactions, %ld messages, %ld bytes read, %ld bytes written, %.3f ms on the bus, %ld NAKs, %ld bit errors\n",
+                    statsSim.m_lTransactions, statsSim.m_lMessages, statsSim.m_lBytesRead, statsSim.m_lBytesWritten,
+                    ((double) statsSim.m_nsBusTime / NSEC_PER_MSEC), statsSim.m_lNAKs, statsSim.m_lBitErrors);
+    if (statsSim.m_lClockSets > 0)
+        (void) fprintf (stderr, "rtcsim: the computer clock would have been set to %lld.%09lld\n",
+                        (long long) (statsSim.m_nsClockSetTo / NSEC_PER_SEC), (long long) (statsSim.m_nsClockSetTo % NSEC_PER_SEC));
+    if (statsSim.m_lClockSlews > 0)
+        (void) fprintf (stderr, "rtcsim: the computer clock would have been slewed by %+.3f ms\n", ((double) statsSim.m_nsClockSlewedBy / NSEC_PER_MSEC));
+}
@@ -0,0 +1,92 @@
+/*
+**  RTCSim.h
+**
+**  This header file contains the definitions and function prototypes for rtcsim, a software model of the MCP7940N
+**  on the PiFace Real Time Clock. It is driven through the same I2C routines as the real thing, by building
+**  rtcdate with the simulator bus backend ('make sim').
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCSim_h
+#define RTCSim_h
+
+# include <stdbool.h>
+# include <stdint.h>
+
+# define SIM_ENVIRONMENT                "RTCSIM"        // Where the simulator's configuration is read from
+# define SIM_REGISTERS                  0x60            // 0x00 - 0x1f registers, 0x20 - 0x5f SRAM
+# define SIM_BUS_NAME                   "rtcsim0"       // The only bus there is
+# define SIM_DEFAULT_ADDRESS            0x6f
+# define SIM_DEFAULT_BUS_KHZ            100
+# define SIM_DEFAULT_OSC_START_USECS    1000            // Crystal start-up, then OSCRUN waits 32 clocks
+# define SIM_DEFAULT_OSC_STOP_USECS     60              // Two clocks for OSCRUN to notice the crystal stopped
+
+/*
+** A message in a simulated bus transaction - the same shape as the real bus backends' messages
+*/
+
+# define SIM_MSG_WR                     0x00
+# define SIM_MSG_RD                     0x01
+# define SIM_MSG_NOSTART                0x02
+
+struct sim_msg {
+    int         m_nAddress;             // 7-bit address
+    int         m_nFlags;               // SIM_MSG_...
+    int         m_nLength;
+    uint8_t     *m_puiBuffer;
+};
+
+/*
+** What the simulator has seen, and injected, since it was attached
+*/
+
+struct sim_stats {
+    long        m_lTransactions;
+    long        m_lMessages;
+    long        m_lBytesRead;
+    long        m_lBytesWritten;
+    long        m_lNAKs;                // Injected, plus those for an address that is not the RTC
+    long        m_lBitErrors;
+    int64_t     m_nsBusTime;            // Time on the wire, at the configured bus speed, plus injected latency
+    long        m_lClockSets;           // Times the computer clock would have been set, and what to
+    int64_t     m_nsClockSetTo;
+    long        m_lClockSlews;          // Times it would have been slewed, and by how much the last time
+    int64_t     m_nsClockSlewedBy;
+};
+
+int SimAttach (char *szConfig);
+int SimTransfer (struct sim_msg *pMsgs, int nMsgs);
+void SimGetStats (struct sim_stats *pStats);
+void SimReport (void);
+int SimSetComputerClock (int64_t nsTime);
+int SimSlewComputerClock (int64_t nsDelta);
+
+#endif // RTCSim_h
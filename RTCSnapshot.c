@@ -0,0 +1,195 @@
+/*
+**  RTCSnapshot.c
+**
+**  This source file contains the register snapshot for the PiFace Real Time Clock. The first time any
+**  register below the NVRAM is needed we read all of them (0x00 - 0x1f) in a single I2CRDWR transaction, and
+**  serve every later read from that image. Writes go through to the device and update the image, so it
+**  stays coherent for the lifetime of the process.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <strings.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <sys/types.h>
+
+# include "I2CRoutines.h"
+# include "RTCSnapshot.h"
+# include "RTCCache.h"
+
+/*
+** The snapshot itself. We remember the bus and device it was read from so that we never serve an image
+** read from one device to a caller asking about another
+*/
+
+static uint8_t  uiSnapshotImage [MCP7940N_SNAPSHOT_LENGTH];
+static bool     bSnapshotValid = false;
+static int      nSnapshotBusFD = -1;
+static int      nSnapshotBusDevId = -1;
+
+/* static bool SnapshotCovers (int nOffset, int nLength)
+**
+** Returns true if the range of registers requested lies entirely within the snapshot
+*/
+
+static bool SnapshotCovers (int nOffset, int nLength)
+{
+    return ((nOffset >= 0) && (nLength >= 0) && ((nOffset + nLength) <= MCP7940N_SNAPSHOT_LENGTH));
+}
+
+/* int SnapshotLoad (int busfd, int nBusDevId)
+**
+** Read all of the registers below the NVRAM in one transaction, replacing any snapshot we already have
+*/
+
+int SnapshotLoad (int busfd, int nBusDevId)
+{
+    bSnapshotValid = false;
+    
+    if (ReadI2CDeviceMemory (busfd, nBusDevId, 0, (void *) uiSnapshotImage, MCP7940N_SNAPSHOT_LENGTH) < 0) {
+        // An error occurred, just return -1 so the caller knows. Leave the snapshot marked as invalid
+        
+        return -1;
+    }
+    
+    nSnapshotBusFD = busfd;
+    nSnapshotBusDevId = nBusDevId;
+    bSnapshotValid = true;
+    
+    return 0;
+}
+
+/* int SnapshotRead (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nReadLength)
+**
+** A drop-in replacement for ReadI2CDeviceMemory. Registers covered by the snapshot are copied out of it
+** (loading it first if need be), anything else is read from the device
+*/
+
+int SnapshotRead (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nReadLength)
+{
+    if (! SnapshotCovers (nOffset, nReadLength)) {
+        // Outside the snapshot (the NVRAM, for example), so go to the device
+        
+        return ReadI2CDeviceMemory (busfd, nBusDevId, nOffset, lpBuffer, nReadLength);
+    }
+    
+    if ((! bSnapshotValid) || (busfd != nSnapshotBusFD) || (nBusDevId != nSnapshotBusDevId)) {
+        // We do not have a snapshot for this device yet, so take one
+        
+        if (SnapshotLoad (busfd, nBusDevId) < 0)
+            return -1;
+    }
+    
+    bcopy ((void *) &(uiSnapshotImage [nOffset]), lpBuffer, nReadLength);
+    return 0;
+}
+
+/* int SnapshotWrite (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nWriteLength)
+**
+** A drop-in replacement for WriteI2CDeviceMemory. The data is written to the device, and if that succeeds any
+** part of it that falls within the snapshot is copied into it
+*/
+
+int SnapshotWrite (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nWriteLength)
+{
+    // Changing the date/time, the oscillator or its trim changes what the RTC will read from now on
+    
+    if (nOffset <= MCP7940N_OSCTRIM_OFFSET)
+        CacheForget ();
+    
+    if (WriteI2CDeviceMemory (busfd, nBusDevId, nOffset, lpBuffer, nWriteLength) < 0) {
+        // We do not know what state the device is in, so the snapshot can no longer be trusted
+        
+        SnapshotInvalidate ();
+        return -1;
+    }
+    
+    SnapshotPatch (busfd, nBusDevId, nOffset, lpBuffer, nWriteLength);
+    return 0;
+}
+
+/* void SnapshotPatch (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nPatchLength)
+**
+** Copy data the caller has already written to the device into the snapshot. Anything outside the snapshot is
+** ignored
+*/
+
+void SnapshotPatch (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nPatchLength)
+{
+    int nStart, nEnd;
+    
+    if ((! bSnapshotValid) || (busfd != nSnapshotBusFD) || (nBusDevId != nSnapshotBusDevId))
+        return;
+    
+    // Work out the overlap between what was written and the snapshot, and update it
+    
+    nStart = (nOffset < 0 ? 0 : nOffset);
+    nEnd = ((nOffset + nPatchLength) > MCP7940N_SNAPSHOT_LENGTH ? MCP7940N_SNAPSHOT_LENGTH : (nOffset + nPatchLength));
+    if (nStart < nEnd)
+        bcopy ((void *) &(((uint8_t *) lpBuffer) [(nStart - nOffset)]), (void *) &(uiSnapshotImage [nStart]), (nEnd - nStart));
+}
+
+/* int SnapshotRefresh (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nRefreshLength)
+**
+** Re-read part of the snapshot from the device, for registers the device changes by itself (the OSCRUN bit,
+** for example). If lpBuffer is supplied the fresh values are also copied into it. If there is no snapshot yet
+** we load the whole thing, which costs the same single transaction
+*/
+
+int SnapshotRefresh (int busfd, int nBusDevId, int nOffset, void *lpBuffer, int nRefreshLength)
+{
+    if (! SnapshotCovers (nOffset, nRefreshLength))
+        return ReadI2CDeviceMemory (busfd, nBusDevId, nOffset, lpBuffer, nRefreshLength);
+    
+    if ((! bSnapshotValid) || (busfd != nSnapshotBusFD) || (nBusDevId != nSnapshotBusDevId)) {
+        if (SnapshotLoad (busfd, nBusDevId) < 0)
+            return -1;
+    }
+    else if (ReadI2CDeviceMemory (busfd, nBusDevId, nOffset, (void *) &(uiSnapshotImage [nOffset]), nRefreshLength) < 0) {
+        SnapshotInvalidate ();
+        return -1;
+    }
+    
+    if (lpBuffer != (void *) 0)
+        bcopy ((void *) &(uiSnapshotImage [nOffset]), lpBuffer, nRefreshLength);
+    
+    return 0;
+}
+
+/* void SnapshotInvalidate (void)
+**
+** Throw away the snapshot. The next read will take a fresh one
+*/
+
+void SnapshotInvalidate (void)
+{
+    bSnapshotValid = false;
+}
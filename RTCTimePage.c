@@ -0,0 +1,125 @@
+/*
+**  RTCTimePage.c
+**
+**  This source file contains the publishing side of the shared time page (RTCTimePage.h): creating the file
+**  that local programs map, and writing each reading of the RTC into it under the sequence count.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdatomic.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/types.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+
+# include "RTCTimePage.h"
+
+/* struct rtc_time_page *TimePageCreate (const char *szPath, int nIntervalSecs)
+**
+** Create the page at szPath (or reuse it, so that readers who already have it mapped keep seeing updates),
+** readable by everyone, and map it for writing. We may be running as root, so we will not follow a symbolic
+** link, and will only reuse a regular file of our own with no other links to it - anything else could be a
+** file someone wants us to overwrite. A page left half written by a publisher that died is marked empty until
+** we publish. Returns a null pointer, with errno set, if we cannot
+*/
+
+struct rtc_time_page *TimePageCreate (const char *szPath, int nIntervalSecs)
+{
+    struct rtc_time_page *pPage;
+    struct stat statPage;
+    void *lpPage;
+    int fd;
+    
+    if ((fd = open (szPath, O_RDWR | O_CREAT | O_NOFOLLOW, 0644)) < 0)
+        return (struct rtc_time_page *) 0;
+    
+    if (fstat (fd, &statPage) < 0) {
+        (void) close (fd);
+        return (struct rtc_time_page *) 0;
+    }
+    
+    if ((! S_ISREG (statPage.st_mode)) || (statPage.st_uid != geteuid ()) || (statPage.st_nlink != 1)) {
+        (void) close (fd);
+        errno = EPERM;
+        return (struct rtc_time_page *) 0;
+    }
+    
+    if (ftruncate (fd, sizeof (struct rtc_time_page)) < 0) {
+        (void) close (fd);
+        return (struct rtc_time_page *) 0;
+    }
+    
+    lpPage = mmap ((void *) 0, sizeof (struct rtc_time_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    (void) close (fd);
+    if (lpPage == MAP_FAILED)
+        return (struct rtc_time_page *) 0;
+    
+    pPage = (struct rtc_time_page *) lpPage;
+    if ((pPage ->m_uiMagic != TIMEPAGE_MAGIC) || (pPage ->m_uiVersion != TIMEPAGE_VERSION) || ((pPage ->m_uiSequence & 1) != 0)) {
+        pPage ->m_uiSequence = 0;
+        atomic_thread_fence (memory_order_seq_cst);
+        pPage ->m_uiMagic = TIMEPAGE_MAGIC;
+        pPage ->m_uiVersion = TIMEPAGE_VERSION;
+    }
+    pPage ->m_nIntervalSecs = nIntervalSecs;
+    
+    return pPage;
+}
+
+/* void TimePagePublish (struct rtc_time_page *pPage, struct rtc_time_page *pReading)
+**
+** Write a reading into the page. The sequence is odd while we write, so a reader that saw it odd, or saw it
+** change, reads again
+*/
+
+void TimePagePublish (struct rtc_time_page *pPage, struct rtc_time_page *pReading)
+{
+    uint32_t uiSequence = pPage ->m_uiSequence;
+    
+    pPage ->m_uiSequence = uiSequence + 1;
+    atomic_thread_fence (memory_order_seq_cst);
+    
+    pPage ->m_uiFlags = pReading ->m_uiFlags;
+    pPage ->m_nsRTCTime = pReading ->m_nsRTCTime;
+    pPage ->m_nsMonotonic = pReading ->m_nsMonotonic;
+    pPage ->m_nsRealtime = pReading ->m_nsRealtime;
+    pPage ->m_nsUncertainty = pReading ->m_nsUncertainty;
+    pPage ->m_nDriftPPB = pReading ->m_nDriftPPB;
+    pPage ->m_nDriftSpreadPPB = pReading ->m_nDriftSpreadPPB;
+    
+    atomic_thread_fence (memory_order_seq_cst);
+    pPage ->m_uiSequence = uiSequence + 2;
+}
@@ -0,0 +1,196 @@
+/*
+**  RTCTimePage.h
+**
+**  This header file contains the shared time page: the last reading rtcdate --timepage took of the PiFace
+**  Real Time Clock, kept in a file that local programs map. The reader is entirely here, as inline functions,
+**  so a program needs only this header to know what the RTC's time is now, without a system call or the bus.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCTimePage_h
+#define RTCTimePage_h
+
+# include <fcntl.h>
+# include <stdatomic.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <time.h>
+# include <unistd.h>
+# include <sys/mman.h>
+
+# define TIMEPAGE_MAGIC                 0x52544350      // "RTCP"
+# define TIMEPAGE_VERSION               1               // Bumped if the layout changes
+# define TIMEPAGE_READ_TRIES            100             // A write takes well under a microsecond
+# define TIMEPAGE_STALE_INTERVALS       5               // Missed this many updates, the publisher has stopped
+# define TIMEPAGE_UNKNOWN_DRIFT_PPB     20000           // The crystal's tolerance, when there is no estimate
+
+# define TIMEPAGE_FLAG_OSCRUN           0x01            // The oscillator was running
+# define TIMEPAGE_FLAG_VBATEN           0x02            // The battery will keep the RTC going
+# define TIMEPAGE_FLAG_PWRFAIL          0x04            // The power has failed since the flag was cleared
+# define TIMEPAGE_FLAG_DRIFT            0x08            // The drift is an estimate, not just assumed to be zero
+
+# define TIMEPAGE_OK                    0
+# define TIMEPAGE_EMPTY                 1               // Nothing has been published
+# define TIMEPAGE_BUSY                  2               // The publisher kept writing while we read
+# define TIMEPAGE_STALE                 3               // Extrapolated, but from a reading that is too old
+
+/*
+** The page. Everything is the RTC and the computer clock at the edge of one of the RTC's seconds, when its
+** time was exactly m_nsRTCTime. Drift is in parts per billion, positive when the RTC gains on the computer
+** clock, with whatever trim is programmed. The sequence is odd while the publisher is writing, and zero until
+** it has written once
+*/
+
+struct rtc_time_page {
+    uint32_t            m_uiMagic;
+    uint32_t            m_uiVersion;
+    volatile uint32_t   m_uiSequence;
+    uint32_t            m_uiFlags;
+    int64_t             m_nsRTCTime;            // The RTC's time at the edge
+    int64_t             m_nsMonotonic;          // CLOCK_MONOTONIC at the edge
+    int64_t             m_nsRealtime;           // CLOCK_REALTIME at the edge
+    int64_t             m_nsUncertainty;        // The edge is within this much of the timestamps
+    int32_t             m_nDriftPPB;
+    int32_t             m_nDriftSpreadPPB;      // How far the drift may be out
+    int32_t             m_nIntervalSecs;        // How often the publisher reads the RTC
+    int32_t             m_nReserved;
+};
+
+/*
+** What a reader gets: the RTC's time now, how far out that may be, and the flags from the last reading
+*/
+
+struct rtc_time_page_now {
+    int64_t             m_nsRTCTime;
+    int64_t             m_nsUncertainty;
+    uint32_t            m_uiFlags;
+};
+
+/* static inline const struct rtc_time_page *TimePageOpen (const char *szPath)
+**
+** Map the page read only. This, and TimePageClose, are the only calls that need the kernel. Returns a null
+** pointer, with errno set, if we cannot
+*/
+
+static inline const struct rtc_time_page *TimePageOpen (const char *szPath)
+{
+    void *lpPage;
+    int fd;
+    
+    if ((fd = open (szPath, O_RDONLY)) < 0)
+        return (const struct rtc_time_page *) 0;
+    
+    lpPage = mmap ((void *) 0, sizeof (struct rtc_time_page), PROT_READ, MAP_SHARED, fd, 0);
+    (void) close (fd);
+    
+    return ((lpPage == MAP_FAILED) ? (const struct rtc_time_page *) 0 : (const struct rtc_time_page *) lpPage);
+}
+
+/* static inline void TimePageClose (const struct rtc_time_page *pPage)
+**
+** Unmap the page
+*/
+
+static inline void TimePageClose (const struct rtc_time_page *pPage)
+{
+    (void) munmap ((void *) pPage, sizeof (struct rtc_time_page));
+}
+
+/* static inline int TimePageSnapshot (const struct rtc_time_page *pPage, struct rtc_time_page *pCopy)
+**
+** Copy the page, retrying while the publisher is part way through writing it. Returns TIMEPAGE_OK,
+** TIMEPAGE_EMPTY or TIMEPAGE_BUSY
+*/
+
+static inline int TimePageSnapshot (const struct rtc_time_page *pPage, struct rtc_time_page *pCopy)
+{
+    uint32_t uiSequence;
+    int nTry;
+    
+    for (nTry = 0; nTry < TIMEPAGE_READ_TRIES; nTry ++) {
+        uiSequence = pPage ->m_uiSequence;
+        atomic_thread_fence (memory_order_seq_cst);
+        
+        if ((uiSequence == 0) || (pPage ->m_uiMagic != TIMEPAGE_MAGIC) || (pPage ->m_uiVersion != TIMEPAGE_VERSION))
+            return TIMEPAGE_EMPTY;
+        
+        *pCopy = *pPage;
+        atomic_thread_fence (memory_order_seq_cst);
+        
+        if (((uiSequence & 1) == 0) && (uiSequence == pPage ->m_uiSequence))
+            return TIMEPAGE_OK;
+    }
+    
+    return TIMEPAGE_BUSY;
+}
+
+/* static inline int TimePageExtrapolate (const struct rtc_time_page *pCopy, int64_t nsMonotonic, struct rtc_time_page_now *pNow)
+**
+** Work out what the RTC read at nsMonotonic from a copy of the page: the time at the edge, plus the time since
+** by the computer clock, corrected for the drift. The uncertainty grows by as much as the drift may be out.
+** Returns TIMEPAGE_OK, or TIMEPAGE_STALE if the publisher has missed too many updates
+*/
+
+static inline int TimePageExtrapolate (const struct rtc_time_page *pCopy, int64_t nsMonotonic, struct rtc_time_page_now *pNow)
+{
+    int64_t nsElapsed = nsMonotonic - pCopy ->m_nsMonotonic;
+    
+    pNow ->m_nsRTCTime = pCopy ->m_nsRTCTime + nsElapsed + (int64_t) ((double) nsElapsed * pCopy ->m_nDriftPPB / 1000000000.0);
+    pNow ->m_nsUncertainty = pCopy ->m_nsUncertainty + (int64_t) ((double) ((nsElapsed < 0) ? -nsElapsed : nsElapsed) * pCopy ->m_nDriftSpreadPPB / 1000000000.0);
+    pNow ->m_uiFlags = pCopy ->m_uiFlags;
+    
+    return ((nsElapsed > ((int64_t) pCopy ->m_nIntervalSecs * TIMEPAGE_STALE_INTERVALS * 1000000000LL)) ? TIMEPAGE_STALE : TIMEPAGE_OK);
+}
+
+/* static inline int TimePageNow (const struct rtc_time_page *pPage, struct rtc_time_page_now *pNow)
+**
+** The RTC's time now. clock_gettime(2) is answered in user space for CLOCK_MONOTONIC (by the vDSO on Linux,
+** and the shared page on FreeBSD), so this makes no system call. Returns as TimePageSnapshot, or
+** TimePageExtrapolate if there was something to extrapolate from
+*/
+
+static inline int TimePageNow (const struct rtc_time_page *pPage, struct rtc_time_page_now *pNow)
+{
+    struct rtc_time_page pageCopy;
+    struct timespec tsNow;
+    int nStatus;
+    
+    if ((nStatus = TimePageSnapshot (pPage, &pageCopy)) != TIMEPAGE_OK)
+        return nStatus;
+    
+    (void) clock_gettime (CLOCK_MONOTONIC, &tsNow);
+    return TimePageExtrapolate (&pageCopy, ((int64_t) tsNow.tv_sec * 1000000000LL) + tsNow.tv_nsec, pNow);
+}
+
+struct rtc_time_page *TimePageCreate (const char *szPath, int nIntervalSecs);
+void TimePagePublish (struct rtc_time_page *pPage, struct rtc_time_page *pReading);
+
+#endif // RTCTimePage_h
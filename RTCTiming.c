@@ -0,0 +1,222 @@
+/*
+**  RTCTiming.c
+**
+**  This source file contains the timing helpers used when reading and setting the PiFace Real Time Clock to
+**  better than a second. Times are carried around as signed 64-bit nanosecond counts, which is simpler than
+**  juggling timespec structures and good for a few hundred years either side of the epoch.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+# include <errno.h>
+# include <stdio.h>
+# include <string.h>
+# include <time.h>
+# include <unistd.h>
+# include <sys/types.h>
+# if defined (__FreeBSD__)
+# include <sys/sysctl.h>
+# include <sys/user.h>
+# endif
+
+# include "RTCTiming.h"
+
+/*
+** Against the simulator the clocks can be run in lockstep with it (RTCSIM=clock=lockstep): they only move when
+** we sleep or use the bus, so a run takes the same polls and sleeps every time
+*/
+
+# if defined (RTCDATE_SIM)
+static bool bTimingLockstep = false;
+static int64_t nsTimingMonotonic, nsTimingRealtimeOffset;
+# endif
+
+/* int64_t TimingNow (clockid_t clockidClock)
+**
+** Return the current time on the clock specified, in nanoseconds
+*/
+
+int64_t TimingNow (clockid_t clockidClock)
+{
+    struct timespec tsNow;
+    
+# if defined (RTCDATE_SIM)
+    if (bTimingLockstep)
+        return nsTimingMonotonic + ((clockidClock == CLOCK_REALTIME) ? nsTimingRealtimeOffset : 0);
+# endif
+    
+    (void) clock_gettime (clockidClock, &tsNow);
+    return TimingFromTimespec (&tsNow);
+}
+
+/* int64_t TimingFromTimespec (struct timespec *ptsTime)
+**
+** Convert a timespec to nanoseconds
+*/
+
+int64_t TimingFromTimespec (struct timespec *ptsTime)
+{
+    return ((int64_t) ptsTime ->tv_sec * NSEC_PER_SEC) + ptsTime ->tv_nsec;
+}
+
+/* void TimingToTimespec (int64_t nsTime, struct timespec *ptsTime)
+**
+** Convert nanoseconds to a timespec. The nanoseconds field is always positive, even for times before the epoch
+*/
+
+void TimingToTimespec (int64_t nsTime, struct timespec *ptsTime)
+{
+    ptsTime ->tv_sec = (time_t) (nsTime / NSEC_PER_SEC);
+    ptsTime ->tv_nsec = (long) (nsTime % NSEC_PER_SEC);
+    if (ptsTime ->tv_nsec < 0) {
+        ptsTime ->tv_sec --;
+        ptsTime ->tv_nsec += NSEC_PER_SEC;
+    }
+}
+
+/* int TimingSleepUntil (clockid_t clockidClock, int64_t nsDeadline, int64_t nsSpin)
+**
+** Sleep until the deadline on the clock specified. The scheduler can wake us late, so we sleep until nsSpin
+** nanoseconds short of the deadline and spin on the clock for the rest of the way
+*/
+
+int TimingSleepUntil (clockid_t clockidClock, int64_t nsDeadline, int64_t nsSpin)
+{
+    struct timespec tsWake;
+    int nStatus;
+    
+# if defined (RTCDATE_SIM)
+    if (bTimingLockstep) {
+        if (nsDeadline > TimingNow (clockidClock))
+            TimingAdvance (nsDeadline - TimingNow (clockidClock));
+        return 0;
+    }
+# endif
+    
+    if ((nsDeadline - nsSpin) > TimingNow (clockidClock)) {
+        TimingToTimespec ((nsDeadline - nsSpin), &tsWake);
+        while ((nStatus = clock_nanosleep (clockidClock, TIMER_ABSTIME, &tsWake, (struct timespec *) 0)) == EINTR)
+            ;
+        if (nStatus != 0) {
+            errno = nStatus;
+            return -1;
+        }
+    }
+    
+    while (TimingNow (clockidClock) < nsDeadline)
+        ;
+    
+    return 0;
+}
+
+# if defined (RTCDATE_SIM)
+
+/* void TimingLockstep (int64_t nsMonotonic, int64_t nsRealtime)
+**
+** Stop following the real clocks, and start CLOCK_MONOTONIC and CLOCK_REALTIME (and every other clock, which
+** counts with CLOCK_MONOTONIC) at the times given
+*/
+
+void TimingLockstep (int64_t nsMonotonic, int64_t nsRealtime)
+{
+    nsTimingMonotonic = nsMonotonic;
+    nsTimingRealtimeOffset = nsRealtime - nsMonotonic;
+    bTimingLockstep = true;
+}
+
+/* bool TimingIsLockstep (void)
+**
+** Whether the clocks are in lockstep with the simulator
+*/
+
+bool TimingIsLockstep (void)
+{
+    return bTimingLockstep;
+}
+
+/* void TimingAdvance (int64_t nsDelta)
+**
+** Move the clocks on, when they are in lockstep
+*/
+
+void TimingAdvance (int64_t nsDelta)
+{
+    if (bTimingLockstep && (nsDelta > 0))
+        nsTimingMonotonic += nsDelta;
+}
+
+# endif // RTCDATE_SIM
+
+/* int64_t TimingProcessAge (void)
+**
+** How long ago this process started, in nanoseconds, or -1 if we cannot tell. The kernel records when the
+** process was forked, which for a program started from a script is as good as when it was exec'd. FreeBSD
+** has it to the microsecond, on the real time clock; Linux only to the clock tick, since boot
+*/
+
+int64_t TimingProcessAge (void)
+{
+# if defined (__FreeBSD__)
+    struct kinfo_proc kinfoSelf;
+    size_t nLength = sizeof (kinfoSelf);
+    int MIB [4] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, (int) getpid () };
+    
+    if (sysctl (MIB, 4, &kinfoSelf, &nLength, NULL, 0) < 0)
+        return -1;
+    
+    return TimingNow (CLOCK_REALTIME) - (((int64_t) kinfoSelf.ki_start.tv_sec * NSEC_PER_SEC) + ((int64_t) kinfoSelf.ki_start.tv_usec * NSEC_PER_USEC));
+# elif defined (__linux__)
+    char szStat [512 +1], *pszField;
+    long long llStartTicks;
+    long lTicksPerSec;
+    FILE *fileStat;
+    int nField;
+    
+    if ((fileStat = fopen ("/proc/self/stat", "r")) == (FILE *) 0)
+        return -1;
+    pszField = fgets (szStat, sizeof (szStat), fileStat);
+    (void) fclose (fileStat);
+    
+    // The start time is the 22nd field. The second is the command name, in brackets, which may have spaces in it
+    
+    if ((pszField == (char *) 0) || ((pszField = strrchr (szStat, ')')) == (char *) 0))
+        return -1;
+    for (nField = 2; nField < 22; nField ++) {
+        if ((pszField = strchr (pszField + 1, ' ')) == (char *) 0)
+            return -1;
+    }
+    if ((sscanf (pszField, " %lld", &llStartTicks) != 1) || ((lTicksPerSec = sysconf (_SC_CLK_TCK)) <= 0))
+        return -1;
+    
+    return TimingNow (CLOCK_BOOTTIME) - ((llStartTicks * NSEC_PER_SEC) / lTicksPerSec);
+# else
+    return -1;
+# endif
+}
@@ -0,0 +1,60 @@
+/*
+**  RTCTiming.h
+**
+**  This header file contains the function prototypes for the timing helpers used when reading and setting
+**  the PiFace Real Time Clock to better than a second.
+**
+** Copyright (c) 2015, jhowie
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice, this
+**   list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+** 
+** * Neither the name of FreeBSDPiFaceRTC nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+** 
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+** OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*/
+
+#ifndef RTCTiming_h
+#define RTCTiming_h
+
+# include <stdbool.h>
+# include <stdint.h>
+# include <time.h>
+
+# define NSEC_PER_SEC           1000000000LL
+# define NSEC_PER_MSEC          1000000LL
+# define NSEC_PER_USEC          1000LL
+
+int64_t TimingNow (clockid_t clockidClock);
+int64_t TimingFromTimespec (struct timespec *ptsTime);
+void TimingToTimespec (int64_t nsTime, struct timespec *ptsTime);
+int TimingSleepUntil (clockid_t clockidClock, int64_t nsDeadline, int64_t nsSpin);
+int64_t TimingProcessAge (void);
+
+# if defined (RTCDATE_SIM)
+void TimingLockstep (int64_t nsMonotonic, int64_t nsRealtime);
+bool TimingIsLockstep (void);
+void TimingAdvance (int64_t nsDelta);
+# endif
+
+#endif // RTCTiming_h